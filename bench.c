@@ -0,0 +1,721 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "qtcf.h"
+#include "qtcb.h"
+#include "qtcg.h"
+#include "qtcs.h"
+#include "qtc3.h"
+#include "qtc8b.h"
+#include "qtca.h"
+#include "qtcr.h"
+#include "qtc_stats.h"
+#include "xbn.h"
+#include "bps.h"
+#include "filt_up.h"
+#include "pgm.h"
+#include "synth.h"
+#include "types.h"
+
+#include "canada_l.h"
+#include "canada_xs.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/*
+ * Codec benchmark. Every codec is run over the corpus with warm-up and
+ * repetition, and the results are written as JSON:
+ *
+ *     make bench
+ *     ./bench.out [-w warmup] [-r reps] [-o out.json] [-g spec ...] [image.pgm ...]
+ *
+ * PGM images are coded as they are by the grayscale codecs and thresholded
+ * at 128 for the bilevel ones. -g adds a synthetic grayscale and bilevel image
+ * pair described by WxH[,density[,scale[,noise[,gradient[,seed]]]]] (see
+ * synth.h), and can be repeated to measure how codecs scale with size and
+ * entropy. Allocations are counted by wrapping malloc and friends at link
+ * time. Build with DEBUG=-O2 for meaningful numbers, and with STATS=1 to add
+ * the phase times and counters of one untimed encode and decode.
+ */
+
+#define BENCH_XBN_X 4
+#define BENCH_MAX_IMGS 64
+
+/**
+ * Heap accounting of the --wrap'ed allocator. Each block is prefixed by its
+ * size so frees can be accounted for
+ */
+typedef struct
+{
+    u64 allocs;
+    u64 live;
+    u64 peak;
+} heap_stats;
+
+static heap_stats heap;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+#define HEAP_HDR 16
+
+static void heap_add(size_t size)
+{
+    heap.allocs++;
+    heap.live += size;
+
+    if (heap.live > heap.peak)
+    {
+        heap.peak = heap.live;
+    }
+}
+
+void *__wrap_malloc(size_t size)
+{
+    u8 *p = __real_malloc(size + HEAP_HDR);
+    if (!p)
+    {
+        return NULL;
+    }
+
+    *(size_t *)p = size;
+    heap_add(size);
+
+    return p + HEAP_HDR;
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    u8 *p = __wrap_malloc(n * size);
+    if (p)
+    {
+        memset(p, 0, n * size);
+    }
+
+    return p;
+}
+
+void __wrap_free(void *p)
+{
+    if (!p)
+    {
+        return;
+    }
+
+    u8 *b = (u8 *)p - HEAP_HDR;
+    heap.live -= *(size_t *)b;
+    __real_free(b);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    if (!p)
+    {
+        return __wrap_malloc(size);
+    }
+
+    u8 *b = (u8 *)p - HEAP_HDR;
+    size_t old = *(size_t *)b;
+
+    b = __real_realloc(b, size + HEAP_HDR);
+    if (!b)
+    {
+        return NULL;
+    }
+
+    *(size_t *)b = size;
+    heap.live -= old;
+    heap_add(size);
+
+    return b + HEAP_HDR;
+}
+
+typedef struct
+{
+    const char *name;
+    const u8 *pix;
+    u16 w;
+    u16 h;
+    bool gray;
+} bench_img;
+
+/**
+ * Uniform codec interface. Bilevel codecs take byte-aligned 1-bit rows,
+ * grayscale codecs one byte per pixel
+ */
+typedef struct
+{
+    const char *name;
+    bool gray;
+    u8 *(*encode)(const u8 *data, u16 w, u16 h, u32 *out_size);
+    u8 *(*decode)(const u8 *data, u16 w, u16 h, u32 *in_size);
+} bench_codec;
+
+static u8 *qtcf_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    return qtcf_encode(data, w, h, out_size);
+}
+
+static u8 *qtcg_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    u64 size;
+    u8 *qtcg = qtcg_encode(data, w, h, &size);
+
+    *out_size = size;
+    return qtcg;
+}
+
+static u8 *qtcg_dec(const u8 *data, u16 w, u16 h, u32 *in_size)
+{
+    u64 size;
+    u8 *pix = qtcg_decode(data, w, h, &size);
+
+    *in_size = size;
+    return pix;
+}
+
+static u8 *qtcs_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    u64 size;
+    u8 *qtcs = qtcs_encode(data, w, h, &size);
+
+    *out_size = size;
+    return qtcs;
+}
+
+static u8 *qtcb4_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    u64 size;
+    u8 *qtcb = qtcb_encode(data, w, h, QTCB_LEAF_4X4, &size);
+
+    *out_size = size;
+    return qtcb;
+}
+
+static u8 *qtcb8_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    u64 size;
+    u8 *qtcb = qtcb_encode(data, w, h, QTCB_LEAF_8X8, &size);
+
+    *out_size = size;
+    return qtcb;
+}
+
+static u8 *qtcb_dec(const u8 *data, u16 w, u16 h, u32 *in_size)
+{
+    u64 size;
+    u8 *pix = qtcb_decode(data, w, h, &size);
+
+    *in_size = size;
+    return pix;
+}
+
+static u8 *qtcr_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    u32 qtcf_size;
+    u8 *qtcf = qtcf_encode(data, w, h, &qtcf_size);
+    if (!qtcf)
+    {
+        return NULL;
+    }
+
+    u8 *qtcr = qtcr_encode(qtcf, w, h, out_size);
+    free(qtcf);
+
+    return qtcr;
+}
+
+static u8 *qtcr_dec(const u8 *data, u16 w, u16 h, u32 *in_size)
+{
+    u32 qtcf_size, qtcf_in_size;
+    u8 *qtcf = qtcr_decode(data, &qtcf_size, in_size);
+    if (!qtcf)
+    {
+        return NULL;
+    }
+
+    u8 *pix = qtcf_decode(qtcf, w, h, &qtcf_in_size);
+    free(qtcf);
+
+    return pix;
+}
+
+/*
+ * xbn and xbsn need their escape width at decode time, so it is stored in
+ * the first byte of the benchmarked stream
+ */
+static u8 *xbn_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    u8 bd_n;
+    u8 *xbn = xbn_encode(data, (w + 7) / 8 * h, BENCH_XBN_X, &bd_n, out_size);
+    if (!xbn)
+    {
+        return NULL;
+    }
+
+    xbn = realloc(xbn, *out_size + 1);
+    memmove(xbn + 1, xbn, *out_size);
+    xbn[0] = bd_n;
+    (*out_size)++;
+
+    return xbn;
+}
+
+static u8 *xbn_dec(const u8 *data, u16 w, u16 h, u32 *in_size)
+{
+    *in_size = 0;
+    return xbn_decode(data + 1, (w + 7) / 8 * h, BENCH_XBN_X, data[0]);
+}
+
+static u8 *xbsn_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    u8 bd_s;
+    u8 *xbsn = xbsn_encode(data, (w + 7) / 8 * h, BENCH_XBN_X, &bd_s, out_size);
+    if (!xbsn)
+    {
+        return NULL;
+    }
+
+    xbsn = realloc(xbsn, *out_size + 1);
+    memmove(xbsn + 1, xbsn, *out_size);
+    xbsn[0] = bd_s;
+    (*out_size)++;
+
+    return xbsn;
+}
+
+static u8 *xbsn_dec(const u8 *data, u16 w, u16 h, u32 *in_size)
+{
+    *in_size = 0;
+    return xbsn_decode(data + 1, (w + 7) / 8 * h, BENCH_XBN_X, data[0]);
+}
+
+static u8 *xbn_blk_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    return xbn_encode_blk(data, (w + 7) / 8 * h, out_size);
+}
+
+static u8 *xbn_blk_dec(const u8 *data, u16 w, u16 h, u32 *in_size)
+{
+    *in_size = 0;
+    return xbn_decode_blk(data, (w + 7) / 8 * h);
+}
+
+static u8 *qtc8b_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    return qtc8b_encode(data, w, h, out_size);
+}
+
+/*
+ * gs8 pipeline: up filter, bit plane slicing and a qtcf stream per plane
+ */
+static u8 *gs8_enc(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    u32 bp_size;
+
+    u8 *filt = filt_up_apply(data, w, h);
+    if (!filt)
+    {
+        return NULL;
+    }
+
+    u8 *bit_planes = bit_plane_slice_8(filt, w, h, &bp_size);
+    free(filt);
+    if (!bit_planes)
+    {
+        return NULL;
+    }
+
+    u8 *gs8c = malloc(8 * qtcf_max_compressed_size(w, h));
+    if (!gs8c)
+    {
+        free(bit_planes);
+        return NULL;
+    }
+
+    *out_size = 0;
+
+    for (u8 bp = 0; bp < 8; bp++)
+    {
+        u32 bpc_size;
+        if (!qtcf_encode_into(bit_planes + bp_size * bp, w, h, gs8c + *out_size, qtcf_max_compressed_size(w, h),
+                              &bpc_size))
+        {
+            free(bit_planes);
+            free(gs8c);
+            return NULL;
+        }
+        *out_size += bpc_size;
+    }
+
+    free(bit_planes);
+
+    return realloc(gs8c, *out_size);
+}
+
+static u8 *gs8_dec(const u8 *data, u16 w, u16 h, u32 *in_size)
+{
+    u32 bp_size = (w + 7) / 8 * h;
+    u8 *bit_planes = malloc(8 * bp_size);
+    if (!bit_planes)
+    {
+        return NULL;
+    }
+
+    *in_size = 0;
+
+    for (u8 bp = 0; bp < 8; bp++)
+    {
+        u32 bpc_size;
+        if (!qtcf_decode_into(data + *in_size, w, h, bit_planes + bp * bp_size, &bpc_size))
+        {
+            free(bit_planes);
+            return NULL;
+        }
+        *in_size += bpc_size;
+    }
+
+    u8 *unsliced = bit_plane_unslice_8(bit_planes, w, h);
+    free(bit_planes);
+    if (!unsliced)
+    {
+        return NULL;
+    }
+
+    u8 *defilt = filt_up_remove(unsliced, w, h);
+    free(unsliced);
+
+    return defilt;
+}
+
+static const bench_codec codecs[] = {
+    {"qtcf", false, qtcf_enc, qtcf_decode},
+    {"qtcg", false, qtcg_enc, qtcg_dec},
+    {"qtcs", false, qtcs_enc, qtcf_decode},
+    {"qtcb4", false, qtcb4_enc, qtcb_dec},
+    {"qtcb8", false, qtcb8_enc, qtcb_dec},
+    {"qtc3", false, qtc3_encode, qtc3_decode},
+    {"qtca", false, qtca_encode, qtca_decode},
+    {"qtcr", false, qtcr_enc, qtcr_dec},
+    {"xbn", false, xbn_enc, xbn_dec},
+    {"xbsn", false, xbsn_enc, xbsn_dec},
+    {"xbn_blk", false, xbn_blk_enc, xbn_blk_dec},
+    {"qtc8b", true, qtc8b_enc, NULL},
+    {"gs8", true, gs8_enc, gs8_dec},
+};
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+
+    return (da > db) - (da < db);
+}
+
+static long peak_rss_kb(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    return ru.ru_maxrss;
+}
+
+/**
+ * Throughput, latency and heap use of one direction of a codec
+ */
+typedef struct
+{
+    double mb_s;
+    double p50_us;
+    double p99_us;
+    double allocs;
+    u64 peak_heap;
+} bench_result;
+
+static void print_result(FILE *f, const char *dir, const bench_result *r)
+{
+    fprintf(f, "\"%s\": {\"mb_s\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"allocs\": %.1f, \"peak_heap\": %llu}",
+            dir, r->mb_s, r->p50_us, r->p99_us, r->allocs, (unsigned long long)r->peak_heap);
+}
+
+/**
+ * Time one direction of a codec. run performs one encode or decode and frees
+ * its result
+ */
+#define BENCH_RUN(res, raw_size, warmup, reps, lat, run)          \
+    do                                                            \
+    {                                                             \
+        for (u32 i_ = 0; i_ < (warmup); i_++)                     \
+        {                                                         \
+            run;                                                  \
+        }                                                         \
+                                                                  \
+        u64 allocs_ = heap.allocs;                                \
+        u64 base_ = heap.live;                                    \
+        heap.peak = heap.live;                                    \
+        double total_ = 0;                                        \
+                                                                  \
+        for (u32 i_ = 0; i_ < (reps); i_++)                       \
+        {                                                         \
+            double t_ = now_s();                                  \
+            run;                                                  \
+            (lat)[i_] = now_s() - t_;                             \
+            total_ += (lat)[i_];                                  \
+        }                                                         \
+                                                                  \
+        qsort((lat), (reps), sizeof(double), cmp_double);         \
+                                                                  \
+        (res).mb_s = (reps) * (double)(raw_size) / total_ / 1e6;  \
+        (res).p50_us = (lat)[(reps) / 2] * 1e6;                   \
+        (res).p99_us = (lat)[((reps) * 99) / 100] * 1e6;          \
+        (res).allocs = (double)(heap.allocs - allocs_) / (reps);  \
+        (res).peak_heap = heap.peak - base_;                      \
+    } while (0)
+
+#ifdef QTC_STATS
+static void print_u64s(FILE *f, const char *name, const u64 *v, u32 n)
+{
+    fprintf(f, "\"%s\": [", name);
+
+    for (u32 i = 0; i < n; i++)
+    {
+        fprintf(f, "%s%llu", i ? ", " : "", (unsigned long long)v[i]);
+    }
+
+    fprintf(f, "]");
+}
+
+static void print_stats(FILE *f, const char *dir, const qtc_stats *st)
+{
+    fprintf(f, ", \"%s_stats\": {", dir);
+    print_u64s(f, "phase_ns", st->phase_ns, QTC_PHASE_Cnt);
+    fprintf(f, ", \"nodes_visited\": %llu, ", (unsigned long long)st->nodes_visited);
+    print_u64s(f, "fills", st->fills, QTC_STATS_MAX_LVLS);
+    fprintf(f, ", ");
+    print_u64s(f, "pattern_fills", st->pattern_fills, QTC_STATS_MAX_LVLS);
+    fprintf(f, ", ");
+    print_u64s(f, "lvl_nibbles", st->lvl_nibbles, QTC_STATS_MAX_LVLS);
+    fprintf(f, ", \"normal_won\": %llu, \"inverted_won\": %llu, \"normal_bytes\": %llu, \"inverted_bytes\": %llu}",
+            (unsigned long long)st->normal_won, (unsigned long long)st->inverted_won,
+            (unsigned long long)st->normal_bytes, (unsigned long long)st->inverted_bytes);
+}
+#endif
+
+static bool bench_codec_img(FILE *f, const bench_codec *c, const bench_img *img, u32 warmup, u32 reps, bool first)
+{
+    u32 raw_size = img->gray ? (u32)img->w * img->h : (u32)(img->w + 7) / 8 * img->h;
+    u32 size, in_size;
+    bench_result enc, dec;
+
+    double *lat = malloc(reps * sizeof(double));
+
+    qtc_stats enc_stats, dec_stats;
+    memset(&enc_stats, 0, sizeof(enc_stats));
+    memset(&dec_stats, 0, sizeof(dec_stats));
+
+    qtc_stats_attach(&enc_stats);
+    u8 *comp = c->encode(img->pix, img->w, img->h, &size);
+    qtc_stats_attach(NULL);
+    if (!comp)
+    {
+        fprintf(stderr, "%s: encode of %s failed\n", c->name, img->name);
+        free(lat);
+        return false;
+    }
+
+    BENCH_RUN(enc, raw_size, warmup, reps, lat, free(c->encode(img->pix, img->w, img->h, &in_size)));
+
+    bool ok = true;
+
+    if (c->decode)
+    {
+        qtc_stats_attach(&dec_stats);
+        u8 *out = c->decode(comp, img->w, img->h, &in_size);
+        qtc_stats_attach(NULL);
+        ok = out && memcmp(out, img->pix, raw_size) == 0;
+        free(out);
+
+        if (!ok)
+        {
+            fprintf(stderr, "%s: round trip of %s failed\n", c->name, img->name);
+        }
+
+        BENCH_RUN(dec, raw_size, warmup, reps, lat, free(c->decode(comp, img->w, img->h, &in_size)));
+    }
+
+    fprintf(f, "%s\n    {\"codec\": \"%s\", \"image\": \"%s\", \"w\": %u, \"h\": %u, \"raw_bytes\": %u, \"comp_bytes\": %u, "
+               "\"ratio\": %.4f, \"round_trip\": %s, ",
+            first ? "" : ",", c->name, img->name, img->w, img->h, raw_size, size, 1.0 * raw_size / size,
+            c->decode ? (ok ? "true" : "false") : "null");
+
+    print_result(f, "enc", &enc);
+
+    if (c->decode)
+    {
+        fprintf(f, ", ");
+        print_result(f, "dec", &dec);
+    }
+
+#ifdef QTC_STATS
+    print_stats(f, "enc", &enc_stats);
+
+    if (c->decode)
+    {
+        print_stats(f, "dec", &dec_stats);
+    }
+#endif
+
+    fprintf(f, ", \"rss_hwm_kb\": %ld}", peak_rss_kb());
+
+    free(comp);
+    free(lat);
+
+    return ok;
+}
+
+/**
+ * Threshold a grayscale image into byte-aligned 1-bit rows
+ */
+static u8 *gray_to_bits(const u8 *pix, u16 w, u16 h)
+{
+    u16 row_size = (w + 7) / 8;
+    u8 *bits = calloc(row_size * h, 1);
+
+    for (u16 y = 0; y < h; y++)
+    {
+        for (u16 x = 0; x < w; x++)
+        {
+            if (pix[(u32)y * w + x] >= 128)
+            {
+                bits[y * row_size + x / 8] |= 1 << (x % 8);
+            }
+        }
+    }
+
+    return bits;
+}
+
+int main(int argc, char **argv)
+{
+    bench_img imgs[BENCH_MAX_IMGS];
+    u8 *owned[BENCH_MAX_IMGS];
+    u32 img_n = 0, owned_n = 0;
+    u32 warmup = 2, reps = 20;
+    const char *out_path = NULL;
+
+    imgs[img_n++] = (bench_img){"canada_l", canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT, false};
+    imgs[img_n++] = (bench_img){"canada_xs", canada_xs_bits, CANADA_XS_WIDTH, CANADA_XS_HEIGHT, false};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+        {
+            warmup = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            reps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            out_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc && img_n + 2 <= BENCH_MAX_IMGS)
+        {
+            synth_params params = {1, 128, 32, 0, 0};
+            u16 w, h;
+
+            if (!synth_parse(argv[++i], &w, &h, &params))
+            {
+                fprintf(stderr, "bad synthetic image %s\n", argv[i]);
+                return 1;
+            }
+
+            u8 *pix = synth_gray(w, h, &params);
+            u8 *bits = synth_bilevel(w, h, &params);
+            if (!pix || !bits)
+            {
+                fprintf(stderr, "cannot generate %s\n", argv[i]);
+                return 1;
+            }
+
+            owned[owned_n++] = pix;
+            owned[owned_n++] = bits;
+
+            imgs[img_n++] = (bench_img){argv[i], pix, w, h, true};
+            imgs[img_n++] = (bench_img){argv[i], bits, w, h, false};
+        }
+        else if (img_n + 2 <= BENCH_MAX_IMGS)
+        {
+            u16 w, h;
+            u8 *pix = pgm_read(argv[i], &w, &h);
+            if (!pix)
+            {
+                fprintf(stderr, "cannot read %s\n", argv[i]);
+                return 1;
+            }
+
+            u8 *bits = gray_to_bits(pix, w, h);
+            owned[owned_n++] = pix;
+            owned[owned_n++] = bits;
+
+            imgs[img_n++] = (bench_img){argv[i], pix, w, h, true};
+            imgs[img_n++] = (bench_img){argv[i], bits, w, h, false};
+        }
+    }
+
+    if (reps == 0)
+    {
+        reps = 1;
+    }
+
+    FILE *f = out_path ? fopen(out_path, "w") : stdout;
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", out_path);
+        return 1;
+    }
+
+    bool ok = true;
+    bool first = true;
+
+    fprintf(f, "{\"warmup\": %u, \"reps\": %u, \"results\": [", warmup, reps);
+
+    for (u32 c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++)
+    {
+        for (u32 i = 0; i < img_n; i++)
+        {
+            if (codecs[c].gray == imgs[i].gray)
+            {
+                ok &= bench_codec_img(f, &codecs[c], &imgs[i], warmup, reps, first);
+                first = false;
+            }
+        }
+    }
+
+    fprintf(f, "\n  ], \"peak_rss_kb\": %ld}\n", peak_rss_kb());
+
+    if (out_path)
+    {
+        fclose(f);
+    }
+
+    for (u32 i = 0; i < owned_n; i++)
+    {
+        free(owned[i]);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,366 @@
+#define _GNU_SOURCE
+
+/*
+ * Microbenchmarks of the primitives the codecs spend their time in. The
+ * kernels internal to qtcf.c and xbn.c are declared in qtcf_internal.h and
+ * xbn_internal.h:
+ *
+ *     make microbench
+ *
+ * Each kernel is run with realistic inputs, the fastest of several runs is
+ * kept, and time and, where perf_event_open is available, cycles are
+ * reported per element. Build with DEBUG=-O2 for meaningful numbers.
+ */
+
+#include "qtcf_internal.h"
+#include "xbn_internal.h"
+
+#include "bps.h"
+#include "filt_up.h"
+#include "mort.h"
+#include "synth.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define MB_RUNS 7
+
+typedef struct
+{
+    int fd;
+    double t;
+    u64 cycles;
+} mb_timer;
+
+static volatile u32 sink;
+
+static void mb_timer_open(mb_timer *tm)
+{
+    tm->fd = -1;
+
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    tm->fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void mb_start(mb_timer *tm)
+{
+#ifdef __linux__
+    if (tm->fd >= 0)
+    {
+        ioctl(tm->fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(tm->fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+
+    tm->t = now_s();
+}
+
+static void mb_stop(mb_timer *tm)
+{
+    tm->t = now_s() - tm->t;
+    tm->cycles = 0;
+
+#ifdef __linux__
+    if (tm->fd >= 0)
+    {
+        ioctl(tm->fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(tm->fd, &tm->cycles, sizeof(tm->cycles)) != sizeof(tm->cycles))
+        {
+            tm->cycles = 0;
+        }
+    }
+#endif
+}
+
+/**
+ * Keep the fastest run of a kernel
+ */
+typedef struct
+{
+    double t;
+    u64 cycles;
+} mb_best;
+
+static void mb_keep(mb_best *best, const mb_timer *tm)
+{
+    if (best->t == 0 || tm->t < best->t)
+    {
+        best->t = tm->t;
+        best->cycles = tm->cycles;
+    }
+}
+
+static void mb_report(const char *name, const mb_best *best, u64 elems, bool have_cycles)
+{
+    printf("%-24s %10.3f ns/elem", name, best->t * 1e9 / elems);
+
+    if (have_cycles)
+    {
+        printf(" %10.3f cycles/elem", (double)best->cycles / elems);
+    }
+
+    printf("\n");
+}
+
+/*
+ * Each kernel runs one measured pass per call and returns the number of
+ * elements it processed
+ */
+
+static u64 mb_morton_inc_x(mb_timer *tm)
+{
+    const u32 n = 1 << 22;
+    u32 mc = 0;
+
+    mb_start(tm);
+    for (u32 i = 0; i < n; i++)
+    {
+        morton_inc_x(&mc);
+    }
+    mb_stop(tm);
+
+    sink = mc;
+    return n;
+}
+
+static u64 mb_morton_inc_y(mb_timer *tm)
+{
+    // row scans as in qtir_build: 2048 x steps, then a y step and x reset
+    const u32 rows = 2048, cols = 2048;
+    u32 mc = 0;
+
+    mb_start(tm);
+    for (u32 y = 0; y < rows; y++)
+    {
+        for (u32 x = 0; x < cols; x++)
+        {
+            morton_inc_x(&mc);
+        }
+
+        morton_inc_y(&mc);
+        morton_rst_x(&mc);
+    }
+    mb_stop(tm);
+
+    sink = mc;
+    return (u64)rows * cols;
+}
+
+static u8 *mb_nibs;
+static const u32 mb_nib_n = 1 << 22;
+
+static u64 mb_na_read(mb_timer *tm)
+{
+    u32 sum = 0;
+
+    mb_start(tm);
+    for (u32 i = 0; i < mb_nib_n; i++)
+    {
+        sum += na_read(mb_nibs, i);
+    }
+    mb_stop(tm);
+
+    sink = sum;
+    return mb_nib_n;
+}
+
+static u64 mb_na_write(mb_timer *tm)
+{
+    mb_start(tm);
+    for (u32 i = 0; i < mb_nib_n; i++)
+    {
+        na_write(mb_nibs, i, i ^ (i >> 4));
+    }
+    mb_stop(tm);
+
+    sink = mb_nibs[mb_nib_n / 4];
+    return mb_nib_n;
+}
+
+static u8 *mb_gray;
+static u8 *mb_bits;
+static const u16 mb_w = 2048, mb_h = 2048;
+
+static u64 mb_bit_plane_slice_8(mb_timer *tm)
+{
+    u32 bp_size;
+
+    mb_start(tm);
+    u8 *bps = bit_plane_slice_8(mb_gray, mb_w, mb_h, &bp_size);
+    mb_stop(tm);
+
+    sink = bps[bp_size];
+    free(bps);
+    return (u64)mb_w * mb_h;
+}
+
+static u64 mb_filt_paeth_apply(mb_timer *tm)
+{
+    mb_start(tm);
+    u8 *filt = filt_paeth_apply(mb_gray, mb_w, mb_h);
+    mb_stop(tm);
+
+    sink = filt[mb_w];
+    free(filt);
+    return (u64)mb_w * mb_h;
+}
+
+static u64 mb_arr_max_run_length(mb_timer *tm)
+{
+    u32 size = (mb_w + 7) / 8 * mb_h;
+
+    mb_start(tm);
+    sink = arr_max_run_length(mb_bits, size);
+    mb_stop(tm);
+
+    return (u64)size * 8;
+}
+
+static qtir_node *mb_qtir;
+static qtir_node *mb_qtir_work;
+static u32 mb_qt_n;
+
+static u64 mb_qtir_get_sizes(mb_timer *tm)
+{
+    // get_sizes rewrites the tree, so every run starts from a fresh copy
+    memcpy(mb_qtir_work, mb_qtir, mb_qt_n * sizeof(qtir_node));
+
+    mb_start(tm);
+    qtir_get_sizes(mb_qtir_work, mb_qt_n, &qtcf_no_blocks, NULL);
+    mb_stop(tm);
+
+    sink = mb_qtir_work[0].sub_size;
+    return mb_qt_n;
+}
+
+static u64 mb_qtir_build(mb_timer *tm)
+{
+    mb_start(tm);
+    qtir_build(mb_qtir_work, mb_qt_n, mb_bits, mb_w, mb_h, 0x00, &qtcf_no_blocks);
+    mb_stop(tm);
+
+    sink = mb_qtir_work[mb_qt_n - 1].val;
+    return (u64)mb_w * mb_h;
+}
+
+static u8 *mb_qt;
+static u8 *mb_raster;
+
+static u64 mb_qt_write_raster(mb_timer *tm)
+{
+    mb_start(tm);
+    qt_write_raster(mb_qt, mb_qt_n, mb_w, mb_h, mb_raster);
+    mb_stop(tm);
+
+    sink = mb_raster[mb_w];
+    return (u64)mb_w * mb_h;
+}
+
+typedef struct
+{
+    const char *name;
+    u64 (*run)(mb_timer *tm);
+} mb_kernel;
+
+static const mb_kernel kernels[] = {
+    {"morton_inc_x", mb_morton_inc_x},
+    {"morton_inc_y + rst_x", mb_morton_inc_y},
+    {"na_read", mb_na_read},
+    {"na_write", mb_na_write},
+    {"bit_plane_slice_8", mb_bit_plane_slice_8},
+    {"filt_paeth_apply", mb_filt_paeth_apply},
+    {"arr_max_run_length", mb_arr_max_run_length},
+    {"qtir_get_sizes", mb_qtir_get_sizes},
+    {"qtir_build", mb_qtir_build},
+    {"qt_write_raster", mb_qt_write_raster},
+};
+
+int main(void)
+{
+    synth_params params = {1, 128, 64, 8, 32};
+
+    mb_gray = synth_gray(mb_w, mb_h, &params);
+    mb_bits = synth_bilevel(mb_w, mb_h, &params);
+    mb_nibs = malloc(mb_nib_n / 2);
+    memcpy(mb_nibs, mb_gray, mb_nib_n / 2);
+
+    mb_qtir = qtir_from_raster(mb_bits, mb_w, mb_h, &mb_qt_n);
+    mb_qt = malloc((mb_qt_n + 1) / 2);
+    for (u32 i = 0; i < mb_qt_n; i++)
+    {
+        na_write(mb_qt, i, mb_qtir[i].val);
+    }
+    mb_raster = malloc((mb_w + 7) / 8 * mb_h);
+
+    qtir_get_fills(mb_qtir, mb_qt_n, &qtcf_no_blocks);
+    mb_qtir_work = malloc(mb_qt_n * sizeof(qtir_node));
+
+    mb_timer tm;
+    mb_timer_open(&tm);
+
+    bool have_cycles = tm.fd >= 0;
+    if (!have_cycles)
+    {
+        printf("perf_event_open unavailable, reporting time only\n");
+    }
+
+    for (u32 k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+        mb_best best = {0, 0};
+        u64 elems = 0;
+
+        for (u32 r = 0; r < MB_RUNS; r++)
+        {
+            elems = kernels[k].run(&tm);
+            mb_keep(&best, &tm);
+        }
+
+        mb_report(kernels[k].name, &best, elems, have_cycles);
+    }
+
+#ifdef __linux__
+    if (have_cycles)
+    {
+        close(tm.fd);
+    }
+#endif
+
+    free(mb_gray);
+    free(mb_bits);
+    free(mb_nibs);
+    free(mb_qtir);
+    free(mb_qtir_work);
+    free(mb_qt);
+    free(mb_raster);
+
+    return 0;
+}
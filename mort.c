@@ -2,6 +2,14 @@
 
 static uint32_t interleave_zeroes_u16(uint16_t x);
 static uint16_t get_even_bits_u32(uint32_t x);
+static uint64_t interleave_zeroes_u32(uint32_t x);
+static uint32_t get_even_bits_u64(uint64_t x);
+static uint64_t interleave_two_zeroes_u32(uint32_t x);
+static uint32_t get_third_bits_u64(uint64_t x);
+
+// bits of the x value within a 3D morton encoding, y and z are shifted by 1
+// and 2
+#define MORTON3_X 0x1249249249249249ULL
 
 uint32_t morton_encode(uint16_t x, uint16_t y)
 {
@@ -56,4 +64,130 @@ static uint16_t get_even_bits_u32(uint32_t x)
     x = (x | (x >> 4)) & 0x00FF00FF;
     x = (x | (x >> 8)) & 0x0000FFFF;
     return (uint16_t)x;
-}
\ No newline at end of file
+}
+
+uint64_t morton64_encode(uint32_t x, uint32_t y)
+{
+    return interleave_zeroes_u32(x) | (interleave_zeroes_u32(y) << 1);
+}
+
+void morton64_decode(uint64_t morton, uint32_t *x, uint32_t *y)
+{
+    *x = get_even_bits_u64(morton);
+    *y = get_even_bits_u64(morton >> 1);
+}
+
+void morton64_inc_x(uint64_t *morton)
+{
+    uint64_t xsum = (*morton | 0xAAAAAAAAAAAAAAAAULL) + 1;
+    *morton = (xsum & 0x5555555555555555ULL) | (*morton & 0xAAAAAAAAAAAAAAAAULL);
+}
+
+void morton64_rst_x(uint64_t *morton)
+{
+    *morton &= ~(0x5555555555555555ULL);
+}
+
+void morton64_inc_y(uint64_t *morton)
+{
+    uint64_t ysum = (*morton | 0x5555555555555555ULL) + 2;
+    *morton = (ysum & 0xAAAAAAAAAAAAAAAAULL) | (*morton & 0x5555555555555555ULL);
+}
+
+void morton64_rst_y(uint64_t *morton)
+{
+    *morton &= ~(0xAAAAAAAAAAAAAAAAULL);
+}
+
+static uint64_t interleave_zeroes_u32(uint32_t x)
+{
+    uint64_t y = x;
+
+    y = (y | (y << 16)) & 0x0000FFFF0000FFFFULL;
+    y = (y | (y << 8)) & 0x00FF00FF00FF00FFULL;
+    y = (y | (y << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    y = (y | (y << 2)) & 0x3333333333333333ULL;
+    y = (y | (y << 1)) & 0x5555555555555555ULL;
+
+    return y;
+}
+
+static uint32_t get_even_bits_u64(uint64_t x)
+{
+    x = x & 0x5555555555555555ULL;
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+    return (uint32_t)x;
+}
+
+uint64_t morton3_encode(uint32_t x, uint32_t y, uint32_t z)
+{
+    return interleave_two_zeroes_u32(x) | (interleave_two_zeroes_u32(y) << 1) | (interleave_two_zeroes_u32(z) << 2);
+}
+
+void morton3_decode(uint64_t morton, uint32_t *x, uint32_t *y, uint32_t *z)
+{
+    *x = get_third_bits_u64(morton);
+    *y = get_third_bits_u64(morton >> 1);
+    *z = get_third_bits_u64(morton >> 2);
+}
+
+void morton3_inc_x(uint64_t *morton)
+{
+    uint64_t xsum = (*morton | ~MORTON3_X) + 1;
+    *morton = (xsum & MORTON3_X) | (*morton & ~MORTON3_X);
+}
+
+void morton3_inc_y(uint64_t *morton)
+{
+    uint64_t ysum = (*morton | ~(MORTON3_X << 1)) + 2;
+    *morton = (ysum & (MORTON3_X << 1)) | (*morton & ~(MORTON3_X << 1));
+}
+
+void morton3_inc_z(uint64_t *morton)
+{
+    uint64_t zsum = (*morton | ~(MORTON3_X << 2)) + 4;
+    *morton = (zsum & (MORTON3_X << 2)) | (*morton & ~(MORTON3_X << 2));
+}
+
+void morton3_rst_x(uint64_t *morton)
+{
+    *morton &= ~MORTON3_X;
+}
+
+void morton3_rst_y(uint64_t *morton)
+{
+    *morton &= ~(MORTON3_X << 1);
+}
+
+void morton3_rst_z(uint64_t *morton)
+{
+    *morton &= ~(MORTON3_X << 2);
+}
+
+static uint64_t interleave_two_zeroes_u32(uint32_t x)
+{
+    uint64_t y = x & 0x1FFFFF;
+
+    y = (y | (y << 32)) & 0x001F00000000FFFFULL;
+    y = (y | (y << 16)) & 0x001F0000FF0000FFULL;
+    y = (y | (y << 8)) & 0x100F00F00F00F00FULL;
+    y = (y | (y << 4)) & 0x10C30C30C30C30C3ULL;
+    y = (y | (y << 2)) & MORTON3_X;
+
+    return y;
+}
+
+static uint32_t get_third_bits_u64(uint64_t x)
+{
+    x = x & MORTON3_X;
+    x = (x | (x >> 2)) & 0x10C30C30C30C30C3ULL;
+    x = (x | (x >> 4)) & 0x100F00F00F00F00FULL;
+    x = (x | (x >> 8)) & 0x001F0000FF0000FFULL;
+    x = (x | (x >> 16)) & 0x001F00000000FFFFULL;
+    x = (x | (x >> 32)) & 0x00000000001FFFFFULL;
+    return (uint32_t)x;
+}
@@ -1,6 +1,7 @@
 #ifndef __MORTON_H__
 #define __MORTON_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -50,4 +51,241 @@ void morton_rst_x(uint32_t *morton);
  */
 void morton_rst_y(uint32_t *morton);
 
+/**
+ * Get 64-bit morton code from 32-bit x and y coordinates
+ *
+ * @param x x coordinate
+ * @param y y coordinate
+ *
+ * @return morton encoding of x and y coordinates
+ */
+uint64_t morton64_encode(uint32_t x, uint32_t y);
+
+/**
+ * Get x and y coordinates from a 64-bit morton code
+ *
+ * @param morton morton code
+ * @param x pointer to variable that will hold x coord
+ * @param y pointer to variable that will hold y coord
+ */
+void morton64_decode(uint64_t morton, uint32_t *x, uint32_t *y);
+
+/**
+ * Increment the x value within a 64-bit morton encoding
+ *
+ * @param morton pointer to morton code
+ */
+void morton64_inc_x(uint64_t *morton);
+
+/**
+ * Increment the y value within a 64-bit morton encoding
+ *
+ * @param morton pointer to morton code
+ */
+void morton64_inc_y(uint64_t *morton);
+
+/**
+ * Set the x value within a 64-bit morton encoding to 0
+ *
+ * @param morton pointer to morton code
+ */
+void morton64_rst_x(uint64_t *morton);
+
+/**
+ * Set the y value within a 64-bit morton encoding to 0
+ *
+ * @param morton pointer to morton code
+ */
+void morton64_rst_y(uint64_t *morton);
+
+/**
+ * Get 64-bit 3D morton code from 21-bit x, y and z coordinates, x in the
+ * lowest bit of each group of three
+ *
+ * @param x x coordinate
+ * @param y y coordinate
+ * @param z z coordinate
+ *
+ * @return morton encoding of x, y and z coordinates
+ */
+uint64_t morton3_encode(uint32_t x, uint32_t y, uint32_t z);
+
+/**
+ * Get x, y and z coordinates from a 64-bit 3D morton code
+ *
+ * @param morton morton code
+ * @param x pointer to variable that will hold x coord
+ * @param y pointer to variable that will hold y coord
+ * @param z pointer to variable that will hold z coord
+ */
+void morton3_decode(uint64_t morton, uint32_t *x, uint32_t *y, uint32_t *z);
+
+/**
+ * Increment the x value within a 3D morton encoding
+ *
+ * @param morton pointer to morton code
+ */
+void morton3_inc_x(uint64_t *morton);
+
+/**
+ * Increment the y value within a 3D morton encoding
+ *
+ * @param morton pointer to morton code
+ */
+void morton3_inc_y(uint64_t *morton);
+
+/**
+ * Increment the z value within a 3D morton encoding
+ *
+ * @param morton pointer to morton code
+ */
+void morton3_inc_z(uint64_t *morton);
+
+/**
+ * Set the x value within a 3D morton encoding to 0
+ *
+ * @param morton pointer to morton code
+ */
+void morton3_rst_x(uint64_t *morton);
+
+/**
+ * Set the y value within a 3D morton encoding to 0
+ *
+ * @param morton pointer to morton code
+ */
+void morton3_rst_y(uint64_t *morton);
+
+/**
+ * Set the z value within a 3D morton encoding to 0
+ *
+ * @param morton pointer to morton code
+ */
+void morton3_rst_z(uint64_t *morton);
+
+/*
+ * Leaf packing kernels of the quad tree builders. A leaf holds a 2x2 pixel
+ * block as a nibble, the NW and NE pixels in bits 0 and 1, SW and SE in bits
+ * 2 and 3. The kernels convert 64 pixels of a pair of raster rows to and from
+ * the 32 leaves they cover with SWAR bit shuffles, leaf k being nibble k % 16
+ * of word k / 16. Leaves 2j and 2j + 1 are neighbours in Morton order, so the
+ * builders step the Morton code once per pair with morton_inc_x2.
+ */
+
+/**
+ * Load up to 8 bytes of a raster row as a word, pixel x in bit x
+ *
+ * @param row pointer to the first byte
+ * @param n number of bytes to load, the rest of the word is zero
+ */
+static inline uint64_t row_load_64(const uint8_t *row, size_t n)
+{
+    uint64_t v = 0;
+
+    if (n >= 8)
+    {
+        // byte-wise so it is endian-neutral, compilers fuse it into one load
+        return (uint64_t)row[0] | (uint64_t)row[1] << 8 | (uint64_t)row[2] << 16 |
+               (uint64_t)row[3] << 24 | (uint64_t)row[4] << 32 | (uint64_t)row[5] << 40 |
+               (uint64_t)row[6] << 48 | (uint64_t)row[7] << 56;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        v |= (uint64_t)row[i] << (8 * i);
+    }
+
+    return v;
+}
+
+/**
+ * Store up to 8 bytes of a word into a raster row, the inverse of row_load_64
+ */
+static inline void row_store_64(uint8_t *row, uint64_t v, size_t n)
+{
+    n = n < 8 ? n : 8;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        row[i] = v >> (8 * i);
+    }
+}
+
+/**
+ * Move the 2-bit groups of a word into the low half of consecutive nibbles
+ */
+static inline uint64_t leaf_spread_pairs(uint32_t x)
+{
+    uint64_t y = x;
+
+    y = (y | (y << 16)) & 0x0000FFFF0000FFFFULL;
+    y = (y | (y << 8)) & 0x00FF00FF00FF00FFULL;
+    y = (y | (y << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    y = (y | (y << 2)) & 0x3333333333333333ULL;
+
+    return y;
+}
+
+/**
+ * Gather the low half of the nibbles of a word, the inverse of
+ * leaf_spread_pairs
+ */
+static inline uint32_t leaf_gather_pairs(uint64_t y)
+{
+    y &= 0x3333333333333333ULL;
+    y = (y | (y >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    y = (y | (y >> 4)) & 0x00FF00FF00FF00FFULL;
+    y = (y | (y >> 8)) & 0x0000FFFF0000FFFFULL;
+    y = (y | (y >> 16)) & 0x00000000FFFFFFFFULL;
+
+    return (uint32_t)y;
+}
+
+/**
+ * Pack 64 pixels of two raster rows into 32 leaves
+ *
+ * @param hi pixels of the upper row
+ * @param lo pixels of the lower row
+ * @param leaves output, leaves 0 ... 15 and 16 ... 31
+ */
+static inline void leaf_pack_64(uint64_t hi, uint64_t lo, uint64_t leaves[2])
+{
+    leaves[0] = leaf_spread_pairs(hi) | leaf_spread_pairs(lo) << 2;
+    leaves[1] = leaf_spread_pairs(hi >> 32) | leaf_spread_pairs(lo >> 32) << 2;
+}
+
+/**
+ * Unpack 32 leaves into 64 pixels of two raster rows
+ *
+ * @param leaves leaves 0 ... 15 and 16 ... 31
+ * @param hi pixels of the upper row
+ * @param lo pixels of the lower row
+ */
+static inline void leaf_unpack_64(const uint64_t leaves[2], uint64_t *hi, uint64_t *lo)
+{
+    *hi = leaf_gather_pairs(leaves[0]) | (uint64_t)leaf_gather_pairs(leaves[1]) << 32;
+    *lo = leaf_gather_pairs(leaves[0] >> 2) | (uint64_t)leaf_gather_pairs(leaves[1] >> 2) << 32;
+}
+
+/**
+ * Add 2 to the x value within a morton encoding
+ *
+ * @param morton pointer to morton code
+ */
+static inline void morton_inc_x2(uint32_t *morton)
+{
+    uint32_t xsum = (*morton | 0xAAAAAAAA) + 4;
+    *morton = (xsum & 0x55555555) | (*morton & 0xAAAAAAAA);
+}
+
+/**
+ * Add 2 to the x value within a 64-bit morton encoding
+ *
+ * @param morton pointer to morton code
+ */
+static inline void morton64_inc_x2(uint64_t *morton)
+{
+    uint64_t xsum = (*morton | 0xAAAAAAAAAAAAAAAAULL) + 4;
+    *morton = (xsum & 0x5555555555555555ULL) | (*morton & 0xAAAAAAAAAAAAAAAAULL);
+}
+
 #endif // __MORTON_H__
\ No newline at end of file
@@ -1,10 +1,26 @@
 #include "mort.h"
 #include "utils.h"
 #include "qtc3.h"
+#include "qtc_stats.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+/**
+ * Size, in bytes, of the largest compressed stream of a tree with n nodes:
+ * the inverted flag and at most one nibble per node
+ */
+#define QTC3_BOUND(n) (((n) + 2) / 2)
+
+struct qtc3_ctx
+{
+    uint16_t w;
+    uint16_t h;
+    uint32_t qt_n;
+    uint8_t *enc_arena;
+    uint8_t *dec_arena;
+};
+
 enum
 {
     QUAD_NW = 0,
@@ -115,52 +131,58 @@ static void fill_ones(uint8_t *qt, uint32_t qt_i, const uint32_t qt_n)
  * Convert a 1-bit raster image to its uncompressed quad tree
  * representation
  *
+ * @param qt pointer to quad tree array of (qt_n + 1) / 2 bytes
+ * @param qt_n number of nodes in the uncompressed quad tree
  * @param pixels row-major pixel data
  * @param w image width
  * @param h image height
- * @param qt_n number of nodes in the uncompressed quad tree
- *
- * @return pointer to uncompressed quad tree. NULL if conversion unsuccessful
+ * @param inv byte xor-ed into every pixel byte read, 0xFF to convert the
+ * inverted image
  */
-static uint8_t *qt_from_pixels(const uint8_t *pixels, uint16_t w, uint16_t h, uint32_t *qt_n)
+static void qt_from_pixels(uint8_t *qt, uint32_t qt_n, const uint8_t *pixels, uint16_t w, uint16_t h, uint8_t inv)
 {
-    uint8_t lvls = calc_lvls(w, h);
-
-    if (lvls == 0)
-    {
-        return NULL;
-    }
-
-    *qt_n = calc_node_cnt(lvls);
-    uint32_t qt_size = (*qt_n + 1) / 2;
-
-    uint8_t *qt = (uint8_t *)malloc(qt_size);
-    if (qt == NULL)
-    {
-        return NULL;
-    }
-
-    memset(qt, 0, qt_size);
+    memset(qt, 0, (qt_n + 1) / 2);
 
     uint16_t px_row_bytes = (w + 7) / 8;
     const uint8_t *px_row_hi = pixels;
     const uint8_t *px_row_lo = px_row_hi + px_row_bytes;
     uint16_t px_row_inc = 2 * px_row_bytes;
 
-    uint32_t leaf_pos = (*qt_n) / 4;
+    uint32_t leaf_pos = qt_n / 4;
+    uint64_t inv_word = inv ? UINT64_MAX : 0;
+    uint16_t leaf_w = w / 2 + (w & 1);
 
     uint32_t morton = 0;
 
-    for (uint16_t y = 0; y < (h & ~1); y += 2)
+    for (uint32_t y = 0; y < h; y += 2)
     {
-        for (uint16_t x = 0; x < w; x += 2)
+        // the last row of an odd height pairs with a row of zeros
+        bool has_lo = y + 1 < h;
+
+        for (uint32_t x = 0; x < w; x += 64)
         {
-            uint8_t nwne = (px_row_hi[x / 8] >> (x % 8)) & 0x3;
-            uint8_t swse = (px_row_lo[x / 8] >> (x % 8)) & 0x3;
+            uint16_t col = x / 8;
+            uint64_t hi = row_load_64(px_row_hi + col, px_row_bytes - col) ^ inv_word;
+            uint64_t lo = has_lo ? row_load_64(px_row_lo + col, px_row_bytes - col) ^ inv_word : 0;
+
+            uint64_t leaves[2];
+            leaf_pack_64(hi, lo, leaves);
+
+            uint32_t k_end = MIN(32, leaf_w - x / 2);
+
+            for (uint32_t k = 0; k < k_end; k += 2)
+            {
+                uint8_t pair = leaves[k / 16] >> (4 * (k % 16));
 
-            na_write(qt, leaf_pos + morton, nwne | (swse << 2));
+                na_write(qt, leaf_pos + morton, pair);
 
-            morton_inc_x(&morton);
+                if (k + 1 < k_end)
+                {
+                    na_write(qt, leaf_pos + morton + 1, pair >> 4);
+                }
+
+                morton_inc_x2(&morton);
+            }
         }
 
         morton_inc_y(&morton);
@@ -170,18 +192,7 @@ static uint8_t *qt_from_pixels(const uint8_t *pixels, uint16_t w, uint16_t h, ui
         px_row_lo += px_row_inc;
     }
 
-    if (h & 1)
-    {
-        for (uint16_t x = 0; x < w; x += 2)
-        {
-            uint8_t nwne = (px_row_hi[x / 8] >> (x % 8)) & 0x3;
-
-            na_write(qt, leaf_pos + morton, nwne);
-            morton_inc_x(&morton);
-        }
-    }
-
-    uint32_t chld_pos = *qt_n - 1;
+    uint32_t chld_pos = qt_n - 1;
     uint32_t prnt_pos = chld_pos / 4 - 1;
 
     while (chld_pos > 0)
@@ -199,8 +210,6 @@ static uint8_t *qt_from_pixels(const uint8_t *pixels, uint16_t w, uint16_t h, ui
         na_write(qt, prnt_pos, prnt);
         prnt_pos--;
     }
-
-    return qt;
 }
 
 /**
@@ -208,21 +217,13 @@ static uint8_t *qt_from_pixels(const uint8_t *pixels, uint16_t w, uint16_t h, ui
  *
  * @param qt pointer to uncompressed quad tree
  * @param qt_n node count of uncompressed quad tree
- * @param out_size size of compressed quadtree in bytes
+ * @param inverted whether the quad tree is of the inverted image
+ * @param qtc output buffer of at least QTC3_BOUND(qt_n) bytes
  *
- * @return pointer to compressed quad tree. NULL if unsuccessful
+ * @return size of compressed quadtree in bytes
  */
-static uint8_t *qt_compress(uint8_t *qt, uint32_t qt_n, bool inverted, uint32_t *out_size)
+static uint32_t qt_compress(uint8_t *qt, uint32_t qt_n, bool inverted, uint8_t *qtc)
 {
-    uint32_t qt_size = (qt_n + 1) / 2;
-    uint8_t *qtc = malloc(qt_size);
-    if (qtc == NULL)
-    {
-        return NULL;
-    }
-
-    memset(qtc, 0, qt_size);
-
     uint32_t prnt_pos = 0;
     uint32_t chld_pos = 0;
 
@@ -238,6 +239,8 @@ static uint8_t *qt_compress(uint8_t *qt, uint32_t qt_n, bool inverted, uint32_t
         {
             if (parent & (1 << q))
             {
+                QTC_STATS_ADD(nodes_visited, 1);
+
                 if (is_all_ones(qt, chld_pos, qt_n))
                 {
                     na_write(qtc, qtc_pos++, 0);
@@ -254,86 +257,54 @@ static uint8_t *qt_compress(uint8_t *qt, uint32_t qt_n, bool inverted, uint32_t
         prnt_pos++;
     }
 
-    *out_size = (qtc_pos + 1) / 2;
-    return realloc(qtc, *out_size);
-}
-
-uint8_t *qtc3_encode(const uint8_t *data, uint16_t w, uint16_t h, uint32_t *out_size)
-{
-    uint8_t *qt, *qtc, *qtc_inv, *data_inv;
-    uint32_t data_size, qtc_size, qtc_inv_size;
-    uint32_t qt_n;
-
-    data_size = (w + 7) / 8 * h;
-
-    qt = qt_from_pixels(data, w, h, &qt_n);
-    if (!qt)
+    // clear the unused nibble of the last byte
+    if (qtc_pos & 1)
     {
-        return NULL;
+        na_write(qtc, qtc_pos, 0);
     }
 
-    qtc = qt_compress(qt, qt_n, false, &qtc_size);
-    free(qt);
+    return (qtc_pos + 1) / 2;
+}
 
-    if (!qtc)
-    {
-        return NULL;
-    }
+uint32_t qtc3_max_compressed_size(uint16_t w, uint16_t h)
+{
+    uint8_t lvls = calc_lvls(w, h);
 
-    data_inv = malloc(data_size);
-    if (!data_inv)
-    {
-        return NULL;
-    }
+    return lvls ? QTC3_BOUND(calc_node_cnt(lvls)) : 0;
+}
 
-    memcpy(data_inv, data, data_size);
-    arr_invert(data_inv, data_size);
+uint8_t *qtc3_encode(const uint8_t *data, uint16_t w, uint16_t h, uint32_t *out_size)
+{
+    uint32_t qtc_cap = qtc3_max_compressed_size(w, h);
+    uint8_t *qtc = malloc(qtc_cap);
 
-    qt = qt_from_pixels(data_inv, w, h, &qt_n);
-    free(data_inv);
-    if (!qt)
+    if (!qtc || !qtc3_encode_into(data, w, h, qtc, qtc_cap, out_size))
     {
         free(qtc);
         return NULL;
     }
 
-    qtc_inv = qt_compress(qt, qt_n, true, &qtc_inv_size);
-    free(qt);
-    if (!qtc_inv)
-    {
-        free(qtc);
-        return NULL;
-    }
+    return realloc(qtc, *out_size);
+}
 
-    if (qtc_size < qtc_inv_size)
-    {
-        free(qtc_inv);
-        *out_size = qtc_size;
-    }
-    else
+bool qtc3_encode_into(const uint8_t *data, uint16_t w, uint16_t h, uint8_t *out, uint32_t out_cap, uint32_t *out_size)
+{
+    qtc3_ctx *ctx = qtc3_ctx_create(w, h);
+    if (!ctx)
     {
-        free(qtc);
-        qtc = qtc_inv;
-        *out_size = qtc_inv_size;
+        return false;
     }
 
-    return qtc;
-}
+    bool ok = qtc3_ctx_encode(ctx, data, out, out_cap, out_size);
 
-static uint8_t *qtc_decompress(const uint8_t *qtc, uint16_t w, uint16_t h, bool *inverted, uint32_t *qt_n, uint32_t *comp_size)
-{
-    uint8_t r = calc_lvls(w, h);
-    *qt_n = calc_node_cnt(r);
-    uint32_t qt_size = (*qt_n + 1) / 2;
+    qtc3_ctx_free(ctx);
 
-    // allocate space for the decompressed quad tree
-    uint8_t *qt = malloc(qt_size);
-    if (qt == NULL)
-    {
-        return NULL;
-    }
+    return ok;
+}
 
-    memset(qt, 0, qt_size);
+static void qtc_decompress(const uint8_t *qtc, uint8_t *qt, uint32_t qt_n, bool *inverted, uint32_t *comp_size)
+{
+    memset(qt, 0, (qt_n + 1) / 2);
 
     uint32_t prnt_pos = 0;
     uint32_t chld_pos = 0;
@@ -344,17 +315,19 @@ static uint8_t *qtc_decompress(const uint8_t *qtc, uint16_t w, uint16_t h, bool
     // copy the first node of the compressed quad tree (the root)
     na_write(qt, chld_pos++, na_read(qtc, qtc_pos++));
 
-    while (chld_pos < *qt_n)
+    while (chld_pos < qt_n)
     {
         uint8_t parent = na_read(qt, prnt_pos);
         for (uint8_t q = 0; q < QUAD_Cnt; q++)
         {
             if ((parent & (1 << q)) && na_read(qt, chld_pos) == 0)
             {
+                QTC_STATS_ADD(nodes_visited, 1);
+
                 if (na_read(qtc, qtc_pos) == 0)
                 {
                     qtc_pos++;
-                    fill_ones(qt, chld_pos, *qt_n);
+                    fill_ones(qt, chld_pos, qt_n);
                 }
                 else
                 {
@@ -367,79 +340,203 @@ static uint8_t *qtc_decompress(const uint8_t *qtc, uint16_t w, uint16_t h, bool
     }
 
     *comp_size = (qtc_pos + 1) / 2;
-
-    return qt;
 }
 
-static uint8_t *qt_to_pixels(uint8_t *qt, uint32_t qt_n, uint16_t w, uint16_t h)
+static void qt_to_pixels(const uint8_t *qt, uint32_t qt_n, uint16_t w, uint16_t h, uint8_t *pixels)
 {
     uint32_t leaf_i = qt_n / 4;
     uint16_t px_row_size = (w + 7) / 8;
-    uint32_t px_size = (px_row_size * h);
-
-    uint8_t *pixels = (uint8_t *)malloc(px_size);
-    memset(pixels, 0, px_size);
+    uint16_t leaf_w = w / 2 + (w & 1);
 
     uint8_t *px_row_hi = pixels;
     uint8_t *px_row_lo = px_row_hi + px_row_size;
     uint32_t morton = 0;
 
-    for (uint16_t y = 0; y < (h & ~1); y += 2)
+    // every pixel byte is stored whole, so the image needs no clearing
+    for (uint32_t y = 0; y < h; y += 2)
     {
-        for (uint16_t x = 0; x < w; x += 2)
+        bool has_lo = y + 1 < h;
+
+        for (uint32_t x = 0; x < w; x += 64)
         {
-            uint8_t nib = na_read(qt, leaf_i + morton);
+            uint64_t leaves[2] = {0, 0};
+            uint32_t k_end = MIN(32, leaf_w - x / 2);
 
-            uint8_t nwne = (nib >> 0) & 0x3;
-            uint8_t swse = (nib >> 2) & 0x3;
+            for (uint32_t k = 0; k < k_end; k += 2)
+            {
+                uint64_t pair = na_read(qt, leaf_i + morton);
 
-            px_row_hi[x / 8] |= nwne << (x % 8);
-            px_row_lo[x / 8] |= swse << (x % 8);
+                if (k + 1 < k_end)
+                {
+                    pair |= na_read(qt, leaf_i + morton + 1) << 4;
+                }
 
-            morton_inc_x(&morton);
+                leaves[k / 16] |= pair << (4 * (k % 16));
+
+                morton_inc_x2(&morton);
+            }
+
+            uint64_t hi, lo;
+            leaf_unpack_64(leaves, &hi, &lo);
+
+            uint16_t col = x / 8;
+            row_store_64(px_row_hi + col, hi, px_row_size - col);
+
+            if (has_lo)
+            {
+                row_store_64(px_row_lo + col, lo, px_row_size - col);
+            }
         }
+
         morton_inc_y(&morton);
         morton_rst_x(&morton);
         px_row_hi += 2 * px_row_size;
         px_row_lo += 2 * px_row_size;
     }
+}
+
+uint8_t *qtc3_decode(const uint8_t *qtc, uint16_t w, uint16_t h, uint32_t *comp_size)
+{
+    uint8_t *pixels = malloc((w + 7) / 8 * h);
 
-    if (h & 1)
+    if (!pixels || !qtc3_decode_into(qtc, w, h, pixels, comp_size))
     {
-        for (uint16_t x = 0; x < w; x += 2)
-        {
-            uint8_t nib = na_read(qt, leaf_i + morton);
+        free(pixels);
+        return NULL;
+    }
+
+    return pixels;
+}
+
+bool qtc3_decode_into(const uint8_t *qtc, uint16_t w, uint16_t h, uint8_t *out, uint32_t *comp_size)
+{
+    qtc3_ctx *ctx = qtc3_ctx_create(w, h);
+    if (!ctx)
+    {
+        return false;
+    }
+
+    bool ok = qtc3_ctx_decode(ctx, qtc, out, comp_size);
+
+    qtc3_ctx_free(ctx);
+
+    return ok;
+}
+
+qtc3_ctx *qtc3_ctx_create(uint16_t w, uint16_t h)
+{
+    uint8_t lvls = calc_lvls(w, h);
+    if (lvls == 0)
+    {
+        return NULL;
+    }
+
+    qtc3_ctx *ctx = malloc(sizeof(qtc3_ctx));
+    if (!ctx)
+    {
+        return NULL;
+    }
 
-            uint8_t nwne = nib & 0x3;
+    ctx->w = w;
+    ctx->h = h;
+    ctx->qt_n = calc_node_cnt(lvls);
+    ctx->enc_arena = NULL;
+    ctx->dec_arena = NULL;
 
-            px_row_hi[x / 8] |= nwne << (x % 8);
+    return ctx;
+}
 
-            morton_inc_x(&morton);
+void qtc3_ctx_free(qtc3_ctx *ctx)
+{
+    if (!ctx)
+    {
+        return;
+    }
+
+    free(ctx->enc_arena);
+    free(ctx->dec_arena);
+    free(ctx);
+}
+
+bool qtc3_ctx_encode(qtc3_ctx *ctx, const uint8_t *data, uint8_t *out, uint32_t out_cap, uint32_t *out_size)
+{
+    uint32_t qt_n = ctx->qt_n;
+    uint32_t qt_size = (qt_n + 1) / 2;
+    uint32_t qtc_cap = QTC3_BOUND(qt_n);
+
+    // quad tree and a stream for each polarity
+    if (!ctx->enc_arena)
+    {
+        ctx->enc_arena = malloc(qt_size + 2 * qtc_cap);
+        if (!ctx->enc_arena)
+        {
+            return false;
         }
     }
 
-    return pixels;
+    uint8_t *qt = ctx->enc_arena;
+    uint8_t *qtc = qt + qt_size;
+    uint8_t *qtc_inv = qtc + qtc_cap;
+
+    QTC_STATS_TIMER(t);
+    qt_from_pixels(qt, qt_n, data, ctx->w, ctx->h, 0x00);
+    QTC_STATS_PHASE(QTC_PHASE_BUILD, t);
+    uint32_t qtc_size = qt_compress(qt, qt_n, false, qtc);
+    QTC_STATS_PHASE(QTC_PHASE_SERIALIZE, t);
+
+    qt_from_pixels(qt, qt_n, data, ctx->w, ctx->h, 0xFF);
+    QTC_STATS_PHASE(QTC_PHASE_BUILD, t);
+    uint32_t qtc_inv_size = qt_compress(qt, qt_n, true, qtc_inv);
+    QTC_STATS_PHASE(QTC_PHASE_SERIALIZE, t);
+
+    QTC_STATS_ADD(normal_bytes, qtc_size);
+    QTC_STATS_ADD(inverted_bytes, qtc_inv_size);
+    QTC_STATS_ADD(normal_won, qtc_size < qtc_inv_size);
+    QTC_STATS_ADD(inverted_won, qtc_size >= qtc_inv_size);
+
+    if (qtc_size >= qtc_inv_size)
+    {
+        qtc = qtc_inv;
+        qtc_size = qtc_inv_size;
+    }
+
+    if (qtc_size > out_cap)
+    {
+        return false;
+    }
+
+    memcpy(out, qtc, qtc_size);
+    *out_size = qtc_size;
+
+    return true;
 }
 
-uint8_t *qtc3_decode(const uint8_t *qtc, uint16_t w, uint16_t h, uint32_t *comp_size)
+bool qtc3_ctx_decode(qtc3_ctx *ctx, const uint8_t *data, uint8_t *out, uint32_t *in_size)
 {
-    uint8_t *qt, *pixels;
-    uint32_t qt_n;
-    bool inverted;
+    uint32_t qt_n = ctx->qt_n;
 
-    qt = qtc_decompress(qtc, w, h, &inverted, &qt_n, comp_size);
-    if (qt == NULL)
+    if (!ctx->dec_arena)
     {
-        return NULL;
+        ctx->dec_arena = malloc((qt_n + 1) / 2);
+        if (!ctx->dec_arena)
+        {
+            return false;
+        }
     }
 
-    pixels = qt_to_pixels(qt, qt_n, w, h);
-    free(qt);
+    bool inverted;
+
+    QTC_STATS_TIMER(t);
+    qtc_decompress(data, ctx->dec_arena, qt_n, &inverted, in_size);
+    QTC_STATS_PHASE(QTC_PHASE_PARSE, t);
+
+    qt_to_pixels(ctx->dec_arena, qt_n, ctx->w, ctx->h, out);
 
     if (inverted)
     {
-        arr_invert(pixels, (w + 7) / 8 * h);
+        arr_invert(out, (ctx->w + 7) / 8 * ctx->h);
     }
+    QTC_STATS_PHASE(QTC_PHASE_RASTER, t);
 
-    return pixels;
-}
\ No newline at end of file
+    return true;
+}
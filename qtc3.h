@@ -2,6 +2,7 @@
 #define __QTC3_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * Compress a 1-bit raster image into a quad tree.
@@ -15,6 +16,31 @@
  */
 uint8_t *qtc3_encode(const uint8_t *data, uint16_t w, uint16_t h, uint32_t *out_size);
 
+/**
+ * Get the largest size qtc3_encode can produce for an image of the specified
+ * size.
+ *
+ * @param w image width
+ * @param h image height
+ *
+ * @return worst-case size, in bytes, of compressed data. 0 if the size is invalid
+ */
+uint32_t qtc3_max_compressed_size(uint16_t w, uint16_t h);
+
+/**
+ * Compress a 1-bit raster image into a caller-provided buffer.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out output buffer, qtc3_max_compressed_size bytes always suffice
+ * @param out_cap size, in bytes, of the output buffer
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtc3_encode_into(const uint8_t *data, uint16_t w, uint16_t h, uint8_t *out, uint32_t out_cap, uint32_t *out_size);
+
 /**
  * Decompress a compressed quad tree into a 1-bit raster image.
  *
@@ -26,4 +52,64 @@ uint8_t *qtc3_encode(const uint8_t *data, uint16_t w, uint16_t h, uint32_t *out_
  */
 uint8_t *qtc3_decode(const uint8_t *data, uint16_t w, uint16_t h, uint32_t *comp_size);
 
+/**
+ * Decompress a compressed quad tree into a caller-provided 1-bit raster.
+ *
+ * @param data pointer to compressed quad tree data
+ * @param w image width
+ * @param h image height
+ * @param out output raster of (w + 7) / 8 * h bytes
+ * @param comp_size the number of bytes processed in the compressed data
+ * @return true if successful, false if out of memory or the size is invalid
+ */
+bool qtc3_decode_into(const uint8_t *data, uint16_t w, uint16_t h, uint8_t *out, uint32_t *comp_size);
+
+/**
+ * Reusable encoder and decoder state for images of one size. Scratch memory
+ * is allocated by the first encode or decode and reused by every later call.
+ */
+typedef struct qtc3_ctx qtc3_ctx;
+
+/**
+ * Create a coding context for images of the specified size.
+ *
+ * @param w image width
+ * @param h image height
+ *
+ * @return pointer to context. NULL if unsuccessful
+ */
+qtc3_ctx *qtc3_ctx_create(uint16_t w, uint16_t h);
+
+/**
+ * Free a coding context and its scratch memory.
+ *
+ * @param ctx pointer to context, may be NULL
+ */
+void qtc3_ctx_free(qtc3_ctx *ctx);
+
+/**
+ * Compress a 1-bit raster image into a caller-provided buffer.
+ *
+ * @param ctx context created for the image size
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param out output buffer
+ * @param out_cap size, in bytes, of the output buffer
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtc3_ctx_encode(qtc3_ctx *ctx, const uint8_t *data, uint8_t *out, uint32_t out_cap, uint32_t *out_size);
+
+/**
+ * Decompress a compressed quad tree into a caller-provided 1-bit raster.
+ *
+ * @param ctx context created for the image size
+ * @param data pointer to compressed quad tree data
+ * @param out output raster of (w + 7) / 8 * h bytes
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return true if successful, false if out of memory
+ */
+bool qtc3_ctx_decode(qtc3_ctx *ctx, const uint8_t *data, uint8_t *out, uint32_t *in_size);
+
 #endif // __QTC3_H__
\ No newline at end of file
@@ -91,7 +91,7 @@ qtir_node *qtir_from_pix(const u8 *data, u16 w, u16 h, u32 *qt_n)
     return ir;
 }
 
-void qtir_get_fills(qtir_node *ir, u32 qt_n)
+static void qtir_get_fills(qtir_node *ir, u32 qt_n)
 {
     qtir_node *ir_p, *ir_c;
 
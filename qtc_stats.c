@@ -0,0 +1,38 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "qtc_stats.h"
+
+#include <time.h>
+
+#ifdef QTC_STATS
+
+qtc_stats *qtc_stats_sink = NULL;
+
+u64 qtc_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+u64 qtc_stats_start(void)
+{
+    QTC_PROBE0(phase_start);
+
+    return qtc_stats_sink ? qtc_stats_now() : 0;
+}
+
+void qtc_stats_attach(qtc_stats *stats)
+{
+    qtc_stats_sink = stats;
+}
+
+#else
+
+void qtc_stats_attach(qtc_stats *stats)
+{
+    (void)stats;
+}
+
+#endif // QTC_STATS
@@ -0,0 +1,117 @@
+#ifndef __QTC_STATS_H__
+#define __QTC_STATS_H__
+
+#include "qtc_trace.h"
+#include "types.h"
+
+/*
+ * Codec instrumentation. Builds with QTC_STATS defined (make STATS=1) time
+ * the phases of every encode and decode and count what they do into the
+ * attached stats struct. Without QTC_STATS the hooks compile to nothing, or
+ * to the phase_start and phase_end USDT probes of builds with QTC_USDT.
+ */
+
+#define QTC_STATS_MAX_LVLS 16
+
+enum
+{
+    // raster to tree
+    QTC_PHASE_BUILD,
+    // fill detection
+    QTC_PHASE_FILLS,
+    // subtree size estimation and raw conversion
+    QTC_PHASE_SIZES,
+    // tree to stream
+    QTC_PHASE_SERIALIZE,
+    // stream to tree
+    QTC_PHASE_PARSE,
+    // tree to raster
+    QTC_PHASE_RASTER,
+    // arithmetic and rANS coding
+    QTC_PHASE_ENTROPY,
+    QTC_PHASE_Cnt
+};
+
+/**
+ * Counters of the codec calls made while attached. Every field accumulates,
+ * so zero the struct before attaching it to measure a single call
+ */
+typedef struct
+{
+    u64 phase_ns[QTC_PHASE_Cnt];
+    // tree nodes examined by the serializers and parsers
+    u64 nodes_visited;
+    // 0xF fills emitted, indexed by fill height
+    u64 fills[QTC_STATS_MAX_LVLS];
+    // pattern fills emitted, indexed by fill height
+    u64 pattern_fills[QTC_STATS_MAX_LVLS];
+    // nibbles of qtcf streams, indexed by tree level
+    u64 lvl_nibbles[QTC_STATS_MAX_LVLS];
+    // encodes won by each polarity, and the stream sizes of both
+    u64 normal_won;
+    u64 inverted_won;
+    u64 normal_bytes;
+    u64 inverted_bytes;
+} qtc_stats;
+
+/**
+ * Attach a stats struct that codec calls will count into. Only one struct can
+ * be attached at a time and the counting is not thread-safe. Does nothing
+ * unless built with QTC_STATS
+ *
+ * @param stats pointer to stats struct, NULL to detach
+ */
+void qtc_stats_attach(qtc_stats *stats);
+
+#ifdef QTC_STATS
+
+extern qtc_stats *qtc_stats_sink;
+
+/**
+ * Monotonic time in nanoseconds
+ */
+u64 qtc_stats_now(void);
+
+/**
+ * Fire the phase_start probe and read the clock if a stats struct is attached
+ *
+ * @return time in nanoseconds, 0 if no stats struct is attached
+ */
+u64 qtc_stats_start(void);
+
+#define QTC_STATS_ADD(field, n)              \
+    do                                       \
+    {                                        \
+        if (qtc_stats_sink)                  \
+        {                                    \
+            qtc_stats_sink->field += (n);    \
+        }                                    \
+    } while (0)
+
+#define QTC_STATS_TIMER(t) u64 t = qtc_stats_start()
+
+#define QTC_STATS_PHASE(phase, t)                                 \
+    do                                                            \
+    {                                                             \
+        QTC_PROBE1(phase_end, phase);                             \
+        if (qtc_stats_sink)                                       \
+        {                                                         \
+            u64 now_ = qtc_stats_now();                           \
+            qtc_stats_sink->phase_ns[phase] += now_ - (t);        \
+            (t) = now_;                                           \
+        }                                                         \
+    } while (0)
+
+#define QTC_STATS_ON() (qtc_stats_sink != NULL)
+
+#else
+
+// t is declared and read only by the QTC_STATS hooks, the probes stand alone
+#define QTC_STATS_ADD(field, n) ((void)0)
+#define QTC_STATS_TIMER(t) QTC_PROBE0(phase_start)
+#define QTC_STATS_PHASE(phase, t) QTC_PROBE1(phase_end, phase)
+#define QTC_STATS_ON() 0
+
+#endif // QTC_STATS
+
+#endif // __QTC_STATS_H__
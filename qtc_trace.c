@@ -0,0 +1,12 @@
+#include "qtc_trace.h"
+
+#include <stddef.h>
+
+qtc_trace_fn qtc_trace_cb = NULL;
+void *qtc_trace_user = NULL;
+
+void qtc_trace_set(qtc_trace_fn fn, void *user)
+{
+    qtc_trace_cb = fn;
+    qtc_trace_user = user;
+}
@@ -0,0 +1,61 @@
+#ifndef __QTC_TRACE_H__
+#define __QTC_TRACE_H__
+
+#include "types.h"
+
+/*
+ * Codec trace points. Metrics the codecs used to print go to a callback
+ * installed with qtc_trace_set, so by default nothing is printed. Builds with
+ * QTC_USDT defined (make USDT=1, needs <sys/sdt.h>) also place USDT probes of
+ * provider qtc at the trace points and at the phase boundaries of qtc_stats.h,
+ * which perf and bpftrace can attach to in production binaries.
+ */
+
+/**
+ * Trace callback
+ *
+ * @param event name of the trace point
+ * @param a first value of the event
+ * @param b second value of the event
+ * @param user pointer given to qtc_trace_set
+ */
+typedef void (*qtc_trace_fn)(const char *event, u64 a, u64 b, void *user);
+
+/**
+ * Install a trace callback. Only one callback can be installed at a time
+ *
+ * @param fn trace callback, NULL to stop tracing
+ * @param user pointer passed to every call of the callback
+ */
+void qtc_trace_set(qtc_trace_fn fn, void *user);
+
+extern qtc_trace_fn qtc_trace_cb;
+extern void *qtc_trace_user;
+
+#ifdef QTC_USDT
+
+#include <sys/sdt.h>
+
+#define QTC_PROBE0(name) DTRACE_PROBE(qtc, name)
+#define QTC_PROBE1(name, a) DTRACE_PROBE1(qtc, name, a)
+#define QTC_PROBE2(name, a, b) DTRACE_PROBE2(qtc, name, a, b)
+
+#else
+
+#define QTC_PROBE0(name) ((void)0)
+#define QTC_PROBE1(name, a) ((void)0)
+#define QTC_PROBE2(name, a, b) ((void)0)
+
+#endif // QTC_USDT
+
+#define QTC_TRACE(name, a, b)                                   \
+    do                                                          \
+    {                                                           \
+        QTC_PROBE2(name, a, b);                                 \
+        if (qtc_trace_cb)                                       \
+        {                                                       \
+            qtc_trace_cb(#name, (a), (b), qtc_trace_user);      \
+        }                                                       \
+    } while (0)
+
+#endif // __QTC_TRACE_H__
@@ -0,0 +1,471 @@
+#include "qtca.h"
+#include "qtcf.h"
+#include "qtir.h"
+#include "qtc_stats.h"
+#include "utils.h"
+
+#include <string.h>
+
+#define RC_PROB_BITS 11
+#define RC_PROB_INIT (1 << (RC_PROB_BITS - 1))
+#define RC_MOVE_BITS 5
+#define RC_TOP (1U << 24)
+
+/**
+ * Upper bound, in bits, of the cost of one coded decision. Probabilities
+ * never drop below 31 / 2048, which costs a little over 6 bits
+ */
+#define RC_MAX_BITS 7
+
+/**
+ * Upper bound of the decisions coded per node: the full bit and the mask
+ */
+#define QTCA_MAX_NODE_BITS 5
+
+/**
+ * Adaptive probabilities of the tree model. Mask bits are indexed by the
+ * bits of the node already coded, with a leading 1 marking how many
+ */
+typedef struct
+{
+    u16 root;
+    u16 full[QTCF_MAX_LVLS][QUAD_Cnt][16];
+    u16 mask[QTCF_MAX_LVLS][QUAD_Cnt][16][16];
+} qtca_model;
+
+typedef struct
+{
+    u64 low;
+    u32 range;
+    u8 cache;
+    u32 cache_size;
+    u8 *out;
+    u32 out_pos;
+    u32 out_cap;
+    bool grow;
+    bool overflow;
+} rc_enc;
+
+typedef struct
+{
+    u32 code;
+    u32 range;
+    const u8 *in;
+} rc_dec;
+
+static void model_init(qtca_model *m)
+{
+    u16 *p = (u16 *)m;
+    u16 *end = (u16 *)(m + 1);
+
+    while (p < end)
+    {
+        *p++ = RC_PROB_INIT;
+    }
+}
+
+static void rc_enc_out(rc_enc *rc, u8 b)
+{
+    if (rc->out_pos >= rc->out_cap)
+    {
+        u8 *out = rc->grow ? realloc(rc->out, 2 * rc->out_cap) : NULL;
+        if (!out)
+        {
+            rc->overflow = true;
+            return;
+        }
+
+        rc->out = out;
+        rc->out_cap *= 2;
+    }
+
+    rc->out[rc->out_pos++] = b;
+}
+
+static void rc_enc_shift_low(rc_enc *rc)
+{
+    if ((u32)rc->low < 0xFF000000 || (rc->low >> 32) != 0)
+    {
+        u8 carry = rc->low >> 32;
+        u8 b = rc->cache;
+
+        do
+        {
+            rc_enc_out(rc, b + carry);
+            b = 0xFF;
+        } while (--rc->cache_size != 0);
+
+        rc->cache = (u8)(rc->low >> 24);
+    }
+
+    rc->cache_size++;
+    rc->low = (rc->low & 0x00FFFFFF) << 8;
+}
+
+static void rc_enc_bit(rc_enc *rc, u16 *prob, bool bit)
+{
+    u32 bound = (rc->range >> RC_PROB_BITS) * (*prob);
+
+    if (!bit)
+    {
+        rc->range = bound;
+        *prob += ((1 << RC_PROB_BITS) - *prob) >> RC_MOVE_BITS;
+    }
+    else
+    {
+        rc->low += bound;
+        rc->range -= bound;
+        *prob -= *prob >> RC_MOVE_BITS;
+    }
+
+    while (rc->range < RC_TOP)
+    {
+        rc->range <<= 8;
+        rc_enc_shift_low(rc);
+    }
+}
+
+static bool rc_dec_bit(rc_dec *rc, u16 *prob)
+{
+    u32 bound = (rc->range >> RC_PROB_BITS) * (*prob);
+    bool bit;
+
+    if (rc->code < bound)
+    {
+        rc->range = bound;
+        *prob += ((1 << RC_PROB_BITS) - *prob) >> RC_MOVE_BITS;
+        bit = false;
+    }
+    else
+    {
+        rc->code -= bound;
+        rc->range -= bound;
+        *prob -= *prob >> RC_MOVE_BITS;
+        bit = true;
+    }
+
+    while (rc->range < RC_TOP)
+    {
+        rc->range <<= 8;
+        rc->code = (rc->code << 8) | *rc->in++;
+    }
+
+    return bit;
+}
+
+/**
+ * Code the mask of a non-empty node. The last bit is implied when the first
+ * three are clear.
+ */
+static void enc_mask(rc_enc *rc, u16 *probs, u8 val)
+{
+    u8 ctx = 1;
+
+    for (u8 q = 0; q < QUAD_Cnt; q++)
+    {
+        bool bit = (val >> q) & 1;
+
+        if (ctx == 0x8)
+        {
+            break;
+        }
+
+        rc_enc_bit(rc, &probs[ctx], bit);
+        ctx = (ctx << 1) | bit;
+    }
+}
+
+static u8 dec_mask(rc_dec *rc, u16 *probs)
+{
+    u8 ctx = 1;
+    u8 val = 0;
+
+    for (u8 q = 0; q < QUAD_Cnt; q++)
+    {
+        bool bit = true;
+
+        if (ctx != 0x8)
+        {
+            bit = rc_dec_bit(rc, &probs[ctx]);
+        }
+
+        val |= bit << q;
+        ctx = (ctx << 1) | bit;
+    }
+
+    return val;
+}
+
+/**
+ * Flag every completely set subtree in fill_height and clear sub_size, which
+ * is used to flag the nodes that get coded
+ */
+static void qtir_mark_full(qtir_node *qtir, u32 qt_n)
+{
+    u32 leaf_start = qt_n / 4;
+
+    for (u32 i = leaf_start; i < qt_n; i++)
+    {
+        qtir[i].fill_height = qtir[i].val == 0xF;
+        qtir[i].sub_size = 0;
+    }
+
+    for (u32 i = leaf_start; i > 0; i--)
+    {
+        qtir_node *c = qtir + 4 * (i - 1) + 1;
+
+        qtir[i - 1].fill_height = c[0].fill_height & c[1].fill_height & c[2].fill_height & c[3].fill_height;
+        qtir[i - 1].sub_size = 0;
+    }
+}
+
+/**
+ * Code an image into a range coder whose output buffer holds at least the
+ * 4 byte length prefix
+ *
+ * @return true if successful, false if out of memory or the output overflowed
+ */
+static bool qtca_encode_rc(const u8 *data, u16 w, u16 h, rc_enc *rc)
+{
+    QTC_STATS_TIMER(t);
+
+    u32 qt_n;
+    qtir_node *qtir = qtir_from_raster(data, w, h, &qt_n);
+    if (!qtir)
+    {
+        return false;
+    }
+
+    qtca_model *m = malloc(sizeof(qtca_model));
+    if (!m)
+    {
+        free(qtir);
+        return false;
+    }
+
+    model_init(m);
+    qtir_mark_full(qtir, qt_n);
+    QTC_STATS_PHASE(QTC_PHASE_BUILD, t);
+
+    u8 lvls = calc_lvls(w, h);
+    u8 lvl = 0;
+    u32 lvl_end = 1;
+
+    rc_enc_bit(rc, &m->root, qtir[0].val != 0);
+    qtir[0].sub_size = qtir[0].val != 0;
+
+    for (u32 i = 0; i < qt_n; i++)
+    {
+        if (i == lvl_end)
+        {
+            lvl++;
+            lvl_end = 4 * lvl_end + 1;
+        }
+
+        qtir_node *n = qtir + i;
+        u8 pmask = 0;
+        u8 q = 0;
+
+        if (i > 0)
+        {
+            qtir_node *p = qtir + (i - 1) / 4;
+            q = (i - 1) % 4;
+            pmask = p->val;
+
+            n->sub_size = p->sub_size && !p->fill_height && (pmask & (1 << q));
+        }
+
+        if (!n->sub_size)
+        {
+            continue;
+        }
+
+        QTC_STATS_ADD(nodes_visited, 1);
+
+        if (lvl + 1 < lvls)
+        {
+            rc_enc_bit(rc, &m->full[lvl][q][pmask], n->fill_height);
+
+            if (n->fill_height)
+            {
+                QTC_STATS_ADD(fills[lvls - 1 - lvl], 1);
+                continue;
+            }
+        }
+
+        enc_mask(rc, m->mask[lvl][q][pmask], n->val);
+    }
+
+    for (u8 k = 0; k < 5; k++)
+    {
+        rc_enc_shift_low(rc);
+    }
+    QTC_STATS_PHASE(QTC_PHASE_ENTROPY, t);
+
+    free(m);
+    free(qtir);
+
+    if (rc->overflow)
+    {
+        return false;
+    }
+
+    rc->out[0] = rc->out_pos >> 0;
+    rc->out[1] = rc->out_pos >> 8;
+    rc->out[2] = rc->out_pos >> 16;
+    rc->out[3] = rc->out_pos >> 24;
+
+    return true;
+}
+
+u32 qtca_max_compressed_size(u16 w, u16 h)
+{
+    u8 lvls = calc_lvls(w, h);
+    if (lvls == 0)
+    {
+        return 0;
+    }
+
+    // length prefix, range coder flush and the root bit
+    u64 bits = 1 + (u64)QTCA_MAX_NODE_BITS * calc_node_cnt(lvls);
+    u64 size = 4 + 5 + (RC_MAX_BITS * bits + 7) / 8;
+
+    return size > UINT32_MAX ? UINT32_MAX : size;
+}
+
+u8 *qtca_encode(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    rc_enc rc = {0, 0xFFFFFFFF, 0, 1, NULL, 4, 256, true, false};
+
+    rc.out = malloc(rc.out_cap);
+    if (!rc.out)
+    {
+        return NULL;
+    }
+
+    if (!qtca_encode_rc(data, w, h, &rc))
+    {
+        free(rc.out);
+        return NULL;
+    }
+
+    *out_size = rc.out_pos;
+    return realloc(rc.out, *out_size);
+}
+
+bool qtca_encode_into(const u8 *data, u16 w, u16 h, u8 *out, u32 out_cap, u32 *out_size)
+{
+    rc_enc rc = {0, 0xFFFFFFFF, 0, 1, out, 4, out_cap, false, false};
+
+    if (out_cap < 4 || !qtca_encode_rc(data, w, h, &rc))
+    {
+        return false;
+    }
+
+    *out_size = rc.out_pos;
+    return true;
+}
+
+u8 *qtca_decode(const u8 *data, u16 w, u16 h, u32 *in_size)
+{
+    u8 *pix = malloc((w + 7) / 8 * h);
+
+    if (!pix || !qtca_decode_into(data, w, h, pix, in_size))
+    {
+        free(pix);
+        return NULL;
+    }
+
+    return pix;
+}
+
+bool qtca_decode_into(const u8 *data, u16 w, u16 h, u8 *out, u32 *in_size)
+{
+    u8 lvls = calc_lvls(w, h);
+    if (lvls == 0)
+    {
+        return false;
+    }
+
+    u32 qt_n = calc_node_cnt(lvls);
+    u32 qt_size = (qt_n + 1) / 2;
+
+    u8 *qt = malloc(qt_size);
+    qtca_model *m = malloc(sizeof(qtca_model));
+    if (!qt || !m)
+    {
+        free(qt);
+        free(m);
+        return false;
+    }
+
+    memset(qt, 0, qt_size);
+    model_init(m);
+
+    QTC_STATS_TIMER(t);
+
+    *in_size = data[0] | (data[1] << 8) | (data[2] << 16) | ((u32)data[3] << 24);
+
+    // the first byte out of the range coder is always 0
+    rc_dec rc = {0, 0xFFFFFFFF, data + 5};
+
+    for (u8 k = 0; k < 4; k++)
+    {
+        rc.code = (rc.code << 8) | *rc.in++;
+    }
+
+    if (rc_dec_bit(&rc, &m->root))
+    {
+        u8 lvl = 0;
+        u32 lvl_end = 1;
+        u32 pi = ~0;
+        u8 pv = 0x1;
+        u8 q = 0;
+
+        for (u32 ci = 0; ci < qt_n; ci++)
+        {
+            if (ci == lvl_end)
+            {
+                lvl++;
+                lvl_end = 4 * lvl_end + 1;
+            }
+
+            if (ci > 0)
+            {
+                q = (ci - 1) % 4;
+
+                if (q == 0)
+                {
+                    pi++;
+                    pv = na_read(qt, pi);
+                }
+            }
+
+            if (!(pv & (1 << q)) || na_read(qt, ci) != 0)
+            {
+                continue;
+            }
+
+            u8 pmask = ci > 0 ? pv : 0;
+
+            QTC_STATS_ADD(nodes_visited, 1);
+
+            if (lvl + 1 < lvls && rc_dec_bit(&rc, &m->full[lvl][q][pmask]))
+            {
+                qt_fill_val(qt, ci, lvls - 1 - lvl, 0xF);
+                continue;
+            }
+
+            na_write(qt, ci, dec_mask(&rc, m->mask[lvl][q][pmask]));
+        }
+    }
+
+    free(m);
+    QTC_STATS_PHASE(QTC_PHASE_ENTROPY, t);
+
+    qt_write_raster(qt, qt_n, w, h, out);
+    free(qt);
+    QTC_STATS_PHASE(QTC_PHASE_RASTER, t);
+
+    return true;
+}
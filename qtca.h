@@ -0,0 +1,72 @@
+#ifndef __QTCA_H__
+#define __QTCA_H__
+
+#include "types.h"
+
+/**
+ * Compress a 1-bit raster image by coding the child-presence bits of its quad
+ * tree with an adaptive binary arithmetic coder. Each bit is modelled on its
+ * tree level, its position in its parent, its parent's mask and the bits of
+ * its node already coded. Completely set subtrees are coded with a single bit.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtca_encode(const u8 *data, u16 w, u16 h, u32 *out_size);
+
+/**
+ * Get the largest size qtca_encode can produce for an image of the specified
+ * size.
+ *
+ * @param w image width
+ * @param h image height
+ *
+ * @return worst-case size, in bytes, of compressed data. 0 if the size is invalid
+ */
+u32 qtca_max_compressed_size(u16 w, u16 h);
+
+/**
+ * Compress a 1-bit raster image into a caller-provided buffer.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out output buffer, qtca_max_compressed_size bytes always suffice
+ * @param out_cap size, in bytes, of the output buffer
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtca_encode_into(const u8 *data, u16 w, u16 h, u8 *out, u32 out_cap, u32 *out_size);
+
+/**
+ * Decompress a 1-bit raster image compressed with qtca_encode.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return pointer to decompressed, 1-bit raster image. NULL if unsuccessful
+ */
+u8 *qtca_decode(const u8 *data, u16 w, u16 h, u32 *in_size);
+
+/**
+ * Decompress a 1-bit raster image compressed with qtca_encode into a
+ * caller-provided buffer.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param out output raster of (w + 7) / 8 * h bytes
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return true if successful, false if out of memory or the size is invalid
+ */
+bool qtca_decode_into(const u8 *data, u16 w, u16 h, u8 *out, u32 *in_size);
+
+#endif // __QTCA_H__
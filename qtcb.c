@@ -0,0 +1,685 @@
+#include "mort.h"
+#include "utils.h"
+#include "qtcb.h"
+#include "qtcf.h"
+#include "qtir.h"
+#include "qtc_stats.h"
+
+#include <string.h>
+
+enum
+{
+    QTCB_HEADER_FLAG_8X8,
+    QTCB_HEADER_FLAG_EMPTY,
+};
+
+/**
+ * Interior nodes hold the mask of their non-empty children in the low nibble
+ * and flags above it
+ */
+#define QTCB_NODE_MASK 0x0F
+#define QTCB_NODE_FULL 0x10
+#define QTCB_NODE_PRESENT 0x20
+
+/**
+ * Shape of the block tree of an image. Interior nodes are stored level by
+ * level as in qtir.h, the leaves follow the last interior level in Morton
+ * order
+ */
+typedef struct
+{
+    u32 w;
+    u32 h;
+    u8 leaf_log2;
+    // leaf side in pixels and nibbles of a raw leaf
+    u8 side;
+    u8 leaf_nibs;
+    u64 full_leaf;
+    u64 node_n;
+    u64 leaf_n;
+    // leaf blocks covering the image
+    u32 cols;
+    u32 rows;
+} qtcb_shape;
+
+static bool shape_init(qtcb_shape *s, u32 w, u32 h, u8 leaf_log2)
+{
+    if (w == 0 || h == 0 || (leaf_log2 != QTCB_LEAF_4X4 && leaf_log2 != QTCB_LEAF_8X8))
+    {
+        return false;
+    }
+
+    u8 img_lvls = calc_lvls(w, h);
+    if (img_lvls > QTCF64_MAX_LVLS)
+    {
+        return false;
+    }
+
+    // at least one interior level, so the root is always a mask
+    u8 lvls = MAX(img_lvls, leaf_log2 + 1) - leaf_log2;
+
+    s->w = w;
+    s->h = h;
+    s->leaf_log2 = leaf_log2;
+    s->side = 1 << leaf_log2;
+    s->leaf_nibs = s->side * s->side / 4;
+    s->full_leaf = leaf_log2 == QTCB_LEAF_8X8 ? UINT64_MAX : 0xFFFF;
+    s->node_n = calc_node_cnt64(lvls);
+    s->leaf_n = (u64)1 << (2 * lvls);
+    s->cols = ((u64)w + s->side - 1) >> leaf_log2;
+    s->rows = ((u64)h + s->side - 1) >> leaf_log2;
+
+    return true;
+}
+
+/**
+ * Size, in bytes, of the largest stream of a tree: header, codebook, a nibble
+ * per interior node and a code nibble and raw block per leaf
+ */
+static u64 shape_bound(const qtcb_shape *s)
+{
+    u64 nibs = 2 + QTCB_CODEBOOK_MAX * s->leaf_nibs;
+
+    nibs += s->node_n + s->leaf_n * (1 + s->leaf_nibs);
+
+    return (nibs + 1) / 2;
+}
+
+/**
+ * Bits of a block row within a raster byte and the mask of the image pixels
+ * in that byte
+ */
+static void block_col(const qtcb_shape *s, size_t row_size, u32 bx, size_t *col, u8 *shift, u8 *valid)
+{
+    u64 x = (u64)bx << s->leaf_log2;
+
+    *col = x / 8;
+    *shift = x % 8;
+    *valid = 0xFF;
+
+    if (*col + 1 == row_size && s->w % 8)
+    {
+        *valid = (1 << (s->w % 8)) - 1;
+    }
+}
+
+/**
+ * Read a leaf block from a raster. Row r of the block is held in bits
+ * r * side ... r * side + side - 1, pixels outside the image are zero. A
+ * block whose pixels inside the image are all set is read as full_leaf, so
+ * blocks on the right and bottom edges can be part of full subtrees
+ */
+static u64 block_read(const qtcb_shape *s, const u8 *data, size_t row_size, u32 bx, u32 by)
+{
+    size_t col;
+    u8 shift, valid;
+    block_col(s, row_size, bx, &col, &shift, &valid);
+
+    u8 row_mask = (1 << s->side) - 1;
+    u64 y = (u64)by << s->leaf_log2;
+    u8 rows = MIN(s->side, s->h - y);
+
+    const u8 *p = data + y * row_size + col;
+    u64 blk = 0;
+    u64 in_img = 0;
+
+    for (u8 r = 0; r < rows; r++)
+    {
+        blk |= (u64)(((*p & valid) >> shift) & row_mask) << (r * s->side);
+        in_img |= (u64)((valid >> shift) & row_mask) << (r * s->side);
+        p += row_size;
+    }
+
+    return blk == in_img ? s->full_leaf : blk;
+}
+
+/**
+ * Write a leaf block into a zeroed raster, dropping pixels outside the image
+ */
+static void block_write(const qtcb_shape *s, u8 *raster, size_t row_size, u32 bx, u32 by, u64 blk)
+{
+    size_t col;
+    u8 shift, valid;
+    block_col(s, row_size, bx, &col, &shift, &valid);
+
+    u8 row_mask = (1 << s->side) - 1;
+    u64 y = (u64)by << s->leaf_log2;
+    u8 rows = MIN(s->side, s->h - y);
+
+    u8 *p = raster + y * row_size + col;
+
+    for (u8 r = 0; r < rows; r++)
+    {
+        *p |= (((blk >> (r * s->side)) & row_mask) << shift) & valid;
+        p += row_size;
+    }
+}
+
+/**
+ * Build the block tree of a raster image: the leaves straight from the
+ * raster bytes, then the interior masks and full flags bottom-up. Subtrees
+ * wholly outside the image are flagged full with an empty mask, so they
+ * neither get coded nor keep their parent from being full
+ *
+ * @param s tree shape
+ * @param data pointer to raster image data in row-major order
+ * @param nodes interior nodes, node_n bytes
+ * @param leaves leaf blocks, leaf_n words
+ */
+static void qtcb_build(const qtcb_shape *s, const u8 *data, u8 *nodes, u64 *leaves)
+{
+    size_t row_size = ((size_t)s->w + 7) / 8;
+
+    memset(leaves, 0, s->leaf_n * sizeof(u64));
+
+    u64 mc = 0;
+
+    for (u32 by = 0; by < s->rows; by++)
+    {
+        for (u32 bx = 0; bx < s->cols; bx++)
+        {
+            leaves[mc] = block_read(s, data, row_size, bx, by);
+            morton64_inc_x(&mc);
+        }
+
+        morton64_inc_y(&mc);
+        morton64_rst_x(&mc);
+    }
+
+    u64 bottom_start = (s->node_n - 1) / 4;
+
+    for (u64 i = s->node_n; i-- > 0;)
+    {
+        u64 c = 4 * i + 1;
+        u8 v = QTCB_NODE_FULL;
+
+        u32 nx = 0, ny = 0;
+        if (i >= bottom_start)
+        {
+            morton64_decode(i - bottom_start, &nx, &ny);
+        }
+
+        for (u8 q = 0; q < QUAD_Cnt; q++, c++)
+        {
+            bool set, full;
+
+            if (c >= s->node_n)
+            {
+                u64 leaf = leaves[c - s->node_n];
+                bool outside = 2 * (u64)nx + (q & 1) >= s->cols || 2 * (u64)ny + (q >> 1) >= s->rows;
+
+                set = leaf != 0;
+                full = outside || leaf == s->full_leaf;
+            }
+            else
+            {
+                set = (nodes[c] & QTCB_NODE_MASK) != 0;
+                full = nodes[c] & QTCB_NODE_FULL;
+            }
+
+            v |= set << q;
+
+            if (!full)
+            {
+                v &= ~QTCB_NODE_FULL;
+            }
+        }
+
+        nodes[i] = v;
+    }
+}
+
+/**
+ * Flag the interior nodes that appear in the stream: the root and the set
+ * children of every present node that is not full
+ */
+static void qtcb_mark_present(const qtcb_shape *s, u8 *nodes)
+{
+    nodes[0] |= QTCB_NODE_PRESENT;
+
+    for (u64 i = 0; 4 * i + 1 < s->node_n; i++)
+    {
+        u8 v = nodes[i];
+
+        if (!(v & QTCB_NODE_PRESENT) || (v & QTCB_NODE_FULL))
+        {
+            continue;
+        }
+
+        for (u8 q = 0; q < QUAD_Cnt; q++)
+        {
+            if (v & (1 << q))
+            {
+                nodes[4 * i + 1 + q] |= QTCB_NODE_PRESENT;
+            }
+        }
+    }
+}
+
+/**
+ * Whether a leaf is coded in the stream, that is its parent is present, not
+ * full, and has the leaf set
+ */
+static bool leaf_coded(const qtcb_shape *s, const u8 *nodes, u64 leaf_i)
+{
+    u64 c = s->node_n + leaf_i - 1;
+    u8 v = nodes[c / 4];
+
+    return (v & QTCB_NODE_PRESENT) && !(v & QTCB_NODE_FULL) && (v & (1 << (c % 4)));
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Pick the most frequent coded leaf blocks for the codebook. An entry costs
+ * one raw block and saves all but a nibble of every leaf that uses it, so
+ * every block used at least twice is worth an entry
+ *
+ * @param s tree shape
+ * @param nodes interior nodes with presence flags
+ * @param leaves leaf blocks
+ * @param blocks scratch array of leaf_n words
+ * @param codebook output codebook of QTCB_CODEBOOK_MAX entries
+ *
+ * @return number of codebook entries
+ */
+static u8 codebook_pick(const qtcb_shape *s, const u8 *nodes, const u64 *leaves, u64 *blocks, u64 *codebook)
+{
+    u64 n = 0;
+
+    for (u64 l = 0; l < s->leaf_n; l++)
+    {
+        if (leaf_coded(s, nodes, l))
+        {
+            blocks[n++] = leaves[l];
+        }
+    }
+
+    qsort(blocks, n, sizeof(u64), cmp_u64);
+
+    u64 counts[QTCB_CODEBOOK_MAX];
+    u8 cnt = 0;
+
+    for (u64 i = 0; i < n;)
+    {
+        u64 j = i + 1;
+        while (j < n && blocks[j] == blocks[i])
+        {
+            j++;
+        }
+
+        u64 run = j - i;
+
+        if (run > 1)
+        {
+            // insert into the entries kept sorted by decreasing count
+            u8 k = cnt < QTCB_CODEBOOK_MAX ? cnt++ : QTCB_CODEBOOK_MAX;
+
+            while (k > 0 && counts[k - 1] < run)
+            {
+                if (k < QTCB_CODEBOOK_MAX)
+                {
+                    counts[k] = counts[k - 1];
+                    codebook[k] = codebook[k - 1];
+                }
+                k--;
+            }
+
+            if (k < QTCB_CODEBOOK_MAX)
+            {
+                counts[k] = run;
+                codebook[k] = blocks[i];
+            }
+        }
+
+        i = j;
+    }
+
+    return cnt;
+}
+
+static u64 blk_write_raw(u8 *qtcb, u64 qtc_i, u64 blk, u8 nibs)
+{
+    for (u8 n = 0; n < nibs; n++)
+    {
+        na_write(qtcb, qtc_i++, (blk >> (4 * n)) & 0xF);
+    }
+
+    return qtc_i;
+}
+
+static u64 blk_read_raw(const u8 *qtcb, u64 *qtc_i, u8 nibs)
+{
+    u64 blk = 0;
+
+    for (u8 n = 0; n < nibs; n++)
+    {
+        blk |= (u64)na_read(qtcb, (*qtc_i)++) << (4 * n);
+    }
+
+    return blk;
+}
+
+/**
+ * Serialize a block tree: header nibble, codebook size and entries, the
+ * present interior nodes in level order, 0 for a full subtree, then a code
+ * nibble for every coded leaf, 0 followed by the raw block or 1 + the index
+ * of its codebook entry
+ *
+ * @return size, in bytes, of the stream
+ */
+static u64 qtcb_write(const qtcb_shape *s, u8 *nodes, const u64 *leaves, u64 *blocks, u8 *qtcb)
+{
+    u64 qtc_i = 0;
+
+    u8 header = 0;
+    bool empty = (nodes[0] & QTCB_NODE_MASK) == 0;
+
+    header |= (s->leaf_log2 == QTCB_LEAF_8X8) << QTCB_HEADER_FLAG_8X8;
+    header |= empty << QTCB_HEADER_FLAG_EMPTY;
+
+    na_write(qtcb, qtc_i++, header);
+
+    if (!empty)
+    {
+        qtcb_mark_present(s, nodes);
+
+        u64 codebook[QTCB_CODEBOOK_MAX];
+        u8 cb_n = codebook_pick(s, nodes, leaves, blocks, codebook);
+
+        QTC_TRACE(qtcb_codebook, cb_n, s->leaf_nibs);
+
+        na_write(qtcb, qtc_i++, cb_n);
+
+        for (u8 k = 0; k < cb_n; k++)
+        {
+            qtc_i = blk_write_raw(qtcb, qtc_i, codebook[k], s->leaf_nibs);
+        }
+
+        for (u64 i = 0; i < s->node_n; i++)
+        {
+            u8 v = nodes[i];
+
+            if (v & QTCB_NODE_PRESENT)
+            {
+                na_write(qtcb, qtc_i++, v & QTCB_NODE_FULL ? 0 : v & QTCB_NODE_MASK);
+                QTC_STATS_ADD(nodes_visited, 1);
+            }
+        }
+
+        for (u64 l = 0; l < s->leaf_n; l++)
+        {
+            if (!leaf_coded(s, nodes, l))
+            {
+                continue;
+            }
+
+            u8 k = 0;
+            while (k < cb_n && codebook[k] != leaves[l])
+            {
+                k++;
+            }
+
+            if (k < cb_n)
+            {
+                na_write(qtcb, qtc_i++, k + 1);
+            }
+            else
+            {
+                na_write(qtcb, qtc_i++, 0);
+                qtc_i = blk_write_raw(qtcb, qtc_i, leaves[l], s->leaf_nibs);
+            }
+
+            QTC_STATS_ADD(nodes_visited, 1);
+        }
+    }
+
+    // clear the unused nibble of the last byte
+    if (qtc_i & 1)
+    {
+        na_write(qtcb, qtc_i, 0);
+    }
+
+    return (qtc_i + 1) / 2;
+}
+
+u64 qtcb_max_compressed_size(u32 w, u32 h, u8 leaf_log2)
+{
+    qtcb_shape s;
+
+    return shape_init(&s, w, h, leaf_log2) ? shape_bound(&s) : 0;
+}
+
+u8 *qtcb_encode(const u8 *data, u32 w, u32 h, u8 leaf_log2, u64 *out_size)
+{
+    u64 qtcb_cap = qtcb_max_compressed_size(w, h, leaf_log2);
+    if (qtcb_cap == 0 || qtcb_cap > SIZE_MAX)
+    {
+        return NULL;
+    }
+
+    u8 *qtcb = malloc(qtcb_cap);
+
+    if (!qtcb || !qtcb_encode_into(data, w, h, leaf_log2, qtcb, qtcb_cap, out_size))
+    {
+        free(qtcb);
+        return NULL;
+    }
+
+    return realloc(qtcb, *out_size);
+}
+
+bool qtcb_encode_into(const u8 *data, u32 w, u32 h, u8 leaf_log2, u8 *out, u64 out_cap, u64 *out_size)
+{
+    qtcb_shape s;
+    if (!shape_init(&s, w, h, leaf_log2))
+    {
+        return false;
+    }
+
+    u64 bound = shape_bound(&s);
+
+    if (s.leaf_n > SIZE_MAX / (2 * sizeof(u64)) || bound > SIZE_MAX)
+    {
+        return false;
+    }
+
+    // leaves and the codebook scratch, and a stream buffer if out may be short
+    u8 *nodes = malloc(s.node_n);
+    u64 *leaves = malloc(2 * s.leaf_n * sizeof(u64));
+    u8 *qtcb = out_cap >= bound ? out : malloc(bound);
+
+    bool ok = nodes && leaves && qtcb;
+
+    if (ok)
+    {
+        QTC_STATS_TIMER(t);
+        qtcb_build(&s, data, nodes, leaves);
+        QTC_STATS_PHASE(QTC_PHASE_BUILD, t);
+
+        u64 size = qtcb_write(&s, nodes, leaves, leaves + s.leaf_n, qtcb);
+        QTC_STATS_PHASE(QTC_PHASE_SERIALIZE, t);
+
+        ok = size <= out_cap;
+
+        if (ok && qtcb != out)
+        {
+            memcpy(out, qtcb, size);
+        }
+
+        *out_size = size;
+    }
+
+    if (qtcb != out)
+    {
+        free(qtcb);
+    }
+
+    free(nodes);
+    free(leaves);
+
+    return ok;
+}
+
+u8 *qtcb_decode(const u8 *data, u32 w, u32 h, u64 *in_size)
+{
+    u8 *pix = malloc(((size_t)w + 7) / 8 * h);
+
+    if (!pix || !qtcb_decode_into(data, w, h, pix, in_size))
+    {
+        free(pix);
+        return NULL;
+    }
+
+    return pix;
+}
+
+/**
+ * Parse a qtcb stream after its header into the interior nodes and leaves of
+ * the tree
+ *
+ * @return number of nibbles read, counting the header
+ */
+static u64 qtcb_parse(const qtcb_shape *s, const u8 *qtcb, u8 *nodes, u64 *leaves)
+{
+    u64 qtc_i = 1;
+
+    u64 codebook[QTCB_CODEBOOK_MAX];
+    u8 cb_n = na_read(qtcb, qtc_i++);
+
+    for (u8 k = 0; k < cb_n; k++)
+    {
+        codebook[k] = blk_read_raw(qtcb, &qtc_i, s->leaf_nibs);
+    }
+
+    memset(nodes, 0, s->node_n);
+    nodes[0] = QTCB_NODE_PRESENT;
+
+    for (u64 i = 0; i < s->node_n; i++)
+    {
+        u8 v = nodes[i];
+
+        if (!(v & QTCB_NODE_PRESENT))
+        {
+            continue;
+        }
+
+        if (!(v & QTCB_NODE_FULL))
+        {
+            u8 nib = na_read(qtcb, qtc_i++);
+            v |= nib ? nib : QTCB_NODE_FULL | QTCB_NODE_MASK;
+            nodes[i] = v;
+
+            QTC_STATS_ADD(nodes_visited, 1);
+        }
+
+        u64 c = 4 * i + 1;
+
+        for (u8 q = 0; q < QUAD_Cnt && c < s->node_n; q++, c++)
+        {
+            if (v & QTCB_NODE_FULL)
+            {
+                nodes[c] = v;
+            }
+            else if (v & (1 << q))
+            {
+                nodes[c] = QTCB_NODE_PRESENT;
+            }
+        }
+    }
+
+    for (u64 l = 0; l < s->leaf_n; l++)
+    {
+        u64 c = s->node_n + l - 1;
+        u8 v = nodes[c / 4];
+
+        if (!(v & QTCB_NODE_PRESENT) || !(v & (1 << (c % 4))))
+        {
+            leaves[l] = 0;
+        }
+        else if (v & QTCB_NODE_FULL)
+        {
+            leaves[l] = s->full_leaf;
+        }
+        else
+        {
+            u8 k = na_read(qtcb, qtc_i++);
+            leaves[l] = k ? codebook[k - 1] : blk_read_raw(qtcb, &qtc_i, s->leaf_nibs);
+
+            QTC_STATS_ADD(nodes_visited, 1);
+        }
+    }
+
+    return qtc_i;
+}
+
+bool qtcb_decode_into(const u8 *data, u32 w, u32 h, u8 *out, u64 *in_size)
+{
+    u8 header = na_read(data, 0);
+    u8 leaf_log2 = header & (1 << QTCB_HEADER_FLAG_8X8) ? QTCB_LEAF_8X8 : QTCB_LEAF_4X4;
+
+    qtcb_shape s;
+    if (!shape_init(&s, w, h, leaf_log2))
+    {
+        return false;
+    }
+
+    size_t row_size = ((size_t)w + 7) / 8;
+
+    memset(out, 0, row_size * h);
+
+    if (header & (1 << QTCB_HEADER_FLAG_EMPTY))
+    {
+        *in_size = 1;
+        return true;
+    }
+
+    if (s.leaf_n > SIZE_MAX / sizeof(u64))
+    {
+        return false;
+    }
+
+    u8 *nodes = malloc(s.node_n);
+    u64 *leaves = malloc(s.leaf_n * sizeof(u64));
+
+    bool ok = nodes && leaves;
+
+    if (ok)
+    {
+        QTC_STATS_TIMER(t);
+        u64 qtc_i = qtcb_parse(&s, data, nodes, leaves);
+        QTC_STATS_PHASE(QTC_PHASE_PARSE, t);
+
+        u64 mc = 0;
+
+        for (u32 by = 0; by < s.rows; by++)
+        {
+            for (u32 bx = 0; bx < s.cols; bx++)
+            {
+                if (leaves[mc])
+                {
+                    block_write(&s, out, row_size, bx, by, leaves[mc]);
+                }
+
+                morton64_inc_x(&mc);
+            }
+
+            morton64_inc_y(&mc);
+            morton64_rst_x(&mc);
+        }
+        QTC_STATS_PHASE(QTC_PHASE_RASTER, t);
+
+        *in_size = (qtc_i + 1) / 2;
+    }
+
+    free(nodes);
+    free(leaves);
+
+    return ok;
+}
@@ -0,0 +1,88 @@
+#ifndef __QTCB_H__
+#define __QTCB_H__
+
+#include "types.h"
+
+/**
+ * Leaf block sizes of qtcb, as log2 of the block side
+ */
+#define QTCB_LEAF_4X4 2
+#define QTCB_LEAF_8X8 3
+
+/**
+ * Largest number of blocks in the codebook of a qtcb stream
+ */
+#define QTCB_CODEBOOK_MAX 15
+
+/**
+ * Compress a 1-bit raster image into a quad tree whose leaves are 4x4 or 8x8
+ * pixel blocks instead of 2x2 nibbles. The tree is 2 or 3 levels shorter
+ * than that of qtcf, so it has 16 or 64 times fewer leaves, and the blocks
+ * are read from and written to the raster as whole row bytes. Leaves are
+ * coded raw or as an index into a codebook of the most frequent blocks.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param leaf_log2 QTCB_LEAF_4X4 or QTCB_LEAF_8X8
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtcb_encode(const u8 *data, u32 w, u32 h, u8 leaf_log2, u64 *out_size);
+
+/**
+ * Get the largest size qtcb_encode can produce for an image of the specified
+ * size.
+ *
+ * @param w image width
+ * @param h image height
+ * @param leaf_log2 QTCB_LEAF_4X4 or QTCB_LEAF_8X8
+ *
+ * @return worst-case size, in bytes, of compressed data. 0 if the size is invalid
+ */
+u64 qtcb_max_compressed_size(u32 w, u32 h, u8 leaf_log2);
+
+/**
+ * Compress a 1-bit raster image into a block-leaf quad tree in a
+ * caller-provided buffer.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param leaf_log2 QTCB_LEAF_4X4 or QTCB_LEAF_8X8
+ * @param out output buffer, qtcb_max_compressed_size bytes always suffice
+ * @param out_cap size, in bytes, of the output buffer
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtcb_encode_into(const u8 *data, u32 w, u32 h, u8 leaf_log2, u8 *out, u64 out_cap, u64 *out_size);
+
+/**
+ * Decompress a block-leaf quad tree into a 1-bit raster image. The leaf size
+ * is read from the stream.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return pointer to decompressed, 1-bit raster image. NULL if unsuccessful
+ */
+u8 *qtcb_decode(const u8 *data, u32 w, u32 h, u64 *in_size);
+
+/**
+ * Decompress a block-leaf quad tree into a caller-provided 1-bit raster.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param out output raster of (w + 7) / 8 * h bytes
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return true if successful, false if out of memory or the size is invalid
+ */
+bool qtcb_decode_into(const u8 *data, u32 w, u32 h, u8 *out, u64 *in_size);
+
+#endif // __QTCB_H__
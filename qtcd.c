@@ -0,0 +1,293 @@
+#include "qtcd.h"
+#include "qtcf.h"
+#include "qtsp.h"
+#include "qtir.h"
+#include "mort.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct qtcd_enc
+{
+    u32 w;
+    u32 h;
+    u32 key_interval;
+    // frames coded since the last keyframe, 0 if the next is a keyframe
+    u32 pos;
+    // previous frame, as the decoder has it up to the end of the last leaf
+    // of a row
+    u8 *prev;
+};
+
+struct qtcd_dec
+{
+    u32 w;
+    u32 h;
+    bool has_frame;
+    u8 *frame;
+};
+
+/**
+ * Check that a frame size can be coded from sparse trees
+ */
+static bool frame_size_valid(u32 w, u32 h)
+{
+    return qt_size_ok(w, h) && ((size_t)w + 7) / 8 <= SIZE_MAX / h;
+}
+
+/**
+ * Xor a square of a uniform pattern into a raster
+ *
+ * @param raster raster of row_size * h bytes
+ * @param row_size size, in bytes, of a raster row
+ * @param h image height
+ * @param x x of the first pixel of the square
+ * @param y y of the first pixel of the square
+ * @param k log2 of the square side, at least 1
+ * @param u leaf nibble of the pattern, by pixel parity
+ */
+static void block_xor(u8 *raster, size_t row_size, u32 h, u64 x, u64 y, u8 k, u8 u)
+{
+    u64 side = (u64)1 << k;
+    size_t col = x / 8;
+
+    if (col >= row_size)
+    {
+        return;
+    }
+
+    // the pattern repeats every two pixels, squares of less than a byte are
+    // masked within theirs
+    u8 pat[2] = {(u & 0x3) * 0x55, (u >> 2) * 0x55};
+    u8 mask = side < 8 ? ((1U << side) - 1) << (x % 8) : 0xFF;
+    size_t n = MIN(MAX(side / 8, 1), row_size - col);
+
+    for (u64 r = 0; r < side && y + r < h; r++)
+    {
+        u8 *p = raster + (y + r) * row_size + col;
+        u8 v = pat[r & 1] & mask;
+
+        for (size_t c = 0; c < n; c++)
+        {
+            p[c] ^= v;
+        }
+    }
+}
+
+/**
+ * Xor the leaves and uniform subtrees of a sparse tree into a raster
+ */
+static void tree_xor(const qtsp_tree *t, u8 *raster, u32 w, u32 h)
+{
+    size_t row_size = ((size_t)w + 7) / 8;
+
+    for (u8 l = 0; l < t->lvls; l++)
+    {
+        const qtsp_list *v = &t->lvl[l];
+        u8 k = t->lvls - l;
+
+        for (u64 j = 0; j < v->n; j++)
+        {
+            const qtsp_node *nd = v->nodes + j;
+            u8 u;
+
+            if (l + 1 == t->lvls)
+            {
+                u = nd->val;
+            }
+            else if (nd->flags & QTSP_NODE_UNIFORM)
+            {
+                u = qtsp_leaf(nd);
+            }
+            else
+            {
+                continue;
+            }
+
+            u32 nx, ny;
+            morton64_decode(nd->i, &nx, &ny);
+
+            block_xor(raster, row_size, h, (u64)nx << k, (u64)ny << k, k, u);
+        }
+    }
+}
+
+qtcd_enc *qtcd_enc_create(u32 w, u32 h, u32 key_interval)
+{
+    if (!frame_size_valid(w, h))
+    {
+        return NULL;
+    }
+
+    qtcd_enc *enc = malloc(sizeof(qtcd_enc));
+    if (!enc)
+    {
+        return NULL;
+    }
+
+    enc->w = w;
+    enc->h = h;
+    enc->key_interval = key_interval;
+    enc->pos = 0;
+    enc->prev = malloc(((size_t)w + 7) / 8 * h);
+
+    if (!enc->prev)
+    {
+        free(enc);
+        return NULL;
+    }
+
+    return enc;
+}
+
+void qtcd_enc_free(qtcd_enc *enc)
+{
+    if (!enc)
+    {
+        return;
+    }
+
+    free(enc->prev);
+    free(enc);
+}
+
+u8 *qtcd_encode(qtcd_enc *enc, const u8 *data, u64 *out_size)
+{
+    bool key = enc->pos == 0;
+    u8 *stream = NULL;
+    u64 stream_size;
+
+    if (key)
+    {
+        stream = qtcf_encode64(data, enc->w, enc->h, &stream_size);
+
+        if (stream)
+        {
+            memcpy(enc->prev, data, ((size_t)enc->w + 7) / 8 * enc->h);
+        }
+    }
+    else
+    {
+        qtsp_tree t;
+        qtsp_init(&t, calc_lvls(enc->w, enc->h));
+
+        // the previous frame is brought up to date from the difference
+        // before writing it, which changes its node states
+        if (qtsp_from_delta(&t, data, enc->prev, enc->w, enc->h))
+        {
+            tree_xor(&t, enc->prev, enc->w, enc->h);
+            stream = qtsp_encode(&t, enc->w, enc->h, &stream_size);
+        }
+
+        qtsp_free(&t);
+    }
+
+    u8 *out = stream ? realloc(stream, stream_size + 1) : NULL;
+
+    if (!out)
+    {
+        free(stream);
+        enc->pos = 0;
+        return NULL;
+    }
+
+    memmove(out + 1, out, stream_size);
+    out[0] = key ? QTCD_FRAME_KEY : QTCD_FRAME_DELTA;
+    *out_size = stream_size + 1;
+
+    enc->pos++;
+
+    if (enc->pos == enc->key_interval)
+    {
+        enc->pos = 0;
+    }
+
+    return out;
+}
+
+qtcd_dec *qtcd_dec_create(u32 w, u32 h)
+{
+    if (!frame_size_valid(w, h))
+    {
+        return NULL;
+    }
+
+    qtcd_dec *dec = malloc(sizeof(qtcd_dec));
+    if (!dec)
+    {
+        return NULL;
+    }
+
+    dec->w = w;
+    dec->h = h;
+    dec->has_frame = false;
+    dec->frame = malloc(((size_t)w + 7) / 8 * h);
+
+    if (!dec->frame)
+    {
+        free(dec);
+        return NULL;
+    }
+
+    return dec;
+}
+
+void qtcd_dec_free(qtcd_dec *dec)
+{
+    if (!dec)
+    {
+        return;
+    }
+
+    free(dec->frame);
+    free(dec);
+}
+
+const u8 *qtcd_decode(qtcd_dec *dec, const u8 *data, u64 *in_size)
+{
+    u64 size;
+
+    if (data[0] == QTCD_FRAME_KEY)
+    {
+        dec->has_frame = qtcf_decode64_into(data + 1, dec->w, dec->h, dec->frame, &size);
+    }
+    else if (data[0] == QTCD_FRAME_DELTA && dec->has_frame)
+    {
+        qtsp_tree t;
+        bool inverted;
+
+        qtsp_init(&t, calc_lvls(dec->w, dec->h));
+
+        // the frame is left as it was if the stream is invalid
+        if (qtsp_from_qtcf(&t, data + 1, &inverted, &size))
+        {
+            tree_xor(&t, dec->frame, dec->w, dec->h);
+
+            // an inverted stream codes the complement of the difference
+            if (inverted)
+            {
+                arr_invert(dec->frame, ((size_t)dec->w + 7) / 8 * dec->h);
+            }
+        }
+        else
+        {
+            dec->has_frame = false;
+        }
+
+        qtsp_free(&t);
+    }
+    else
+    {
+        return NULL;
+    }
+
+    if (!dec->has_frame)
+    {
+        return NULL;
+    }
+
+    *in_size = size + 1;
+
+    return dec->frame;
+}
@@ -0,0 +1,96 @@
+#ifndef __QTCD_H__
+#define __QTCD_H__
+
+#include "types.h"
+
+/**
+ * Sequence codec for 1-bit raster frames of one size that change locally
+ * from frame to frame. A keyframe is the qtcf stream of its frame. Any other
+ * frame is the qtcf stream of its difference with the previous frame, whose
+ * unchanged subtrees are empty and so take no node at all, and only the
+ * changed subtrees are coded. The difference is built from the blocks of
+ * the two rasters that differ and is applied to the previous frame in place,
+ * so, past comparing the rasters, coding a frame takes time and space in
+ * proportion to the area that changed.
+ *
+ * Each coded frame is a byte of its QTCD_FRAME_ type followed by its stream.
+ */
+enum
+{
+    QTCD_FRAME_KEY,
+    QTCD_FRAME_DELTA,
+};
+
+/**
+ * Encoder state: the previous frame and the position in the keyframe
+ * interval
+ */
+typedef struct qtcd_enc qtcd_enc;
+
+/**
+ * Decoder state: the frame decoded last
+ */
+typedef struct qtcd_dec qtcd_dec;
+
+/**
+ * Create a sequence encoder for frames of the specified size.
+ *
+ * @param w frame width
+ * @param h frame height
+ * @param key_interval number of frames from one keyframe to the next, 1 for
+ * only keyframes and 0 for a keyframe first only
+ *
+ * @return pointer to encoder. NULL if unsuccessful
+ */
+qtcd_enc *qtcd_enc_create(u32 w, u32 h, u32 key_interval);
+
+/**
+ * Free a sequence encoder.
+ *
+ * @param enc pointer to encoder, may be NULL
+ */
+void qtcd_enc_free(qtcd_enc *enc);
+
+/**
+ * Compress the next frame of a sequence.
+ *
+ * @param enc encoder
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param out_size size, in bytes, of the coded frame
+ *
+ * @return pointer to the coded frame. NULL if unsuccessful, in which case the
+ * next frame is a keyframe
+ */
+u8 *qtcd_encode(qtcd_enc *enc, const u8 *data, u64 *out_size);
+
+/**
+ * Create a sequence decoder for frames of the specified size.
+ *
+ * @param w frame width
+ * @param h frame height
+ *
+ * @return pointer to decoder. NULL if unsuccessful
+ */
+qtcd_dec *qtcd_dec_create(u32 w, u32 h);
+
+/**
+ * Free a sequence decoder.
+ *
+ * @param dec pointer to decoder, may be NULL
+ */
+void qtcd_dec_free(qtcd_dec *dec);
+
+/**
+ * Decompress the next frame of a sequence. A delta frame needs the frame
+ * before it to have been decoded.
+ *
+ * @param dec decoder
+ * @param data pointer to the coded frame
+ * @param in_size the number of bytes processed in the coded frame
+ *
+ * @return pointer to the decoded 1-bit raster image, owned by the decoder and
+ * valid until the next call. NULL if unsuccessful
+ */
+const u8 *qtcd_decode(qtcd_dec *dec, const u8 *data, u64 *in_size);
+
+#endif // __QTCD_H__
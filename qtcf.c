@@ -1,67 +1,53 @@
 #include "mort.h"
 #include "utils.h"
 #include "qtcf.h"
+#include "qtcf_internal.h"
+#include "qtir.h"
+#include "qtc_stats.h"
 #include <string.h>
 
 #include <stdio.h>
 
-enum
-{
-    QUAD_NW = 0,
-    QUAD_NE,
-    QUAD_SW,
-    QUAD_SE,
-    QUAD_Cnt
-};
-
-enum
-{
-    QTC_HEADER_FLAG_INVERTED,
-    QTC_HEADER_FLAG_ALL_BLACK,
-};
-
 /**
- * Quad tree intermediate representation type
+ * Size, in bytes, of the largest qtcf stream of a tree with n nodes: the
+ * header nibble and at most one nibble per node
  */
-typedef struct
-{
-    u8 fill_height;
-    u8 val;
-    u32 sub_size;
-} qtir_node;
+#define QTCF_BOUND(n) (((n) + 2) / 2)
 
 /**
- * Calculate the number of nodes in a perfect quad tree
- *
- * @param lvls number of levels in quad tree
- * @return number of nodes
+ * Back-reference of a DAG stream: the offsets, within their level, of the
+ * subtree copied to and the earlier one copied from
  */
-static u32 calc_node_cnt(u8 lvls)
+typedef struct
 {
-    // # nodes = (4^lvls - 1) / 3
-    return 0x55555555 >> (32 - 2 * lvls);
-}
+    u64 dst;
+    u64 src;
+    u8 lvl;
+} qtcf_ref;
 
 /**
- * Calculate the height of quad tree needed to represent
- * an image of the specified size
- *
- * @param w width of image
- * @param h height of image
- *
- * @return number of levels needed for the quad tree
+ * Growable list of back-references in stream order
  */
-static u8 calc_lvls(u16 w, u32 h)
+typedef struct
 {
-    u8 lvls = 0;
-    while ((u32)(1 << lvls) < w)
-        lvls++;
-
-    while ((u32)(1 << lvls) < h)
-        lvls++;
+    qtcf_ref *refs;
+    u64 n;
+    u64 cap;
+    bool oom;
+} qtcf_refs;
 
-    return lvls;
-}
+struct qtcf_ctx
+{
+    u32 w;
+    u32 h;
+    u64 qt_n;
+    void *enc_arena;
+    u8 *dec_arena;
+    // encode with back-references, see qtcf_encode_dag
+    bool dag;
+    u64 *dag_arena;
+    qtcf_refs refs;
+};
 
 /**
  * Fill a subtree of an intermediate representation tree with ones (0xF) for
@@ -71,7 +57,7 @@ static u8 calc_lvls(u16 w, u32 h)
  * @param qt_i index of root node of subtree to fill
  * @param lvls number of levels to fill down from the subtree root
  */
-static void qtir_fill_ones(qtir_node *qtir, u32 qt_i, u8 lvls)
+static void qtir_fill_ones(qtir_node *qtir, u64 qt_i, u8 lvls)
 {
     if (!lvls)
     {
@@ -87,177 +73,352 @@ static void qtir_fill_ones(qtir_node *qtir, u32 qt_i, u8 lvls)
     qtir[qt_i].val = 0xF;
 }
 
-/**
- * Fill a subtree of a compact quad tree with a value at the specified level
- *
- * @param qt pointer to compacted qt array
- * @param qt_i index of root node of subtree to fill
- * @param lvls number of levels down from the subtree root where the
- * value is filled
- * @param val value to fill with
- */
-static void qt_fill_val(u8 *qt, u32 qt_i, u8 lvls, u8 val)
+void qt_fill_val(u8 *qt, u64 qt_i, u8 lvls, u8 val)
 {
-    u32 lvl_len = 1;
+    u64 lvl_len = 1;
 
     while (lvls)
     {
-        for (u32 j = 0; j < lvl_len; j++)
-        {
-            na_write(qt, qt_i + j, 0xF);
-        }
+        na_fill(qt, qt_i, lvl_len, 0xF);
 
         lvls--;
         qt_i = 4 * qt_i + 1;
         lvl_len *= 4;
     }
 
-    for (u32 j = 0; j < lvl_len; j++)
+    na_fill(qt, qt_i, lvl_len, val);
+}
+
+/**
+ * Height, in levels, of the blocks classified by the uniform pre-scan of
+ * qtir_build. The blocks are 32x32 pixels, small enough that the fill height
+ * of a full block root does not wrap
+ */
+#define QTCF_BLOCK_LVLS 5
+
+/**
+ * Fill height and subtree size that qtir_get_fills and qtir_get_sizes give the
+ * root of a full block
+ */
+#define QTCF_BLOCK_FULL_FILL (QTCF_BLOCK_LVLS - 1)
+#define QTCF_BLOCK_FULL_SIZE 2
+
+enum
+{
+    QTCF_BLOCK_MIXED,
+    QTCF_BLOCK_EMPTY,
+    QTCF_BLOCK_FULL,
+};
+
+const qtcf_blocks qtcf_no_blocks = {NULL, 0};
+
+/**
+ * Number of levels of a perfect quad tree of qt_n nodes
+ */
+static u8 qt_lvls(u64 qt_n)
+{
+    u8 lvls = 0;
+
+    for (u64 n = 1; n <= qt_n; n = 4 * n + 1)
     {
-        na_write(qt, qt_i + j, val);
+        lvls++;
     }
+
+    return lvls;
+}
+
+/**
+ * Index of the first node of a level
+ */
+static inline u64 lvl_start(u8 lvl)
+{
+    return ((u64)1 << (2 * lvl)) / 3;
 }
 
-static void qtir_consolidate(qtir_node *qt, u32 qt_n)
+/**
+ * Advance to the next run of level nodes outside uniform blocks. Levels above
+ * the blocks are a single run
+ *
+ * @param b uniform blocks
+ * @param lvl tree level
+ * @param j offset, within the level, of the next node to visit. Moved to the
+ * start of the run
+ * @param end offset past the end of the run
+ *
+ * @return false once the level is done
+ */
+static inline bool blocks_next(const qtcf_blocks *b, u8 lvl, u64 *j, u64 *end)
 {
-    u32 qt_p, qt_c;
+    u64 len = (u64)1 << (2 * lvl);
 
-    qt_c = qt_n - 1;
-    qt_p = qt_c / 4 - 1;
+    if (!b->map || lvl < b->lvl)
+    {
+        *end = len;
+        return *j < len;
+    }
 
-    while (qt_c > 0)
+    u8 shift = 2 * (lvl - b->lvl);
+
+    while (*j < len && b->map[*j >> shift] != QTCF_BLOCK_MIXED)
     {
-        u8 v = 0;
+        *j += (u64)1 << shift;
+    }
 
-        qtir_node *c = qt + qt_c - 3;
-        for (u8 q = 0; q < QUAD_Cnt; q++)
+    *end = *j + ((u64)1 << shift);
+
+    return *j < len;
+}
+
+/**
+ * Classify the 32x32 blocks lying wholly inside the image as empty, full or
+ * mixed, comparing a 32-bit word per block row
+ *
+ * @param b uniform blocks to fill in
+ * @param data pointer to raster image data in row-major order
+ * @param w image width
+ * @param h image height
+ * @param inv word xor-ed into every raster word read
+ */
+static void blocks_scan(const qtcf_blocks *b, const u8 *data, u32 w, u32 h, u32 inv)
+{
+    size_t rast_row_size = ((size_t)w + 7) / 8;
+    u32 side = 1U << QTCF_BLOCK_LVLS;
+
+    memset(b->map, QTCF_BLOCK_MIXED, (size_t)1 << (2 * b->lvl));
+
+    for (u32 by = 0; by < h / side; by++)
+    {
+        for (u32 bx = 0; bx < w / side; bx++)
         {
-            if (c->val != 0)
+            const u8 *rast = data + (size_t)by * side * rast_row_size + (size_t)bx * side / 8;
+            u32 all = UINT32_MAX;
+            u32 any = 0;
+
+            for (u32 r = 0; r < side && (all == UINT32_MAX || any == 0); r++)
+            {
+                u32 row = row_load_64(rast, side / 8) ^ inv;
+                all &= row;
+                any |= row;
+                rast += rast_row_size;
+            }
+
+            u8 state = QTCF_BLOCK_MIXED;
+            if (any == 0)
+            {
+                state = QTCF_BLOCK_EMPTY;
+            }
+            else if (all == UINT32_MAX)
             {
-                v |= 1 << q;
+                state = QTCF_BLOCK_FULL;
             }
-            c++;
+
+            b->map[morton64_encode(bx, by)] = state;
         }
-        qt[qt_p].val = v;
-        qt_p--;
-        qt_c -= 4;
     }
 }
 
-static qtir_node *qtir_from_raster(const u8 *data, u16 w, u16 h, u32 *qt_n)
+/**
+ * Write the nodes of the full blocks that are read after the bottom-up
+ * passes: the root in its final state and the leaves
+ */
+static void blocks_fill(const qtcf_blocks *b, qtir_node *qtir, u8 lvls)
 {
-    u8 qt_lvls = calc_lvls(w, h);
+    u64 blocks_n = (u64)1 << (2 * b->lvl);
+    u64 leaves_n = (u64)1 << (2 * (QTCF_BLOCK_LVLS - 1));
 
-    if (qt_lvls == 0)
+    qtir_node *roots = qtir + lvl_start(b->lvl);
+    qtir_node *leaves = qtir + lvl_start(lvls - 1);
+
+    for (u64 j = 0; j < blocks_n; j++)
     {
-        return NULL;
+        if (b->map[j] != QTCF_BLOCK_FULL)
+        {
+            continue;
+        }
+
+        roots[j].val = 0xF;
+        roots[j].fill_height = QTCF_BLOCK_FULL_FILL;
+        roots[j].sub_size = QTCF_BLOCK_FULL_SIZE;
+
+        for (qtir_node *leaf = leaves + j * leaves_n; leaf < leaves + (j + 1) * leaves_n; leaf++)
+        {
+            leaf->val = 0xF;
+            leaf->sub_size = 1;
+        }
     }
+}
 
-    *qt_n = calc_node_cnt(qt_lvls);
-    u32 qt_size = (*qt_n) * sizeof(qtir_node);
+static void qtir_consolidate(qtir_node *qt, u64 qt_n, const qtcf_blocks *b)
+{
+    u8 lvls = qt_lvls(qt_n);
 
-    qtir_node *qtir = (qtir_node *)malloc(qt_size);
-    if (qtir == NULL)
+    for (u8 l = lvls - 1; l-- > 0;)
     {
-        return NULL;
+        qtir_node *lvl = qt + lvl_start(l);
+        u64 j = 0, end;
+
+        while (blocks_next(b, l, &j, &end))
+        {
+            for (; j < end; j++)
+            {
+                qtir_node *c = qt + 4 * (lvl + j - qt) + 1;
+                u8 v = 0;
+
+                for (u8 q = 0; q < QUAD_Cnt; q++)
+                {
+                    if (c[q].val != 0)
+                    {
+                        v |= 1 << q;
+                    }
+                }
+
+                lvl[j].val = v;
+            }
+        }
     }
+}
 
-    u16 rast_row_size = (w + 7) / 8;
+void qtir_build(qtir_node *qtir, u64 qt_n, const u8 *data, u32 w, u32 h, u8 inv, const qtcf_blocks *b)
+{
+    size_t rast_row_size = ((size_t)w + 7) / 8;
     const u8 *rast_row_hi = data;
     const u8 *rast_row_lo = rast_row_hi + rast_row_size;
-    u16 rast_row_inc = 2 * rast_row_size;
+    size_t rast_row_inc = 2 * rast_row_size;
+
+    u64 inv_word = inv ? UINT64_MAX : 0;
+    u32 leaf_w = w / 2 + (w & 1);
 
-    qtir_node *qt_leaves = qtir + *qt_n / 4;
+    qtir_node *qt_leaves = qtir + qt_n / 4;
 
-    memset(qtir, 0, qt_size);
+    memset(qtir, 0, qt_n * sizeof(qtir_node));
+
+    if (b->map)
+    {
+        blocks_scan(b, data, w, h, inv_word);
+        blocks_fill(b, qtir, qt_lvls(qt_n));
+    }
 
-    u32 mc = 0;
+    u64 mc = 0;
 
-    for (u16 y = 0; y < h - 1; y += 2)
+    for (u32 y = 0; y < h; y += 2)
     {
-        for (u16 x = 0; x < w; x += 2)
+        // the last row of an odd height pairs with a row of zeros
+        bool has_lo = y + 1 < h;
+
+        for (u32 x = 0; x < w; x += 64)
         {
-            u8 nwne = (rast_row_hi[x / 8] >> (x % 8)) & 0x3;
-            u8 swse = (rast_row_lo[x / 8] >> (x % 8)) & 0x3;
+            size_t col = x / 8;
+            u64 hi = row_load_64(rast_row_hi + col, rast_row_size - col) ^ inv_word;
+            u64 lo = has_lo ? row_load_64(rast_row_lo + col, rast_row_size - col) ^ inv_word : 0;
 
-            u8 nib = nwne | (swse << 2);
+            u64 leaves[2];
+            leaf_pack_64(hi, lo, leaves);
 
-            if (nib != 0)
+            u32 k_end = MIN(32, leaf_w - x / 2);
+
+            for (u32 k = 0; k < k_end; k += 2)
             {
-                qt_leaves[mc].sub_size = 1;
-            }
+                // each half word is the row of one block, skipped if uniform
+                if (k % 16 == 0)
+                {
+                    mc = morton64_encode(x / 2 + k, y / 2);
+
+                    if (b->map && b->map[mc >> (2 * (QTCF_BLOCK_LVLS - 1))] != QTCF_BLOCK_MIXED)
+                    {
+                        k += 14;
+                        continue;
+                    }
+                }
 
-            qt_leaves[mc].val = nib;
+                u8 pair = leaves[k / 16] >> (4 * (k % 16));
+                qtir_node *leaf = qt_leaves + mc;
 
-            morton_inc_x(&mc);
-        }
+                leaf[0].val = pair & 0xF;
+                leaf[0].sub_size = leaf[0].val != 0;
 
-        morton_inc_y(&mc);
-        morton_rst_x(&mc);
+                if (k + 1 < k_end)
+                {
+                    leaf[1].val = pair >> 4;
+                    leaf[1].sub_size = leaf[1].val != 0;
+                }
+
+                morton64_inc_x2(&mc);
+            }
+        }
 
         rast_row_hi += rast_row_inc;
         rast_row_lo += rast_row_inc;
     }
 
-    if (h & 1)
+    qtir_consolidate(qtir, qt_n, b);
+}
+
+qtir_node *qtir_from_raster(const u8 *data, u16 w, u16 h, u32 *qt_n)
+{
+    u8 qt_lvls = calc_lvls(w, h);
+
+    if (qt_lvls == 0)
     {
-        for (u16 x = 0; x < w; x += 2)
-        {
-            u8 nwne = (rast_row_hi[x / 8] >> (x % 8)) & 0x3;
+        return NULL;
+    }
 
-            if (nwne != 0)
-            {
-                qt_leaves[mc].sub_size = 1;
-            }
+    *qt_n = calc_node_cnt(qt_lvls);
 
-            qt_leaves[mc].val = nwne;
-            morton_inc_x(&mc);
-        }
+    qtir_node *qtir = (qtir_node *)malloc((*qt_n) * sizeof(qtir_node));
+    if (qtir == NULL)
+    {
+        return NULL;
     }
 
-    qtir_consolidate(qtir, *qt_n);
+    qtir_build(qtir, *qt_n, data, w, h, 0x00, &qtcf_no_blocks);
 
     return qtir;
 }
 
-static void qtir_get_fills(qtir_node *qtir, u32 qt_n)
+void qtir_get_fills(qtir_node *qtir, u64 qt_n, const qtcf_blocks *b)
 {
     qtir_node *qtir_p, *qtir_c;
 
-    qtir_c = qtir + qt_n - 1;
-    qtir_p = qtir + (qt_n - 1) / 4 - 1;
+    u8 lvls = qt_lvls(qt_n);
 
-    while (qtir_c > qtir)
+    for (u8 l = lvls - 1; l-- > 0;)
     {
-        u8 v = qtir_c->val;
-        u8 h = qtir_c->fill_height;
-        qtir_c--;
-
-        bool extend_fill = qtir_p->val == 0xF;
+        qtir_node *lvl = qtir + lvl_start(l);
+        u64 j = 0, end;
 
-        for (u8 q = 1; q < QUAD_Cnt; q++)
+        while (blocks_next(b, l, &j, &end))
         {
-            if (extend_fill && (qtir_c->val != v || qtir_c->fill_height != h))
+            for (; j < end; j++)
             {
-                extend_fill = false;
-            }
+                qtir_p = lvl + j;
+                qtir_c = qtir + 4 * (qtir_p - qtir) + 1;
 
-            qtir_c--;
-        }
+                u8 v = qtir_c[3].val;
+                u8 h = qtir_c[3].fill_height;
 
-        if (extend_fill)
-        {
-            qtir_p->val = v;
+                bool extend_fill = qtir_p->val == 0xF;
 
-            qtir_p->fill_height = h + 1;
+                for (u8 q = 0; q < QUAD_Cnt - 1 && extend_fill; q++)
+                {
+                    if (qtir_c[q].val != v || qtir_c[q].fill_height != h)
+                    {
+                        extend_fill = false;
+                    }
+                }
 
-            if (qtir_p->fill_height > 8)
-            {
-                qtir_p->fill_height = 0;
+                if (extend_fill)
+                {
+                    qtir_p->val = v;
+
+                    qtir_p->fill_height = h + 1;
+
+                    if (qtir_p->fill_height > 8)
+                    {
+                        qtir_p->fill_height = 0;
+                    }
+                }
             }
         }
-
-        qtir_p--;
     }
 
     qtir_c = qtir + qt_n / 16;
@@ -286,184 +447,380 @@ static void qtir_get_fills(qtir_node *qtir, u32 qt_n)
     }
 }
 
-static void qtir_get_sizes(qtir_node *qtir, u32 qt_n)
+/**
+ * Hash the subtree of a node from the hashes of its children
+ *
+ * @param c hashes of the children, in quadrant order
+ */
+static u64 dag_mix(const u64 *c)
 {
-    qtir_node *qtir_p, *qtir_c, *lvl_start;
+    u64 m = 0;
+
+    for (u8 q = 0; q < QUAD_Cnt; q++)
+    {
+        m = (m ^ c[q]) * 0x9E3779B97F4A7C15ULL;
+        m ^= m >> 29;
+    }
 
-    qtir_c = qtir + qt_n - 1;
-    qtir_p = qtir + (qt_n - 1) / 4 - 1;
-    lvl_start = qtir_p;
+    return m;
+}
 
-    u8 h = 2;
-    u32 lvl_len = qt_n - (qt_n - 1) / 4;
-    lvl_len /= 4;
-    u32 base_len = 4;
+/**
+ * Hash a subtree whose leaves all hold one nibble
+ *
+ * @param u leaf nibble
+ * @param mixes levels between the subtree root and the lowest hashed level
+ */
+static u64 dag_uniform(u8 u, u8 mixes)
+{
+    u64 c[QUAD_Cnt];
+    u64 m = u * 0x1111111111111111ULL;
 
-    while (qtir_c > lvl_start)
+    for (u8 k = 0; k < mixes; k++)
     {
-        if (qtir_p->fill_height != 0 && qtir_p->val == 0xF)
-        {
-            qtir_p->sub_size = 1;
-        }
-        else if (qtir_p->val != 0)
-        {
-            qtir_p->sub_size = 1;
+        c[0] = c[1] = c[2] = c[3] = m;
+        m = dag_mix(c);
+    }
 
-            for (u8 q = 0; q < QUAD_Cnt; q++)
-            {
-                if (qtir_p->val & (1 << q))
-                {
-                    qtir_p->sub_size += 1;
-                }
-            }
-        }
+    return m;
+}
 
-        qtir_c -= 4;
-        qtir_p--;
-    }
+/**
+ * Find the latest node of a level before a node with the same leaves, and
+ * make the node the latest of its hash. Any earlier node that was written,
+ * as nodes or as a reference itself, can be referenced
+ *
+ * @param dag subtree hashes and table
+ * @param qtir pointer to ir tree array
+ * @param qt_n number of nodes in the tree
+ * @param lvls number of levels in the tree
+ * @param lvl level of the node
+ * @param qt_i index of the node
+ *
+ * @return distance back to the earlier node within the level. 0 if there is none
+ */
+static u64 dag_find(qtcf_dag *dag, const qtir_node *qtir, u64 qt_n, u8 lvls, u8 lvl, u64 qt_i)
+{
+    u64 hash = dag->hash[qt_i];
+    u64 first = lvl_start(lvl);
+    u64 s = ((hash + lvl) * 0x9E3779B97F4A7C15ULL >> 20) & dag->table_mask;
 
-    lvl_start = qtir_p;
-    lvl_len /= 4;
-    base_len *= 4;
-    h++;
+    u64 leaves_n = (u64)1 << (2 * (lvls - 1 - lvl));
+    const qtir_node *leaves = qtir + qt_n / 4;
+    const qtir_node *b = leaves + (qt_i - first) * leaves_n;
 
-    while (qtir_c > lvl_start)
+    for (; dag->table[s] != 0; s = (s + 1) & dag->table_mask)
     {
-        if (qtir_p->fill_height > 1)
-        {
-            qtir_p->sub_size = qtir_p->val == 0xF ? 2 : 3;
-            qtir_c -= 4;
-        }
-        else if (qtir_p->fill_height == 1)
-        {
-            for (u8 q = 0; q < QUAD_Cnt; q++)
-            {
-                qtir_p->sub_size += qtir_c->sub_size;
-                qtir_c--;
-            }
+        u64 e = dag->table[s] - 1;
 
-            qtir_p->sub_size -= 4 - (qtir_p->val == 0xF ? 2 : 3);
-        }
-        else if (qtir_p->val != 0)
+        if (e < first || dag->hash[e] != hash)
         {
-            qtir_p->sub_size += 1;
-            for (u8 q = 0; q < QUAD_Cnt; q++)
-            {
-                qtir_p->sub_size += qtir_c->sub_size;
-                qtir_c--;
-            }
+            continue;
         }
-        else
+
+        // hashes of levels above 8x8 nodes may collide
+        const qtir_node *a = leaves + (e - first) * leaves_n;
+        u64 k = 0;
+
+        while (k < leaves_n && a[k].val == b[k].val)
         {
-            qtir_c -= 4;
+            k++;
         }
 
-        if (qtir_p->sub_size > base_len + 2)
+        if (k == leaves_n)
         {
-            qtir_p->val = 0xF;
-            qtir_fill_ones(qtir, qtir_p - qtir, h - 1);
-            qtir_p->sub_size = base_len + 2;
+            dag->table[s] = qt_i + 1;
+            return qt_i - e;
         }
+    }
+
+    dag->table[s] = qt_i + 1;
+
+    return 0;
+}
 
-        qtir_p--;
+void qtir_get_sizes(qtir_node *qtir, u64 qt_n, const qtcf_blocks *b, qtcf_dag *dag)
+{
+    u8 lvls = qt_lvls(qt_n);
+
+    if (lvls < 2)
+    {
+        return;
     }
 
-    lvl_len /= 4;
-    base_len *= 4;
-    h++;
+    qtir_node *qtir_p, *qtir_c;
+    u64 j, end;
 
-    u32 lvl_i = 0;
+    // parents of the leaves
+    qtir_node *lvl = qtir + lvl_start(lvls - 2);
 
-    while (qtir_c > qtir)
+    for (j = 0; blocks_next(b, lvls - 2, &j, &end);)
     {
-        if (qtir_p->fill_height > 0)
+        for (; j < end; j++)
         {
-            for (u8 q = 0; q < QUAD_Cnt; q++)
-            {
-                qtir_p->sub_size += qtir_c->sub_size;
-                qtir_c--;
-            }
+            qtir_p = lvl + j;
 
-            if (qtir_p->fill_height == 1)
+            if (qtir_p->fill_height != 0 && qtir_p->val == 0xF)
             {
-                qtir_p->sub_size -= 4 - (qtir_p->val == 0xF ? 2 : 3);
+                qtir_p->sub_size = 1;
             }
-            else
+            else if (qtir_p->val != 0)
             {
-                qtir_p->sub_size -= 3 * (qtir_p->val == 0xF ? 2 : 3);
-            }
-        }
-        else if (qtir_p->val != 0)
-        {
-            qtir_p->sub_size += 1;
+                qtir_p->sub_size = 1;
 
-            for (u8 q = 0; q < QUAD_Cnt; q++)
-            {
-                if (qtir_p->val & (1 << (3 - q)))
+                for (u8 q = 0; q < QUAD_Cnt; q++)
                 {
-                    qtir_p->sub_size += qtir_c->sub_size;
+                    if (qtir_p->val & (1 << q))
+                    {
+                        qtir_p->sub_size += 1;
+                    }
                 }
-
-                qtir_c--;
             }
         }
-        else
-        {
-            qtir_c -= 4;
-        }
+    }
 
-        if (qtir_p->sub_size > base_len + 2)
-        {
-            qtir_p->val = 0xF;
-            qtir_fill_ones(qtir, qtir_p - qtir, h - 1);
-            qtir_p->sub_size = base_len + 2;
-        }
+    if (lvls < 3)
+    {
+        return;
+    }
+
+    u8 h = 3;
+    u64 base_len = 16;
 
-        qtir_p--;
-        lvl_i++;
+    // the roots of uniform blocks are skipped below, and hashed as their
+    // uniform leaves
+    if (dag && b->map)
+    {
+        u64 *roots = dag->hash + lvl_start(b->lvl);
 
-        if (lvl_i >= lvl_len)
+        for (j = 0; j < (u64)1 << (2 * b->lvl); j++)
         {
-            lvl_i = 0;
-            lvl_len /= 4;
-            base_len *= 4;
-            h++;
+            if (b->map[j] != QTCF_BLOCK_MIXED)
+            {
+                roots[j] = dag_uniform(b->map[j] == QTCF_BLOCK_FULL ? 0xF : 0, lvls - 3 - b->lvl);
+            }
         }
     }
-}
 
-static u8 *qtir_to_qtcf(qtir_node *qtir, u32 qt_n, bool inverted, u32 *out_size)
-{
-    qtir_get_fills(qtir, qt_n);
-    qtir_get_sizes(qtir, qt_n);
+    lvl = qtir + lvl_start(lvls - 3);
 
-    u32 qt_size = (qt_n + 2) / 2;
-    u8 *qtcf = malloc(qt_size);
-    memset(qtcf, 0, qt_size);
+    for (j = 0; blocks_next(b, lvls - 3, &j, &end);)
+    {
+        for (; j < end; j++)
+        {
+            qtir_p = lvl + j;
+            qtir_c = qtir + 4 * (qtir_p - qtir) + 1;
 
-    u8 *skip_nodes = malloc(qt_size);
-    memset(skip_nodes, 0, qt_size);
+            if (qtir_p->fill_height > 1)
+            {
+                qtir_p->sub_size = qtir_p->val == 0xF ? 2 : 3;
+            }
+            else if (qtir_p->fill_height == 1)
+            {
+                for (u8 q = 0; q < QUAD_Cnt; q++)
+                {
+                    qtir_p->sub_size += qtir_c[q].sub_size;
+                }
 
-    u32 qtc_i = 0;
+                qtir_p->sub_size -= 4 - (qtir_p->val == 0xF ? 2 : 3);
+            }
+            else if (qtir_p->val != 0)
+            {
+                qtir_p->sub_size += 1;
 
-    u8 header = 0;
+                for (u8 q = 0; q < QUAD_Cnt; q++)
+                {
+                    qtir_p->sub_size += qtir_c[q].sub_size;
+                }
+            }
 
-    header |= inverted << QTC_HEADER_FLAG_INVERTED;
-    header |= (qtir[0].val == 0) << QTC_HEADER_FLAG_ALL_BLACK;
+            if (qtir_p->sub_size > base_len + 2)
+            {
+                qtir_p->val = 0xF;
+                qtir_fill_ones(qtir, qtir_p - qtir, h - 1);
+                qtir_p->sub_size = base_len + 2;
+            }
 
-    na_write(qtcf, qtc_i++, header);
+            // the 16 leaves of an 8x8 node are their own hash
+            if (dag)
+            {
+                const qtir_node *leaf = qtir + 16 * (qtir_p - qtir) + 5;
+                u64 hash = 0;
 
-    u32 qtir_i = 0;
+                for (u8 k = 0; k < 16; k++)
+                {
+                    hash |= (u64)leaf[k].val << (4 * k);
+                }
 
-    u32 lvl_1_start = qt_n / 4;
-    u32 lvl_2_start = lvl_1_start / 4;
+                dag->hash[qtir_p - qtir] = hash;
+            }
+        }
+    }
+
+    // sizes near the root of trees over 16 levels exceed 32 bits, so they are
+    // summed in 64 bits and saturated when stored
+    for (u8 l = lvls - 3; l-- > 0;)
+    {
+        h++;
+        base_len *= 4;
+
+        lvl = qtir + lvl_start(l);
+
+        for (j = 0; blocks_next(b, l, &j, &end);)
+        {
+            for (; j < end; j++)
+            {
+                qtir_p = lvl + j;
+                qtir_c = qtir + 4 * (qtir_p - qtir) + 1;
+
+                u64 sub_size = qtir_p->sub_size;
+
+                if (qtir_p->fill_height > 0)
+                {
+                    for (u8 q = 0; q < QUAD_Cnt; q++)
+                    {
+                        sub_size += qtir_c[q].sub_size;
+                    }
+
+                    if (qtir_p->fill_height == 1)
+                    {
+                        sub_size -= 4 - (qtir_p->val == 0xF ? 2 : 3);
+                    }
+                    else
+                    {
+                        sub_size -= 3 * (qtir_p->val == 0xF ? 2 : 3);
+                    }
+                }
+                else if (qtir_p->val != 0)
+                {
+                    sub_size += 1;
+
+                    for (u8 q = 0; q < QUAD_Cnt; q++)
+                    {
+                        if (qtir_p->val & (1 << q))
+                        {
+                            sub_size += qtir_c[q].sub_size;
+                        }
+                    }
+                }
+
+                if (sub_size > base_len + 2)
+                {
+                    qtir_p->val = 0xF;
+                    qtir_fill_ones(qtir, qtir_p - qtir, h - 1);
+                    sub_size = base_len + 2;
+                }
+
+                qtir_p->sub_size = MIN(sub_size, UINT32_MAX);
+
+                if (dag)
+                {
+                    dag->hash[qtir_p - qtir] = dag_mix(dag->hash + 4 * (qtir_p - qtir) + 1);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Serialize an intermediate representation tree into a qtcf stream
+ *
+ * @param qtir pointer to ir tree array
+ * @param qt_n number of nodes in the tree
+ * @param inverted whether the tree was built from the inverted image
+ * @param skip_nodes scratch nibble array of at least QTCF_BOUND(qt_n) bytes
+ * @param qtcf output buffer of at least QTCF_BOUND(qt_n) bytes
+ * @param b uniform blocks the tree was built with
+ * @param dag subtree hashes and table to write back-references with. NULL
+ * for a plain stream
+ *
+ * @return size, in bytes, of the qtcf stream
+ */
+static u64 qtir_write_qtcf(qtir_node *qtir, u64 qt_n, bool inverted, u8 *skip_nodes, u8 *qtcf, const qtcf_blocks *b, qtcf_dag *dag)
+{
+    QTC_STATS_TIMER(t);
+
+    qtir_get_fills(qtir, qt_n, b);
+    QTC_STATS_PHASE(QTC_PHASE_FILLS, t);
+
+    qtir_get_sizes(qtir, qt_n, b, dag);
+    QTC_STATS_PHASE(QTC_PHASE_SIZES, t);
+
+    memset(skip_nodes, 0, QTCF_BOUND(qt_n));
+
+    if (dag)
+    {
+        memset(dag->table, 0, (dag->table_mask + 1) * sizeof(u64));
+    }
+
+    u64 qtc_i = 0;
+
+    u8 header = 0;
+
+    header |= inverted << QTC_HEADER_FLAG_INVERTED;
+    header |= (qtir[0].val == 0) << QTC_HEADER_FLAG_ALL_BLACK;
+    header |= (dag != NULL) << QTC_HEADER_FLAG_DAG;
+
+    na_write(qtcf, qtc_i++, header);
+
+    u64 qtir_i = 0;
+
+    u64 lvl_1_start = qt_n / 4;
+    u64 lvl_2_start = lvl_1_start / 4;
+
+    u8 lvls = qt_lvls(qt_n);
+    u8 lvl = 0;
+    u64 lvl_end = 1;
 
     while (qtir_i < lvl_2_start)
     {
         qtir_node *p = qtir + qtir_i;
 
-        if (na_read(skip_nodes, qtir_i) == 0)
+        if (qtir_i == lvl_end)
+        {
+            lvl++;
+            lvl_end = 4 * lvl_end + 1;
+        }
+
+        // a subtree written before is coded as a pattern fill of zeros, which
+        // no tree holds, followed by the distance back to it. The node and
+        // its subtree are then skipped like those of a fill
+        u64 ref = 0;
+        u8 ref_len = 1;
+
+        if (dag && na_read(skip_nodes, qtir_i) == 0 && p->sub_size > 4)
+        {
+            ref = dag_find(dag, qtir, qt_n, lvls, lvl, qtir_i);
+
+            while (ref && ref_len < 8 && (ref - 1) >> (4 * ref_len))
+            {
+                ref_len++;
+            }
+
+            // distances past 8 nibbles and small subtrees are written as nodes
+            if (ref && ((ref - 1) >> (4 * ref_len) || ref_len + 3U >= p->sub_size))
+            {
+                ref = 0;
+            }
+        }
+
+        if (ref)
+        {
+            na_write(qtcf, qtc_i++, 0);
+            na_write(qtcf, qtc_i++, (ref_len - 1) | 0x8);
+            na_write(qtcf, qtc_i++, 0);
+
+            for (u8 k = 0; k < ref_len; k++)
+            {
+                na_write(qtcf, qtc_i++, ((ref - 1) >> (4 * k)) & 0xF);
+            }
+
+            qt_fill_val(skip_nodes, qtir_i, lvls - 1 - lvl, 0xF);
+        }
+        else if (na_read(skip_nodes, qtir_i) == 0)
         {
+            QTC_STATS_ADD(nodes_visited, 1);
+
             if (p->fill_height > 0)
             {
                 na_write(qtcf, qtc_i++, 0);
@@ -471,11 +828,13 @@ static u8 *qtir_to_qtcf(qtir_node *qtir, u32 qt_n, bool inverted, u32 *out_size)
                 if (p->val == 0xF)
                 {
                     na_write(qtcf, qtc_i++, p->fill_height - 1);
+                    QTC_STATS_ADD(fills[p->fill_height], 1);
                 }
                 else
                 {
                     na_write(qtcf, qtc_i++, (p->fill_height - 1) | 0x8);
                     na_write(qtcf, qtc_i++, p->val);
+                    QTC_STATS_ADD(pattern_fills[p->fill_height], 1);
                 }
 
                 qt_fill_val(skip_nodes, qtir_i, p->fill_height, 0xF);
@@ -495,9 +854,12 @@ static u8 *qtir_to_qtcf(qtir_node *qtir, u32 qt_n, bool inverted, u32 *out_size)
 
         if (na_read(skip_nodes, qtir_i) == 0)
         {
+            QTC_STATS_ADD(nodes_visited, 1);
+
             if (p->fill_height != 0)
             {
                 na_write(qtcf, qtc_i++, 0);
+                QTC_STATS_ADD(fills[1], 1);
                 qt_fill_val(skip_nodes, qtir_i, p->fill_height, 0xF);
             }
             else if (p->val != 0)
@@ -511,7 +873,7 @@ static u8 *qtir_to_qtcf(qtir_node *qtir, u32 qt_n, bool inverted, u32 *out_size)
 
     u8 q = 0;
 
-    u32 pi = lvl_2_start;
+    u64 pi = lvl_2_start;
     u8 pv = qtir[pi].val;
 
     while (qtir_i < qt_n)
@@ -521,6 +883,7 @@ static u8 *qtir_to_qtcf(qtir_node *qtir, u32 qt_n, bool inverted, u32 *out_size)
         if (na_read(skip_nodes, qtir_i) == 0 && (pv & (1 << q)))
         {
             na_write(qtcf, qtc_i++, p->val);
+            QTC_STATS_ADD(nodes_visited, 1);
         }
 
         qtir_i++;
@@ -534,143 +897,208 @@ static u8 *qtir_to_qtcf(qtir_node *qtir, u32 qt_n, bool inverted, u32 *out_size)
         }
     }
 
-    free(skip_nodes);
+    // clear the unused nibble of the last byte
+    if (qtc_i & 1)
+    {
+        na_write(qtcf, qtc_i, 0);
+    }
 
-    *out_size = (qtc_i + 1) / 2;
-    return realloc(qtcf, *out_size);
+    QTC_STATS_PHASE(QTC_PHASE_SERIALIZE, t);
+
+    return (qtc_i + 1) / 2;
 }
 
-u8 *qtcf_encode(const u8 *data, u16 w, u32 h, u32 *out_size)
+u32 qtcf_max_compressed_size(u16 w, u16 h)
 {
-    qtir_node *qtir;
-    u8 *qtcf, *qtcf_inv, *data_inv;
-    u32 data_size, qtc_size, qtc_inv_size;
-    u32 qt_n;
-
-    qtir = qtir_from_raster(data, w, h, &qt_n);
-    if (!qtir)
-    {
-        return NULL;
-    }
-
-    qtcf = qtir_to_qtcf(qtir, qt_n, false, &qtc_size);
+    u8 lvls = calc_lvls(w, h);
 
-    free(qtir);
+    return lvls ? QTCF_BOUND(calc_node_cnt(lvls)) : 0;
+}
 
+u8 *qtcf_encode(const u8 *data, u16 w, u32 h, u32 *out_size)
+{
+    // h may exceed 16 bits, as for stacked bit planes, so this takes the
+    // 64-bit path rather than truncating it
+    u64 size;
+    u8 *qtcf = qtcf_encode64(data, w, h, &size);
     if (!qtcf)
     {
         return NULL;
     }
 
-    data_size = (w + 7) / 8 * h;
-
-    data_inv = malloc(data_size);
-    if (!data_inv)
+    if (size > UINT32_MAX)
     {
+        free(qtcf);
         return NULL;
     }
 
-    memcpy(data_inv, data, data_size);
-    arr_invert(data_inv, data_size);
+    *out_size = size;
+
+    return qtcf;
+}
 
-    qtir = qtir_from_raster(data_inv, w, h, &qt_n);
-    free(data_inv);
-    if (!qtir)
+bool qtcf_encode_into(const u8 *data, u16 w, u16 h, u8 *out, u32 out_cap, u32 *out_size)
+{
+    qtcf_ctx *ctx = qtcf_ctx_create(w, h);
+    if (!ctx)
     {
-        free(qtcf);
-        return NULL;
+        return false;
     }
 
-    qtcf_inv = qtir_to_qtcf(qtir, qt_n, true, &qtc_inv_size);
+    bool ok = qtcf_ctx_encode(ctx, data, out, out_cap, out_size);
 
-    free(qtir);
-    if (!qtcf_inv)
-    {
-        free(qtcf);
-        return NULL;
-    }
+    qtcf_ctx_free(ctx);
 
-    if (qtc_size <= qtc_inv_size)
-    {
-        free(qtcf_inv);
-        *out_size = qtc_size;
-    }
-    else
+    return ok;
+}
+
+/**
+ * Append a back-reference to a list
+ */
+static void refs_push(qtcf_refs *r, u8 lvl, u64 dst, u64 src)
+{
+    if (r->n == r->cap)
     {
-        free(qtcf);
-        qtcf = qtcf_inv;
-        *out_size = qtc_inv_size;
+        u64 cap = r->cap ? 2 * r->cap : 64;
+        qtcf_ref *refs = realloc(r->refs, cap * sizeof(qtcf_ref));
+        if (!refs)
+        {
+            r->oom = true;
+            return;
+        }
+
+        r->refs = refs;
+        r->cap = cap;
     }
 
-    return qtcf;
+    r->refs[r->n++] = (qtcf_ref){dst, src, lvl};
 }
 
-static u8 *qtcf_to_qt(const u8 *qtc, u32 qt_n, bool *inverted, u32 *comp_size)
+/**
+ * Parse a qtcf stream into a compact quad tree. The subtree of a
+ * back-reference is filled with ones, its pixels copied by refs_apply
+ *
+ * @param qtc pointer to compressed data
+ * @param qt_n number of nodes in the tree
+ * @param qt output compact quad tree of (qt_n + 1) / 2 bytes
+ * @param inverted whether the stream codes the inverted image
+ * @param comp_size the number of bytes processed in the compressed data
+ * @param lvl_starts level start offsets of the stream, may be NULL
+ * @param refs list the back-references are appended to, may be NULL
+ */
+static void qtcf_to_qt(const u8 *qtc, u64 qt_n, u8 *qt, bool *inverted, u64 *comp_size, u32 *lvl_starts, qtcf_refs *refs)
 {
-    u32 qt_size = (qt_n + 1) / 2;
-
-    // allocate space for the decompressed quad tree
-    u8 *qt = malloc(qt_size);
-    assert(qt);
+    memset(qt, 0, (qt_n + 1) / 2);
 
-    memset(qt, 0, qt_size);
-
-    u32 pi = ~0;
-    u32 ci = 0;
-    u32 qtc_i = 0;
+    u64 pi = ~(u64)0;
+    u64 ci = 0;
+    u64 qtc_i = 0;
 
     u8 header = na_read(qtc, qtc_i++);
     *inverted = (header >> 0) & 0x1;
     bool all_zero = (header >> 1) & 0x1;
+    bool dag = (header >> QTC_HEADER_FLAG_DAG) & 0x1;
+    u8 lvls = qt_lvls(qt_n);
+
+    u64 lvl_1_start = qt_n / 4;
+    u64 lvl_2_start = lvl_1_start / 4;
+    u64 lvl_end = 1;
+    u8 lvl = 0;
 
     if (all_zero)
     {
+        if (lvl_starts)
+        {
+            for (lvl_end = 1; lvl_end <= qt_n; lvl_end = 4 * lvl_end + 1)
+            {
+                lvl_starts[lvl++] = qtc_i;
+            }
+            lvl_starts[lvl] = qtc_i;
+        }
+
         *comp_size = 1;
-        return qt;
+        return;
     }
 
-    u32 lvl_1_start = qt_n / 4;
-    u32 lvl_2_start = lvl_1_start / 4;
-
     u8 pv = 0x8;
     u8 q = 3;
 
     while (ci < lvl_2_start)
     {
-        u8 cv = na_read(qt, ci);
-        if (cv == 0 && pv & (1 << q))
+        u64 first = ci;
+
+        if (lvl_starts)
         {
-            if (na_read(qtc, qtc_i) == 0)
+            lvl_starts[lvl] = qtc_i;
+        }
+
+        while (ci < lvl_end)
+        {
+            u8 cv = na_read(qt, ci);
+            if (cv == 0 && pv & (1 << q))
             {
-                qtc_i++;
+                QTC_STATS_ADD(nodes_visited, 1);
 
-                u8 fh = na_read(qtc, qtc_i++);
-                u8 fv = 0xF;
-                if (fh & 0x8)
+                if (na_read(qtc, qtc_i) == 0)
+                {
+                    qtc_i++;
+
+                    u8 fh = na_read(qtc, qtc_i++);
+                    u8 fv = 0xF;
+                    if (fh & 0x8)
+                    {
+                        fv = na_read(qtc, qtc_i++);
+                        fh &= ~(0x8);
+                    }
+
+                    fh++;
+
+                    if (dag && fv == 0)
+                    {
+                        u64 ref = 0;
+
+                        for (u8 k = 0; k < fh; k++)
+                        {
+                            ref |= (u64)na_read(qtc, qtc_i++) << (4 * k);
+                        }
+
+                        // references before the start of the level are ignored
+                        if (refs && ref < ci - first)
+                        {
+                            refs_push(refs, lvl, ci - first, ci - first - ref - 1);
+                        }
+
+                        qt_fill_val(qt, ci, lvls - 1 - lvl, 0xF);
+                    }
+                    else
+                    {
+                        qt_fill_val(qt, ci, fh, fv);
+                    }
+                }
+                else
                 {
-                    fv = na_read(qtc, qtc_i++);
-                    fh &= ~(0x8);
+                    na_write(qt, ci, na_read(qtc, qtc_i++));
                 }
+            }
 
-                fh++;
+            ci++;
+            q++;
 
-                qt_fill_val(qt, ci, fh, fv);
-            }
-            else
+            if ((ci & 0x3) == 0x1)
             {
-                na_write(qt, ci, na_read(qtc, qtc_i++));
+                pi++;
+                q = 0;
+                pv = na_read(qt, pi);
             }
         }
 
-        ci++;
-        q++;
+        lvl_end = 4 * lvl_end + 1;
+        lvl++;
+    }
 
-        if ((ci & 0x3) == 0x1)
-        {
-            pi++;
-            q = 0;
-            pv = na_read(qt, pi);
-        }
+    if (lvl_starts && ci < lvl_1_start)
+    {
+        lvl_starts[lvl++] = qtc_i;
     }
 
     while (ci < lvl_1_start)
@@ -678,6 +1106,8 @@ static u8 *qtcf_to_qt(const u8 *qtc, u32 qt_n, bool *inverted, u32 *comp_size)
         u8 cv = na_read(qt, ci);
         if (cv == 0 && pv & (1 << q))
         {
+            QTC_STATS_ADD(nodes_visited, 1);
+
             if (na_read(qtc, qtc_i) == 0)
             {
                 qtc_i++;
@@ -701,12 +1131,18 @@ static u8 *qtcf_to_qt(const u8 *qtc, u32 qt_n, bool *inverted, u32 *comp_size)
         }
     }
 
+    if (lvl_starts)
+    {
+        lvl_starts[lvl++] = qtc_i;
+    }
+
     while (ci < qt_n)
     {
         u8 cv = na_read(qt, ci);
         if (cv == 0 && pv & (1 << q))
         {
             na_write(qt, ci, na_read(qtc, qtc_i++));
+            QTC_STATS_ADD(nodes_visited, 1);
         }
 
         ci++;
@@ -719,79 +1155,568 @@ static u8 *qtcf_to_qt(const u8 *qtc, u32 qt_n, bool *inverted, u32 *comp_size)
             pv = na_read(qt, pi);
         }
     }
-    *comp_size = (qtc_i + 1) / 2;
+    if (lvl_starts)
+    {
+        lvl_starts[lvl] = qtc_i;
+    }
 
-    return qt;
+    *comp_size = (qtc_i + 1) / 2;
 }
 
-static u8 *qt_to_raster(u8 *qt, u32 qt_n, u16 w, u16 h)
+void qt_write_raster(const u8 *qt, u64 qt_n, u32 w, u32 h, u8 *raster)
 {
-    u32 leaf_i = qt_n / 4;
-    u16 rast_row_size = (w + 7) / 8;
-    u32 raster_size = rast_row_size * h;
-
-    u8 *raster = (u8 *)malloc(raster_size);
-    memset(raster, 0, raster_size);
+    u64 leaf_i = qt_n / 4;
+    size_t rast_row_size = ((size_t)w + 7) / 8;
 
     u8 *rast_row_h = raster;
     u8 *rast_row_l = rast_row_h + rast_row_size;
-    u32 rast_row_inc = 2 * rast_row_size;
-    u32 mc = 0;
+    size_t rast_row_inc = 2 * rast_row_size;
+    u32 leaf_w = w / 2 + (w & 1);
+    u64 mc = 0;
 
-    for (u16 y = 0; y < h - 1; y += 2)
+    // every raster byte is stored whole, so the raster needs no clearing
+    for (u32 y = 0; y < h; y += 2)
     {
-        for (u16 x = 0; x < w; x += 2)
+        bool has_lo = y + 1 < h;
+
+        for (u32 x = 0; x < w; x += 64)
         {
-            u8 nib = na_read(qt, leaf_i + mc);
+            u64 leaves[2] = {0, 0};
+            u32 k_end = MIN(32, leaf_w - x / 2);
 
-            u8 nib_h = (nib >> 0) & 0x3;
-            u8 nib_l = (nib >> 2) & 0x3;
+            for (u32 k = 0; k < k_end; k += 2)
+            {
+                u64 pair = na_read(qt, leaf_i + mc);
+
+                if (k + 1 < k_end)
+                {
+                    pair |= na_read(qt, leaf_i + mc + 1) << 4;
+                }
 
-            rast_row_h[x / 8] |= nib_h << (x % 8);
-            rast_row_l[x / 8] |= nib_l << (x % 8);
+                leaves[k / 16] |= pair << (4 * (k % 16));
 
-            morton_inc_x(&mc);
+                morton64_inc_x2(&mc);
+            }
+
+            u64 hi, lo;
+            leaf_unpack_64(leaves, &hi, &lo);
+
+            size_t col = x / 8;
+            row_store_64(rast_row_h + col, hi, rast_row_size - col);
+
+            if (has_lo)
+            {
+                row_store_64(rast_row_l + col, lo, rast_row_size - col);
+            }
         }
-        morton_inc_y(&mc);
-        morton_rst_x(&mc);
+
+        morton64_inc_y(&mc);
+        morton64_rst_x(&mc);
         rast_row_h += rast_row_inc;
         rast_row_l += rast_row_inc;
     }
+}
+
+/**
+ * Copy the pixels of the subtrees of back-references in a raster written
+ * from their quad tree. Referenced subtrees hold only references of lower
+ * levels, or earlier ones of their level, so levels are copied from the
+ * leaves up and each level in stream order
+ *
+ * @param r back-references in stream order
+ * @param lvls number of levels in the tree
+ * @param w image width
+ * @param h image height
+ * @param raster raster of (w + 7) / 8 * h bytes
+ */
+static void refs_apply(const qtcf_refs *r, u8 lvls, u32 w, u32 h, u8 *raster)
+{
+    size_t rast_row_size = ((size_t)w + 7) / 8;
 
-    if (h & 1)
+    for (u64 end = r->n; end > 0;)
     {
-        for (u16 x = 0; x < w; x += 2)
+        u64 start = end - 1;
+
+        while (start > 0 && r->refs[start - 1].lvl == r->refs[end - 1].lvl)
+        {
+            start--;
+        }
+
+        for (u64 k = start; k < end; k++)
         {
-            u8 nib = na_read(qt, leaf_i + mc);
+            const qtcf_ref *ref = r->refs + k;
+
+            // subtrees above the parents of the leaves are at least 8 pixels
+            // a side, so their rows are whole bytes
+            u64 side = (u64)1 << (lvls - ref->lvl);
+            u32 sx, sy, dx, dy;
 
-            u8 nwne = nib & 0x3;
+            morton64_decode(ref->src, &sx, &sy);
+            morton64_decode(ref->dst, &dx, &dy);
 
-            rast_row_h[x / 8] |= nwne << (x % 8);
+            u64 src_col = sx * side / 8, dst_col = dx * side / 8;
+            u64 src_y = sy * side, dst_y = dy * side;
 
-            morton_inc_x(&mc);
+            if (dst_col >= rast_row_size)
+            {
+                continue;
+            }
+
+            // pixels of the source past the raster are clear
+            size_t dst_n = MIN(side / 8, rast_row_size - dst_col);
+            size_t src_n = src_col < rast_row_size ? MIN(side / 8, rast_row_size - src_col) : 0;
+            size_t copy_n = MIN(src_n, dst_n);
+
+            for (u64 y = 0; y < side && dst_y + y < h; y++)
+            {
+                u8 *dst = raster + (dst_y + y) * rast_row_size + dst_col;
+                size_t n = src_y + y < h ? copy_n : 0;
+
+                if (n)
+                {
+                    memcpy(dst, raster + (src_y + y) * rast_row_size + src_col, n);
+                }
+
+                memset(dst + n, 0, dst_n - n);
+            }
         }
+
+        end = start;
     }
+}
+
+u8 *qt_to_raster(u8 *qt, u64 qt_n, u32 w, u32 h)
+{
+    u8 *raster = (u8 *)malloc(((size_t)w + 7) / 8 * h);
+    if (!raster)
+    {
+        return NULL;
+    }
+
+    qt_write_raster(qt, qt_n, w, h, raster);
 
     return raster;
 }
 
 u8 *qtcf_decode(const u8 *qtc, u16 w, u16 h, u32 *comp_size)
+{
+    u8 *pix = malloc((w + 7) / 8 * h);
+
+    if (!pix || !qtcf_decode_into(qtc, w, h, pix, comp_size))
+    {
+        free(pix);
+        return NULL;
+    }
+
+    return pix;
+}
+
+bool qtcf_decode_into(const u8 *qtc, u16 w, u16 h, u8 *out, u32 *comp_size)
+{
+    qtcf_ctx *ctx = qtcf_ctx_create(w, h);
+    if (!ctx)
+    {
+        return false;
+    }
+
+    bool ok = qtcf_ctx_decode(ctx, qtc, out, comp_size);
+
+    qtcf_ctx_free(ctx);
+
+    return ok;
+}
+
+u8 qtcf_lvl_starts(const u8 *qtc, u16 w, u16 h, u32 *lvl_starts)
 {
     u8 lvls = calc_lvls(w, h);
     u32 qt_n = calc_node_cnt(lvls);
+    u64 comp_size;
+    bool inverted;
+
+    u8 *qt = malloc((qt_n + 1) / 2);
+    if (!qt)
+    {
+        return 0;
+    }
+
+    qtcf_to_qt(qtc, qt_n, qt, &inverted, &comp_size, lvl_starts, NULL);
+
+    free(qt);
+
+    return lvls;
+}
+
+#ifdef QTC_STATS
+/**
+ * Count the nibbles of each level of a qtcf stream into the attached stats
+ *
+ * @param lvl_starts level start offsets of the stream, as from qtcf_to_qt
+ * @param lvls number of levels in the tree
+ */
+static void qtcf_stats_lvls(const u32 *lvl_starts, u8 lvls)
+{
+    for (u8 l = 0; l < lvls && l < QTC_STATS_MAX_LVLS; l++)
+    {
+        qtc_stats_sink->lvl_nibbles[l] += lvl_starts[l + 1] - lvl_starts[l];
+    }
+}
+#endif
+
+static qtcf_ctx *qtcf_ctx_alloc(u32 w, u32 h)
+{
+    u8 lvls = calc_lvls(w, h);
+    if (lvls == 0 || lvls > QTCF64_MAX_LVLS)
+    {
+        return NULL;
+    }
+
+    qtcf_ctx *ctx = malloc(sizeof(qtcf_ctx));
+    if (!ctx)
+    {
+        return NULL;
+    }
+
+    ctx->w = w;
+    ctx->h = h;
+    ctx->qt_n = calc_node_cnt64(lvls);
+    ctx->enc_arena = NULL;
+    ctx->dec_arena = NULL;
+    ctx->dag = false;
+    ctx->dag_arena = NULL;
+    ctx->refs = (qtcf_refs){NULL, 0, 0, false};
+
+    return ctx;
+}
+
+qtcf_ctx *qtcf_ctx_create(u16 w, u16 h)
+{
+    return qtcf_ctx_alloc(w, h);
+}
+
+void qtcf_ctx_free(qtcf_ctx *ctx)
+{
+    if (!ctx)
+    {
+        return;
+    }
+
+    free(ctx->enc_arena);
+    free(ctx->dec_arena);
+    free(ctx->dag_arena);
+    free(ctx->refs.refs);
+    free(ctx);
+}
+
+static bool qtcf_ctx_encode_wide(qtcf_ctx *ctx, const u8 *data, u8 *out, u64 out_cap, u64 *out_size)
+{
+    u64 qt_n = ctx->qt_n;
+    u64 qtcf_cap = QTCF_BOUND(qt_n);
+
+    // trees of fewer levels than a block are not pre-scanned
+    u8 lvls = qt_lvls(qt_n);
+    qtcf_blocks blocks = qtcf_no_blocks;
+    size_t blocks_n = 0;
+
+    if (lvls >= QTCF_BLOCK_LVLS)
+    {
+        blocks.lvl = lvls - QTCF_BLOCK_LVLS;
+        blocks_n = (size_t)1 << (2 * blocks.lvl);
+    }
+
+    // ir tree, skip nodes, a stream for each polarity and the block map
+    if (!ctx->enc_arena)
+    {
+        if (qt_n > SIZE_MAX / (sizeof(qtir_node) + 3))
+        {
+            return false;
+        }
+
+        ctx->enc_arena = malloc(qt_n * sizeof(qtir_node) + 3 * qtcf_cap + blocks_n);
+        if (!ctx->enc_arena)
+        {
+            return false;
+        }
+    }
+
+    qtir_node *qtir = ctx->enc_arena;
+    u8 *skip_nodes = (u8 *)(qtir + qt_n);
+    u8 *qtcf = skip_nodes + qtcf_cap;
+    u8 *qtcf_inv = qtcf + qtcf_cap;
+
+    if (blocks_n)
+    {
+        blocks.map = qtcf_inv + qtcf_cap;
+    }
+
+    // hashes of the levels above the parents of the leaves, and a table of
+    // at least twice as many slots
+    qtcf_dag dag_state, *dag = NULL;
+
+    if (ctx->dag && lvls >= 3)
+    {
+        u64 hash_n = lvl_start(lvls - 2);
+        u64 table_n = 2;
+
+        while (table_n < 2 * hash_n)
+        {
+            table_n *= 2;
+        }
+
+        if (!ctx->dag_arena)
+        {
+            if (hash_n + table_n > SIZE_MAX / sizeof(u64))
+            {
+                return false;
+            }
+
+            ctx->dag_arena = malloc((hash_n + table_n) * sizeof(u64));
+            if (!ctx->dag_arena)
+            {
+                return false;
+            }
+        }
+
+        dag_state.hash = ctx->dag_arena;
+        dag_state.table = ctx->dag_arena + hash_n;
+        dag_state.table_mask = table_n - 1;
+        dag = &dag_state;
+    }
+
+    QTC_STATS_TIMER(t);
+    qtir_build(qtir, qt_n, data, ctx->w, ctx->h, 0x00, &blocks);
+    QTC_STATS_PHASE(QTC_PHASE_BUILD, t);
+    u64 qtc_size = qtir_write_qtcf(qtir, qt_n, false, skip_nodes, qtcf, &blocks, dag);
+
+    QTC_STATS_TIMER(t_inv);
+    qtir_build(qtir, qt_n, data, ctx->w, ctx->h, 0xFF, &blocks);
+    QTC_STATS_PHASE(QTC_PHASE_BUILD, t_inv);
+    u64 qtc_inv_size = qtir_write_qtcf(qtir, qt_n, true, skip_nodes, qtcf_inv, &blocks, dag);
+
+    QTC_STATS_ADD(normal_bytes, qtc_size);
+    QTC_STATS_ADD(inverted_bytes, qtc_inv_size);
+    QTC_STATS_ADD(normal_won, qtc_inv_size >= qtc_size);
+    QTC_STATS_ADD(inverted_won, qtc_inv_size < qtc_size);
+
+    if (qtc_inv_size < qtc_size)
+    {
+        qtcf = qtcf_inv;
+        qtc_size = qtc_inv_size;
+    }
+
+    if (qtc_size > out_cap)
+    {
+        return false;
+    }
+
+    memcpy(out, qtcf, qtc_size);
+    *out_size = qtc_size;
+
+#ifdef QTC_STATS
+    if (qtc_stats_sink)
+    {
+        // re-parse the stream for its level boundaries, into the skip nodes
+        // scratch, without counting the parse as decoded nodes
+        u32 lvl_starts[QTCF64_MAX_LVLS + 1];
+        u64 nodes_visited = qtc_stats_sink->nodes_visited;
+        bool inverted;
+        u64 comp_size;
+
+        qtcf_to_qt(out, qt_n, skip_nodes, &inverted, &comp_size, lvl_starts, NULL);
+        qtcf_stats_lvls(lvl_starts, calc_lvls(ctx->w, ctx->h));
+
+        qtc_stats_sink->nodes_visited = nodes_visited;
+    }
+#endif
+
+    return true;
+}
+
+bool qtcf_ctx_encode(qtcf_ctx *ctx, const u8 *data, u8 *out, u32 out_cap, u32 *out_size)
+{
+    u64 size;
+
+    if (!qtcf_ctx_encode_wide(ctx, data, out, out_cap, &size))
+    {
+        return false;
+    }
+
+    *out_size = size;
+
+    return true;
+}
+
+static bool qtcf_ctx_decode_wide(qtcf_ctx *ctx, const u8 *data, u8 *out, u64 *in_size)
+{
+    u64 qt_n = ctx->qt_n;
+
+    if (!ctx->dec_arena)
+    {
+        if ((qt_n + 1) / 2 > SIZE_MAX)
+        {
+            return false;
+        }
+
+        ctx->dec_arena = malloc((qt_n + 1) / 2);
+        if (!ctx->dec_arena)
+        {
+            return false;
+        }
+    }
 
     bool inverted;
+    u32 *lvl_starts = NULL;
 
-    u8 *qt = qtcf_to_qt(qtc, qt_n, &inverted, comp_size);
+#ifdef QTC_STATS
+    u32 stats_lvl_starts[QTCF64_MAX_LVLS + 1];
+    if (qtc_stats_sink)
+    {
+        lvl_starts = stats_lvl_starts;
+    }
+#endif
 
-    u8 *pix = qt_to_raster(qt, qt_n, w, h);
+    ctx->refs.n = 0;
+    ctx->refs.oom = false;
+
+    QTC_STATS_TIMER(t);
+    qtcf_to_qt(data, qt_n, ctx->dec_arena, &inverted, in_size, lvl_starts, &ctx->refs);
+    QTC_STATS_PHASE(QTC_PHASE_PARSE, t);
+
+    if (ctx->refs.oom)
+    {
+        return false;
+    }
+
+    qt_write_raster(ctx->dec_arena, qt_n, ctx->w, ctx->h, out);
+    refs_apply(&ctx->refs, qt_lvls(qt_n), ctx->w, ctx->h, out);
 
     if (inverted)
     {
-        arr_invert(pix, (w + 7) / 8 * h);
+        arr_invert(out, ((size_t)ctx->w + 7) / 8 * ctx->h);
     }
+    QTC_STATS_PHASE(QTC_PHASE_RASTER, t);
 
-    free(qt);
+#ifdef QTC_STATS
+    if (lvl_starts)
+    {
+        qtcf_stats_lvls(lvl_starts, calc_lvls(ctx->w, ctx->h));
+    }
+#endif
+
+    return true;
+}
+
+bool qtcf_ctx_decode(qtcf_ctx *ctx, const u8 *data, u8 *out, u32 *in_size)
+{
+    u64 size;
+
+    if (!qtcf_ctx_decode_wide(ctx, data, out, &size))
+    {
+        return false;
+    }
+
+    *in_size = size;
+
+    return true;
+}
+
+u64 qtcf_max_compressed_size64(u32 w, u32 h)
+{
+    u8 lvls = calc_lvls(w, h);
+
+    return lvls && lvls <= QTCF64_MAX_LVLS ? QTCF_BOUND(calc_node_cnt64(lvls)) : 0;
+}
+
+u8 *qtcf_encode64(const u8 *data, u32 w, u32 h, u64 *out_size)
+{
+    u64 qtcf_cap = qtcf_max_compressed_size64(w, h);
+    if (qtcf_cap == 0 || qtcf_cap > SIZE_MAX)
+    {
+        return NULL;
+    }
+
+    u8 *qtcf = malloc(qtcf_cap);
+
+    if (!qtcf || !qtcf_encode64_into(data, w, h, qtcf, qtcf_cap, out_size))
+    {
+        free(qtcf);
+        return NULL;
+    }
+
+    return realloc(qtcf, *out_size);
+}
+
+bool qtcf_encode64_into(const u8 *data, u32 w, u32 h, u8 *out, u64 out_cap, u64 *out_size)
+{
+    qtcf_ctx *ctx = qtcf_ctx_alloc(w, h);
+    if (!ctx)
+    {
+        return false;
+    }
+
+    bool ok = qtcf_ctx_encode_wide(ctx, data, out, out_cap, out_size);
+
+    qtcf_ctx_free(ctx);
+
+    return ok;
+}
+
+u8 *qtcf_encode_dag(const u8 *data, u32 w, u32 h, u64 *out_size)
+{
+    u64 qtcf_cap = qtcf_max_compressed_size64(w, h);
+    if (qtcf_cap == 0 || qtcf_cap > SIZE_MAX)
+    {
+        return NULL;
+    }
+
+    qtcf_ctx *ctx = qtcf_ctx_alloc(w, h);
+    u8 *qtcf = malloc(qtcf_cap);
+
+    if (!ctx || !qtcf)
+    {
+        qtcf_ctx_free(ctx);
+        free(qtcf);
+        return NULL;
+    }
+
+    ctx->dag = true;
+
+    bool ok = qtcf_ctx_encode_wide(ctx, data, qtcf, qtcf_cap, out_size);
+
+    qtcf_ctx_free(ctx);
+
+    if (!ok)
+    {
+        free(qtcf);
+        return NULL;
+    }
+
+    return realloc(qtcf, *out_size);
+}
+
+u8 *qtcf_decode64(const u8 *qtc, u32 w, u32 h, u64 *in_size)
+{
+    u8 *pix = malloc(((size_t)w + 7) / 8 * h);
+
+    if (!pix || !qtcf_decode64_into(qtc, w, h, pix, in_size))
+    {
+        free(pix);
+        return NULL;
+    }
 
     return pix;
-}
\ No newline at end of file
+}
+
+bool qtcf_decode64_into(const u8 *qtc, u32 w, u32 h, u8 *out, u64 *in_size)
+{
+    qtcf_ctx *ctx = qtcf_ctx_alloc(w, h);
+    if (!ctx)
+    {
+        return false;
+    }
+
+    bool ok = qtcf_ctx_decode_wide(ctx, qtc, out, in_size);
+
+    qtcf_ctx_free(ctx);
+
+    return ok;
+}
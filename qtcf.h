@@ -3,6 +3,17 @@
 
 #include "types.h"
 
+/**
+ * Maximum number of levels in a quad tree of a 65535x65535 image
+ */
+#define QTCF_MAX_LVLS 16
+
+/**
+ * Maximum number of levels in a quad tree coded by the 64-bit entry points,
+ * which take images of up to 2^31 pixels a side
+ */
+#define QTCF64_MAX_LVLS 31
+
 /**
  * Compress a 1-bit raster image.
  *
@@ -15,6 +26,31 @@
  */
 u8 *qtcf_encode(const u8 *data, u16 w, u32 h, u32 *out_size);
 
+/**
+ * Get the largest size qtcf_encode can produce for an image of the specified
+ * size.
+ *
+ * @param w image width
+ * @param h image height
+ *
+ * @return worst-case size, in bytes, of compressed data. 0 if the size is invalid
+ */
+u32 qtcf_max_compressed_size(u16 w, u16 h);
+
+/**
+ * Compress a 1-bit raster image into a caller-provided buffer.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out output buffer, qtcf_max_compressed_size bytes always suffice
+ * @param out_cap size, in bytes, of the output buffer
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtcf_encode_into(const u8 *data, u16 w, u16 h, u8 *out, u32 out_cap, u32 *out_size);
+
 /**
  * Decompress a 1-bit raster image.
  *
@@ -27,4 +63,166 @@ u8 *qtcf_encode(const u8 *data, u16 w, u32 h, u32 *out_size);
  */
 u8 *qtcf_decode(const u8 *data, u16 w, u16 h, u32 *in_size);
 
+/**
+ * Decompress a 1-bit raster image into a caller-provided buffer, such as a
+ * framebuffer.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param out output raster of (w + 7) / 8 * h bytes
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return true if successful, false if out of memory or the size is invalid
+ */
+bool qtcf_decode_into(const u8 *data, u16 w, u16 h, u8 *out, u32 *in_size);
+
+/**
+ * Find where each quad tree level starts in a compressed 1-bit raster image.
+ * Nibble 0 of the stream is the header, so level 0 always starts at nibble 1.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param lvl_starts array of at least QTCF_MAX_LVLS + 1 entries that will hold
+ * the nibble index where each level starts, followed by the stream length in
+ * nibbles
+ *
+ * @return number of levels in the quad tree. 0 if unsuccessful
+ */
+u8 qtcf_lvl_starts(const u8 *data, u16 w, u16 h, u32 *lvl_starts);
+
+/**
+ * Reusable encoder and decoder state for images of one size. Scratch memory
+ * is allocated by the first encode or decode and reused by every later call,
+ * so coding a stream of same-sized images does not allocate.
+ */
+typedef struct qtcf_ctx qtcf_ctx;
+
+/**
+ * Create a coding context for images of the specified size.
+ *
+ * @param w image width
+ * @param h image height
+ *
+ * @return pointer to context. NULL if unsuccessful
+ */
+qtcf_ctx *qtcf_ctx_create(u16 w, u16 h);
+
+/**
+ * Free a coding context and its scratch memory.
+ *
+ * @param ctx pointer to context, may be NULL
+ */
+void qtcf_ctx_free(qtcf_ctx *ctx);
+
+/**
+ * Compress a 1-bit raster image into a caller-provided buffer. The output is
+ * identical to that of qtcf_encode.
+ *
+ * @param ctx context created for the image size
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param out output buffer
+ * @param out_cap size, in bytes, of the output buffer
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtcf_ctx_encode(qtcf_ctx *ctx, const u8 *data, u8 *out, u32 out_cap, u32 *out_size);
+
+/**
+ * Decompress a 1-bit raster image into a caller-provided buffer.
+ *
+ * @param ctx context created for the image size
+ * @param data pointer to compressed data
+ * @param out output raster of (w + 7) / 8 * h bytes
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return true if successful, false if out of memory
+ */
+bool qtcf_ctx_decode(qtcf_ctx *ctx, const u8 *data, u8 *out, u32 *in_size);
+
+/**
+ * Get the largest size qtcf_encode64 can produce for an image of the
+ * specified size.
+ *
+ * @param w image width
+ * @param h image height
+ *
+ * @return worst-case size, in bytes, of compressed data. 0 if the size is invalid
+ */
+u64 qtcf_max_compressed_size64(u32 w, u32 h);
+
+/**
+ * Compress a 1-bit raster image of up to 2^31 pixels a side. Node indices
+ * and Morton codes are 64-bit, and the stream is the one qtcf_encode
+ * produces for images it can take.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtcf_encode64(const u8 *data, u32 w, u32 h, u64 *out_size);
+
+/**
+ * Compress a 1-bit raster image of up to 2^31 pixels a side into a
+ * caller-provided buffer.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out output buffer, qtcf_max_compressed_size64 bytes always suffice
+ * @param out_cap size, in bytes, of the output buffer
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtcf_encode64_into(const u8 *data, u32 w, u32 h, u8 *out, u64 out_cap, u64 *out_size);
+
+/**
+ * Compress a 1-bit raster image of up to 2^31 pixels a side into a qtcf
+ * stream whose repeated subtrees are back-references. Subtrees of 8x8 pixels
+ * and up are hashed while their sizes are computed, and a subtree with the
+ * same pixels as an earlier one of its level is written as a reference to it
+ * when that is shorter. The decoders of qtcf take these streams and copy the
+ * pixels of references from the raster decoded so far.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtcf_encode_dag(const u8 *data, u32 w, u32 h, u64 *out_size);
+
+/**
+ * Decompress a 1-bit raster image of up to 2^31 pixels a side.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return pointer to decompressed, 1-bit raster image. NULL if unsuccessful
+ */
+u8 *qtcf_decode64(const u8 *data, u32 w, u32 h, u64 *in_size);
+
+/**
+ * Decompress a 1-bit raster image of up to 2^31 pixels a side into a
+ * caller-provided buffer.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param out output raster of (w + 7) / 8 * h bytes
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return true if successful, false if out of memory or the size is invalid
+ */
+bool qtcf_decode64_into(const u8 *data, u32 w, u32 h, u8 *out, u64 *in_size);
+
 #endif // __QTCF_H__
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef __QTCF_INTERNAL_H__
+#define __QTCF_INTERNAL_H__
+
+#include "qtir.h"
+#include "types.h"
+
+/*
+ * Passes of qtcf.c over the intermediate representation tree, declared for
+ * the kernel microbenchmarks. Not part of the qtcf API.
+ */
+
+/**
+ * Uniform blocks found by the pre-scan, one entry per node of level lvl in
+ * level order. The bottom-up passes skip the subtrees of uniform blocks: an
+ * empty block is left zeroed, a full block gets the final state of its root
+ * and its leaves, the only nodes of it that are read again
+ */
+typedef struct
+{
+    u8 *map;
+    u8 lvl;
+} qtcf_blocks;
+
+/**
+ * No uniform blocks, for trees built without the pre-scan
+ */
+extern const qtcf_blocks qtcf_no_blocks;
+
+/**
+ * Subtree hashes and the table of the latest subtree of each hash, for the
+ * back-references of DAG streams. Only the levels above the parents of the
+ * leaves, whose nodes can be coded as fills, are hashed
+ */
+typedef struct
+{
+    // hash of the leaves of each node of the hashed levels
+    u64 *hash;
+    // node index + 1 of the latest node of a hash, 0 for an empty slot
+    u64 *table;
+    u64 table_mask;
+} qtcf_dag;
+
+/**
+ * Build the intermediate representation of a 1-bit raster image into an
+ * existing tree array
+ *
+ * @param qtir pointer to ir tree array of qt_n nodes
+ * @param qt_n number of nodes in the tree
+ * @param data pointer to raster image data in row-major order
+ * @param w image width
+ * @param h image height
+ * @param inv byte xor-ed into every raster byte read, 0xFF to build the tree
+ * of the inverted image
+ * @param b uniform blocks, pre-scanned here when b has a map. Their leaves are
+ * not packed and their subtrees are skipped by the bottom-up passes
+ */
+void qtir_build(qtir_node *qtir, u64 qt_n, const u8 *data, u32 w, u32 h, u8 inv, const qtcf_blocks *b);
+
+/**
+ * Find, bottom-up, the subtrees of an intermediate representation tree that
+ * are coded as fills, and set their fill height and value
+ *
+ * @param qtir pointer to ir tree array of qt_n nodes
+ * @param qt_n number of nodes in the tree
+ * @param b uniform blocks, whose subtrees are skipped
+ */
+void qtir_get_fills(qtir_node *qtir, u64 qt_n, const qtcf_blocks *b);
+
+/**
+ * Calculate, bottom-up, the coded size of the subtrees of an intermediate
+ * representation tree, converting to raw leaves the subtrees that are
+ * smaller coded that way
+ *
+ * @param qtir pointer to ir tree array of qt_n nodes
+ * @param qt_n number of nodes in the tree
+ * @param b uniform blocks, whose subtrees are skipped
+ * @param dag subtree hashes of a DAG stream, NULL to code every subtree
+ */
+void qtir_get_sizes(qtir_node *qtir, u64 qt_n, const qtcf_blocks *b, qtcf_dag *dag);
+
+#endif // __QTCF_INTERNAL_H__
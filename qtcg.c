@@ -0,0 +1,300 @@
+#include "qtcg.h"
+#include "qtcf.h"
+#include "qtir.h"
+#include "qtc_trace.h"
+#include "utils.h"
+
+#include <string.h>
+
+/**
+ * Padding, in pixels, charged for every tile when picking the tile side. It
+ * stands in for the header and upper levels that every tile stream repeats,
+ * and keeps the grid from splitting into many small tiles for little gain
+ */
+#define QTCG_TILE_COST 4096
+
+/**
+ * Smallest side a tile is coded with. Thinner edge tiles are padded to it,
+ * as qtcf needs trees of at least three levels
+ */
+#define QTCG_MIN_SIDE (1U << QTCG_MIN_TILE_LOG2)
+
+/**
+ * Layout of a grid: full tiles of side x side pixels, with the last column
+ * and row cut to the image
+ */
+typedef struct
+{
+    u8 side_log2;
+    u32 side;
+    u32 cols;
+    u32 rows;
+    u32 last_w;
+    u32 last_h;
+} qtcg_grid;
+
+static void grid_init(qtcg_grid *g, u32 w, u32 h, u8 side_log2)
+{
+    g->side_log2 = side_log2;
+    g->side = 1U << side_log2;
+    g->cols = ((u64)w + g->side - 1) >> side_log2;
+    g->rows = ((u64)h + g->side - 1) >> side_log2;
+    g->last_w = w - (g->cols - 1) * g->side;
+    g->last_h = h - (g->rows - 1) * g->side;
+}
+
+static u32 tile_w(const qtcg_grid *g, u32 tx)
+{
+    return tx + 1 == g->cols ? g->last_w : g->side;
+}
+
+static u32 tile_h(const qtcg_grid *g, u32 ty)
+{
+    return ty + 1 == g->rows ? g->last_h : g->side;
+}
+
+/**
+ * Number of pixels covered by the quad tree of a tile
+ */
+static u64 tile_area(u32 w, u32 h)
+{
+    return (u64)1 << (2 * calc_lvls(w, h));
+}
+
+/**
+ * Pick the tile side whose grid pads the image the least, counting
+ * QTCG_TILE_COST for every tile
+ *
+ * @param w image width
+ * @param h image height
+ *
+ * @return log2 of the tile side
+ */
+static u8 grid_pick(u32 w, u32 h)
+{
+    u8 best = QTCG_MIN_TILE_LOG2;
+    u64 best_cost = UINT64_MAX;
+
+    for (u8 k = QTCG_MIN_TILE_LOG2; k <= QTCG_MAX_TILE_LOG2; k++)
+    {
+        qtcg_grid g;
+        grid_init(&g, w, h, k);
+
+        u64 full = (u64)(g.cols - 1) * (g.rows - 1);
+        u64 cost = full * tile_area(g.side, g.side);
+
+        cost += (u64)(g.rows - 1) * tile_area(g.last_w, g.side);
+        cost += (u64)(g.cols - 1) * tile_area(g.side, g.last_h);
+        cost += tile_area(g.last_w, g.last_h);
+        cost += (u64)g.cols * g.rows * QTCG_TILE_COST;
+
+        if (cost < best_cost)
+        {
+            best = k;
+            best_cost = cost;
+        }
+
+        if (g.cols == 1 && g.rows == 1)
+        {
+            break;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Free the coding contexts of the four tile sizes of a grid
+ */
+static void ctxs_free(qtcf_ctx *ctxs[2][2])
+{
+    for (u8 i = 0; i < 4; i++)
+    {
+        qtcf_ctx_free(ctxs[i / 2][i % 2]);
+    }
+}
+
+/**
+ * Get the coding context of the size of a tile, creating it on first use
+ *
+ * @return pointer to context. NULL if unsuccessful
+ */
+static qtcf_ctx *tile_ctx(qtcf_ctx *ctxs[2][2], const qtcg_grid *g, u32 tx, u32 ty)
+{
+    qtcf_ctx **ctx = &ctxs[ty + 1 == g->rows][tx + 1 == g->cols];
+
+    if (!*ctx)
+    {
+        *ctx = qtcf_ctx_create(MAX(tile_w(g, tx), QTCG_MIN_SIDE), MAX(tile_h(g, ty), QTCG_MIN_SIDE));
+    }
+
+    return *ctx;
+}
+
+u64 qtcg_max_compressed_size(u32 w, u32 h)
+{
+    if (w == 0 || h == 0)
+    {
+        return 0;
+    }
+
+    qtcg_grid g;
+    grid_init(&g, w, h, grid_pick(w, h));
+
+    u64 size = 1;
+
+    u32 last_w = MAX(g.last_w, QTCG_MIN_SIDE);
+    u32 last_h = MAX(g.last_h, QTCG_MIN_SIDE);
+
+    size += (u64)(g.cols - 1) * (g.rows - 1) * qtcf_max_compressed_size(g.side, g.side);
+    size += (u64)(g.rows - 1) * qtcf_max_compressed_size(last_w, g.side);
+    size += (u64)(g.cols - 1) * qtcf_max_compressed_size(g.side, last_h);
+    size += qtcf_max_compressed_size(last_w, last_h);
+
+    return size;
+}
+
+u8 *qtcg_encode(const u8 *data, u32 w, u32 h, u64 *out_size)
+{
+    u64 qtcg_cap = qtcg_max_compressed_size(w, h);
+    if (qtcg_cap == 0 || qtcg_cap > SIZE_MAX)
+    {
+        return NULL;
+    }
+
+    u8 *qtcg = malloc(qtcg_cap);
+
+    if (!qtcg || !qtcg_encode_into(data, w, h, qtcg, qtcg_cap, out_size))
+    {
+        free(qtcg);
+        return NULL;
+    }
+
+    return realloc(qtcg, *out_size);
+}
+
+bool qtcg_encode_into(const u8 *data, u32 w, u32 h, u8 *out, u64 out_cap, u64 *out_size)
+{
+    if (w == 0 || h == 0 || out_cap == 0)
+    {
+        return false;
+    }
+
+    qtcg_grid g;
+    grid_init(&g, w, h, grid_pick(w, h));
+
+    size_t row_size = ((size_t)w + 7) / 8;
+    u8 *tile = malloc((size_t)g.side / 8 * g.side);
+    qtcf_ctx *ctxs[2][2] = {{NULL, NULL}, {NULL, NULL}};
+
+    bool ok = tile != NULL;
+    u64 pos = 0;
+
+    out[pos++] = g.side_log2;
+
+    QTC_TRACE(qtcg_grid, g.side, (u64)g.cols * g.rows);
+
+    for (u32 ty = 0; ok && ty < g.rows; ty++)
+    {
+        for (u32 tx = 0; ok && tx < g.cols; tx++)
+        {
+            qtcf_ctx *ctx = tile_ctx(ctxs, &g, tx, ty);
+            if (!ctx)
+            {
+                ok = false;
+                break;
+            }
+
+            u32 th = tile_h(&g, ty);
+            size_t tile_row = ((size_t)tile_w(&g, tx) + 7) / 8;
+            const u8 *src = data + (size_t)ty * g.side * row_size + (size_t)tx * (g.side / 8);
+
+            for (u32 r = 0; r < th; r++)
+            {
+                memcpy(tile + r * tile_row, src + r * row_size, tile_row);
+            }
+
+            if (th < QTCG_MIN_SIDE)
+            {
+                memset(tile + th * tile_row, 0, (QTCG_MIN_SIDE - th) * tile_row);
+            }
+
+            u32 size;
+            ok = qtcf_ctx_encode(ctx, tile, out + pos, MIN(out_cap - pos, UINT32_MAX), &size);
+            pos += size;
+        }
+    }
+
+    ctxs_free(ctxs);
+    free(tile);
+
+    *out_size = pos;
+
+    return ok;
+}
+
+u8 *qtcg_decode(const u8 *data, u32 w, u32 h, u64 *in_size)
+{
+    u8 *pix = malloc(((size_t)w + 7) / 8 * h);
+
+    if (!pix || !qtcg_decode_into(data, w, h, pix, in_size))
+    {
+        free(pix);
+        return NULL;
+    }
+
+    return pix;
+}
+
+bool qtcg_decode_into(const u8 *data, u32 w, u32 h, u8 *out, u64 *in_size)
+{
+    u8 side_log2 = data[0];
+
+    if (w == 0 || h == 0 || side_log2 < QTCG_MIN_TILE_LOG2 || side_log2 > QTCG_MAX_TILE_LOG2)
+    {
+        return false;
+    }
+
+    qtcg_grid g;
+    grid_init(&g, w, h, side_log2);
+
+    size_t row_size = ((size_t)w + 7) / 8;
+    u8 *tile = malloc((size_t)g.side / 8 * g.side);
+    qtcf_ctx *ctxs[2][2] = {{NULL, NULL}, {NULL, NULL}};
+
+    bool ok = tile != NULL;
+    u64 pos = 1;
+
+    for (u32 ty = 0; ok && ty < g.rows; ty++)
+    {
+        for (u32 tx = 0; ok && tx < g.cols; tx++)
+        {
+            qtcf_ctx *ctx = tile_ctx(ctxs, &g, tx, ty);
+            u32 size;
+
+            if (!ctx || !qtcf_ctx_decode(ctx, data + pos, tile, &size))
+            {
+                ok = false;
+                break;
+            }
+
+            pos += size;
+
+            u32 th = tile_h(&g, ty);
+            size_t tile_row = ((size_t)tile_w(&g, tx) + 7) / 8;
+            u8 *dst = out + (size_t)ty * g.side * row_size + (size_t)tx * (g.side / 8);
+
+            for (u32 r = 0; r < th; r++)
+            {
+                memcpy(dst + r * row_size, tile + r * tile_row, tile_row);
+            }
+        }
+    }
+
+    ctxs_free(ctxs);
+    free(tile);
+
+    *in_size = pos;
+
+    return ok;
+}
@@ -0,0 +1,80 @@
+#ifndef __QTCG_H__
+#define __QTCG_H__
+
+#include "types.h"
+
+/**
+ * Smallest and largest tile side, as log2, of the qtcg grid
+ */
+#define QTCG_MIN_TILE_LOG2 3
+#define QTCG_MAX_TILE_LOG2 15
+
+/**
+ * Compress a 1-bit raster image as a row-major grid of square quad trees.
+ * A single qtcf tree pads the image to the next power-of-two square, while
+ * the grid picks a power-of-two tile side that leaves little padding and
+ * codes every tile as its own qtcf stream, so memory is bounded by the tile
+ * size. The stream is the log2 of the tile side followed by the tile streams.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtcg_encode(const u8 *data, u32 w, u32 h, u64 *out_size);
+
+/**
+ * Get the largest size qtcg_encode can produce for an image of the specified
+ * size.
+ *
+ * @param w image width
+ * @param h image height
+ *
+ * @return worst-case size, in bytes, of compressed data. 0 if the size is invalid
+ */
+u64 qtcg_max_compressed_size(u32 w, u32 h);
+
+/**
+ * Compress a 1-bit raster image as a grid of quad trees into a
+ * caller-provided buffer.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out output buffer, qtcg_max_compressed_size bytes always suffice
+ * @param out_cap size, in bytes, of the output buffer
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtcg_encode_into(const u8 *data, u32 w, u32 h, u8 *out, u64 out_cap, u64 *out_size);
+
+/**
+ * Decompress a 1-bit raster image coded as a grid of quad trees.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return pointer to decompressed, 1-bit raster image. NULL if unsuccessful
+ */
+u8 *qtcg_decode(const u8 *data, u32 w, u32 h, u64 *in_size);
+
+/**
+ * Decompress a 1-bit raster image coded as a grid of quad trees into a
+ * caller-provided buffer.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param out output raster of (w + 7) / 8 * h bytes
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return true if successful, false if out of memory or the data is invalid
+ */
+bool qtcg_decode_into(const u8 *data, u32 w, u32 h, u8 *out, u64 *in_size);
+
+#endif // __QTCG_H__
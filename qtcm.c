@@ -0,0 +1,400 @@
+#include "qtcm.h"
+#include "qtsp.h"
+#include "qtir.h"
+#include "qtco.h"
+#include "mort.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Height, in levels, of the blocks an update rebuilds
+ */
+#define QTCM_BLOCK_LVLS 5
+
+/**
+ * Rectangle of new pixels being written over the blocks of a tree it covers
+ */
+typedef struct
+{
+    const qtsp_tree *src;
+    // tree of the pixels that change
+    qtsp_tree *diff;
+    u8 blk_lvls;
+    u32 x;
+    u32 y;
+    u32 w;
+    u32 h;
+    const u8 *data;
+    bool oom;
+} qtcm_patch;
+
+/**
+ * Copy the leaves and uniform subtrees of a subtree of one tree into another
+ *
+ * @param src source tree
+ * @param root offset of the subtree root in src
+ * @param src_l level of the subtree root in src
+ * @param dst tree being built, levels past those already added
+ * @param dst_root offset of the subtree root in dst
+ * @param dst_l level of the subtree root in dst
+ *
+ * @return false if out of memory
+ */
+static bool subtree_copy(const qtsp_tree *src, u64 root, u8 src_l, qtsp_tree *dst, u64 dst_root, u8 dst_l)
+{
+    for (u8 l = src_l; l < src->lvls; l++)
+    {
+        const qtsp_list *v = &src->lvl[l];
+        u8 sh = 2 * (l - src_l);
+        u64 first = root << sh;
+        u64 dst_first = dst_root << sh;
+
+        for (u64 j = qtsp_find(v, first); j < v->n && v->nodes[j].i >> sh == root; j++)
+        {
+            const qtsp_node *nd = v->nodes + j;
+            u8 u = 0;
+
+            if (l + 1 == src->lvls)
+            {
+                u = nd->val;
+            }
+            else if (nd->flags & QTSP_NODE_UNIFORM)
+            {
+                u = qtsp_leaf(nd);
+            }
+
+            if (!qtsp_uniform(dst, dst_l + l - src_l, dst_first + (nd->i - first), u))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+u8 *qtcm_crop(const u8 *data, u32 w, u32 h, u8 lvls, u32 tx, u32 ty, u64 *out_size)
+{
+    u8 src_lvls = calc_lvls(w, h);
+
+    if (!qt_lvls_ok(src_lvls) || !qt_lvls_ok(lvls) || lvls > src_lvls)
+    {
+        return NULL;
+    }
+
+    u8 root_l = src_lvls - lvls;
+
+    if (tx >> root_l || ty >> root_l)
+    {
+        return NULL;
+    }
+
+    qtsp_tree src, dst;
+    u64 root = morton64_encode(tx, ty);
+    u8 *out = NULL;
+
+    qtsp_init(&src, src_lvls);
+    qtsp_init(&dst, lvls);
+
+    bool ok = qtsp_image(&src, data, w, h);
+    bool done = false;
+
+    // the tile may lie within a uniform subtree
+    for (u8 l = 0; ok && !done && l < root_l; l++)
+    {
+        const qtsp_list *v = &src.lvl[l];
+        u64 i = root >> (2 * (root_l - l));
+        u64 j = qtsp_find(v, i);
+
+        if (j == v->n || v->nodes[j].i != i)
+        {
+            done = true;
+        }
+        else if (v->nodes[j].flags & QTSP_NODE_UNIFORM)
+        {
+            ok = qtsp_uniform(&dst, 0, 0, qtsp_leaf(v->nodes + j));
+            done = true;
+        }
+    }
+
+    if (ok && !done)
+    {
+        ok = subtree_copy(&src, root, root_l, &dst, 0, 0);
+    }
+
+    qtsp_free(&src);
+
+    if (ok && qtsp_consolidate(&dst))
+    {
+        out = qtsp_encode(&dst, 1U << lvls, 1U << lvls, out_size);
+    }
+
+    qtsp_free(&dst);
+
+    return out;
+}
+
+u8 *qtcm_mosaic(const u8 *const tiles[4], u8 lvls, u64 *out_size)
+{
+    if (!qt_lvls_ok(lvls) || !qt_lvls_ok(lvls + 1))
+    {
+        return NULL;
+    }
+
+    u32 side = 1U << lvls;
+    qtsp_tree dst;
+    u8 *out = NULL;
+    bool ok = true;
+
+    qtsp_init(&dst, lvls + 1);
+
+    // the tiles are the subtrees of the root in Morton order, so every level
+    // of the parent is built in order
+    for (u8 q = 0; ok && q < QUAD_Cnt; q++)
+    {
+        if (!tiles[q])
+        {
+            continue;
+        }
+
+        qtsp_tree src;
+        qtsp_init(&src, lvls);
+
+        ok = qtsp_image(&src, tiles[q], side, side) && subtree_copy(&src, 0, 0, &dst, q, 1);
+
+        qtsp_free(&src);
+    }
+
+    if (ok && qtsp_consolidate(&dst))
+    {
+        out = qtsp_encode(&dst, 2 * side, 2 * side, out_size);
+    }
+
+    qtsp_free(&dst);
+
+    return out;
+}
+
+/**
+ * Draw a uniform square into the rows of a block
+ *
+ * @param rows rows of the block, pixel x of the block in bit x
+ * @param x x of the first pixel of the square within the block
+ * @param y y of the first pixel of the square within the block
+ * @param k log2 of the square side, at least 1
+ * @param u leaf nibble of the square
+ */
+static void square_draw(u32 *rows, u32 x, u32 y, u8 k, u8 u)
+{
+    u32 side = 1U << k;
+    u32 mask = (UINT32_MAX >> (32 - side)) << x;
+    u32 pat[2] = {(u & 0x3) * 0x55555555U, (u >> 2) * 0x55555555U};
+
+    for (u32 r = 0; r < side; r++)
+    {
+        rows[y + r] |= pat[r & 1] & mask;
+    }
+}
+
+/**
+ * Read the pixels of a block of a tree into rows, from the nodes of the
+ * block and the path to it
+ */
+static void block_render(const qtsp_tree *t, u8 blk_lvls, u32 bx, u32 by, u32 *rows)
+{
+    u8 root_l = t->lvls - blk_lvls;
+    u64 root = morton64_encode(bx, by);
+
+    memset(rows, 0, sizeof(u32) << blk_lvls);
+
+    // the block may be empty or lie within a uniform subtree
+    for (u8 l = 0; l <= root_l; l++)
+    {
+        const qtsp_list *v = &t->lvl[l];
+        u64 i = root >> (2 * (root_l - l));
+        u64 j = qtsp_find(v, i);
+
+        if (j == v->n || v->nodes[j].i != i)
+        {
+            return;
+        }
+
+        if (v->nodes[j].flags & QTSP_NODE_UNIFORM)
+        {
+            square_draw(rows, 0, 0, blk_lvls, qtsp_leaf(v->nodes + j));
+            return;
+        }
+    }
+
+    for (u8 l = root_l + 1; l < t->lvls; l++)
+    {
+        const qtsp_list *v = &t->lvl[l];
+        u8 sh = 2 * (l - root_l);
+        u8 k = t->lvls - l;
+        u64 first = root << sh;
+
+        for (u64 j = qtsp_find(v, first); j < v->n && v->nodes[j].i >> sh == root; j++)
+        {
+            const qtsp_node *nd = v->nodes + j;
+            u8 u;
+
+            if (l + 1 == t->lvls)
+            {
+                u = nd->val;
+            }
+            else if (nd->flags & QTSP_NODE_UNIFORM)
+            {
+                u = qtsp_leaf(nd);
+            }
+            else
+            {
+                continue;
+            }
+
+            u32 x, y;
+            morton64_decode(nd->i - first, &x, &y);
+
+            square_draw(rows, x << k, y << k, k, u);
+        }
+    }
+}
+
+/**
+ * Write the pixels of the patch that fall within a block over its rows
+ */
+static void patch_write(const qtcm_patch *p, u32 bx, u32 by, u32 *rows)
+{
+    u32 side = 1U << p->blk_lvls;
+    u64 x0 = (u64)bx * side;
+    u64 y0 = (u64)by * side;
+    u64 cx0 = MAX(x0, p->x);
+    u64 cx1 = MIN(x0 + side, (u64)p->x + p->w);
+
+    size_t row_size = ((size_t)p->w + 7) / 8;
+    u32 col = cx0 - p->x;
+    u32 mask = (UINT32_MAX >> (32 - (cx1 - cx0))) << (cx0 - x0);
+
+    for (u32 r = 0; r < side; r++)
+    {
+        u64 y = y0 + r;
+
+        if (y < p->y || y >= (u64)p->y + p->h)
+        {
+            continue;
+        }
+
+        const u8 *row = p->data + (y - p->y) * row_size + col / 8;
+        u64 bits = row_load_64(row, MIN(8, row_size - col / 8)) >> (col % 8);
+
+        rows[r] = (rows[r] & ~mask) | ((u32)(bits << (cx0 - x0)) & mask);
+    }
+}
+
+/**
+ * Add the changed pixels of the blocks of a square of the block grid that
+ * the patch covers, in Morton order
+ *
+ * @param bx x of the first block of the square
+ * @param by y of the first block of the square
+ * @param lvl log2 of the square side, in blocks
+ */
+static void patch_visit(qtcm_patch *p, u32 bx, u32 by, u8 lvl)
+{
+    u64 side = (u64)1 << (p->blk_lvls + lvl);
+    u64 x = (u64)bx << p->blk_lvls;
+    u64 y = (u64)by << p->blk_lvls;
+
+    if (p->oom || x >= (u64)p->x + p->w || y >= (u64)p->y + p->h || x + side <= p->x || y + side <= p->y)
+    {
+        return;
+    }
+
+    if (lvl == 0)
+    {
+        u32 rows[1 << QTCM_BLOCK_LVLS];
+        u32 diff[1 << QTCM_BLOCK_LVLS];
+
+        block_render(p->src, p->blk_lvls, bx, by, rows);
+        memcpy(diff, rows, sizeof(u32) << p->blk_lvls);
+        patch_write(p, bx, by, rows);
+
+        for (u32 r = 0; r < 1U << p->blk_lvls; r++)
+        {
+            diff[r] ^= rows[r];
+        }
+
+        p->oom = !qtsp_block(p->diff, p->blk_lvls, bx, by, diff);
+        return;
+    }
+
+    u32 half = 1U << (lvl - 1);
+
+    patch_visit(p, bx, by, lvl - 1);
+    patch_visit(p, bx + half, by, lvl - 1);
+    patch_visit(p, bx, by + half, lvl - 1);
+    patch_visit(p, bx + half, by + half, lvl - 1);
+}
+
+u8 *qtcm_update(const u8 *data, u32 w, u32 h, u32 x, u32 y, u32 pw, u32 ph, const u8 *patch, u64 *out_size)
+{
+    u8 lvls = calc_lvls(w, h);
+
+    if (!qt_lvls_ok(lvls) || pw == 0 || ph == 0 || x >= w || pw > w - x || y >= h || ph > h - y)
+    {
+        return NULL;
+    }
+
+    // stream, area, inverted stream, the pixels that change and the result
+    qtsp_tree t[5];
+    u8 *out = NULL;
+    bool inverted = false;
+    u64 in_size;
+
+    for (u8 j = 0; j < 5; j++)
+    {
+        qtsp_init(&t[j], lvls);
+    }
+
+    bool ok = qtsp_from_qtcf(&t[0], data, &inverted, &in_size);
+
+    // pixels past the width in the last leaf of a row are kept, as decoding
+    // and encoding again keeps them
+    if (ok && inverted)
+    {
+        ok = qtsp_area(&t[1], 2 * ((u64)w / 2 + (w & 1)), h) && qtsp_combine(&t[0], &t[1], QTCO_XOR, &t[2]);
+    }
+
+    qtcm_patch p;
+
+    p.src = inverted ? &t[2] : &t[0];
+    p.diff = &t[3];
+    p.blk_lvls = MIN(lvls, QTCM_BLOCK_LVLS);
+    p.x = x;
+    p.y = y;
+    p.w = pw;
+    p.h = ph;
+    p.data = patch;
+    p.oom = false;
+
+    // only the blocks under the patch are read and rebuilt, the rest of the
+    // tree is taken as it is by the xor
+    if (ok)
+    {
+        patch_visit(&p, 0, 0, lvls - p.blk_lvls);
+        ok = !p.oom && qtsp_consolidate(&t[3]);
+    }
+
+    if (ok && qtsp_combine(p.src, &t[3], QTCO_XOR, &t[4]))
+    {
+        out = qtsp_encode(&t[4], w, h, out_size);
+    }
+
+    for (u8 j = 0; j < 5; j++)
+    {
+        qtsp_free(&t[j]);
+    }
+
+    return out;
+}
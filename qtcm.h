@@ -0,0 +1,60 @@
+#ifndef __QTCM_H__
+#define __QTCM_H__
+
+#include "types.h"
+
+/**
+ * Extract an aligned square tile of an image from its qtcf stream, as the
+ * stream of the tile image. The tile is a subtree of the image tree, so its
+ * nodes are taken from the sparse tree of the stream as they are, without a
+ * raster. Pixels of the tile past the image are clear.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param lvls log2 of the tile side, at least 3 as in qtcf and at most the
+ * height of the image tree
+ * @param tx x of the tile, in tiles
+ * @param ty y of the tile, in tiles
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtcm_crop(const u8 *data, u32 w, u32 h, u8 lvls, u32 tx, u32 ty, u64 *out_size);
+
+/**
+ * Stitch four square tiles into the stream of their parent tile, of twice
+ * their side. The tile trees become the subtrees of a new root, so a tile
+ * pyramid is built level by level from the streams alone.
+ *
+ * @param tiles compressed tiles in NW, NE, SW, SE order, NULL for an empty
+ * tile
+ * @param lvls log2 of the tile side, at least 3 as in qtcf
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtcm_mosaic(const u8 *const tiles[4], u8 lvls, u64 *out_size);
+
+/**
+ * Write a rectangle of new pixels into an image, from its qtcf stream to the
+ * stream of the edited image. Only the blocks of the sparse tree under the
+ * rectangle are read and rebuilt, as a tree of the pixels that change, which
+ * is xor-ed into the tree of the stream. The sizes along the path to the root
+ * are recomputed as the tree is written, with no raster of the image.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param x x of the first pixel of the rectangle
+ * @param y y of the first pixel of the rectangle
+ * @param pw width of the rectangle, within the image
+ * @param ph height of the rectangle, within the image
+ * @param patch pointer to raster data of the rectangle in row-major order. Rows should be byte-aligned
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtcm_update(const u8 *data, u32 w, u32 h, u32 x, u32 y, u32 pw, u32 ph, const u8 *patch, u64 *out_size);
+
+#endif // __QTCM_H__
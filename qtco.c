@@ -0,0 +1,423 @@
+#include "qtco.h"
+#include "qtsp.h"
+#include "qtir.h"
+#include "qtc_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * No node of an operand on the level of a pair
+ */
+#define QTCO_NONE UINT64_MAX
+
+/**
+ * Node of the combined tree and the subtrees of the operands at its position
+ */
+typedef struct
+{
+    u64 i;
+    // node of each operand on the level, QTCO_NONE if the position is empty
+    // or within a uniform subtree
+    u64 node[2];
+    // leaf nibble of the uniform subtree of each operand, 0 if empty
+    u8 u[2];
+} qtco_pair;
+
+typedef struct
+{
+    qtco_pair *pairs;
+    u64 n;
+    u64 cap;
+} qtco_list;
+
+static qtco_pair *pair_push(qtco_list *l, u64 i)
+{
+    if (l->n == l->cap)
+    {
+        u64 cap = l->cap ? 2 * l->cap : 64;
+        if (cap > SIZE_MAX / sizeof(qtco_pair))
+        {
+            return NULL;
+        }
+
+        qtco_pair *pairs = realloc(l->pairs, cap * sizeof(qtco_pair));
+        if (!pairs)
+        {
+            return NULL;
+        }
+
+        l->pairs = pairs;
+        l->cap = cap;
+    }
+
+    qtco_pair *pr = l->pairs + l->n++;
+
+    pr->i = i;
+    pr->node[0] = QTCO_NONE;
+    pr->node[1] = QTCO_NONE;
+    pr->u[0] = 0;
+    pr->u[1] = 0;
+
+    return pr;
+}
+
+static u8 op_apply(u8 op, u8 a, u8 b)
+{
+    switch (op)
+    {
+    case QTCO_AND:
+        return a & b;
+    case QTCO_OR:
+        return a | b;
+    case QTCO_XOR:
+        return a ^ b;
+    default:
+        return a & ~b & 0xF;
+    }
+}
+
+/**
+ * Resolve the side of a pair that is a leaf or a uniform terminal into its
+ * leaf nibble
+ *
+ * @return true if the side is uniform, or empty, on the whole subtree
+ */
+static bool side_uniform(const qtsp_tree *t, u8 l, const qtco_pair *pr, u8 s, u8 *u)
+{
+    if (pr->node[s] == QTCO_NONE)
+    {
+        *u = pr->u[s];
+        return true;
+    }
+
+    const qtsp_node *nd = t->lvl[l].nodes + pr->node[s];
+
+    if (l + 1 == t->lvls)
+    {
+        *u = nd->val;
+        return true;
+    }
+
+    if (nd->flags & QTSP_NODE_UNIFORM)
+    {
+        *u = qtsp_leaf(nd);
+        return true;
+    }
+
+    return false;
+}
+
+bool qtsp_combine(const qtsp_tree *a, const qtsp_tree *b, u8 op, qtsp_tree *r)
+{
+    const qtsp_tree *t[2] = {a, b};
+    u8 lvls = r->lvls;
+    qtco_list v[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    bool ok = true;
+
+    if (t[0]->lvl[0].n || t[1]->lvl[0].n)
+    {
+        qtco_pair *pr = pair_push(&v[0], 0);
+        ok = pr != NULL;
+
+        for (u8 s = 0; ok && s < 2; s++)
+        {
+            pr->node[s] = t[s]->lvl[0].n ? 0 : QTCO_NONE;
+        }
+    }
+
+    for (u8 l = 0; ok && l < lvls; l++)
+    {
+        qtco_list *cur = &v[l & 1];
+        qtco_list *next = &v[!(l & 1)];
+        u64 k[2] = {0, 0};
+
+        next->n = 0;
+
+        for (u64 j = 0; ok && j < cur->n; j++)
+        {
+            const qtco_pair *pr = cur->pairs + j;
+            u8 u[2];
+            bool uni[2];
+
+            for (u8 s = 0; s < 2; s++)
+            {
+                uni[s] = side_uniform(t[s], l, pr, s, &u[s]);
+            }
+
+            // a uniform operand decides the result if it does not depend on
+            // the other operand
+            if (uni[0] && uni[1])
+            {
+                ok = qtsp_uniform(r, l, pr->i, op_apply(op, u[0], u[1]));
+                continue;
+            }
+
+            if (uni[0] && op_apply(op, u[0], 0) == op_apply(op, u[0], 0xF))
+            {
+                ok = qtsp_uniform(r, l, pr->i, op_apply(op, u[0], 0));
+                continue;
+            }
+
+            if (uni[1] && op_apply(op, 0, u[1]) == op_apply(op, 0xF, u[1]))
+            {
+                ok = qtsp_uniform(r, l, pr->i, op_apply(op, 0, u[1]));
+                continue;
+            }
+
+            for (u8 q = 0; ok && q < QUAD_Cnt; q++)
+            {
+                u64 ci = 4 * pr->i + q;
+                u64 node[2] = {QTCO_NONE, QTCO_NONE};
+                u8 cu[2] = {0, 0};
+
+                for (u8 s = 0; s < 2; s++)
+                {
+                    const qtsp_list *c = &t[s]->lvl[l + 1];
+
+                    if (uni[s])
+                    {
+                        cu[s] = u[s];
+                        continue;
+                    }
+
+                    while (k[s] < c->n && c->nodes[k[s]].i < ci)
+                    {
+                        k[s]++;
+                    }
+
+                    if (k[s] < c->n && c->nodes[k[s]].i == ci)
+                    {
+                        node[s] = k[s];
+                    }
+                }
+
+                if (node[0] == QTCO_NONE && node[1] == QTCO_NONE && cu[0] == 0 && cu[1] == 0)
+                {
+                    continue;
+                }
+
+                qtco_pair *ch = pair_push(next, ci);
+                if (!ch)
+                {
+                    ok = false;
+                    break;
+                }
+
+                for (u8 s = 0; s < 2; s++)
+                {
+                    ch->node[s] = node[s];
+                    ch->u[s] = cu[s];
+                }
+            }
+        }
+    }
+
+    free(v[0].pairs);
+    free(v[1].pairs);
+
+    return ok && qtsp_consolidate(r);
+}
+
+/**
+ * Add the nodes of a rectangle at the top left of the tree
+ *
+ * @param l level of the node
+ * @param i offset of the node within its level
+ * @param x x of the first pixel of the node
+ * @param y y of the first pixel of the node
+ * @param w width of the rectangle
+ * @param h height of the rectangle
+ *
+ * @return false if out of memory
+ */
+static bool area_add(qtsp_tree *t, u8 l, u64 i, u64 x, u64 y, u64 w, u64 h)
+{
+    u64 side = (u64)1 << (t->lvls - l);
+
+    if (x >= w || y >= h)
+    {
+        return true;
+    }
+
+    if (x + side <= w && y + side <= h)
+    {
+        return qtsp_uniform(t, l, i, 0xF);
+    }
+
+    if (l + 1 == t->lvls)
+    {
+        u8 leaf = 0x1;
+
+        leaf |= (x + 1 < w) << QUAD_NE;
+        leaf |= (y + 1 < h) << QUAD_SW;
+        leaf |= (x + 1 < w && y + 1 < h) << QUAD_SE;
+
+        return qtsp_uniform(t, l, i, leaf);
+    }
+
+    u64 half = side / 2;
+
+    for (u8 q = 0; q < QUAD_Cnt; q++)
+    {
+        if (!area_add(t, l + 1, 4 * i + q, x + (q & 1) * half, y + (q >> 1) * half, w, h))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool qtsp_area(qtsp_tree *t, u64 w, u64 h)
+{
+    return area_add(t, 0, 0, 0, 0, w, h) && qtsp_consolidate(t);
+}
+
+/**
+ * Replace a tree by that of the inverted image, as the xor with the area
+ *
+ * @param t tree
+ * @param area tree of the area of the image
+ *
+ * @return false if out of memory
+ */
+static bool tree_invert(qtsp_tree *t, const qtsp_tree *area)
+{
+    qtsp_tree inv;
+    qtsp_init(&inv, t->lvls);
+
+    if (!qtsp_combine(t, area, QTCO_XOR, &inv))
+    {
+        qtsp_free(&inv);
+        return false;
+    }
+
+    qtsp_free(t);
+    *t = inv;
+
+    return true;
+}
+
+bool qtsp_image(qtsp_tree *t, const u8 *data, u32 w, u32 h)
+{
+    qtsp_tree p, area;
+    bool inverted;
+    u64 in_size;
+
+    qtsp_init(&p, t->lvls);
+    qtsp_init(&area, t->lvls);
+
+    // the decoder inverts the whole raster of an inverted stream, and pixels
+    // past the width in the last leaf of a row are not part of the image
+    bool ok = qtsp_from_qtcf(&p, data, &inverted, &in_size) && qtsp_area(&area, w, h);
+
+    if (ok && inverted)
+    {
+        ok = qtsp_combine(&area, &p, QTCO_ANDNOT, t);
+    }
+    else if (ok)
+    {
+        ok = qtsp_combine(&p, &area, QTCO_AND, t);
+    }
+
+    qtsp_free(&p);
+    qtsp_free(&area);
+
+    return ok;
+}
+
+u8 *qtsp_encode(qtsp_tree *t, u32 w, u32 h, u64 *out_size)
+{
+    qtsp_tree area, inv;
+    qtsp_out o[2] = {{NULL, 0, 0, false}, {NULL, 0, 0, false}};
+
+    qtsp_init(&area, t->lvls);
+    qtsp_init(&inv, t->lvls);
+
+    // the encoder inverts the pixels past the width in the last leaf of a row
+    bool ok = qtsp_area(&area, 2 * ((u64)w / 2 + (w & 1)), h) && qtsp_combine(t, &area, QTCO_XOR, &inv);
+
+    ok = ok && qtsp_write(t, false, &o[0]) && qtsp_write(&inv, true, &o[1]);
+
+    qtsp_free(&area);
+    qtsp_free(&inv);
+
+    if (!ok)
+    {
+        free(o[0].out);
+        free(o[1].out);
+        return NULL;
+    }
+
+    u64 size = (o[0].pos + 1) / 2;
+    u64 inv_size = (o[1].pos + 1) / 2;
+
+    QTC_STATS_ADD(normal_bytes, size);
+    QTC_STATS_ADD(inverted_bytes, inv_size);
+    QTC_STATS_ADD(normal_won, inv_size >= size);
+    QTC_STATS_ADD(inverted_won, inv_size < size);
+
+    u8 pick = inv_size < size;
+
+    free(o[!pick].out);
+
+    *out_size = pick ? inv_size : size;
+
+    return realloc(o[pick].out, *out_size);
+}
+
+u8 *qtco_combine(const u8 *a, const u8 *b, u32 w, u32 h, u8 op, u64 *out_size)
+{
+    u8 lvls = calc_lvls(w, h);
+
+    if (!qt_lvls_ok(lvls) || op > QTCO_ANDNOT)
+    {
+        return NULL;
+    }
+
+    // operands, the area and the result
+    qtsp_tree t[4];
+    const u8 *in[2] = {a, b};
+    u8 *out = NULL;
+
+    for (u8 j = 0; j < 4; j++)
+    {
+        qtsp_init(&t[j], lvls);
+    }
+
+    QTC_STATS_TIMER(tm);
+
+    // pixels past the width in the last leaf of a row are kept, as decoding
+    // and encoding again keeps them
+    bool ok = qtsp_area(&t[2], 2 * ((u64)w / 2 + (w & 1)), h);
+
+    for (u8 s = 0; ok && s < 2; s++)
+    {
+        bool inverted;
+        u64 in_size;
+
+        ok = qtsp_from_qtcf(&t[s], in[s], &inverted, &in_size);
+
+        if (ok && inverted)
+        {
+            ok = tree_invert(&t[s], &t[2]);
+        }
+    }
+    QTC_STATS_PHASE(QTC_PHASE_PARSE, tm);
+
+    ok = ok && qtsp_combine(&t[0], &t[1], op, &t[3]);
+    QTC_STATS_PHASE(QTC_PHASE_BUILD, tm);
+
+    if (ok)
+    {
+        out = qtsp_encode(&t[3], w, h, out_size);
+    }
+
+    for (u8 j = 0; j < 4; j++)
+    {
+        qtsp_free(&t[j]);
+    }
+
+    return out;
+}
@@ -0,0 +1,38 @@
+#ifndef __QTCO_H__
+#define __QTCO_H__
+
+#include "types.h"
+
+/**
+ * Boolean operations of qtco_combine, applied to each pixel of the two images
+ */
+enum
+{
+    QTCO_AND,
+    QTCO_OR,
+    QTCO_XOR,
+    // pixels of the first image that are not set in the second
+    QTCO_ANDNOT,
+};
+
+/**
+ * Combine two qtcf streams of images of the same size with a boolean
+ * operation, without decoding them. Both streams are read into sparse quad
+ * trees and walked together level by level. Where either operand is a
+ * uniform subtree that decides the result, such as a fill of zero under AND,
+ * the subtree is not descended, so the cost follows the occupied nodes of
+ * the operands rather than the area of the image. The result is the stream
+ * qtcf_encode64 produces for the combined image.
+ *
+ * @param a first compressed image
+ * @param b second compressed image
+ * @param w image width
+ * @param h image height
+ * @param op one of QTCO_AND, QTCO_OR, QTCO_XOR or QTCO_ANDNOT
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtco_combine(const u8 *a, const u8 *b, u32 w, u32 h, u8 op, u64 *out_size);
+
+#endif // __QTCO_H__
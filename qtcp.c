@@ -0,0 +1,131 @@
+#include "qtcp.h"
+#include "qtir.h"
+#include "mort.h"
+#include "utils.h"
+
+#include <stdlib.h>
+
+/**
+ * Count the pixels of a leaf nibble within a mask
+ */
+static u32 nibble_count(u8 u, u8 mask)
+{
+    static const u8 bits[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+    return bits[u & mask];
+}
+
+/**
+ * Write a level of the pyramid from the pixel counts of the nodes of its tree
+ * level
+ *
+ * @param lvl nodes of the tree level, pixel counts in sub_size
+ * @param w image width
+ * @param h image height
+ * @param k pyramid level
+ * @param out output level
+ */
+static void lvl_write(const qtir_node *lvl, u16 w, u16 h, u8 k, u8 *out)
+{
+    u32 side = 1U << k;
+    u32 lw = ((u32)w + side - 1) >> k;
+    u32 lh = ((u32)h + side - 1) >> k;
+
+    for (u32 y = 0; y < lh; y++)
+    {
+        u32 bh = MIN(side, h - y * side);
+        u32 mc = morton_encode(0, y);
+
+        for (u32 x = 0; x < lw; x++)
+        {
+            u64 cnt = lvl[mc].sub_size * 255ULL;
+            u32 bw = MIN(side, w - x * side);
+
+            // blocks within the image divide by a power of two
+            if (bw == side && bh == side)
+            {
+                *out++ = (cnt + side * side / 2) >> (2 * k);
+            }
+            else
+            {
+                *out++ = (cnt + (u64)bw * bh / 2) / ((u64)bw * bh);
+            }
+
+            morton_inc_x(&mc);
+        }
+    }
+}
+
+u64 qtcp_offset(u16 w, u16 h, u8 k)
+{
+    u64 off = 0;
+
+    for (u8 l = 1; l < k; l++)
+    {
+        u32 side = 1U << l;
+
+        off += (u64)(((u32)w + side - 1) >> l) * (((u32)h + side - 1) >> l);
+    }
+
+    return off;
+}
+
+u8 *qtcp_pyramid(const u8 *data, u16 w, u16 h, u8 *lvls, u64 *out_size)
+{
+    u32 qt_n;
+    qtir_node *qtir = qtir_from_raster(data, w, h, &qt_n);
+    if (!qtir)
+    {
+        return NULL;
+    }
+
+    *lvls = calc_lvls(w, h);
+    *out_size = qtcp_offset(w, h, *lvls + 1);
+
+    u8 *out = (u8 *)malloc(*out_size);
+    if (!out)
+    {
+        free(qtir);
+        return NULL;
+    }
+
+    u32 start = qt_n / 4;
+
+    for (u32 i = start; i < qt_n; i++)
+    {
+        qtir[i].sub_size = nibble_count(qtir[i].val, 0xF);
+    }
+
+    // the leaves of the last column of an odd width hold the raster padding
+    if (w & 1)
+    {
+        for (u32 y = 0; y < (u32)h / 2 + (h & 1); y++)
+        {
+            qtir_node *leaf = qtir + start + morton_encode(w / 2, y);
+
+            leaf->sub_size = nibble_count(leaf->val, 0x5);
+        }
+    }
+
+    lvl_write(qtir + start, w, h, 1, out);
+
+    // sum the counts up the tree, a level at a time
+    for (u8 k = 2; k <= *lvls; k++)
+    {
+        u32 end = start;
+        start = (start - 1) / 4;
+
+        for (u32 i = start; i < end; i++)
+        {
+            qtir_node *c = qtir + 4 * i + 1;
+
+            qtir[i].sub_size = qtir[i].val ? c[0].sub_size + c[1].sub_size + c[2].sub_size + c[3].sub_size : 0;
+        }
+
+        lvl_write(qtir + start, w, h, k, out + qtcp_offset(w, h, k));
+    }
+
+    free(qtir);
+
+    return out;
+}
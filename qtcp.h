@@ -0,0 +1,41 @@
+#ifndef __QTCP_H__
+#define __QTCP_H__
+
+#include "types.h"
+
+/**
+ * Build the coverage pyramid of a 1-bit raster image: for every block side
+ * 2^k, from 2 up to the side of the quad tree, an 8-bit image of the fraction
+ * of set pixels in each block, 255 being fully set. The node at level
+ * lvls - k of the quad tree is the block of pyramid level k, so the pixel
+ * counts are summed up the intermediate representation in a single pass and
+ * each level is written as its counts are complete, with no box filter over
+ * the raster. Blocks at the right and bottom edges are scaled by their area
+ * within the image.
+ *
+ * Level k is ceil(w / 2^k) by ceil(h / 2^k) bytes in row-major order, and
+ * levels are stored one after another from k = 1, at qtcp_offset.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param lvls number of levels of the pyramid
+ * @param out_size size, in bytes, of the pyramid
+ *
+ * @return pointer to pyramid. NULL if unsuccessful
+ */
+u8 *qtcp_pyramid(const u8 *data, u16 w, u16 h, u8 *lvls, u64 *out_size);
+
+/**
+ * Get the offset of a level in a coverage pyramid
+ *
+ * @param w image width
+ * @param h image height
+ * @param k level, as log2 of its block side, from 1. One past the last level
+ * gives the size of the pyramid
+ *
+ * @return offset, in bytes, of the level
+ */
+u64 qtcp_offset(u16 w, u16 h, u8 k);
+
+#endif // __QTCP_H__
@@ -0,0 +1,236 @@
+#include "qtcq.h"
+#include "qtsp.h"
+#include "qtir.h"
+#include "mort.h"
+#include "utils.h"
+
+#include <stdlib.h>
+
+struct qtcq_index
+{
+    u32 w;
+    u32 h;
+    u64 count;
+    // tree of the image, clipped to its size
+    qtsp_tree t;
+};
+
+/**
+ * Bounding box edges, in the order of qtcq_bbox
+ */
+enum
+{
+    QTCQ_EDGE_LEFT,
+    QTCQ_EDGE_TOP,
+    QTCQ_EDGE_RIGHT,
+    QTCQ_EDGE_BOTTOM,
+    QTCQ_EDGE_Cnt
+};
+
+/**
+ * Order in which the children of a node are searched for each edge, those
+ * nearest to the edge first
+ */
+static const u8 edge_order[QTCQ_EDGE_Cnt][QUAD_Cnt] = {
+    {QUAD_NW, QUAD_SW, QUAD_NE, QUAD_SE},
+    {QUAD_NW, QUAD_NE, QUAD_SW, QUAD_SE},
+    {QUAD_NE, QUAD_SE, QUAD_NW, QUAD_SW},
+    {QUAD_SW, QUAD_SE, QUAD_NW, QUAD_NE},
+};
+
+/**
+ * Get the leaf nibble of a node, if its subtree is uniform
+ *
+ * @return false if the node has children
+ */
+static bool node_uniform(const qtsp_tree *t, u8 l, const qtsp_node *nd, u8 *u)
+{
+    if (l + 1 == t->lvls)
+    {
+        *u = nd->val;
+        return true;
+    }
+
+    if (nd->flags & QTSP_NODE_UNIFORM)
+    {
+        *u = qtsp_leaf(nd);
+        return true;
+    }
+
+    return false;
+}
+
+qtcq_index *qtcq_index_create(const u8 *data, u32 w, u32 h)
+{
+    u8 lvls = calc_lvls(w, h);
+
+    if (!qt_lvls_ok(lvls))
+    {
+        return NULL;
+    }
+
+    qtcq_index *idx = malloc(sizeof(qtcq_index));
+    if (!idx)
+    {
+        return NULL;
+    }
+
+    qtsp_init(&idx->t, lvls);
+
+    if (!qtsp_image(&idx->t, data, w, h))
+    {
+        qtcq_index_free(idx);
+        return NULL;
+    }
+
+    idx->w = w;
+    idx->h = h;
+    idx->count = 0;
+
+    for (u8 l = 0; l < lvls; l++)
+    {
+        const qtsp_list *v = &idx->t.lvl[l];
+        u64 leaves = (u64)1 << (2 * (lvls - 1 - l));
+
+        for (u64 j = 0; j < v->n; j++)
+        {
+            u8 u;
+
+            if (node_uniform(&idx->t, l, v->nodes + j, &u))
+            {
+                idx->count += leaves * ((u & 1) + (u >> 1 & 1) + (u >> 2 & 1) + (u >> 3));
+            }
+        }
+    }
+
+    return idx;
+}
+
+void qtcq_index_free(qtcq_index *idx)
+{
+    if (!idx)
+    {
+        return;
+    }
+
+    qtsp_free(&idx->t);
+    free(idx);
+}
+
+u64 qtcq_count(const qtcq_index *idx)
+{
+    return idx->count;
+}
+
+/**
+ * Search a subtree for a set pixel beyond an edge
+ *
+ * @param l level of the node
+ * @param k index of the node within its level
+ * @param e edge
+ * @param best edge found so far, moved outwards by the pixels of the subtree
+ */
+static void edge_find(const qtsp_tree *t, u8 l, u64 k, u8 e, u64 *best)
+{
+    const qtsp_node *nd = t->lvl[l].nodes + k;
+    u8 sh = t->lvls - l;
+    u64 side = (u64)1 << sh;
+    u32 nx, ny;
+
+    morton64_decode(nd->i, &nx, &ny);
+
+    u64 x = (u64)nx << sh;
+    u64 y = (u64)ny << sh;
+
+    bool beyond[QTCQ_EDGE_Cnt] = {x < *best, y < *best, x + side > *best, y + side > *best};
+
+    if (!beyond[e])
+    {
+        return;
+    }
+
+    u8 u;
+
+    if (node_uniform(t, l, nd, &u))
+    {
+        // columns and rows of the leaves that hold set pixels
+        u64 ext[QTCQ_EDGE_Cnt] = {
+            x + !(u & 0x5),
+            y + !(u & 0x3),
+            x + side - !(u & 0xA),
+            y + side - !(u & 0xC),
+        };
+
+        *best = e < QTCQ_EDGE_RIGHT ? MIN(*best, ext[e]) : MAX(*best, ext[e]);
+        return;
+    }
+
+    const qtsp_list *c = &t->lvl[l + 1];
+    u64 ch[QUAD_Cnt] = {UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX};
+
+    for (u64 j = qtsp_find(c, 4 * nd->i); j < c->n && c->nodes[j].i >> 2 == nd->i; j++)
+    {
+        ch[c->nodes[j].i & 3] = j;
+    }
+
+    for (u8 q = 0; q < QUAD_Cnt; q++)
+    {
+        u64 j = ch[edge_order[e][q]];
+
+        if (j != UINT64_MAX)
+        {
+            edge_find(t, l + 1, j, e, best);
+        }
+    }
+}
+
+bool qtcq_bbox(const qtcq_index *idx, u32 bbox[4])
+{
+    if (idx->count == 0)
+    {
+        return false;
+    }
+
+    for (u8 e = 0; e < QTCQ_EDGE_Cnt; e++)
+    {
+        u64 best = e < QTCQ_EDGE_RIGHT ? UINT64_MAX : 0;
+
+        edge_find(&idx->t, 0, 0, e, &best);
+
+        bbox[e] = best;
+    }
+
+    return true;
+}
+
+bool qtcq_get(const qtcq_index *idx, u32 x, u32 y)
+{
+    if (x >= idx->w || y >= idx->h)
+    {
+        return false;
+    }
+
+    const qtsp_tree *t = &idx->t;
+    u64 leaf = morton64_encode(x / 2, y / 2);
+
+    for (u8 l = 0; l < t->lvls; l++)
+    {
+        const qtsp_list *v = &t->lvl[l];
+        u64 i = leaf >> (2 * (t->lvls - 1 - l));
+        u64 k = qtsp_find(v, i);
+
+        if (k == v->n || v->nodes[k].i != i)
+        {
+            return false;
+        }
+
+        u8 u;
+
+        if (node_uniform(t, l, v->nodes + k, &u))
+        {
+            return (u >> ((x & 1) | (y & 1) << 1)) & 1;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,68 @@
+#ifndef __QTCQ_H__
+#define __QTCQ_H__
+
+#include "types.h"
+
+/**
+ * Sparse quad tree of a qtcf stream for answering queries without a raster.
+ * The tree holds only the occupied nodes of the image, uniform subtrees being
+ * kept as single nodes, so queries touch a number of nodes that follows the
+ * content of the image rather than its area.
+ */
+typedef struct qtcq_index qtcq_index;
+
+/**
+ * Build the query index of a qtcf stream. Inverted streams are resolved, so
+ * queries are about the pixels of the decoded image.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ *
+ * @return pointer to index. NULL if unsuccessful
+ */
+qtcq_index *qtcq_index_create(const u8 *data, u32 w, u32 h);
+
+/**
+ * Free a query index.
+ *
+ * @param idx pointer to index, may be NULL
+ */
+void qtcq_index_free(qtcq_index *idx);
+
+/**
+ * Count the set pixels of the image, from the leaf nibbles and the sizes of
+ * uniform subtrees.
+ *
+ * @param idx index
+ *
+ * @return number of set pixels
+ */
+u64 qtcq_count(const qtcq_index *idx);
+
+/**
+ * Get the bounding box of the set pixels of the image. Each edge is found by
+ * descending the subtrees nearest to it first, skipping those that cannot
+ * hold a pixel beyond the edge found so far.
+ *
+ * @param idx index
+ * @param bbox output x and y of the first set pixel, and x and y past the
+ * last set pixel
+ *
+ * @return false if no pixel is set
+ */
+bool qtcq_bbox(const qtcq_index *idx, u32 bbox[4]);
+
+/**
+ * Get a pixel of the image, by descending to the leaf or uniform subtree
+ * holding it.
+ *
+ * @param idx index
+ * @param x x of the pixel
+ * @param y y of the pixel
+ *
+ * @return whether the pixel is set, false if it is outside the image
+ */
+bool qtcq_get(const qtcq_index *idx, u32 x, u32 y);
+
+#endif // __QTCQ_H__
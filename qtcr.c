@@ -0,0 +1,566 @@
+#include "qtcr.h"
+#include "qtcf.h"
+#include "qtc_stats.h"
+#include "utils.h"
+
+#include <string.h>
+
+#define RANS_PROB_BITS 12
+#define RANS_PROB_SCALE (1 << RANS_PROB_BITS)
+#define RANS_L (1U << 16)
+#define RANS_WAYS 4
+#define RANS_PAD 2
+
+/**
+ * Size, in bytes, of the largest container header: flags, level count, level
+ * sizes, used contexts and frequency tables
+ */
+#define QTCR_HDR_CAP (3 + 5 * QTCF_MAX_LVLS + QTCR_CTX_Cnt * 16 * 2)
+
+enum
+{
+    QTCR_FLAG_RANS = 0x1,
+};
+
+/**
+ * Nibble contexts
+ */
+enum
+{
+    QTCR_CTX_UPPER,
+    QTCR_CTX_LVL_3,
+    QTCR_CTX_LVL_2,
+    QTCR_CTX_LEAF,
+    QTCR_CTX_FILL_H,
+    QTCR_CTX_FILL_V,
+    QTCR_CTX_Cnt
+};
+
+typedef struct
+{
+    u16 freq[16];
+    u16 start[16];
+} rans_tbl;
+
+/**
+ * Get the context of the mask nibbles of a tree level
+ *
+ * @param lvl tree level, 0 being the root
+ * @param lvls number of levels in the tree
+ *
+ * @return context of the level's mask nibbles
+ */
+static u8 lvl_ctx(u8 lvl, u8 lvls)
+{
+    if (lvl + 1 == lvls)
+    {
+        return QTCR_CTX_LEAF;
+    }
+    else if (lvl + 2 == lvls)
+    {
+        return QTCR_CTX_LVL_2;
+    }
+    else if (lvl + 3 == lvls)
+    {
+        return QTCR_CTX_LVL_3;
+    }
+
+    return QTCR_CTX_UPPER;
+}
+
+/**
+ * Get the context of the nibble following a nibble in a level with fill headers
+ *
+ * @param ctx context of the current nibble
+ * @param nib value of the current nibble
+ * @param mask_ctx context of the level's mask nibbles
+ *
+ * @return context of the next nibble
+ */
+static u8 next_ctx(u8 ctx, u8 nib, u8 mask_ctx)
+{
+    if (ctx == QTCR_CTX_FILL_H)
+    {
+        return (nib & 0x8) ? QTCR_CTX_FILL_V : mask_ctx;
+    }
+    else if (ctx == QTCR_CTX_FILL_V)
+    {
+        return mask_ctx;
+    }
+
+    return nib == 0 ? QTCR_CTX_FILL_H : mask_ctx;
+}
+
+static void write_varint(u8 **p, u32 v)
+{
+    while (v >= 0x80)
+    {
+        *(*p)++ = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    *(*p)++ = v;
+}
+
+static u32 read_varint(const u8 **p)
+{
+    u32 v = 0;
+    u8 shift = 0;
+    u8 b;
+
+    do
+    {
+        b = *(*p)++;
+        v |= (u32)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    return v;
+}
+
+/**
+ * Scale symbol counts to frequencies summing to RANS_PROB_SCALE, keeping every
+ * occurring symbol at a frequency of at least 1
+ */
+static void tbl_normalize(rans_tbl *tbl, const u32 *cnt, u32 total)
+{
+    u32 sum = 0;
+    u8 max_s = 0;
+
+    for (u8 s = 0; s < 16; s++)
+    {
+        tbl->freq[s] = 0;
+
+        if (cnt[s])
+        {
+            u32 f = (u64)cnt[s] * RANS_PROB_SCALE / total;
+            tbl->freq[s] = f ? f : 1;
+        }
+
+        sum += tbl->freq[s];
+
+        if (cnt[s] > cnt[max_s])
+        {
+            max_s = s;
+        }
+    }
+
+    tbl->freq[max_s] += RANS_PROB_SCALE - sum;
+}
+
+static void tbl_starts(rans_tbl *tbl)
+{
+    u16 start = 0;
+
+    for (u8 s = 0; s < 16; s++)
+    {
+        tbl->start[s] = start;
+        start += tbl->freq[s];
+    }
+}
+
+/*
+ * 32-bit rANS state renormalized 16 bits at a time. As the probability scale is
+ * below 16 bits, at most one renormalization step happens per symbol.
+ */
+static inline void rans_enc_put(u32 *r, u8 **p, const rans_tbl *tbl, u8 s)
+{
+    u32 x = *r;
+    u32 freq = tbl->freq[s];
+    u64 x_max = (u64)((RANS_L >> RANS_PROB_BITS) << 16) * freq;
+
+    if (x >= x_max)
+    {
+        *p -= 2;
+        (*p)[0] = x >> 0;
+        (*p)[1] = x >> 8;
+        x >>= 16;
+    }
+
+    *r = ((x / freq) << RANS_PROB_BITS) + (x % freq) + tbl->start[s];
+}
+
+static inline void rans_enc_flush(u32 r, u8 **p)
+{
+    *p -= 4;
+    (*p)[0] = r >> 0;
+    (*p)[1] = r >> 8;
+    (*p)[2] = r >> 16;
+    (*p)[3] = r >> 24;
+}
+
+static inline u32 rans_dec_init(const u8 **p)
+{
+    u32 r = (*p)[0] | ((*p)[1] << 8) | ((*p)[2] << 16) | ((u32)(*p)[3] << 24);
+    *p += 4;
+    return r;
+}
+
+static inline u8 rans_dec_sym(u32 *r, const rans_tbl *tbl, const u8 *sym)
+{
+    u32 x = *r;
+    u32 slot = x & (RANS_PROB_SCALE - 1);
+    u8 s = sym[slot];
+
+    *r = tbl->freq[s] * (x >> RANS_PROB_BITS) + slot - tbl->start[s];
+    return s;
+}
+
+/*
+ * Branchless refill. The next two bytes are always read but only consumed when
+ * needed, which is why the encoder pads the payload with two bytes.
+ */
+static inline void rans_dec_renorm(u32 *r, const u8 **p)
+{
+    u32 x = *r;
+    u32 refill = x < RANS_L;
+    u32 word = (*p)[0] | ((*p)[1] << 8);
+
+    *r = refill ? (x << 16) | word : x;
+    *p += 2 * refill;
+}
+
+u32 qtcr_max_compressed_size(u16 w, u16 h)
+{
+    u32 qtcf_max = qtcf_max_compressed_size(w, h);
+    if (qtcf_max == 0)
+    {
+        return 0;
+    }
+
+    // flags, level count and level sizes ahead of a raw qtcf stream
+    return 2 + 5 * QTCF_MAX_LVLS + qtcf_max;
+}
+
+u8 *qtcr_encode(const u8 *qtcf, u16 w, u16 h, u32 *out_size)
+{
+    u32 out_cap = qtcr_max_compressed_size(w, h);
+    u8 *out = malloc(out_cap);
+
+    if (!out || !qtcr_encode_into(qtcf, w, h, out, out_cap, out_size))
+    {
+        free(out);
+        return NULL;
+    }
+
+    return realloc(out, *out_size);
+}
+
+bool qtcr_encode_into(const u8 *qtcf, u16 w, u16 h, u8 *out, u32 out_cap, u32 *out_size)
+{
+    u32 lvl_starts[QTCF_MAX_LVLS + 1];
+    u32 cnt[QTCR_CTX_Cnt][16] = {{0}};
+    u32 ctx_total[QTCR_CTX_Cnt] = {0};
+    rans_tbl tbls[QTCR_CTX_Cnt];
+
+    QTC_STATS_TIMER(t);
+
+    u8 lvls = qtcf_lvl_starts(qtcf, w, h, lvl_starts);
+    if (lvls == 0)
+    {
+        return false;
+    }
+
+    QTC_STATS_PHASE(QTC_PHASE_PARSE, t);
+
+    u32 nib_n = lvl_starts[lvls];
+    u32 qtcf_size = (nib_n + 1) / 2;
+
+    u8 *ctxs = malloc(nib_n);
+    if (!ctxs)
+    {
+        return false;
+    }
+
+    for (u8 lvl = 0; lvl < lvls; lvl++)
+    {
+        u8 mask_ctx = lvl_ctx(lvl, lvls);
+        bool fills = lvl + 2 < lvls;
+        u8 ctx = mask_ctx;
+
+        for (u32 i = lvl_starts[lvl]; i < lvl_starts[lvl + 1]; i++)
+        {
+            u8 nib = na_read(qtcf, i);
+
+            ctxs[i] = ctx;
+            cnt[ctx][nib]++;
+            ctx_total[ctx]++;
+
+            if (fills)
+            {
+                ctx = next_ctx(ctx, nib, mask_ctx);
+            }
+        }
+    }
+
+    u8 ctx_used = 0;
+
+    for (u8 c = 0; c < QTCR_CTX_Cnt; c++)
+    {
+        if (ctx_total[c])
+        {
+            ctx_used |= 1 << c;
+            tbl_normalize(&tbls[c], cnt[c], ctx_total[c]);
+            tbl_starts(&tbls[c]);
+        }
+    }
+
+    u32 payload_cap = 2 * nib_n + 4 * RANS_WAYS + RANS_PAD;
+
+    u8 *payload_buf = malloc(payload_cap);
+    if (!payload_buf)
+    {
+        free(ctxs);
+        return false;
+    }
+
+    u8 hdr[QTCR_HDR_CAP];
+    u8 *p = hdr;
+
+    *p++ = na_read(qtcf, 0) << 4;
+    *p++ = lvls;
+
+    for (u8 lvl = 0; lvl < lvls; lvl++)
+    {
+        write_varint(&p, lvl_starts[lvl + 1] - lvl_starts[lvl]);
+    }
+
+    u8 *hdr_end = p;
+
+    *p++ = ctx_used;
+
+    for (u8 c = 0; c < QTCR_CTX_Cnt; c++)
+    {
+        if (ctx_used & (1 << c))
+        {
+            for (u8 s = 0; s < 16; s++)
+            {
+                write_varint(&p, tbls[c].freq[s]);
+            }
+        }
+    }
+
+    // rANS runs backwards, so the payload is built at the end of the buffer
+    u8 *payload_end = payload_buf + payload_cap;
+    u8 *payload = payload_end;
+    u32 r[RANS_WAYS];
+
+    for (u8 k = 0; k < RANS_WAYS; k++)
+    {
+        r[k] = RANS_L;
+    }
+
+    payload -= RANS_PAD;
+    memset(payload, 0, RANS_PAD);
+
+    for (u32 i = nib_n; i > 1; i--)
+    {
+        u32 j = i - 1;
+        rans_enc_put(&r[j % RANS_WAYS], &payload, &tbls[ctxs[j]], na_read(qtcf, j));
+    }
+
+    for (u8 k = RANS_WAYS; k > 0; k--)
+    {
+        rans_enc_flush(r[k - 1], &payload);
+    }
+
+    free(ctxs);
+
+    u32 payload_size = payload_end - payload;
+
+    if ((u32)(p - hdr_end) + payload_size < qtcf_size)
+    {
+        hdr[0] |= QTCR_FLAG_RANS;
+    }
+    else
+    {
+        p = hdr_end;
+        payload = (u8 *)qtcf;
+        payload_size = qtcf_size;
+    }
+
+    u32 hdr_size = p - hdr;
+    bool fits = hdr_size + payload_size <= out_cap;
+
+    if (fits)
+    {
+        memcpy(out, hdr, hdr_size);
+        memcpy(out + hdr_size, payload, payload_size);
+        *out_size = hdr_size + payload_size;
+    }
+
+    free(payload_buf);
+    QTC_STATS_PHASE(QTC_PHASE_ENTROPY, t);
+
+    return fits;
+}
+
+u8 *qtcr_decode(const u8 *data, u32 *qtcf_size, u32 *in_size)
+{
+    const u8 *p = data + 1;
+    u8 lvls = *p++;
+
+    if (lvls > QTCF_MAX_LVLS)
+    {
+        return NULL;
+    }
+
+    u32 nib_n = 1;
+
+    for (u8 lvl = 0; lvl < lvls; lvl++)
+    {
+        nib_n += read_varint(&p);
+    }
+
+    u32 qtcf_cap = (nib_n + 1) / 2;
+    u8 *qtcf = malloc(qtcf_cap);
+
+    if (!qtcf || !qtcr_decode_into(data, qtcf, qtcf_cap, qtcf_size, in_size))
+    {
+        free(qtcf);
+        return NULL;
+    }
+
+    return qtcf;
+}
+
+bool qtcr_decode_into(const u8 *data, u8 *out, u32 out_cap, u32 *qtcf_size, u32 *in_size)
+{
+    u32 lvl_nibs[QTCF_MAX_LVLS];
+    rans_tbl tbls[QTCR_CTX_Cnt];
+    const u8 *p = data;
+
+    u8 flags = *p & 0xF;
+    u8 header = *p++ >> 4;
+    u8 lvls = *p++;
+
+    if (lvls > QTCF_MAX_LVLS)
+    {
+        return false;
+    }
+
+    u32 nib_n = 1;
+
+    for (u8 lvl = 0; lvl < lvls; lvl++)
+    {
+        lvl_nibs[lvl] = read_varint(&p);
+        nib_n += lvl_nibs[lvl];
+    }
+
+    *qtcf_size = (nib_n + 1) / 2;
+
+    if (*qtcf_size > out_cap)
+    {
+        return false;
+    }
+
+    if (!(flags & QTCR_FLAG_RANS))
+    {
+        memcpy(out, p, *qtcf_size);
+        *in_size = p + *qtcf_size - data;
+        return true;
+    }
+
+    QTC_STATS_TIMER(t);
+
+    u8 ctx_used = *p++;
+
+    u8 *syms = malloc(QTCR_CTX_Cnt * RANS_PROB_SCALE);
+    if (!syms)
+    {
+        return false;
+    }
+
+    for (u8 c = 0; c < QTCR_CTX_Cnt; c++)
+    {
+        if (ctx_used & (1 << c))
+        {
+            for (u8 s = 0; s < 16; s++)
+            {
+                tbls[c].freq[s] = read_varint(&p);
+            }
+
+            tbl_starts(&tbls[c]);
+
+            for (u8 s = 0; s < 16; s++)
+            {
+                memset(syms + c * RANS_PROB_SCALE + tbls[c].start[s], s, tbls[c].freq[s]);
+            }
+        }
+    }
+
+    u32 r[RANS_WAYS];
+
+    for (u8 k = 0; k < RANS_WAYS; k++)
+    {
+        r[k] = rans_dec_init(&p);
+    }
+
+    u32 i = 1;
+    u8 out_byte = header;
+
+    for (u8 lvl = 0; lvl < lvls; lvl++)
+    {
+        u8 mask_ctx = lvl_ctx(lvl, lvls);
+        bool fills = lvl + 2 < lvls;
+        u8 ctx = mask_ctx;
+        u32 lvl_end = i + lvl_nibs[lvl];
+
+        const rans_tbl *tbl = &tbls[ctx];
+        const u8 *sym = syms + ctx * RANS_PROB_SCALE;
+
+        while (i < lvl_end)
+        {
+            if (!fills && i % RANS_WAYS == 0 && i + RANS_WAYS <= lvl_end)
+            {
+                // one symbol per state, letting the four state updates overlap
+                u8 s0 = rans_dec_sym(&r[0], tbl, sym);
+                u8 s1 = rans_dec_sym(&r[1], tbl, sym);
+                u8 s2 = rans_dec_sym(&r[2], tbl, sym);
+                u8 s3 = rans_dec_sym(&r[3], tbl, sym);
+
+                rans_dec_renorm(&r[0], &p);
+                rans_dec_renorm(&r[1], &p);
+                rans_dec_renorm(&r[2], &p);
+                rans_dec_renorm(&r[3], &p);
+
+                *out++ = s0 | (s1 << 4);
+                *out++ = s2 | (s3 << 4);
+
+                i += RANS_WAYS;
+                continue;
+            }
+
+            u8 nib = rans_dec_sym(&r[i % RANS_WAYS], tbl, sym);
+            rans_dec_renorm(&r[i % RANS_WAYS], &p);
+
+            if (i & 1)
+            {
+                *out++ = out_byte | (nib << 4);
+            }
+            else
+            {
+                out_byte = nib;
+            }
+
+            i++;
+
+            if (fills)
+            {
+                ctx = next_ctx(ctx, nib, mask_ctx);
+                tbl = &tbls[ctx];
+                sym = syms + ctx * RANS_PROB_SCALE;
+            }
+        }
+    }
+
+    if (i & 1)
+    {
+        *out = out_byte;
+    }
+
+    free(syms);
+    QTC_STATS_PHASE(QTC_PHASE_ENTROPY, t);
+
+    *in_size = p + RANS_PAD - data;
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef __QTCR_H__
+#define __QTCR_H__
+
+#include "types.h"
+
+/**
+ * Entropy code a qtcf stream with a static, 4-way interleaved rANS coder.
+ * Nibbles are modelled in separate contexts for leaves, the two levels above
+ * the leaves, the remaining interior masks, and fill heights and values.
+ * Streams that do not shrink are stored raw.
+ *
+ * @param qtcf pointer to qtcf compressed data
+ * @param w image width
+ * @param h image height
+ * @param out_size size, in bytes, of entropy coded data
+ *
+ * @return pointer to entropy coded data. NULL if unsuccessful
+ */
+u8 *qtcr_encode(const u8 *qtcf, u16 w, u16 h, u32 *out_size);
+
+/**
+ * Get the largest size qtcr_encode can produce from a qtcf stream of an image
+ * of the specified size.
+ *
+ * @param w image width
+ * @param h image height
+ *
+ * @return worst-case size, in bytes, of entropy coded data. 0 if the size is invalid
+ */
+u32 qtcr_max_compressed_size(u16 w, u16 h);
+
+/**
+ * Entropy code a qtcf stream into a caller-provided buffer.
+ *
+ * @param qtcf pointer to qtcf compressed data
+ * @param w image width
+ * @param h image height
+ * @param out output buffer, qtcr_max_compressed_size bytes always suffice
+ * @param out_cap size, in bytes, of the output buffer
+ * @param out_size size, in bytes, of entropy coded data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtcr_encode_into(const u8 *qtcf, u16 w, u16 h, u8 *out, u32 out_cap, u32 *out_size);
+
+/**
+ * Undo the entropy coding of qtcr_encode.
+ *
+ * @param data pointer to entropy coded data
+ * @param qtcf_size size, in bytes, of the restored qtcf stream
+ * @param in_size the number of bytes processed in the entropy coded data
+ *
+ * @return pointer to the qtcf stream, which can be passed to qtcf_decode.
+ * NULL if unsuccessful
+ */
+u8 *qtcr_decode(const u8 *data, u32 *qtcf_size, u32 *in_size);
+
+/**
+ * Undo the entropy coding of qtcr_encode into a caller-provided buffer.
+ *
+ * @param data pointer to entropy coded data
+ * @param out output buffer for the qtcf stream, qtcf_max_compressed_size
+ * bytes always suffice
+ * @param out_cap size, in bytes, of the output buffer
+ * @param qtcf_size size, in bytes, of the restored qtcf stream
+ * @param in_size the number of bytes processed in the entropy coded data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtcr_decode_into(const u8 *data, u8 *out, u32 out_cap, u32 *qtcf_size, u32 *in_size);
+
+#endif // __QTCR_H__
@@ -0,0 +1,1145 @@
+#include "qtcs.h"
+#include "qtsp.h"
+#include "qtir.h"
+#include "mort.h"
+#include "qtc_stats.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Height, in levels, of the blocks the raster is read in. Blocks of 32x32
+ * pixels that are wholly set are kept as a single terminal
+ */
+#define QTCS_BLOCK_LVLS 5
+
+/**
+ * Raster being read into a sparse tree
+ */
+typedef struct
+{
+    qtsp_tree *t;
+    const u8 *data;
+    // raster xor-ed into data, NULL for none
+    const u8 *prev;
+    u32 w;
+    u32 h;
+    u32 inv;
+    u8 blk_lvls;
+    u32 blk_cols;
+    u32 blk_rows;
+    bool oom;
+} qtcs_src;
+
+qtsp_node *qtsp_push(qtsp_list *l, u64 i)
+{
+    if (l->n == l->cap)
+    {
+        u64 cap = l->cap ? 2 * l->cap : 64;
+        if (cap > SIZE_MAX / sizeof(qtsp_node))
+        {
+            return NULL;
+        }
+
+        qtsp_node *nodes = realloc(l->nodes, cap * sizeof(qtsp_node));
+        if (!nodes)
+        {
+            return NULL;
+        }
+
+        l->nodes = nodes;
+        l->cap = cap;
+    }
+
+    qtsp_node *nd = l->nodes + l->n++;
+
+    nd->i = i;
+    nd->sub_size = 0;
+    nd->val = 0;
+    nd->fill_height = 0;
+    nd->flags = 0;
+    nd->cov = 0;
+
+    return nd;
+}
+
+u64 qtsp_find(const qtsp_list *l, u64 i)
+{
+    u64 lo = 0;
+    u64 hi = l->n;
+
+    while (lo < hi)
+    {
+        u64 mid = lo + (hi - lo) / 2;
+
+        if (l->nodes[mid].i < i)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static void out_nibble(qtsp_out *o, u8 val)
+{
+    if (o->pos / 2 >= o->cap)
+    {
+        u64 cap = o->cap ? 2 * o->cap : 256;
+        u8 *out = cap <= SIZE_MAX ? realloc(o->out, cap) : NULL;
+        if (!out)
+        {
+            o->oom = true;
+            return;
+        }
+
+        o->out = out;
+        o->cap = cap;
+    }
+
+    na_write(o->out, o->pos++, val);
+}
+
+/**
+ * Read the rows of a block as words, pixel x of the block in bit x. Pixels
+ * are masked as qtir_build reads them: up to the end of the last leaf of a
+ * row, and rows past the image are zero
+ */
+static void block_read(const qtcs_src *s, u32 bx, u32 by, u32 *rows)
+{
+    u32 side = 1U << s->blk_lvls;
+    size_t row_size = ((size_t)s->w + 7) / 8;
+
+    u64 x = (u64)bx * side;
+    u64 pix_w = 2 * ((u64)s->w / 2 + (s->w & 1));
+    u32 mask = UINT32_MAX >> (32 - MIN(side, pix_w - x));
+
+    size_t col = x / 8;
+    size_t n = MIN(side / 8, row_size - col);
+
+    for (u32 r = 0; r < side; r++)
+    {
+        u64 y = (u64)by * side + r;
+
+        rows[r] = 0;
+
+        if (y < s->h)
+        {
+            u32 row = (u32)row_load_64(s->data + y * row_size + col, n) ^ s->inv;
+
+            if (s->prev)
+            {
+                row ^= (u32)row_load_64(s->prev + y * row_size + col, n);
+            }
+
+            rows[r] = row & mask;
+        }
+    }
+}
+
+bool qtsp_block(qtsp_tree *t, u8 blk_lvls, u32 bx, u32 by, const u32 *rows)
+{
+    u32 side = 1U << blk_lvls;
+    u32 side_mask = UINT32_MAX >> (32 - side);
+
+    u32 any = 0;
+    u32 all = side_mask;
+
+    for (u32 r = 0; r < side; r++)
+    {
+        any |= rows[r];
+        all &= rows[r];
+    }
+
+    if (any == 0)
+    {
+        return true;
+    }
+
+    u64 code = morton64_encode(bx, by);
+
+    if (all == side_mask)
+    {
+        return qtsp_uniform(t, t->lvls - blk_lvls, code, 0xF);
+    }
+
+    // leaves in Morton order within the block
+    u8 leaves[1 << (2 * (QTCS_BLOCK_LVLS - 1))];
+    u32 leaf_side = side / 2;
+
+    for (u32 r = 0; r < side; r += 2)
+    {
+        u64 packed[2];
+        leaf_pack_64(rows[r], rows[r + 1], packed);
+
+        for (u32 k = 0; k < leaf_side; k++)
+        {
+            leaves[morton_encode(k, r / 2)] = (packed[0] >> (4 * k)) & 0xF;
+        }
+    }
+
+    qtsp_list *l = &t->lvl[t->lvls - 1];
+    u64 base = code << (2 * (blk_lvls - 1));
+
+    for (u32 j = 0; j < leaf_side * leaf_side; j++)
+    {
+        if (leaves[j] == 0)
+        {
+            continue;
+        }
+
+        qtsp_node *nd = qtsp_push(l, base + j);
+        if (!nd)
+        {
+            return false;
+        }
+
+        nd->val = leaves[j];
+        nd->sub_size = 1;
+    }
+
+    return true;
+}
+
+/**
+ * Add the occupied leaves of a block, or a terminal if the block is full
+ */
+static void block_add(qtcs_src *s, u32 bx, u32 by)
+{
+    u32 rows[1 << QTCS_BLOCK_LVLS];
+
+    block_read(s, bx, by, rows);
+
+    if (!qtsp_block(s->t, s->blk_lvls, bx, by, rows))
+    {
+        s->oom = true;
+    }
+}
+
+/**
+ * Add the blocks of a square of the block grid in Morton order, skipping
+ * those outside the image
+ *
+ * @param bx x of the first block of the square
+ * @param by y of the first block of the square
+ * @param lvl log2 of the square side, in blocks
+ */
+static void blocks_visit(qtcs_src *s, u32 bx, u32 by, u8 lvl)
+{
+    if (s->oom || bx >= s->blk_cols || by >= s->blk_rows)
+    {
+        return;
+    }
+
+    if (lvl == 0)
+    {
+        block_add(s, bx, by);
+        return;
+    }
+
+    u32 half = 1U << (lvl - 1);
+
+    blocks_visit(s, bx, by, lvl - 1);
+    blocks_visit(s, bx + half, by, lvl - 1);
+    blocks_visit(s, bx, by + half, lvl - 1);
+    blocks_visit(s, bx + half, by + half, lvl - 1);
+}
+
+/**
+ * Build the occupied nodes of a level from those of the level below, merging
+ * in the terminals of the level
+ *
+ * @param c occupied nodes of the level below
+ * @param term terminals of this level
+ * @param p output list
+ *
+ * @return false if out of memory
+ */
+static bool lvl_consolidate(const qtsp_list *c, const qtsp_list *term, qtsp_list *p)
+{
+    u64 k = 0;
+    u64 f = 0;
+
+    while (k < c->n || f < term->n)
+    {
+        if (f < term->n && (k == c->n || term->nodes[f].i < c->nodes[k].i >> 2))
+        {
+            qtsp_node *nd = qtsp_push(p, 0);
+            if (!nd)
+            {
+                return false;
+            }
+
+            *nd = term->nodes[f++];
+            continue;
+        }
+
+        u64 pi = c->nodes[k].i >> 2;
+
+        if (p->n == 0 || p->nodes[p->n - 1].i != pi)
+        {
+            if (!qtsp_push(p, pi))
+            {
+                return false;
+            }
+        }
+
+        p->nodes[p->n - 1].val |= 1 << (c->nodes[k].i & 3);
+        k++;
+    }
+
+    return true;
+}
+
+/**
+ * Set the state the fill and size passes give the root of a uniform subtree.
+ * Every node of the subtree extends the fill of its children, and the sizes
+ * of the subtree stay far below those of raw leaves, so the state only
+ * depends on the leaf nibble and the height
+ *
+ * @param nd terminal
+ * @param u leaf nibble
+ * @param h height of the subtree, at least 2
+ */
+static void uniform_init(qtsp_node *nd, u8 u, u8 h)
+{
+    u8 fill_len = u == 0xF ? 2 : 3;
+    u8 cnt = 0;
+
+    for (u8 q = 0; q < QUAD_Cnt; q++)
+    {
+        cnt += (u >> q) & 1;
+    }
+
+    u64 sub_size = u == 0xF ? 1 : 1 + cnt;
+    u8 fill_height = 1;
+
+    for (u8 x = 3; x <= h; x++)
+    {
+        fill_height = (x - 1) % 9;
+
+        if (x == 3)
+        {
+            sub_size = fill_len;
+        }
+        else if (fill_height > 0)
+        {
+            sub_size = 4 * sub_size - (fill_height == 1 ? 4 - fill_len : 3 * fill_len);
+        }
+        else
+        {
+            sub_size = 1 + cnt * sub_size;
+        }
+
+        sub_size = MIN(sub_size, UINT32_MAX);
+    }
+
+    nd->val = u;
+    nd->fill_height = fill_height;
+    nd->sub_size = sub_size;
+    nd->flags = QTSP_NODE_UNIFORM | u << 4;
+}
+
+void qtsp_init(qtsp_tree *t, u8 lvls)
+{
+    memset(t, 0, sizeof(*t));
+
+    t->lvls = lvls;
+}
+
+void qtsp_free(qtsp_tree *t)
+{
+    for (u8 l = 0; l < QTCF64_MAX_LVLS; l++)
+    {
+        free(t->lvl[l].nodes);
+        free(t->term[l].nodes);
+    }
+
+    memset(t, 0, sizeof(*t));
+}
+
+bool qtsp_uniform(qtsp_tree *t, u8 l, u64 i, u8 u)
+{
+    if (u == 0)
+    {
+        return true;
+    }
+
+    if (l + 1 == t->lvls)
+    {
+        qtsp_node *nd = qtsp_push(&t->lvl[l], i);
+        if (!nd)
+        {
+            return false;
+        }
+
+        nd->val = u;
+        nd->sub_size = 1;
+        return true;
+    }
+
+    qtsp_node *nd = qtsp_push(&t->term[l], i);
+    if (!nd)
+    {
+        return false;
+    }
+
+    uniform_init(nd, u, t->lvls - l);
+
+    return true;
+}
+
+bool qtsp_consolidate(qtsp_tree *t)
+{
+    for (u8 l = t->lvls - 1; l-- > 0;)
+    {
+        if (!lvl_consolidate(&t->lvl[l + 1], &t->term[l], &t->lvl[l]))
+        {
+            return false;
+        }
+
+        t->term[l].n = 0;
+    }
+
+    return true;
+}
+
+/**
+ * Build the sparse tree of a raster, xor-ed with another raster if prev is
+ * not NULL
+ */
+static bool from_src(qtsp_tree *t, const u8 *data, const u8 *prev, u32 w, u32 h, u8 inv)
+{
+    qtcs_src s;
+
+    s.t = t;
+    s.data = data;
+    s.prev = prev;
+    s.w = w;
+    s.h = h;
+    s.inv = inv ? UINT32_MAX : 0;
+    s.blk_lvls = MIN(t->lvls, QTCS_BLOCK_LVLS);
+    s.oom = false;
+
+    u32 side = 1U << s.blk_lvls;
+
+    s.blk_cols = ((u64)w + side - 1) / side;
+    s.blk_rows = ((u64)h + side - 1) / side;
+
+    blocks_visit(&s, 0, 0, t->lvls - s.blk_lvls);
+
+    return !s.oom && qtsp_consolidate(t);
+}
+
+bool qtsp_from_raster(qtsp_tree *t, const u8 *data, u32 w, u32 h, u8 inv)
+{
+    return from_src(t, data, NULL, w, h, inv);
+}
+
+bool qtsp_from_delta(qtsp_tree *t, const u8 *data, const u8 *prev, u32 w, u32 h)
+{
+    return from_src(t, data, prev, w, h, 0);
+}
+
+/**
+ * Flag of a slot of the stream that is read while parsing
+ */
+#define QTSP_PARSE_READ QTSP_NODE_SKIP
+
+/**
+ * Get the slots and implied nodes of the next level while parsing. Nodes
+ * under a fill hold the remaining fill height in fill_height and the fill
+ * value in cov, the rest are read from the stream for the set bits of their
+ * parent
+ *
+ * @param v nodes of a level, after reading its slots
+ * @param next output list
+ *
+ * @return false if out of memory
+ */
+static bool parse_next(const qtsp_list *v, qtsp_list *next)
+{
+    next->n = 0;
+
+    for (u64 j = 0; j < v->n; j++)
+    {
+        const qtsp_node *p = v->nodes + j;
+
+        for (u8 q = 0; q < QUAD_Cnt; q++)
+        {
+            if (p->fill_height == 0 && !(p->val & (1 << q)))
+            {
+                continue;
+            }
+
+            qtsp_node *nd = qtsp_push(next, 4 * p->i + q);
+            if (!nd)
+            {
+                return false;
+            }
+
+            if (p->fill_height == 0)
+            {
+                nd->flags = QTSP_PARSE_READ;
+            }
+            else if (p->fill_height > 1)
+            {
+                nd->val = 0xF;
+                nd->fill_height = p->fill_height - 1;
+                nd->cov = p->cov;
+            }
+            else
+            {
+                // the decoder reads the slots of nodes filled with zero
+                nd->val = p->cov;
+                nd->flags = p->cov ? 0 : QTSP_PARSE_READ;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool qtsp_from_qtcf(qtsp_tree *t, const u8 *data, bool *inverted, u64 *in_size)
+{
+    u8 lvls = t->lvls;
+    u64 qtc_i = 0;
+
+    u8 header = na_read(data, qtc_i++);
+    *inverted = (header >> QTC_HEADER_FLAG_INVERTED) & 0x1;
+
+    // back-references are resolved on the raster only
+    if ((header >> QTC_HEADER_FLAG_DAG) & 0x1)
+    {
+        return false;
+    }
+
+    if ((header >> QTC_HEADER_FLAG_ALL_BLACK) & 0x1)
+    {
+        *in_size = 1;
+        return true;
+    }
+
+    qtsp_list v[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    bool ok = qtsp_push(&v[0], 0) != NULL;
+
+    if (ok)
+    {
+        v[0].nodes[0].flags = QTSP_PARSE_READ;
+    }
+
+    for (u8 l = 0; ok && l < lvls; l++)
+    {
+        qtsp_list *cur = &v[l & 1];
+        u64 n = 0;
+
+        for (u64 j = 0; ok && j < cur->n; j++)
+        {
+            qtsp_node nd = cur->nodes[j];
+
+            if (nd.flags & QTSP_PARSE_READ)
+            {
+                nd.flags = 0;
+                nd.val = na_read(data, qtc_i++);
+
+                if (l + 1 == lvls)
+                {
+                    ok = qtsp_uniform(t, l, nd.i, nd.val);
+                    continue;
+                }
+
+                if (nd.val == 0)
+                {
+                    u8 fh = 1;
+                    u8 fv = 0xF;
+
+                    if (l + 2 < lvls)
+                    {
+                        fh = na_read(data, qtc_i++);
+
+                        if (fh & 0x8)
+                        {
+                            fv = na_read(data, qtc_i++);
+                            fh &= ~0x8;
+                        }
+
+                        fh++;
+                    }
+
+                    if (l + fh >= lvls)
+                    {
+                        ok = false;
+                        break;
+                    }
+
+                    if (l + fh + 1 == lvls && fv != 0)
+                    {
+                        ok = qtsp_uniform(t, l, nd.i, fv);
+                        continue;
+                    }
+
+                    nd.val = 0xF;
+                    nd.fill_height = fh;
+                    nd.cov = fv;
+                }
+            }
+            else if (l + 1 == lvls)
+            {
+                // leaves of fills of zero are read, the rest are implied
+                ok = qtsp_uniform(t, l, nd.i, nd.val);
+                continue;
+            }
+
+            cur->nodes[n++] = nd;
+        }
+
+        cur->n = n;
+
+        if (ok && l + 1 < lvls)
+        {
+            ok = parse_next(cur, &v[!(l & 1)]);
+        }
+    }
+
+    free(v[0].nodes);
+    free(v[1].nodes);
+
+    *in_size = (qtc_i + 1) / 2;
+
+    return ok && qtsp_consolidate(t);
+}
+
+/**
+ * Number of children of a node, which start at offset k of the level below
+ */
+static u64 child_cnt(const qtsp_list *c, u64 k, u64 pi)
+{
+    u64 end = k;
+
+    while (end < c->n && c->nodes[end].i >> 2 == pi)
+    {
+        end++;
+    }
+
+    return end - k;
+}
+
+/**
+ * Fill detection, as qtir_get_fills
+ */
+static void tree_fills(qtsp_tree *t)
+{
+    for (u8 l = t->lvls - 1; l-- > 0;)
+    {
+        qtsp_list *p = &t->lvl[l];
+        qtsp_list *c = &t->lvl[l + 1];
+        u64 k = 0;
+
+        for (u64 j = 0; j < p->n; j++)
+        {
+            qtsp_node *nd = p->nodes + j;
+            qtsp_node *ch = c->nodes + k;
+
+            k += child_cnt(c, k, nd->i);
+
+            if ((nd->flags & QTSP_NODE_UNIFORM) || nd->val != 0xF)
+            {
+                continue;
+            }
+
+            bool extend_fill = true;
+
+            for (u8 q = 1; q < QUAD_Cnt; q++)
+            {
+                if (ch[q].val != ch[0].val || ch[q].fill_height != ch[0].fill_height)
+                {
+                    extend_fill = false;
+                }
+            }
+
+            if (extend_fill)
+            {
+                nd->val = ch[0].val;
+                nd->fill_height = ch[0].fill_height + 1;
+
+                if (nd->fill_height > 8)
+                {
+                    nd->fill_height = 0;
+                }
+            }
+        }
+    }
+
+    // pattern fills one level above the leaves are only kept under fills
+    qtsp_list *p = &t->lvl[t->lvls - 3];
+    qtsp_list *c = &t->lvl[t->lvls - 2];
+    u64 k = 0;
+
+    for (u64 j = 0; j < p->n; j++)
+    {
+        qtsp_node *ch = c->nodes + k;
+        u64 ch_n = child_cnt(c, k, p->nodes[j].i);
+
+        k += ch_n;
+
+        if (p->nodes[j].fill_height != 0)
+        {
+            continue;
+        }
+
+        for (u64 q = 0; q < ch_n; q++)
+        {
+            if (ch[q].fill_height == 1 && ch[q].val != 0xF)
+            {
+                ch[q].fill_height = 0;
+                ch[q].val = 0xF;
+            }
+        }
+    }
+}
+
+/**
+ * Subtree size estimation and raw conversion, as qtir_get_sizes. A converted
+ * subtree is only flagged at its root, its nodes are generated while
+ * serializing
+ */
+static void tree_sizes(qtsp_tree *t)
+{
+    u8 lvls = t->lvls;
+    qtsp_list *a = &t->lvl[lvls - 2];
+
+    for (u64 j = 0; j < a->n; j++)
+    {
+        qtsp_node *nd = a->nodes + j;
+
+        if (nd->fill_height != 0 && nd->val == 0xF)
+        {
+            nd->sub_size = 1;
+        }
+        else
+        {
+            nd->sub_size = 1;
+
+            for (u8 q = 0; q < QUAD_Cnt; q++)
+            {
+                if (nd->val & (1 << q))
+                {
+                    nd->sub_size += 1;
+                }
+            }
+        }
+    }
+
+    for (u8 l = lvls - 2; l-- > 0;)
+    {
+        qtsp_list *p = &t->lvl[l];
+        qtsp_list *c = &t->lvl[l + 1];
+        u8 h = lvls - l;
+        u64 base_len = (u64)1 << (2 * (h - 1));
+        u64 k = 0;
+
+        for (u64 j = 0; j < p->n; j++)
+        {
+            qtsp_node *nd = p->nodes + j;
+            qtsp_node *ch = c->nodes + k;
+            u64 ch_n = child_cnt(c, k, nd->i);
+
+            k += ch_n;
+
+            if (nd->flags & QTSP_NODE_UNIFORM)
+            {
+                continue;
+            }
+
+            u64 sub_size = 0;
+            u8 fill_len = nd->val == 0xF ? 2 : 3;
+
+            if (h == 3 && nd->fill_height > 1)
+            {
+                sub_size = fill_len;
+            }
+            else if (nd->fill_height > 0)
+            {
+                for (u64 q = 0; q < ch_n; q++)
+                {
+                    sub_size += ch[q].sub_size;
+                }
+
+                sub_size -= nd->fill_height == 1 ? 4 - fill_len : 3 * fill_len;
+            }
+            else if (nd->val != 0)
+            {
+                sub_size = 1;
+
+                for (u64 q = 0; q < ch_n; q++)
+                {
+                    if (nd->val & (1 << (ch[q].i & 3)))
+                    {
+                        sub_size += ch[q].sub_size;
+                    }
+                }
+            }
+
+            if (sub_size > base_len + 2)
+            {
+                nd->val = 0xF;
+                nd->fill_height = (h - 2) % 9;
+                nd->flags |= QTSP_NODE_RAW;
+                sub_size = base_len + 2;
+            }
+
+            nd->sub_size = MIN(sub_size, UINT32_MAX);
+        }
+    }
+}
+
+/**
+ * Serialize the nodes of one level that are not covered by fills
+ *
+ * @param v nodes of the level, as visited
+ * @param last whether the level is the one above the leaves
+ */
+static void lvl_write(const qtsp_list *v, bool last, qtsp_out *o)
+{
+    for (u64 j = 0; j < v->n; j++)
+    {
+        const qtsp_node *nd = v->nodes + j;
+
+        if (nd->flags & QTSP_NODE_SKIP)
+        {
+            continue;
+        }
+
+        QTC_STATS_ADD(nodes_visited, 1);
+
+        if (nd->fill_height > 0)
+        {
+            out_nibble(o, 0);
+
+            if (last)
+            {
+                QTC_STATS_ADD(fills[1], 1);
+            }
+            else if (nd->val == 0xF)
+            {
+                out_nibble(o, nd->fill_height - 1);
+                QTC_STATS_ADD(fills[nd->fill_height], 1);
+            }
+            else
+            {
+                out_nibble(o, (nd->fill_height - 1) | 0x8);
+                out_nibble(o, nd->val);
+                QTC_STATS_ADD(pattern_fills[nd->fill_height], 1);
+            }
+        }
+        else
+        {
+            out_nibble(o, nd->val);
+        }
+    }
+}
+
+/**
+ * Get the visited nodes of the next level. Nodes of raw and uniform subtrees
+ * are generated from their height, subtrees wholly covered
+ * by fills are dropped
+ *
+ * @param t sparse tree
+ * @param l level of the nodes in v
+ * @param v nodes of level l, as visited
+ * @param next output list
+ *
+ * @return false if out of memory
+ */
+static bool lvl_next(const qtsp_tree *t, u8 l, const qtsp_list *v, qtsp_list *next)
+{
+    const qtsp_list *c = &t->lvl[l + 1];
+    u8 below = t->lvls - 1 - l;
+    u8 h = below;
+    u64 k = 0;
+
+    next->n = 0;
+
+    for (u64 j = 0; j < v->n; j++)
+    {
+        const qtsp_node *p = v->nodes + j;
+
+        while (k < c->n && c->nodes[k].i >> 2 < p->i)
+        {
+            k++;
+        }
+
+        if (p->cov >= below)
+        {
+            continue;
+        }
+
+        u8 inherit = p->flags & (QTSP_NODE_UNIFORM | QTSP_NODE_RAW | 0xF0);
+
+        for (u8 q = 0; q < QUAD_Cnt; q++)
+        {
+            u64 ci = 4 * p->i + q;
+            const qtsp_node *s = NULL;
+
+            if (k < c->n && c->nodes[k].i == ci)
+            {
+                s = c->nodes + k++;
+            }
+
+            if (!s && !inherit)
+            {
+                continue;
+            }
+
+            qtsp_node *nd = qtsp_push(next, ci);
+            if (!nd)
+            {
+                return false;
+            }
+
+            if (s)
+            {
+                *nd = *s;
+            }
+
+            nd->flags |= inherit;
+
+            if (nd->flags & QTSP_NODE_RAW)
+            {
+                nd->val = 0xF;
+                nd->fill_height = (h - 2) % 9;
+            }
+            else if (!s)
+            {
+                nd->val = qtsp_leaf(nd);
+                nd->fill_height = (h - 1) % 9;
+            }
+
+            if (p->cov > 0)
+            {
+                nd->flags |= QTSP_NODE_SKIP;
+                nd->cov = p->cov - 1;
+            }
+            else
+            {
+                nd->flags &= ~QTSP_NODE_SKIP;
+                nd->cov = nd->fill_height;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Serialize the leaves under the visited nodes of the level above them
+ */
+static void leaves_write(const qtsp_tree *t, const qtsp_list *v, qtsp_out *o)
+{
+    const qtsp_list *c = &t->lvl[t->lvls - 1];
+    u64 k = 0;
+
+    for (u64 j = 0; j < v->n; j++)
+    {
+        const qtsp_node *p = v->nodes + j;
+
+        while (k < c->n && c->nodes[k].i >> 2 < p->i)
+        {
+            k++;
+        }
+
+        if (p->cov > 0)
+        {
+            continue;
+        }
+
+        for (u8 q = 0; q < QUAD_Cnt; q++)
+        {
+            u64 ci = 4 * p->i + q;
+            u8 val = p->flags & QTSP_NODE_UNIFORM ? qtsp_leaf(p) : 0;
+
+            if (k < c->n && c->nodes[k].i == ci)
+            {
+                val = c->nodes[k++].val;
+            }
+
+            if (p->val & (1 << q))
+            {
+                out_nibble(o, val);
+                QTC_STATS_ADD(nodes_visited, 1);
+            }
+        }
+    }
+}
+
+static bool tree_write(const qtsp_tree *t, bool inverted, qtsp_out *o)
+{
+    const qtsp_list *root = &t->lvl[0];
+    u8 header = 0;
+
+    header |= inverted << QTC_HEADER_FLAG_INVERTED;
+    header |= (root->n == 0 || root->nodes[0].val == 0) << QTC_HEADER_FLAG_ALL_BLACK;
+
+    out_nibble(o, header);
+
+    qtsp_list v[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    bool ok = true;
+
+    for (u64 j = 0; j < root->n; j++)
+    {
+        qtsp_node *nd = qtsp_push(&v[0], 0);
+        if (!nd)
+        {
+            ok = false;
+            break;
+        }
+
+        *nd = root->nodes[j];
+        nd->cov = nd->fill_height;
+    }
+
+    for (u8 l = 0; ok && l + 1 < t->lvls; l++)
+    {
+        qtsp_list *cur = &v[l & 1];
+
+        lvl_write(cur, l + 2 == t->lvls, o);
+
+        if (l + 2 == t->lvls)
+        {
+            leaves_write(t, cur, o);
+        }
+        else
+        {
+            ok = lvl_next(t, l, cur, &v[!(l & 1)]);
+        }
+    }
+
+    // clear the unused nibble of the last byte
+    if (o->pos & 1)
+    {
+        out_nibble(o, 0);
+        o->pos--;
+    }
+
+    free(v[0].nodes);
+    free(v[1].nodes);
+
+    return ok && !o->oom;
+}
+
+bool qtsp_write(qtsp_tree *t, bool inverted, qtsp_out *o)
+{
+    QTC_STATS_TIMER(tm);
+
+    tree_fills(t);
+    QTC_STATS_PHASE(QTC_PHASE_FILLS, tm);
+
+    tree_sizes(t);
+    QTC_STATS_PHASE(QTC_PHASE_SIZES, tm);
+
+    bool ok = tree_write(t, inverted, o);
+    QTC_STATS_PHASE(QTC_PHASE_SERIALIZE, tm);
+
+    return ok;
+}
+
+/**
+ * Encode one polarity of an image
+ *
+ * @param inv byte xor-ed into every raster byte read
+ * @param o output stream
+ *
+ * @return false if out of memory or the size is invalid
+ */
+static bool qtcs_encode_pol(const u8 *data, u32 w, u32 h, u8 inv, qtsp_out *o)
+{
+    u8 lvls = calc_lvls(w, h);
+
+    if (!qt_lvls_ok(lvls))
+    {
+        return false;
+    }
+
+    qtsp_tree t;
+    qtsp_init(&t, lvls);
+
+    QTC_STATS_TIMER(tm);
+
+    bool ok = qtsp_from_raster(&t, data, w, h, inv);
+    QTC_STATS_PHASE(QTC_PHASE_BUILD, tm);
+
+    ok = ok && qtsp_write(&t, inv != 0, o);
+
+    qtsp_free(&t);
+
+    return ok;
+}
+
+/**
+ * Encode both polarities of an image
+ *
+ * @param o output streams of the normal and inverted image
+ *
+ * @return index of the smaller stream, -1 if unsuccessful
+ */
+static int qtcs_encode_both(const u8 *data, u32 w, u32 h, qtsp_out o[2])
+{
+    if (!qtcs_encode_pol(data, w, h, 0x00, &o[0]) || !qtcs_encode_pol(data, w, h, 0xFF, &o[1]))
+    {
+        return -1;
+    }
+
+    u64 size = (o[0].pos + 1) / 2;
+    u64 inv_size = (o[1].pos + 1) / 2;
+
+    QTC_STATS_ADD(normal_bytes, size);
+    QTC_STATS_ADD(inverted_bytes, inv_size);
+    QTC_STATS_ADD(normal_won, inv_size >= size);
+    QTC_STATS_ADD(inverted_won, inv_size < size);
+
+    return inv_size < size;
+}
+
+u8 *qtcs_encode(const u8 *data, u32 w, u32 h, u64 *out_size)
+{
+    qtsp_out o[2] = {{NULL, 0, 0, false}, {NULL, 0, 0, false}};
+
+    int pick = qtcs_encode_both(data, w, h, o);
+
+    if (pick < 0)
+    {
+        free(o[0].out);
+        free(o[1].out);
+        return NULL;
+    }
+
+    free(o[!pick].out);
+
+    *out_size = (o[pick].pos + 1) / 2;
+
+    return realloc(o[pick].out, *out_size);
+}
+
+bool qtcs_encode_into(const u8 *data, u32 w, u32 h, u8 *out, u64 out_cap, u64 *out_size)
+{
+    qtsp_out o[2] = {{NULL, 0, 0, false}, {NULL, 0, 0, false}};
+
+    int pick = qtcs_encode_both(data, w, h, o);
+    bool ok = pick >= 0 && (o[pick].pos + 1) / 2 <= out_cap;
+
+    if (ok)
+    {
+        *out_size = (o[pick].pos + 1) / 2;
+        memcpy(out, o[pick].out, *out_size);
+    }
+
+    free(o[0].out);
+    free(o[1].out);
+
+    return ok;
+}
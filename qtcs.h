@@ -0,0 +1,38 @@
+#ifndef __QTCS_H__
+#define __QTCS_H__
+
+#include "types.h"
+
+/**
+ * Compress a 1-bit raster image into a qtcf stream from a sparse quad tree.
+ * Only the occupied nodes are built, level by level as lists sorted by
+ * Morton code, and 32x32 blocks that are wholly set are kept as single
+ * nodes, so memory and time scale with the content of the image rather
+ * than with the padded area of the tree qtcf_encode64 allocates. The stream
+ * is the one qtcf_encode64 produces and is decoded with qtcf_decode64.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtcs_encode(const u8 *data, u32 w, u32 h, u64 *out_size);
+
+/**
+ * Compress a 1-bit raster image into a qtcf stream from a sparse quad tree,
+ * in a caller-provided buffer.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param out output buffer, qtcf_max_compressed_size64 bytes always suffice
+ * @param out_cap size, in bytes, of the output buffer
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return true if successful, false if out of memory or out_cap is too small
+ */
+bool qtcs_encode_into(const u8 *data, u32 w, u32 h, u8 *out, u64 out_cap, u64 *out_size);
+
+#endif // __QTCS_H__
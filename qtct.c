@@ -0,0 +1,300 @@
+#include "qtct.h"
+#include "qtsp.h"
+#include "qtir.h"
+#include "mort.h"
+#include "utils.h"
+
+#include <stdlib.h>
+
+/**
+ * A transform is a swap of the axes followed by mirrors of each axis
+ */
+enum
+{
+    QTCT_SWAP = 1 << 0,
+    QTCT_MIRROR_X = 1 << 1,
+    QTCT_MIRROR_Y = 1 << 2,
+};
+
+static const u8 transform_steps[] = {
+    [QTCT_FLIP_H] = QTCT_MIRROR_X,
+    [QTCT_FLIP_V] = QTCT_MIRROR_Y,
+    [QTCT_ROT_90] = QTCT_SWAP | QTCT_MIRROR_X,
+    [QTCT_ROT_180] = QTCT_MIRROR_X | QTCT_MIRROR_Y,
+    [QTCT_ROT_270] = QTCT_SWAP | QTCT_MIRROR_Y,
+    [QTCT_TRANSPOSE] = QTCT_SWAP,
+};
+
+/**
+ * Moved parts of the tree, as unsorted lists of nodes per level
+ */
+typedef struct
+{
+    u8 lvls;
+    qtsp_list lvl[QTCF64_MAX_LVLS];
+    // output image size
+    s64 w;
+    s64 h;
+    bool oom;
+} qtct_parts;
+
+/**
+ * Swap the x and y of the pixels of a leaf nibble
+ */
+static u8 nibble_swap(u8 u)
+{
+    return (u & 0x9) | (u & 0x2) << 1 | (u & 0x4) >> 1;
+}
+
+/**
+ * Swap the columns of a leaf nibble
+ */
+static u8 nibble_mirror_x(u8 u)
+{
+    return (u & 0x5) << 1 | (u & 0xA) >> 1;
+}
+
+/**
+ * Swap the rows of a leaf nibble
+ */
+static u8 nibble_mirror_y(u8 u)
+{
+    return (u & 0x3) << 2 | (u & 0xC) >> 2;
+}
+
+static void part_push(qtct_parts *p, u8 l, u64 i, u8 u)
+{
+    qtsp_node *nd = qtsp_push(&p->lvl[l], i);
+    if (!nd)
+    {
+        p->oom = true;
+        return;
+    }
+
+    nd->val = u;
+}
+
+/**
+ * Add the part of a node within a rectangle of a uniform pattern. Nodes
+ * wholly within the rectangle are added whole, leaves are masked
+ *
+ * @param l level of the node
+ * @param i offset of the node within its level
+ * @param x x of the first pixel of the node
+ * @param y y of the first pixel of the node
+ * @param r rectangle, as first and past the last pixel in x and y
+ * @param u leaf nibble of the pattern, by pixel parity
+ */
+static void rect_add(qtct_parts *p, u8 l, u64 i, s64 x, s64 y, const s64 r[4], u8 u)
+{
+    s64 side = (s64)1 << (p->lvls - l);
+
+    if (p->oom || x >= r[2] || y >= r[3] || x + side <= r[0] || y + side <= r[1])
+    {
+        return;
+    }
+
+    if (x >= r[0] && y >= r[1] && x + side <= r[2] && y + side <= r[3])
+    {
+        part_push(p, l, i, u);
+        return;
+    }
+
+    if (l + 1 == p->lvls)
+    {
+        u8 mask = 0;
+
+        for (u8 q = 0; q < QUAD_Cnt; q++)
+        {
+            s64 px = x + (q & 1);
+            s64 py = y + (q >> 1);
+
+            mask |= (px >= r[0] && px < r[2] && py >= r[1] && py < r[3]) << q;
+        }
+
+        if (u & mask)
+        {
+            part_push(p, l, i, u & mask);
+        }
+
+        return;
+    }
+
+    s64 half = side / 2;
+
+    for (u8 q = 0; q < QUAD_Cnt; q++)
+    {
+        rect_add(p, l + 1, 4 * i + q, x + (q & 1) * half, y + (q >> 1) * half, r, u);
+    }
+}
+
+/**
+ * Move a leaf or uniform subtree of the source tree
+ *
+ * @param l level of the node
+ * @param i offset of the node within its level
+ * @param u leaf nibble
+ * @param steps transform steps
+ */
+static void node_move(qtct_parts *p, u8 l, u64 i, u8 u, u8 steps)
+{
+    s64 side = (s64)1 << (p->lvls - l);
+    u32 nx, ny;
+
+    morton64_decode(i, &nx, &ny);
+
+    s64 x = (s64)nx * side;
+    s64 y = (s64)ny * side;
+
+    if (steps & QTCT_SWAP)
+    {
+        s64 t = x;
+        x = y;
+        y = t;
+        u = nibble_swap(u);
+    }
+
+    // a mirror keeps the parity of columns if the width is odd
+    if (steps & QTCT_MIRROR_X)
+    {
+        x = p->w - x - side;
+        u = p->w & 1 ? u : nibble_mirror_x(u);
+    }
+
+    if (steps & QTCT_MIRROR_Y)
+    {
+        y = p->h - y - side;
+        u = p->h & 1 ? u : nibble_mirror_y(u);
+    }
+
+    // pixels moved outside the image were masked off the source leaves
+    s64 r[4] = {MAX(x, 0), MAX(y, 0), MIN(x + side, p->w), MIN(y + side, p->h)};
+
+    if (r[0] >= r[2] || r[1] >= r[3])
+    {
+        return;
+    }
+
+    // the moved node lies across at most 2x2 nodes of its level
+    s64 n = (s64)1 << l;
+
+    for (s64 cy = MAX(r[1] / side, 0); cy <= (r[3] - 1) / side && cy < n; cy++)
+    {
+        for (s64 cx = MAX(r[0] / side, 0); cx <= (r[2] - 1) / side && cx < n; cx++)
+        {
+            rect_add(p, l, morton64_encode(cx, cy), cx * side, cy * side, r, u);
+        }
+    }
+}
+
+static int node_cmp(const void *a, const void *b)
+{
+    u64 ia = ((const qtsp_node *)a)->i;
+    u64 ib = ((const qtsp_node *)b)->i;
+
+    return (ia > ib) - (ia < ib);
+}
+
+/**
+ * Sort the moved parts into a tree. Parts of neighbouring source nodes only
+ * share leaves, whose pixels are merged
+ *
+ * @return false if out of memory
+ */
+static bool parts_build(qtct_parts *p, qtsp_tree *t)
+{
+    for (u8 l = 0; l < p->lvls; l++)
+    {
+        qtsp_list *v = &p->lvl[l];
+
+        if (v->n > 1)
+        {
+            qsort(v->nodes, v->n, sizeof(qtsp_node), node_cmp);
+        }
+
+        for (u64 j = 0; j < v->n;)
+        {
+            u64 i = v->nodes[j].i;
+            u8 u = 0;
+
+            for (; j < v->n && v->nodes[j].i == i; j++)
+            {
+                u |= v->nodes[j].val;
+            }
+
+            if (!qtsp_uniform(t, l, i, u))
+            {
+                return false;
+            }
+        }
+    }
+
+    return qtsp_consolidate(t);
+}
+
+u8 *qtct_transform(const u8 *data, u32 w, u32 h, u8 op, u64 *out_size)
+{
+    u8 lvls = calc_lvls(w, h);
+
+    if (!qt_lvls_ok(lvls) || op > QTCT_TRANSPOSE)
+    {
+        return NULL;
+    }
+
+    u8 steps = transform_steps[op];
+    u32 out_w = steps & QTCT_SWAP ? h : w;
+    u32 out_h = steps & QTCT_SWAP ? w : h;
+
+    qtsp_tree src, dst;
+    qtct_parts p;
+    u8 *out = NULL;
+
+    qtsp_init(&src, lvls);
+    qtsp_init(&dst, lvls);
+
+    memset(&p, 0, sizeof(p));
+    p.lvls = lvls;
+    p.w = out_w;
+    p.h = out_h;
+
+    bool ok = qtsp_image(&src, data, w, h);
+
+    for (u8 l = 0; ok && l < lvls; l++)
+    {
+        const qtsp_list *v = &src.lvl[l];
+
+        for (u64 j = 0; j < v->n && !p.oom; j++)
+        {
+            const qtsp_node *nd = v->nodes + j;
+
+            if (l + 1 == lvls)
+            {
+                node_move(&p, l, nd->i, nd->val, steps);
+            }
+            else if (nd->flags & QTSP_NODE_UNIFORM)
+            {
+                node_move(&p, l, nd->i, qtsp_leaf(nd), steps);
+            }
+        }
+
+        ok = !p.oom;
+    }
+
+    qtsp_free(&src);
+
+    ok = ok && parts_build(&p, &dst);
+
+    for (u8 l = 0; l < lvls; l++)
+    {
+        free(p.lvl[l].nodes);
+    }
+
+    if (ok)
+    {
+        out = qtsp_encode(&dst, out_w, out_h, out_size);
+    }
+
+    qtsp_free(&dst);
+
+    return out;
+}
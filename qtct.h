@@ -0,0 +1,40 @@
+#ifndef __QTCT_H__
+#define __QTCT_H__
+
+#include "types.h"
+
+/**
+ * Orientation changes of qtct_transform. Rotations are clockwise, and those
+ * by 90 and 270 degrees and the transpose swap the width and height
+ */
+enum
+{
+    QTCT_FLIP_H,
+    QTCT_FLIP_V,
+    QTCT_ROT_90,
+    QTCT_ROT_180,
+    QTCT_ROT_270,
+    QTCT_TRANSPOSE,
+};
+
+/**
+ * Change the orientation of the image of a qtcf stream without decoding it.
+ * The stream is read into a sparse quad tree whose leaves and uniform
+ * subtrees are moved to their new position, their leaf nibbles permuted,
+ * and the moved tree is written again. A mirror within the tree is a
+ * permutation of the quadrants of every node, but the image sits at the top
+ * left of its tree, so subtrees shifted off the node grid by a flip are
+ * split along it. The result is the stream qtcf_encode64 produces for the
+ * transformed image.
+ *
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ * @param op one of the QTCT_ transforms
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtct_transform(const u8 *data, u32 w, u32 h, u8 op, u64 *out_size);
+
+#endif // __QTCT_H__
@@ -0,0 +1,974 @@
+#include "qtcv.h"
+#include "mort.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Maximum number of levels in the octree of a volume of QTCV_MAX_SIDE voxels
+ * a side
+ */
+#define QTCV_MAX_LVLS 21
+
+/**
+ * Height, in levels, of the blocks the volume is read in. Blocks of 8x8x8
+ * voxels are a byte of each of their rows, and are skipped or kept as a fill
+ * when empty or full
+ */
+#define QTCV_BLOCK_LVLS 3
+
+/**
+ * Size, in bytes, of an entry of the slab table
+ */
+#define QTCV_SLAB_ENTRY 8
+
+/**
+ * Occupied node of a slab octree
+ */
+typedef struct
+{
+    // offset of the node within its level, the 3D morton code of its position
+    u64 i;
+    // child mask, or voxels of a leaf
+    u8 val;
+    // levels below the node that are complete, 0 if it is not a fill
+    u8 fill_height;
+    // value of the nodes at the bottom of the fill
+    u8 fill_val;
+    // levels of an ancestor fill that cover the node, while writing
+    u8 cov;
+} qtcv_node;
+
+/**
+ * Growable list of nodes sorted by offset
+ */
+typedef struct
+{
+    qtcv_node *nodes;
+    u64 n;
+    u64 cap;
+} qtcv_list;
+
+/**
+ * Growable byte stream
+ */
+typedef struct
+{
+    u8 *out;
+    u64 n;
+    u64 cap;
+    bool oom;
+} qtcv_out;
+
+/**
+ * Volume being encoded
+ */
+typedef struct
+{
+    const u8 *data;
+    u32 w;
+    u32 h;
+    u32 d;
+    size_t row_size;
+    size_t slice_size;
+    u8 lvls;
+    // nodes of the slab being encoded, on the levels of the slab
+    qtcv_list lvl[QTCV_MAX_LVLS];
+    bool oom;
+} qtcv_enc;
+
+/**
+ * Slot of the stream while decoding: a node that is read, or one that is
+ * implied by the fill of an ancestor
+ */
+typedef struct
+{
+    u64 i;
+    // levels of an ancestor fill that cover the node, 0 if it is read
+    u8 cov;
+    u8 fill_val;
+} qtcv_slot;
+
+typedef struct
+{
+    qtcv_slot *slots;
+    u64 n;
+    u64 cap;
+} qtcv_slots;
+
+struct qtcv_dec
+{
+    const u8 *data;
+    u32 w;
+    u32 h;
+    u32 d;
+    size_t row_size;
+    size_t slice_size;
+    u8 lvls;
+    u8 slab_lvls;
+    u32 slabs;
+    // offsets of the slab roots, on level lvls - slab_lvls
+    u64 *roots;
+    u64 roots_n;
+    // offset of each slab in data, and of the end of the last
+    u64 *slab_pos;
+};
+
+/**
+ * Get the number of levels of the octree of a volume, its side being the
+ * smallest power of two that holds it
+ */
+static u8 vol_lvls(u32 w, u32 h, u32 d)
+{
+    u32 side = MAX(MAX(w, h), d);
+    u8 lvls = 1;
+
+    while (((u64)1 << lvls) < side)
+    {
+        lvls++;
+    }
+
+    return lvls;
+}
+
+static bool vol_size_valid(u32 w, u32 h, u32 d)
+{
+    if (w == 0 || h == 0 || d == 0 || w > QTCV_MAX_SIDE || h > QTCV_MAX_SIDE || d > QTCV_MAX_SIDE)
+    {
+        return false;
+    }
+
+    size_t slice_size = ((size_t)w + 7) / 8;
+
+    return slice_size <= SIZE_MAX / h && slice_size * h <= SIZE_MAX / d;
+}
+
+static bool list_push(qtcv_list *l, const qtcv_node *nd)
+{
+    if (l->n == l->cap)
+    {
+        u64 cap = l->cap ? 2 * l->cap : 64;
+        if (cap > SIZE_MAX / sizeof(qtcv_node))
+        {
+            return false;
+        }
+
+        qtcv_node *nodes = realloc(l->nodes, cap * sizeof(qtcv_node));
+        if (!nodes)
+        {
+            return false;
+        }
+
+        l->nodes = nodes;
+        l->cap = cap;
+    }
+
+    l->nodes[l->n++] = *nd;
+
+    return true;
+}
+
+static bool slot_push(qtcv_slots *l, u64 i, u8 cov, u8 fill_val)
+{
+    if (l->n == l->cap)
+    {
+        u64 cap = l->cap ? 2 * l->cap : 64;
+        if (cap > SIZE_MAX / sizeof(qtcv_slot))
+        {
+            return false;
+        }
+
+        qtcv_slot *slots = realloc(l->slots, cap * sizeof(qtcv_slot));
+        if (!slots)
+        {
+            return false;
+        }
+
+        l->slots = slots;
+        l->cap = cap;
+    }
+
+    qtcv_slot *s = l->slots + l->n++;
+
+    s->i = i;
+    s->cov = cov;
+    s->fill_val = fill_val;
+
+    return true;
+}
+
+static void out_byte(qtcv_out *o, u8 val)
+{
+    if (o->n == o->cap)
+    {
+        u64 cap = o->cap ? 2 * o->cap : 256;
+        u8 *out = cap <= SIZE_MAX ? realloc(o->out, cap) : NULL;
+        if (!out)
+        {
+            o->oom = true;
+            return;
+        }
+
+        o->out = out;
+        o->cap = cap;
+    }
+
+    o->out[o->n++] = val;
+}
+
+/**
+ * Read the voxels of a leaf
+ *
+ * @param x x of the first voxel of the leaf, within the volume
+ * @param y y of the first voxel of the leaf, within the volume
+ * @param z z of the first voxel of the leaf, within the volume
+ */
+static u8 leaf_read(const qtcv_enc *e, u64 x, u64 y, u64 z)
+{
+    u8 cols = x + 1 < e->w ? 0x3 : 0x1;
+    u8 leaf = 0;
+
+    for (u8 dz = 0; dz < 2 && z + dz < e->d; dz++)
+    {
+        for (u8 dy = 0; dy < 2 && y + dy < e->h; dy++)
+        {
+            u8 b = e->data[(z + dz) * e->slice_size + (y + dy) * e->row_size + x / 8];
+
+            leaf |= ((b >> (x % 8)) & cols) << (2 * dy + 4 * dz);
+        }
+    }
+
+    return leaf;
+}
+
+/**
+ * Check whether a block of voxels is empty or full
+ *
+ * @param x x of the first voxel of the block, a multiple of 8 within the
+ * volume
+ * @param y y of the first voxel of the block
+ * @param z z of the first voxel of the block
+ * @param any whether a voxel of the block is set
+ *
+ * @return true if every voxel of the block is set
+ */
+static bool block_full(const qtcv_enc *e, u64 x, u64 y, u64 z, bool *any)
+{
+    u32 side = 1U << QTCV_BLOCK_LVLS;
+    u8 cols = e->w - x >= 8 ? 0xFF : (1U << (e->w - x)) - 1;
+    u8 any_set = 0;
+    u8 all_set = 0xFF;
+
+    for (u32 dz = 0; dz < side; dz++)
+    {
+        for (u32 dy = 0; dy < side; dy++)
+        {
+            u8 b = 0;
+
+            if (z + dz < e->d && y + dy < e->h)
+            {
+                b = e->data[(z + dz) * e->slice_size + (y + dy) * e->row_size + x / 8] & cols;
+            }
+
+            any_set |= b;
+            all_set &= b;
+        }
+    }
+
+    *any = any_set != 0;
+
+    return all_set == 0xFF;
+}
+
+/**
+ * Build the subtree of a node from the volume, depth first. The nodes of the
+ * subtree are added to their levels, below the node itself, which its parent
+ * adds. A fill that reaches the leaves keeps none of the nodes it covers
+ *
+ * @param l level of the node
+ * @param x x of the node on its level
+ * @param y y of the node on its level
+ * @param z z of the node on its level
+ * @param nd output node
+ *
+ * @return false if the node is empty or out of memory
+ */
+static bool node_build(qtcv_enc *e, u8 l, u32 x, u32 y, u32 z, qtcv_node *nd)
+{
+    u8 k = e->lvls - l;
+    u64 vx = (u64)x << k;
+    u64 vy = (u64)y << k;
+    u64 vz = (u64)z << k;
+
+    if (e->oom || vx >= e->w || vy >= e->h || vz >= e->d)
+    {
+        return false;
+    }
+
+    nd->i = morton3_encode(x, y, z);
+    nd->fill_height = 0;
+    nd->fill_val = 0;
+    nd->cov = 0;
+
+    if (k == 1)
+    {
+        nd->val = leaf_read(e, vx, vy, vz);
+        return nd->val != 0;
+    }
+
+    if (k == QTCV_BLOCK_LVLS)
+    {
+        bool any;
+
+        if (block_full(e, vx, vy, vz, &any))
+        {
+            nd->val = 0xFF;
+            nd->fill_height = k - 1;
+            nd->fill_val = 0xFF;
+            return true;
+        }
+
+        if (!any)
+        {
+            return false;
+        }
+    }
+
+    qtcv_node c[8];
+    bool has[8];
+    u8 mask = 0;
+
+    for (u8 q = 0; q < 8; q++)
+    {
+        has[q] = node_build(e, l + 1, 2 * x + (q & 1), 2 * y + ((q >> 1) & 1), 2 * z + (q >> 2), &c[q]);
+        mask |= has[q] << q;
+    }
+
+    if (e->oom || mask == 0)
+    {
+        return false;
+    }
+
+    nd->val = mask;
+
+    // a complete node extends the fills of its children if they are equal
+    if (mask == 0xFF)
+    {
+        u8 h = c[0].fill_height;
+        u8 v = h ? c[0].fill_val : c[0].val;
+        bool extend_fill = true;
+
+        for (u8 q = 1; q < 8 && extend_fill; q++)
+        {
+            extend_fill = c[q].fill_height == h && (h ? c[q].fill_val : c[q].val) == v;
+        }
+
+        if (extend_fill)
+        {
+            nd->fill_height = h + 1;
+            nd->fill_val = v;
+        }
+    }
+
+    if (nd->fill_height && l + nd->fill_height + 1 == e->lvls)
+    {
+        return true;
+    }
+
+    for (u8 q = 0; q < 8; q++)
+    {
+        if (has[q] && !list_push(&e->lvl[l + 1], &c[q]))
+        {
+            e->oom = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Write the levels of a slab breadth first. Nodes covered by a fill are not
+ * written, those at its bottom have their children written as usual
+ *
+ * @param root_l level of the slab roots
+ * @param o output stream
+ */
+static void slab_write(qtcv_enc *e, u8 root_l, qtcv_out *o)
+{
+    for (u8 l = root_l; l < e->lvls; l++)
+    {
+        qtcv_list *v = &e->lvl[l];
+        const qtcv_list *p = &e->lvl[l - (l > root_l)];
+        u64 k = 0;
+
+        for (u64 j = 0; j < v->n; j++)
+        {
+            qtcv_node *nd = v->nodes + j;
+
+            if (l > root_l)
+            {
+                while (p->nodes[k].i != nd->i >> 3)
+                {
+                    k++;
+                }
+
+                const qtcv_node *pn = p->nodes + k;
+
+                nd->cov = pn->cov > 1 ? pn->cov - 1 : pn->cov == 1 ? 0 : pn->fill_height;
+            }
+
+            if (nd->cov)
+            {
+                continue;
+            }
+
+            if (nd->fill_height)
+            {
+                out_byte(o, 0);
+                out_byte(o, (nd->fill_height - 1) | (nd->fill_val != 0xFF) << 7);
+
+                if (nd->fill_val != 0xFF)
+                {
+                    out_byte(o, nd->fill_val);
+                }
+            }
+            else
+            {
+                out_byte(o, nd->val);
+            }
+        }
+    }
+}
+
+static int offset_cmp(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Write the masks of the levels above the slabs, breadth first
+ *
+ * @param roots sorted offsets of the slab roots
+ * @param n number of roots
+ * @param root_l level of the slab roots
+ * @param o output stream
+ *
+ * @return false if out of memory
+ */
+static bool coarse_write(const u64 *roots, u64 n, u8 root_l, qtcv_out *o)
+{
+    qtcv_list lvl[QTCV_MAX_LVLS];
+    bool ok = true;
+
+    memset(lvl, 0, sizeof(lvl));
+
+    for (u8 l = root_l; ok && l-- > 0;)
+    {
+        u64 cn = l + 1 == root_l ? n : lvl[l + 1].n;
+
+        for (u64 j = 0; ok && j < cn; j++)
+        {
+            u64 ci = l + 1 == root_l ? roots[j] : lvl[l + 1].nodes[j].i;
+            qtcv_list *p = &lvl[l];
+
+            if (p->n == 0 || p->nodes[p->n - 1].i != ci >> 3)
+            {
+                qtcv_node nd = {ci >> 3, 0, 0, 0, 0};
+                ok = list_push(p, &nd);
+            }
+
+            if (ok)
+            {
+                p->nodes[p->n - 1].val |= 1 << (ci & 7);
+            }
+        }
+    }
+
+    // the root of an empty volume is written as an empty mask
+    if (ok && root_l > 0 && n == 0)
+    {
+        out_byte(o, 0);
+    }
+
+    for (u8 l = 0; ok && l < root_l; l++)
+    {
+        for (u64 j = 0; j < lvl[l].n; j++)
+        {
+            out_byte(o, lvl[l].nodes[j].val);
+        }
+    }
+
+    for (u8 l = 0; l < root_l; l++)
+    {
+        free(lvl[l].nodes);
+    }
+
+    return ok && !o->oom;
+}
+
+u8 *qtcv_encode(const u8 *data, u32 w, u32 h, u32 d, u8 slab_lvls, u64 *out_size)
+{
+    if (!vol_size_valid(w, h, d) || slab_lvls == 0)
+    {
+        return NULL;
+    }
+
+    qtcv_enc e;
+
+    memset(&e, 0, sizeof(e));
+    e.data = data;
+    e.w = w;
+    e.h = h;
+    e.d = d;
+    e.row_size = ((size_t)w + 7) / 8;
+    e.slice_size = e.row_size * h;
+    e.lvls = vol_lvls(w, h, d);
+
+    slab_lvls = MIN(slab_lvls, e.lvls);
+
+    u8 root_l = e.lvls - slab_lvls;
+    u32 slab_d = 1U << slab_lvls;
+    u32 slabs = ((u64)d + slab_d - 1) / slab_d;
+    u32 root_cols = ((u64)w + slab_d - 1) / slab_d;
+    u32 root_rows = ((u64)h + slab_d - 1) / slab_d;
+    u64 grid_n = (u64)root_cols * root_rows;
+
+    qtcv_out slab_out = {NULL, 0, 0, false};
+    qtcv_out o = {NULL, 0, 0, false};
+    u64 *sizes = calloc(slabs, sizeof(u64));
+    u64 *grid = grid_n <= SIZE_MAX / sizeof(u64) ? malloc(grid_n * sizeof(u64)) : NULL;
+    qtcv_list roots = {NULL, 0, 0};
+    u8 *out = NULL;
+    bool ok = sizes && grid;
+
+    // the roots of a slab are in the morton order of their x and y, their z
+    // being that of the slab
+    for (u32 ry = 0; ok && ry < root_rows; ry++)
+    {
+        for (u32 rx = 0; rx < root_cols; rx++)
+        {
+            grid[(u64)ry * root_cols + rx] = morton64_encode(rx, ry);
+        }
+    }
+
+    if (ok)
+    {
+        qsort(grid, grid_n, sizeof(u64), offset_cmp);
+    }
+
+    for (u32 k = 0; ok && k < slabs; k++)
+    {
+        u64 start = slab_out.n;
+
+        for (u64 m = 0; ok && m < grid_n; m++)
+        {
+            u32 rx, ry;
+            qtcv_node nd;
+
+            morton64_decode(grid[m], &rx, &ry);
+
+            if (node_build(&e, root_l, rx, ry, k, &nd))
+            {
+                ok = list_push(&e.lvl[root_l], &nd) && list_push(&roots, &nd);
+            }
+
+            ok = ok && !e.oom;
+        }
+
+        if (ok)
+        {
+            slab_write(&e, root_l, &slab_out);
+            ok = !slab_out.oom;
+            sizes[k] = slab_out.n - start;
+        }
+
+        for (u8 l = root_l; l < e.lvls; l++)
+        {
+            e.lvl[l].n = 0;
+        }
+    }
+
+    u64 *offsets = ok ? malloc(roots.n * sizeof(u64) + 1) : NULL;
+    ok = offsets != NULL;
+
+    if (ok)
+    {
+        for (u64 j = 0; j < roots.n; j++)
+        {
+            offsets[j] = roots.nodes[j].i;
+        }
+
+        qsort(offsets, roots.n, sizeof(u64), offset_cmp);
+
+        out_byte(&o, slab_lvls);
+        ok = coarse_write(offsets, roots.n, root_l, &o);
+    }
+
+    for (u32 k = 0; ok && k < slabs; k++)
+    {
+        for (u8 b = 0; b < QTCV_SLAB_ENTRY; b++)
+        {
+            out_byte(&o, sizes[k] >> (8 * b));
+        }
+    }
+
+    if (ok && !o.oom)
+    {
+        *out_size = o.n + slab_out.n;
+        out = malloc(*out_size);
+
+        if (out)
+        {
+            memcpy(out, o.out, o.n);
+
+            // an empty volume has no slab stream
+            if (slab_out.n)
+            {
+                memcpy(out + o.n, slab_out.out, slab_out.n);
+            }
+        }
+    }
+
+    for (u8 l = 0; l < QTCV_MAX_LVLS; l++)
+    {
+        free(e.lvl[l].nodes);
+    }
+
+    free(offsets);
+    free(grid);
+    free(roots.nodes);
+    free(sizes);
+    free(slab_out.out);
+    free(o.out);
+
+    return out;
+}
+
+qtcv_dec *qtcv_dec_create(const u8 *data, u32 w, u32 h, u32 d, u32 *slab_d)
+{
+    if (!vol_size_valid(w, h, d))
+    {
+        return NULL;
+    }
+
+    u8 lvls = vol_lvls(w, h, d);
+
+    if (data[0] == 0 || data[0] > lvls)
+    {
+        return NULL;
+    }
+
+    qtcv_dec *dec = calloc(1, sizeof(qtcv_dec));
+    if (!dec)
+    {
+        return NULL;
+    }
+
+    dec->data = data;
+    dec->w = w;
+    dec->h = h;
+    dec->d = d;
+    dec->row_size = ((size_t)w + 7) / 8;
+    dec->slice_size = dec->row_size * h;
+    dec->lvls = lvls;
+    dec->slab_lvls = data[0];
+    dec->slabs = ((u64)d + (1U << dec->slab_lvls) - 1) >> dec->slab_lvls;
+
+    u8 root_l = lvls - dec->slab_lvls;
+    u64 pos = 1;
+    qtcv_slots v[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    bool ok = slot_push(&v[0], 0, 0, 0);
+
+    // the masks of the levels above the slabs give the slab roots
+    for (u8 l = 0; ok && l < root_l; l++)
+    {
+        qtcv_slots *cur = &v[l & 1];
+        qtcv_slots *next = &v[!(l & 1)];
+
+        next->n = 0;
+
+        for (u64 j = 0; ok && j < cur->n; j++)
+        {
+            u8 mask = data[pos++];
+
+            for (u8 q = 0; ok && q < 8; q++)
+            {
+                if ((mask >> q) & 1)
+                {
+                    ok = slot_push(next, 8 * cur->slots[j].i + q, 0, 0);
+                }
+            }
+        }
+    }
+
+    dec->slab_pos = ok ? malloc(((u64)dec->slabs + 1) * sizeof(u64)) : NULL;
+    ok = dec->slab_pos != NULL;
+
+    u64 table = pos;
+
+    pos += (u64)QTCV_SLAB_ENTRY * dec->slabs;
+
+    for (u32 k = 0; ok && k <= dec->slabs; k++)
+    {
+        dec->slab_pos[k] = pos;
+
+        if (k < dec->slabs)
+        {
+            pos += row_load_64(data + table + (u64)QTCV_SLAB_ENTRY * k, QTCV_SLAB_ENTRY);
+        }
+    }
+
+    const qtcv_slots *r = &v[root_l & 1];
+
+    // a single slab holds the root, if it is not empty
+    dec->roots_n = root_l > 0 || (ok && dec->slab_pos[1] > dec->slab_pos[0]) ? r->n : 0;
+    dec->roots = ok ? malloc(dec->roots_n * sizeof(u64) + 1) : NULL;
+    ok = dec->roots != NULL;
+
+    for (u64 j = 0; ok && j < dec->roots_n; j++)
+    {
+        dec->roots[j] = r->slots[j].i;
+    }
+
+    free(v[0].slots);
+    free(v[1].slots);
+
+    if (!ok)
+    {
+        qtcv_dec_free(dec);
+        return NULL;
+    }
+
+    *slab_d = 1U << dec->slab_lvls;
+
+    return dec;
+}
+
+void qtcv_dec_free(qtcv_dec *dec)
+{
+    if (!dec)
+    {
+        return;
+    }
+
+    free(dec->roots);
+    free(dec->slab_pos);
+    free(dec);
+}
+
+/**
+ * Set the voxels of a cube of a uniform leaf pattern in the slices of a slab
+ *
+ * @param out slices of the slab
+ * @param z0 first slice of the slab
+ * @param z1 end of the slices of the slab
+ * @param x x of the first voxel of the cube
+ * @param y y of the first voxel of the cube
+ * @param z z of the first voxel of the cube
+ * @param k log2 of the cube side, at least 1
+ * @param u leaf pattern
+ */
+static void cube_draw(const qtcv_dec *dec, u8 *out, u64 z0, u64 z1, u64 x, u64 y, u64 z, u8 k, u8 u)
+{
+    u64 side = (u64)1 << k;
+
+    if (x >= dec->w)
+    {
+        return;
+    }
+
+    size_t c0 = x / 8;
+    size_t c1 = MIN((x + side - 1) / 8, ((u64)dec->w - 1) / 8);
+    u8 first = side < 8 ? ((1U << side) - 1) << (x % 8) : 0xFF;
+    u8 last = dec->w % 8 ? (1U << (dec->w % 8)) - 1 : 0xFF;
+
+    for (u64 dz = 0; dz < side && z + dz < z1; dz++)
+    {
+        for (u64 dy = 0; dy < side && y + dy < dec->h; dy++)
+        {
+            // the pattern of a row repeats every two voxels
+            u8 pat = ((u >> (2 * (dy & 1) + 4 * (dz & 1))) & 0x3) * 0x55;
+            u8 *row = out + (z + dz - z0) * dec->slice_size + (y + dy) * dec->row_size;
+
+            for (size_t c = c0; c <= c1; c++)
+            {
+                u8 m = c == c0 ? first : 0xFF;
+
+                if (c == ((u64)dec->w - 1) / 8)
+                {
+                    m &= last;
+                }
+
+                row[c] |= pat & m;
+            }
+        }
+    }
+}
+
+bool qtcv_decode_slab(qtcv_dec *dec, u32 k, u8 *out)
+{
+    if (k >= dec->slabs)
+    {
+        return false;
+    }
+
+    u8 lvls = dec->lvls;
+    u8 root_l = lvls - dec->slab_lvls;
+    u64 z0 = (u64)k << dec->slab_lvls;
+    u64 z1 = MIN(z0 + ((u64)1 << dec->slab_lvls), dec->d);
+    const u8 *data = dec->data;
+    u64 pos = dec->slab_pos[k];
+    u64 end = dec->slab_pos[k + 1];
+
+    memset(out, 0, (z1 - z0) * dec->slice_size);
+
+    qtcv_slots v[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    bool ok = true;
+
+    for (u64 j = 0; ok && j < dec->roots_n; j++)
+    {
+        u32 x, y, z;
+        morton3_decode(dec->roots[j], &x, &y, &z);
+
+        if (z == k)
+        {
+            ok = slot_push(&v[0], dec->roots[j], 0, 0);
+        }
+    }
+
+    for (u8 l = root_l; ok && l < lvls; l++)
+    {
+        qtcv_slots *cur = &v[(l - root_l) & 1];
+        qtcv_slots *next = &v[!((l - root_l) & 1)];
+        u8 sh = lvls - l;
+
+        next->n = 0;
+
+        for (u64 j = 0; ok && j < cur->n; j++)
+        {
+            const qtcv_slot *s = cur->slots + j;
+            u8 val;
+            u8 cov = 0;
+            u8 fill_val = 0;
+
+            if (s->cov > 1)
+            {
+                val = 0xFF;
+                cov = s->cov - 1;
+                fill_val = s->fill_val;
+            }
+            else if (s->cov == 1)
+            {
+                val = s->fill_val;
+            }
+            else
+            {
+                if (pos >= end)
+                {
+                    ok = false;
+                    break;
+                }
+
+                val = data[pos++];
+
+                if (val == 0 && l + 1 < lvls)
+                {
+                    if (pos >= end)
+                    {
+                        ok = false;
+                        break;
+                    }
+
+                    u8 f = data[pos++];
+                    u8 fill_height = (f & 0x7F) + 1;
+
+                    fill_val = 0xFF;
+
+                    if (f & 0x80)
+                    {
+                        ok = pos < end;
+                        fill_val = ok ? data[pos++] : 0;
+                    }
+
+                    if (!ok || l + fill_height >= lvls)
+                    {
+                        ok = false;
+                        break;
+                    }
+
+                    // a fill that reaches the leaves is a uniform cube
+                    if (l + fill_height + 1 == lvls)
+                    {
+                        u32 x, y, z;
+                        morton3_decode(s->i, &x, &y, &z);
+
+                        cube_draw(dec, out, z0, z1, (u64)x << sh, (u64)y << sh, (u64)z << sh, sh, fill_val);
+                        continue;
+                    }
+
+                    val = 0xFF;
+                    cov = fill_height;
+                }
+            }
+
+            if (l + 1 == lvls)
+            {
+                u32 x, y, z;
+                morton3_decode(s->i, &x, &y, &z);
+
+                cube_draw(dec, out, z0, z1, 2 * (u64)x, 2 * (u64)y, 2 * (u64)z, 1, val);
+                continue;
+            }
+
+            for (u8 q = 0; ok && q < 8; q++)
+            {
+                if ((val >> q) & 1)
+                {
+                    ok = slot_push(next, 8 * s->i + q, cov, fill_val);
+                }
+            }
+        }
+    }
+
+    free(v[0].slots);
+    free(v[1].slots);
+
+    return ok && pos == end;
+}
+
+u8 *qtcv_decode(const u8 *data, u32 w, u32 h, u32 d, u64 *in_size)
+{
+    u32 slab_d;
+    qtcv_dec *dec = qtcv_dec_create(data, w, h, d, &slab_d);
+    if (!dec)
+    {
+        return NULL;
+    }
+
+    u8 *out = malloc(dec->slice_size * d);
+    bool ok = out != NULL;
+
+    for (u32 k = 0; ok && k < dec->slabs; k++)
+    {
+        ok = qtcv_decode_slab(dec, k, out + (size_t)k * slab_d * dec->slice_size);
+    }
+
+    if (ok)
+    {
+        *in_size = dec->slab_pos[dec->slabs];
+    }
+    else
+    {
+        free(out);
+        out = NULL;
+    }
+
+    qtcv_dec_free(dec);
+
+    return out;
+}
@@ -0,0 +1,96 @@
+#ifndef __QTCV_H__
+#define __QTCV_H__
+
+#include "types.h"
+
+/**
+ * Largest side, in voxels, of a volume, the octree offsets being 3D morton
+ * codes of 21-bit coordinates
+ */
+#define QTCV_MAX_SIDE (1U << 21)
+
+/**
+ * Volume codec for 1-bit occupancy grids, the octree counterpart of qtcf.
+ * A volume is d slices of w by h voxels, each slice a raster of byte-aligned
+ * rows, one after another. The octree has 2x2x2 voxel leaves of a byte, voxel
+ * (x, y, z) of a leaf in bit x + 2y + 4z, and nodes of a byte child mask in 3D
+ * morton order. Its levels are written breadth first as with qtcf, and a
+ * node whose subtree is complete for some levels, with the nodes below them
+ * all of one value, is written as a fill of that height and value in place
+ * of the nodes it covers, so coherence between slices is coded as it is
+ * within them.
+ *
+ * The volume is cut along z into slabs of 2^slab_lvls slices, which are the
+ * subtrees at level lvls - slab_lvls. The levels above are written first as
+ * masks only, then a table of the size of every slab, then the levels of
+ * each slab, so a slab is decoded on its own with memory of its nodes and
+ * its slices.
+ */
+
+/**
+ * Decoder state: the slab roots and the position of every slab
+ */
+typedef struct qtcv_dec qtcv_dec;
+
+/**
+ * Compress a 1-bit volume.
+ *
+ * @param data pointer to the slices of the volume, of (w + 7) / 8 * h bytes each
+ * @param w volume width
+ * @param h volume height
+ * @param d volume depth, in slices
+ * @param slab_lvls log2 of the slab depth, at least 1. Deeper slabs code more
+ * of the coherence between slices
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtcv_encode(const u8 *data, u32 w, u32 h, u32 d, u8 slab_lvls, u64 *out_size);
+
+/**
+ * Decompress a 1-bit volume.
+ *
+ * @param data pointer to compressed data
+ * @param w volume width
+ * @param h volume height
+ * @param d volume depth, in slices
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return pointer to the decompressed slices. NULL if unsuccessful
+ */
+u8 *qtcv_decode(const u8 *data, u32 w, u32 h, u32 d, u64 *in_size);
+
+/**
+ * Create a decoder of the slabs of a compressed volume, reading the levels
+ * above the slabs and the slab table.
+ *
+ * @param data pointer to compressed data, which must outlive the decoder
+ * @param w volume width
+ * @param h volume height
+ * @param d volume depth, in slices
+ * @param slab_d number of slices of a slab, the last may have fewer
+ *
+ * @return pointer to decoder. NULL if unsuccessful
+ */
+qtcv_dec *qtcv_dec_create(const u8 *data, u32 w, u32 h, u32 d, u32 *slab_d);
+
+/**
+ * Free a slab decoder.
+ *
+ * @param dec pointer to decoder, may be NULL
+ */
+void qtcv_dec_free(qtcv_dec *dec);
+
+/**
+ * Decompress a slab of a volume, in any order.
+ *
+ * @param dec decoder
+ * @param k slab, slices k * slab_d and on
+ * @param out output slices, up to slab_d of (w + 7) / 8 * h bytes, within the
+ * volume
+ *
+ * @return true if successful, false if out of memory or the stream is invalid
+ */
+bool qtcv_decode_slab(qtcv_dec *dec, u32 k, u8 *out);
+
+#endif // __QTCV_H__
@@ -0,0 +1,161 @@
+#ifndef __QTIR_H__
+#define __QTIR_H__
+
+#include "qtcf.h"
+#include "types.h"
+
+/*
+ * Quad tree intermediate representation shared by the codecs built on the
+ * qtcf tree. Nodes are stored level by level, children of node i being at
+ * 4 * i + 1 ... 4 * i + 4 in NW, NE, SW, SE order. Leaves hold the 2x2 pixel
+ * block as a nibble, interior nodes a mask of their non-empty children.
+ */
+
+enum
+{
+    QUAD_NW = 0,
+    QUAD_NE,
+    QUAD_SW,
+    QUAD_SE,
+    QUAD_Cnt
+};
+
+/**
+ * Bits of the header nibble of a qtcf stream
+ */
+enum
+{
+    QTC_HEADER_FLAG_INVERTED,
+    QTC_HEADER_FLAG_ALL_BLACK,
+    // subtrees may be back-references to earlier ones, see qtcf_encode_dag
+    QTC_HEADER_FLAG_DAG,
+};
+
+/**
+ * Quad tree intermediate representation type
+ */
+typedef struct
+{
+    u8 fill_height;
+    u8 val;
+    u32 sub_size;
+} qtir_node;
+
+/**
+ * Calculate the number of nodes in a perfect quad tree
+ *
+ * @param lvls number of levels in quad tree
+ * @return number of nodes
+ */
+static inline u32 calc_node_cnt(u8 lvls)
+{
+    // # nodes = (4^lvls - 1) / 3
+    return 0x55555555 >> (32 - 2 * lvls);
+}
+
+/**
+ * Calculate the number of nodes in a perfect quad tree of up to 32 levels
+ *
+ * @param lvls number of levels in quad tree
+ * @return number of nodes
+ */
+static inline u64 calc_node_cnt64(u8 lvls)
+{
+    return 0x5555555555555555ULL >> (64 - 2 * lvls);
+}
+
+/**
+ * Calculate the height of quad tree needed to represent
+ * an image of the specified size
+ *
+ * @param w width of image
+ * @param h height of image
+ *
+ * @return number of levels needed for the quad tree
+ */
+static inline u8 calc_lvls(u32 w, u32 h)
+{
+    u8 lvls = 0;
+    while (((u64)1 << lvls) < w)
+        lvls++;
+
+    while (((u64)1 << lvls) < h)
+        lvls++;
+
+    return lvls;
+}
+
+/**
+ * Check that a quad tree of the specified height can be coded as a qtcf
+ * stream, which takes trees of at least three levels
+ *
+ * @param lvls number of levels in quad tree
+ *
+ * @return true if the tree can be coded
+ */
+static inline bool qt_lvls_ok(u32 lvls)
+{
+    return lvls >= 3 && lvls <= QTCF64_MAX_LVLS;
+}
+
+/**
+ * Check that an image of the specified size can be coded as a qtcf stream
+ *
+ * @param w width of image
+ * @param h height of image
+ *
+ * @return true if the image can be coded
+ */
+static inline bool qt_size_ok(u32 w, u32 h)
+{
+    return qt_lvls_ok(calc_lvls(w, h));
+}
+
+/**
+ * Build the intermediate representation of a 1-bit raster image. Leaves hold
+ * the pixels, interior nodes the mask of their non-empty children.
+ *
+ * @param data pointer to raster image data in row-major order. Rows should be byte-aligned
+ * @param w image width
+ * @param h image height
+ * @param qt_n number of nodes in the tree
+ *
+ * @return pointer to ir tree array. NULL if unsuccessful
+ */
+qtir_node *qtir_from_raster(const u8 *data, u16 w, u16 h, u32 *qt_n);
+
+/**
+ * Fill a subtree of a compact quad tree with a value at the specified level
+ *
+ * @param qt pointer to compacted qt array
+ * @param qt_i index of root node of subtree to fill
+ * @param lvls number of levels down from the subtree root where the
+ * value is filled
+ * @param val value to fill with
+ */
+void qt_fill_val(u8 *qt, u64 qt_i, u8 lvls, u8 val);
+
+/**
+ * Convert a compact quad tree to a 1-bit raster image
+ *
+ * @param qt pointer to compacted qt array
+ * @param qt_n number of nodes in the tree
+ * @param w image width
+ * @param h image height
+ *
+ * @return pointer to raster image. NULL if unsuccessful
+ */
+u8 *qt_to_raster(u8 *qt, u64 qt_n, u32 w, u32 h);
+
+/**
+ * Write the leaves of a compact quad tree into an existing 1-bit raster image
+ *
+ * @param qt pointer to compacted qt array
+ * @param qt_n number of nodes in the tree
+ * @param w image width
+ * @param h image height
+ * @param raster output raster of (w + 7) / 8 * h bytes
+ */
+void qt_write_raster(const u8 *qt, u64 qt_n, u32 w, u32 h, u8 *raster);
+
+#endif // __QTIR_H__
@@ -0,0 +1,256 @@
+#ifndef __QTSP_H__
+#define __QTSP_H__
+
+#include "qtcf.h"
+#include "types.h"
+
+/*
+ * Sparse quad tree shared by the codecs and operators that work on qtcf
+ * streams without the dense tree. Every level is a list of its occupied
+ * nodes, sorted by their offset within the level, which is the Morton code
+ * of their position. A uniform subtree, whose leaves all hold one nibble, can
+ * be kept as a single terminal node. Node state is that of qtir_node, and
+ * the qtcf passes run on the lists, so a sparse tree writes the stream of
+ * the dense tree of the same image.
+ */
+
+enum
+{
+    // terminal of a uniform subtree, its leaf nibble in the 4 msbs of flags
+    QTSP_NODE_UNIFORM = 1 << 0,
+    // subtree converted to raw leaves by the size pass
+    QTSP_NODE_RAW = 1 << 1,
+    // covered by the fill of an ancestor while serializing
+    QTSP_NODE_SKIP = 1 << 2,
+};
+
+/**
+ * Occupied node of a sparse quad tree
+ */
+typedef struct
+{
+    // offset of the node within its level
+    u64 i;
+    u32 sub_size;
+    u8 val;
+    u8 fill_height;
+    u8 flags;
+    // levels below the node covered by fills, while serializing
+    u8 cov;
+} qtsp_node;
+
+/**
+ * Growable list of nodes sorted by offset
+ */
+typedef struct
+{
+    qtsp_node *nodes;
+    u64 n;
+    u64 cap;
+} qtsp_list;
+
+/**
+ * Sparse quad tree. Terminals are collected per level while a tree is built
+ * top-down or block by block, and merged into the levels by qtsp_consolidate
+ */
+typedef struct
+{
+    u8 lvls;
+    qtsp_list lvl[QTCF64_MAX_LVLS];
+    qtsp_list term[QTCF64_MAX_LVLS];
+} qtsp_tree;
+
+/**
+ * Growable qtcf stream
+ */
+typedef struct
+{
+    u8 *out;
+    // nibbles written
+    u64 pos;
+    u64 cap;
+    bool oom;
+} qtsp_out;
+
+/**
+ * Get the leaf nibble of a uniform terminal
+ */
+static inline u8 qtsp_leaf(const qtsp_node *nd)
+{
+    return nd->flags >> 4;
+}
+
+/**
+ * Initialize an empty sparse tree
+ *
+ * @param t tree
+ * @param lvls number of levels, at least 3 as in qtcf
+ */
+void qtsp_init(qtsp_tree *t, u8 lvls);
+
+/**
+ * Free the lists of a sparse tree
+ */
+void qtsp_free(qtsp_tree *t);
+
+/**
+ * Append a zeroed node to a list
+ *
+ * @param l list
+ * @param i offset of the node, past those already in the list
+ *
+ * @return pointer to node. NULL if out of memory
+ */
+qtsp_node *qtsp_push(qtsp_list *l, u64 i);
+
+/**
+ * Find the first node of a list at or past an offset
+ *
+ * @param l list
+ * @param i offset
+ *
+ * @return index of the node, the list length if there is none
+ */
+u64 qtsp_find(const qtsp_list *l, u64 i);
+
+/**
+ * Add a uniform subtree to a tree being built: a terminal on an interior
+ * level, a leaf on the last one. Nothing is added for a nibble of zero
+ *
+ * @param t tree
+ * @param l level of the subtree root
+ * @param i offset of the subtree root, past those already added on level l
+ * @param u leaf nibble
+ *
+ * @return false if out of memory
+ */
+bool qtsp_uniform(qtsp_tree *t, u8 l, u64 i, u8 u);
+
+/**
+ * Add the occupied leaves of a square block of pixels to a tree being built,
+ * or a terminal if the block is full
+ *
+ * @param t tree
+ * @param blk_lvls log2 of the block side, at most 5
+ * @param bx x of the block, in blocks
+ * @param by y of the block, in blocks, the block past those already added in
+ * Morton order
+ * @param rows rows of the block, pixel x of the block in bit x
+ *
+ * @return false if out of memory
+ */
+bool qtsp_block(qtsp_tree *t, u8 blk_lvls, u32 bx, u32 by, const u32 *rows);
+
+/**
+ * Build the interior levels of a tree from its leaves and terminals
+ *
+ * @return false if out of memory
+ */
+bool qtsp_consolidate(qtsp_tree *t);
+
+/**
+ * Build the sparse tree of a 1-bit raster image
+ *
+ * @param t tree initialized for the image size
+ * @param data pointer to raster image data in row-major order
+ * @param w image width
+ * @param h image height
+ * @param inv byte xor-ed into every raster byte read, 0xFF for the tree of
+ * the inverted image
+ *
+ * @return false if out of memory
+ */
+bool qtsp_from_raster(qtsp_tree *t, const u8 *data, u32 w, u32 h, u8 inv);
+
+/**
+ * Build the sparse tree of the pixels that differ between two 1-bit raster
+ * images of the same size. Blocks whose rows are equal add nothing
+ *
+ * @param t tree initialized for the image size
+ * @param data pointer to raster image data in row-major order
+ * @param prev pointer to the raster image data compared with
+ * @param w image width
+ * @param h image height
+ *
+ * @return false if out of memory
+ */
+bool qtsp_from_delta(qtsp_tree *t, const u8 *data, const u8 *prev, u32 w, u32 h);
+
+/**
+ * Build the sparse tree of a qtcf stream. Fills that reach the leaves become
+ * terminals, the rest of the stream is read node by node
+ *
+ * @param t tree initialized for the image size
+ * @param data pointer to compressed data
+ * @param inverted whether the stream codes the inverted image
+ * @param in_size the number of bytes processed in the compressed data
+ *
+ * @return false if out of memory or the stream is invalid
+ */
+bool qtsp_from_qtcf(qtsp_tree *t, const u8 *data, bool *inverted, u64 *in_size);
+
+/**
+ * Serialize a sparse tree into a qtcf stream. Runs the fill and size passes,
+ * which change the node states, so a tree is written once
+ *
+ * @param t tree
+ * @param inverted whether the tree is of the inverted image
+ * @param o output stream
+ *
+ * @return false if out of memory
+ */
+bool qtsp_write(qtsp_tree *t, bool inverted, qtsp_out *o);
+
+/**
+ * Build the sparse tree of a rectangle of set pixels at the top left of the
+ * tree
+ *
+ * @param t tree, initialized and empty
+ * @param w width of the rectangle
+ * @param h height of the rectangle
+ *
+ * @return false if out of memory
+ */
+bool qtsp_area(qtsp_tree *t, u64 w, u64 h);
+
+/**
+ * Combine two sparse trees of the same size with a boolean operation
+ *
+ * @param a first operand, consolidated
+ * @param b second operand, consolidated
+ * @param op one of the operations of qtco.h
+ * @param r output tree, initialized and empty
+ *
+ * @return false if out of memory
+ */
+bool qtsp_combine(const qtsp_tree *a, const qtsp_tree *b, u8 op, qtsp_tree *r);
+
+/**
+ * Build the sparse tree of the image a qtcf stream decodes to. An inverted
+ * stream is resolved, and pixels past the width in the last leaf of a row
+ * are cleared, so the tree holds exactly the set pixels of the image
+ *
+ * @param t tree, initialized and empty
+ * @param data pointer to compressed data
+ * @param w image width
+ * @param h image height
+ *
+ * @return false if out of memory or the stream is invalid
+ */
+bool qtsp_image(qtsp_tree *t, const u8 *data, u32 w, u32 h);
+
+/**
+ * Compress the sparse tree of an image into the qtcf stream qtcf_encode64
+ * produces, writing both polarities and keeping the smaller. The tree is
+ * written, which changes its node states
+ *
+ * @param t tree of the image, empty past the last leaf of a row
+ * @param w image width
+ * @param h image height
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+u8 *qtsp_encode(qtsp_tree *t, u32 w, u32 h, u64 *out_size);
+
+#endif // __QTSP_H__
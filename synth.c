@@ -0,0 +1,201 @@
+#include "synth.h"
+#include "utils.h"
+
+#include <string.h>
+
+#define SYNTH_NOISE_SALT 0x5BD1E995U
+
+/**
+ * Hash lattice or pixel coordinates into 32 random bits
+ */
+static u32 synth_hash(u32 seed, u32 x, u32 y)
+{
+    u32 h = seed + x * 0x9E3779B1U;
+
+    h ^= h >> 16;
+    h *= 0x7FEB352DU;
+    h ^= y * 0x85EBCA77U;
+    h ^= h >> 15;
+    h *= 0x846CA68BU;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/**
+ * Smoothstep of t / 256, scaled to 0 ... 256
+ */
+static u32 synth_smooth(u32 t)
+{
+    return t * t * (3 * 256 - 2 * t) / (256 * 256);
+}
+
+static u8 synth_lerp(u8 a, u8 b, u32 s)
+{
+    return (a * (256 - s) + b * s) / 256;
+}
+
+/**
+ * Generate one row of the grayscale field
+ *
+ * @param row output row of w pixels
+ * @param w image width
+ * @param h image height
+ * @param y row index
+ * @param params image parameters
+ */
+static void synth_row(u8 *row, u16 w, u16 h, u16 y, const synth_params *params)
+{
+    u32 scale = params->scale ? params->scale : 1;
+    u32 gy = y / scale;
+    u32 sy = synth_smooth((y % scale) * 256 / scale);
+    u32 ramp_y = (u32)y * 255 / h;
+    u32 g = params->gradient;
+
+    for (u32 gx = 0; gx * scale < w; gx++)
+    {
+        u8 a = synth_lerp(synth_hash(params->seed, gx, gy), synth_hash(params->seed, gx, gy + 1), sy);
+        u8 b = synth_lerp(synth_hash(params->seed, gx + 1, gy), synth_hash(params->seed, gx + 1, gy + 1), sy);
+
+        u32 x_end = MIN((gx + 1) * scale, w);
+
+        for (u32 x = gx * scale; x < x_end; x++)
+        {
+            s32 field = synth_lerp(a, b, synth_smooth((x - gx * scale) * 256 / scale));
+            s32 ramp = (x * 255 / w + ramp_y) / 2;
+            s32 v = ((255 - g) * field + g * ramp) / 255;
+
+            if (params->noise)
+            {
+                s32 n = (synth_hash(params->seed ^ SYNTH_NOISE_SALT, x, y) & 0xFF) - 128;
+                v += params->noise * n / 128;
+            }
+
+            row[x] = v < 0 ? 0 : (v > 255 ? 255 : v);
+        }
+    }
+}
+
+u8 *synth_gray(u16 w, u16 h, const synth_params *params)
+{
+    u8 *pix = malloc((size_t)w * h);
+    if (!pix)
+    {
+        return NULL;
+    }
+
+    s32 offset = (s32)params->density - 128;
+
+    for (u16 y = 0; y < h; y++)
+    {
+        u8 *row = pix + (size_t)y * w;
+
+        synth_row(row, w, h, y, params);
+
+        for (u16 x = 0; x < w; x++)
+        {
+            s32 v = row[x] + offset;
+            row[x] = v < 0 ? 0 : (v > 255 ? 255 : v);
+        }
+    }
+
+    return pix;
+}
+
+u8 *synth_bilevel(u16 w, u16 h, const synth_params *params)
+{
+    u16 row_size = (w + 7) / 8;
+    u8 *bits = malloc((size_t)row_size * h);
+    u8 *row = malloc(w);
+    if (!bits || !row)
+    {
+        free(bits);
+        free(row);
+        return NULL;
+    }
+
+    // the field is not uniformly distributed, so the threshold that sets the
+    // requested fraction of pixels is found from its histogram
+    u64 hist[256] = {0};
+
+    for (u16 y = 0; y < h; y++)
+    {
+        synth_row(row, w, h, y, params);
+
+        for (u16 x = 0; x < w; x++)
+        {
+            hist[row[x]]++;
+        }
+    }
+
+    u64 target = (u64)w * h * params->density / 256;
+    u64 below = 0;
+    u32 t = 0;
+
+    while (t < 256 && below + hist[t] <= target)
+    {
+        below += hist[t++];
+    }
+
+    memset(bits, 0, (size_t)row_size * h);
+
+    for (u16 y = 0; y < h; y++)
+    {
+        u8 *bits_row = bits + (size_t)y * row_size;
+
+        synth_row(row, w, h, y, params);
+
+        for (u16 x = 0; x < w; x++)
+        {
+            if (row[x] < t)
+            {
+                bits_row[x / 8] |= 1 << (x % 8);
+            }
+        }
+    }
+
+    free(row);
+
+    return bits;
+}
+
+bool synth_parse(const char *spec, u16 *w, u16 *h, synth_params *params)
+{
+    char *end;
+    unsigned long v[7];
+    u8 n = 0;
+
+    v[n++] = strtoul(spec, &end, 10);
+    if (*end != 'x')
+    {
+        return false;
+    }
+
+    v[n++] = strtoul(end + 1, &end, 10);
+
+    while (*end == ',' && n < 7)
+    {
+        v[n++] = strtoul(end + 1, &end, 10);
+    }
+
+    if (*end != '\0' || v[0] == 0 || v[0] > 0xFFFF || v[1] == 0 || v[1] > 0xFFFF)
+    {
+        return false;
+    }
+
+    *w = v[0];
+    *h = v[1];
+
+    if (n > 2)
+        params->density = MIN(v[2], 255);
+    if (n > 3)
+        params->scale = MIN(v[3], 0xFFFF);
+    if (n > 4)
+        params->noise = MIN(v[4], 255);
+    if (n > 5)
+        params->gradient = MIN(v[5], 255);
+    if (n > 6)
+        params->seed = v[6];
+
+    return true;
+}
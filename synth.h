@@ -0,0 +1,60 @@
+#ifndef __SYNTH_H__
+#define __SYNTH_H__
+
+#include "types.h"
+
+/**
+ * Parameters of a synthetic image. The image is a smooth value-noise field
+ * blended with a diagonal gradient, plus per-pixel noise. The same parameters
+ * always give the same image
+ */
+typedef struct
+{
+    u32 seed;
+    // fraction, out of 256, of set pixels in bilevel images and mean level of
+    // grayscale images
+    u8 density;
+    // size, in pixels, of the features of the value-noise field
+    u16 scale;
+    // amplitude, out of 255, of the per-pixel noise
+    u8 noise;
+    // weight, out of 255, of the gradient against the value-noise field
+    u8 gradient;
+} synth_params;
+
+/**
+ * Generate a synthetic 8-bit grayscale image.
+ *
+ * @param w image width
+ * @param h image height
+ * @param params image parameters
+ *
+ * @return pointer to w * h pixels in row-major order. NULL if unsuccessful
+ */
+u8 *synth_gray(u16 w, u16 h, const synth_params *params);
+
+/**
+ * Generate a synthetic 1-bit raster image.
+ *
+ * @param w image width
+ * @param h image height
+ * @param params image parameters
+ *
+ * @return pointer to raster image with byte-aligned rows. NULL if unsuccessful
+ */
+u8 *synth_bilevel(u16 w, u16 h, const synth_params *params);
+
+/**
+ * Parse image parameters of the form WxH[,density[,scale[,noise[,gradient[,seed]]]]].
+ * Omitted fields keep the values already in params.
+ *
+ * @param spec parameter string
+ * @param w variable that will get the image width
+ * @param h variable that will get the image height
+ * @param params parameters to update
+ *
+ * @return true if successful
+ */
+bool synth_parse(const char *spec, u16 *w, u16 *h, synth_params *params);
+
+#endif // __SYNTH_H__
@@ -1,13 +1,29 @@
 #include "qtcf.h"
+#include "qtcb.h"
+#include "qtcg.h"
+#include "qtcs.h"
+#include "qtco.h"
+#include "qtcq.h"
+#include "qtct.h"
+#include "qtcm.h"
+#include "qtcp.h"
+#include "qtcd.h"
+#include "qtcv.h"
 #include "qtc3.h"
 #include "qtc8b.h"
+#include "qtcr.h"
+#include "qtca.h"
+#include "qtc_stats.h"
+#include "qtc_trace.h"
 
 #include "utils.h"
+#include "mort.h"
 
 #include "pgm.h"
 #include "bps.h"
 #include "xbn.h"
 #include "filt_up.h"
+#include "synth.h"
 
 #include "canada.h"
 #include "canada_xs.h"
@@ -17,6 +33,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 bool img_equal(const u8 *img1_bits, const u8 *img2_bits, u16 w, u16 h)
 {
@@ -132,6 +149,29 @@ void test_qtc_img(const u8 *in, u16 w, u16 h, bool print_qtc)
     free(out);
 }
 
+void test_qtcr_img(const u8 *in, u16 w, u16 h)
+{
+    u32 in_size = (w + 7) / 8 * h;
+
+    u8 *qtc, *qtcr, *qtc_out;
+    u32 qtc_size, qtcr_size, qtc_out_size, qtcr_in_size;
+
+    qtc = qtcf_encode(in, w, h, &qtc_size);
+    qtcr = qtcr_encode(qtc, w, h, &qtcr_size);
+
+    printf("size: %u, cr: %f, qtcf size: %u\n", qtcr_size, 1.0 * in_size / qtcr_size, qtc_size);
+
+    qtc_out = qtcr_decode(qtcr, &qtc_out_size, &qtcr_in_size);
+
+    assert(qtcr_in_size == qtcr_size);
+    assert(qtc_out_size == qtc_size);
+    assert(arr_equal(qtc, qtc_out, qtc_size));
+
+    free(qtc);
+    free(qtcr);
+    free(qtc_out);
+}
+
 void test_qtc8b_img(const u8 *in, u16 w, u16 h, bool print_qtc)
 {
     u32 in_size = w * h;
@@ -156,6 +196,836 @@ void test_qtc8b_img(const u8 *in, u16 w, u16 h, bool print_qtc)
     // free(out);
 }
 
+void print_trace(const char *event, u64 a, u64 b, void *user)
+{
+    (void)user;
+    printf("%s %llu %llu\n", event, (unsigned long long)a, (unsigned long long)b);
+}
+
+typedef struct
+{
+    u32 calls;
+    u64 bits;
+    u64 bd;
+} trace_count;
+
+void count_trace(const char *event, u64 a, u64 b, void *user)
+{
+    trace_count *tc = user;
+
+    if (strcmp(event, "xbn_encode") == 0 || strcmp(event, "xbsn_encode") == 0)
+    {
+        tc->calls++;
+        tc->bits = a;
+        tc->bd = b;
+    }
+}
+
+void test_trace_img(const u8 *in, u16 w, u16 h)
+{
+    u32 in_size = (w + 7) / 8 * h;
+    u32 xbn_size, xbsn_size;
+    u8 bd_n, bd_s;
+
+    trace_count tc = {0, 0, 0};
+    qtc_trace_set(count_trace, &tc);
+
+    u8 *xbn = xbn_encode(in, in_size, 4, &bd_n, &xbn_size);
+    assert(tc.calls == 1 && tc.bd == bd_n && (tc.bits + 7) / 8 == xbn_size);
+
+    u8 *xbsn = xbsn_encode(in, in_size, 4, &bd_s, &xbsn_size);
+    assert(tc.calls == 2 && tc.bd == bd_s && (tc.bits + 7) / 8 == xbsn_size);
+
+    qtc_trace_set(NULL, NULL);
+
+    printf("xbn: %u, xbsn: %u\n", xbn_size, xbsn_size);
+
+    free(xbn);
+    free(xbsn);
+}
+
+void test_xbn_blk_img(const u8 *in, u16 w, u16 h)
+{
+    u32 in_size = (w + 7) / 8 * h;
+
+    u8 *xbn;
+    u32 xbn_size;
+
+    xbn = xbn_encode_blk(in, in_size, &xbn_size);
+
+    printf("size: %u, cr: %f\n", xbn_size, 1.0 * in_size / xbn_size);
+
+    u8 *out = xbn_decode_blk(xbn, in_size);
+
+    assert(arr_equal(in, out, in_size));
+
+    free(xbn);
+    free(out);
+}
+
+void test_qtca_img(const u8 *in, u16 w, u16 h)
+{
+    u32 in_size = (w + 7) / 8 * h;
+
+    u8 *qtc;
+    u32 qtc_size, qtc_in_size;
+
+    qtc = qtca_encode(in, w, h, &qtc_size);
+
+    printf("size: %u, cr: %f\n", qtc_size, 1.0 * in_size / qtc_size);
+
+    u8 *out = qtca_decode(qtc, w, h, &qtc_in_size);
+
+    assert(qtc_in_size == qtc_size);
+    assert(arr_equal(in, out, in_size));
+
+    free(qtc);
+    free(out);
+}
+
+void test_qtcf_ctx_img(const u8 *in, u16 w, u16 h, u16 reps)
+{
+    u32 in_size = (w + 7) / 8 * h;
+
+    u32 qtc_size, ctx_size, ctx_in_size;
+    u8 *qtc = qtcf_encode(in, w, h, &qtc_size);
+
+    u32 qtc_cap = qtcf_max_compressed_size(w, h);
+    u8 *qtc_buf = malloc(qtc_cap);
+    u8 *out = malloc(in_size);
+
+    qtcf_ctx *ctx = qtcf_ctx_create(w, h);
+    assert(ctx);
+
+    clock_t start = clock();
+    for (u16 i = 0; i < reps; i++)
+    {
+        bool ok = qtcf_ctx_encode(ctx, in, qtc_buf, qtc_cap, &ctx_size);
+        assert(ok);
+        ok = qtcf_ctx_decode(ctx, qtc_buf, out, &ctx_in_size);
+        assert(ok);
+    }
+    double s = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("size: %u, enc + dec: %.1f MB/s\n", ctx_size, reps * in_size / s / 1e6);
+
+    assert(ctx_size == qtc_size);
+    assert(ctx_in_size == qtc_size);
+    assert(arr_equal(qtc, qtc_buf, qtc_size));
+    assert(arr_equal(in, out, in_size));
+
+    qtcf_ctx_free(ctx);
+    free(qtc);
+    free(qtc_buf);
+    free(out);
+}
+
+void test_qtcf64_img(const u8 *in, u16 w, u16 h)
+{
+    u32 in_size = (w + 7) / 8 * h;
+    u32 qtc_size;
+    u64 qtc64_size, in64_size;
+
+    u8 *qtc = qtcf_encode(in, w, h, &qtc_size);
+    u8 *qtc64 = qtcf_encode64(in, w, h, &qtc64_size);
+
+    assert(qtc64_size == qtc_size);
+    assert(arr_equal(qtc, qtc64, qtc_size));
+
+    u8 *out = qtcf_decode64(qtc64, w, h, &in64_size);
+
+    assert(in64_size == qtc_size);
+    assert(arr_equal(in, out, in_size));
+
+    // morton codes past 16 bits a coordinate
+    u32 x = 70001, y = 123457, dx, dy;
+    u64 mc = morton64_encode(x, y);
+
+    morton64_decode(mc, &dx, &dy);
+    assert(dx == x && dy == y);
+
+    morton64_inc_x(&mc);
+    assert(mc == morton64_encode(x + 1, y));
+
+    morton64_inc_y(&mc);
+    morton64_rst_x(&mc);
+    assert(mc == morton64_encode(0, y + 1));
+
+    printf("size: %llu\n", (unsigned long long)qtc64_size);
+
+    free(qtc);
+    free(qtc64);
+    free(out);
+}
+
+void test_qtcf_dag_img(const u8 *in, u32 w, u32 h)
+{
+    u64 size, dag_size, in_size;
+
+    u8 *qtc = qtcf_encode64(in, w, h, &size);
+    u8 *dag = qtcf_encode_dag(in, w, h, &dag_size);
+
+    // references are only written where they are shorter
+    assert(qtc && dag && dag_size <= size);
+
+    u8 *out = qtcf_decode64(dag, w, h, &in_size);
+
+    assert(in_size == dag_size);
+    assert(arr_equal(in, out, (w + 7) / 8 * h));
+
+    printf("size: %llu, dag size: %llu\n", (unsigned long long)size, (unsigned long long)dag_size);
+
+    free(qtc);
+    free(dag);
+    free(out);
+}
+
+void test_qtcg_img(const u8 *in, u32 w, u32 h)
+{
+    u64 qtcg_size, in_size;
+
+    u8 *qtcg = qtcg_encode(in, w, h, &qtcg_size);
+    assert(qtcg && qtcg_size <= qtcg_max_compressed_size(w, h));
+
+    u8 *out = qtcg_decode(qtcg, w, h, &in_size);
+    assert(out && in_size == qtcg_size);
+
+    // rows are compared up to the last whole byte, the padding bits are free
+    u32 row_size = (w + 7) / 8;
+    for (u32 y = 0; y < h; y++)
+    {
+        assert(arr_equal(in + y * row_size, out + y * row_size, w / 8));
+        if (w % 8)
+        {
+            u8 mask = (1 << (w % 8)) - 1;
+            assert(((in[y * row_size + w / 8] ^ out[y * row_size + w / 8]) & mask) == 0);
+        }
+    }
+
+    printf("tile: %u, size: %llu, cr: %f\n", 1U << qtcg[0], (unsigned long long)qtcg_size,
+           1.0 * row_size * h / qtcg_size);
+
+    free(qtcg);
+    free(out);
+}
+
+void test_qtcb_img(const u8 *in, u32 w, u32 h, u8 leaf_log2)
+{
+    u64 qtcb_size, in_size;
+
+    u8 *qtcb = qtcb_encode(in, w, h, leaf_log2, &qtcb_size);
+    assert(qtcb && qtcb_size <= qtcb_max_compressed_size(w, h, leaf_log2));
+
+    u8 *out = qtcb_decode(qtcb, w, h, &in_size);
+    assert(out && in_size == qtcb_size);
+
+    u32 row_size = (w + 7) / 8;
+    for (u32 y = 0; y < h; y++)
+    {
+        assert(arr_equal(in + y * row_size, out + y * row_size, w / 8));
+        if (w % 8)
+        {
+            u8 mask = (1 << (w % 8)) - 1;
+            assert(((in[y * row_size + w / 8] ^ out[y * row_size + w / 8]) & mask) == 0);
+        }
+    }
+
+    printf("leaf: %u, size: %llu, cr: %f\n", 1U << leaf_log2, (unsigned long long)qtcb_size,
+           1.0 * row_size * h / qtcb_size);
+
+    free(qtcb);
+    free(out);
+}
+
+void test_qtcs_img(const u8 *in, u32 w, u32 h)
+{
+    u64 qtcf_size, qtcs_size;
+
+    u8 *qtcf = qtcf_encode64(in, w, h, &qtcf_size);
+    u8 *qtcs = qtcs_encode(in, w, h, &qtcs_size);
+
+    // the sparse tree codes the stream of the dense one
+    assert(qtcf && qtcs && qtcs_size == qtcf_size);
+    assert(arr_equal(qtcf, qtcs, qtcf_size));
+
+    bool ok = qtcs_encode_into(in, w, h, qtcs, qtcs_size, &qtcs_size);
+    assert(ok);
+    assert(arr_equal(qtcf, qtcs, qtcf_size));
+    ok = qtcs_encode_into(in, w, h, qtcs, qtcs_size - 1, &qtcs_size);
+    assert(!ok);
+
+    printf("size: %llu, cr: %f\n", (unsigned long long)qtcf_size, 1.0 * (w + 7) / 8 * h / qtcf_size);
+
+    free(qtcf);
+    free(qtcs);
+}
+
+void test_qtco_img(const u8 *a, const u8 *b, u32 w, u32 h)
+{
+    size_t in_size = (size_t)(w + 7) / 8 * h;
+    u64 a_size, b_size, size, ref_size;
+
+    u8 *qa = qtcf_encode64(a, w, h, &a_size);
+    u8 *qb = qtcf_encode64(b, w, h, &b_size);
+    u8 *c = malloc(in_size);
+
+    assert(qa && qb && c);
+
+    for (u8 op = QTCO_AND; op <= QTCO_ANDNOT; op++)
+    {
+        for (size_t i = 0; i < in_size; i++)
+        {
+            u8 x = a[i], y = b[i];
+            c[i] = op == QTCO_AND ? x & y : op == QTCO_OR ? x | y : op == QTCO_XOR ? x ^ y : x & ~y;
+        }
+
+        u8 *ref = qtcf_encode64(c, w, h, &ref_size);
+        u8 *qtc = qtco_combine(qa, qb, w, h, op, &size);
+
+        // combining the streams gives the stream of the combined image
+        assert(ref && qtc && size == ref_size);
+        assert(arr_equal(ref, qtc, size));
+
+        printf("%u: %llu ", op, (unsigned long long)size);
+
+        free(ref);
+        free(qtc);
+    }
+
+    printf("\n");
+
+    free(qa);
+    free(qb);
+    free(c);
+}
+
+void test_qtcq_img(const u8 *in, u32 w, u32 h)
+{
+    size_t row_size = ((size_t)w + 7) / 8;
+    u64 size, count = 0;
+    u32 bbox[4] = {w, h, 0, 0}, qbbox[4];
+
+    u8 *qtc = qtcf_encode64(in, w, h, &size);
+    qtcq_index *idx = qtcq_index_create(qtc, w, h);
+
+    assert(qtc && idx);
+
+    for (u32 y = 0; y < h; y++)
+    {
+        for (u32 x = 0; x < w; x++)
+        {
+            bool set = (in[y * row_size + x / 8] >> (x % 8)) & 1;
+
+            assert(qtcq_get(idx, x, y) == set);
+
+            if (set)
+            {
+                count++;
+                bbox[0] = MIN(bbox[0], x);
+                bbox[1] = MIN(bbox[1], y);
+                bbox[2] = MAX(bbox[2], x + 1);
+                bbox[3] = MAX(bbox[3], y + 1);
+            }
+        }
+    }
+
+    assert(!qtcq_get(idx, w, 0) && !qtcq_get(idx, 0, h));
+    assert(qtcq_count(idx) == count);
+    bool has_bbox = qtcq_bbox(idx, qbbox);
+    assert(has_bbox == (count > 0));
+    assert(count == 0 || arr_equal((u8 *)bbox, (u8 *)qbbox, sizeof(bbox)));
+
+    printf("count: %llu, bbox: %u %u %u %u\n", (unsigned long long)count, bbox[0], bbox[1], bbox[2], bbox[3]);
+
+    qtcq_index_free(idx);
+    free(qtc);
+}
+
+void test_qtct_img(const u8 *in, u32 w, u32 h)
+{
+    size_t row_size = ((size_t)w + 7) / 8;
+    u64 size, ref_size, out_size;
+
+    u8 *qtc = qtcf_encode64(in, w, h, &size);
+    assert(qtc);
+
+    for (u8 op = QTCT_FLIP_H; op <= QTCT_TRANSPOSE; op++)
+    {
+        bool swap = op == QTCT_ROT_90 || op == QTCT_ROT_270 || op == QTCT_TRANSPOSE;
+        u32 out_w = swap ? h : w;
+        u32 out_h = swap ? w : h;
+        size_t out_row_size = ((size_t)out_w + 7) / 8;
+
+        u8 *out = calloc(out_row_size, out_h);
+
+        for (u32 y = 0; y < h; y++)
+        {
+            for (u32 x = 0; x < w; x++)
+            {
+                u32 mx = w - 1 - x, my = h - 1 - y;
+                u32 to_x = op == QTCT_FLIP_H || op == QTCT_ROT_180 ? mx : op == QTCT_FLIP_V ? x : op == QTCT_ROT_90 ? my : y;
+                u32 to_y = op == QTCT_FLIP_V || op == QTCT_ROT_180 ? my : op == QTCT_FLIP_H ? y : op == QTCT_ROT_270 ? mx : x;
+
+                if ((in[y * row_size + x / 8] >> (x % 8)) & 1)
+                {
+                    out[to_y * out_row_size + to_x / 8] |= 1 << (to_x % 8);
+                }
+            }
+        }
+
+        u8 *ref = qtcf_encode64(out, out_w, out_h, &ref_size);
+        u8 *moved = qtct_transform(qtc, w, h, op, &out_size);
+
+        // moving the tree gives the stream of the moved image
+        assert(ref && moved && out_size == ref_size);
+        assert(arr_equal(ref, moved, out_size));
+
+        printf("%u: %llu ", op, (unsigned long long)out_size);
+
+        free(out);
+        free(ref);
+        free(moved);
+    }
+
+    printf("\n");
+
+    free(qtc);
+}
+
+/**
+ * Copy a square of an image into a raster of its own, clear past the image
+ */
+static u8 *tile_raster(const u8 *in, u32 w, u32 h, u32 x0, u32 y0, u32 side)
+{
+    u8 *tile = calloc(side / 8, side);
+
+    for (u32 y = 0; y < side && y0 + y < h; y++)
+    {
+        for (u32 x = 0; x < side && x0 + x < w; x++)
+        {
+            if ((in[(size_t)(y0 + y) * ((w + 7) / 8) + (x0 + x) / 8] >> ((x0 + x) % 8)) & 1)
+            {
+                tile[(size_t)y * (side / 8) + x / 8] |= 1 << (x % 8);
+            }
+        }
+    }
+
+    return tile;
+}
+
+void test_qtcm_img(const u8 *in, u32 w, u32 h, u8 lvls, u32 tx, u32 ty)
+{
+    u32 side = 1U << lvls;
+    u64 size, tile_size, ref_size;
+    const u8 *tiles[4];
+
+    u8 *qtc = qtcf_encode64(in, w, h, &size);
+    assert(qtc);
+
+    // the tiles of the parent tile at tx, ty
+    for (u8 q = 0; q < 4; q++)
+    {
+        u32 x = 2 * tx + (q & 1), y = 2 * ty + (q >> 1);
+
+        u8 *raster = tile_raster(in, w, h, x * side, y * side, side);
+        u8 *ref = qtcf_encode64(raster, side, side, &ref_size);
+        u8 *tile = qtcm_crop(qtc, w, h, lvls, x, y, &tile_size);
+
+        assert(ref && tile && tile_size == ref_size);
+        assert(arr_equal(ref, tile, tile_size));
+
+        tiles[q] = tile;
+
+        free(raster);
+        free(ref);
+    }
+
+    u8 *raster = tile_raster(in, w, h, 2 * tx * side, 2 * ty * side, 2 * side);
+    u8 *ref = qtcf_encode64(raster, 2 * side, 2 * side, &ref_size);
+    u8 *parent = qtcm_mosaic(tiles, lvls, &size);
+
+    // stitching the tiles gives the stream of the parent tile
+    assert(ref && parent && size == ref_size);
+    assert(arr_equal(ref, parent, size));
+
+    printf("tiles: %llu, parent: %llu\n", (unsigned long long)tile_size, (unsigned long long)size);
+
+    for (u8 q = 0; q < 4; q++)
+    {
+        free((u8 *)tiles[q]);
+    }
+
+    free(raster);
+    free(ref);
+    free(parent);
+    free(qtc);
+}
+
+void test_qtcm_update_img(const u8 *in, u32 w, u32 h, u32 x, u32 y, u32 pw, u32 ph)
+{
+    u32 row_size = (w + 7) / 8;
+    u32 patch_row_size = (pw + 7) / 8;
+    u64 size, in_size, upd_size, ref_size;
+
+    u8 *qtc = qtcf_encode64(in, w, h, &size);
+    u8 *ref = qtcf_decode64(qtc, w, h, &in_size);
+    u8 *patch = calloc(patch_row_size, ph);
+    assert(qtc && ref && patch);
+
+    // the patch inverts the rectangle, and the reference is edited to match
+    for (u32 r = 0; r < ph; r++)
+    {
+        for (u32 c = 0; c < pw; c++)
+        {
+            u8 *p = ref + (y + r) * row_size + (x + c) / 8;
+
+            *p ^= 1 << ((x + c) % 8);
+            patch[r * patch_row_size + c / 8] |= (*p >> ((x + c) % 8) & 1) << (c % 8);
+        }
+    }
+
+    u8 *upd = qtcm_update(qtc, w, h, x, y, pw, ph, patch, &upd_size);
+    u8 *ref_qtc = qtcf_encode64(ref, w, h, &ref_size);
+
+    // the same stream as encoding the edited image
+    assert(upd && ref_qtc && upd_size == ref_size);
+    assert(arr_equal(upd, ref_qtc, upd_size));
+
+    printf("size: %llu, updated size: %llu\n", (unsigned long long)size, (unsigned long long)upd_size);
+
+    free(qtc);
+    free(ref);
+    free(patch);
+    free(upd);
+    free(ref_qtc);
+}
+
+void test_qtcp_img(const u8 *in, u16 w, u16 h)
+{
+    u8 lvls;
+    u64 size;
+
+    u8 *pyr = qtcp_pyramid(in, w, h, &lvls, &size);
+    assert(pyr && size == qtcp_offset(w, h, lvls + 1));
+
+    // box filter every level over the raster
+    for (u8 k = 1; k <= lvls; k++)
+    {
+        u32 side = 1U << k;
+        u32 lw = ((u32)w + side - 1) >> k;
+        u32 lh = ((u32)h + side - 1) >> k;
+        u32 *cnt = calloc(lw * lh, sizeof(u32));
+
+        for (u32 y = 0; y < h; y++)
+        {
+            for (u32 x = 0; x < w; x++)
+            {
+                cnt[(y >> k) * lw + (x >> k)] += (in[y * ((w + 7) / 8) + x / 8] >> (x % 8)) & 1;
+            }
+        }
+
+        const u8 *lvl = pyr + qtcp_offset(w, h, k);
+
+        for (u32 y = 0; y < lh; y++)
+        {
+            for (u32 x = 0; x < lw; x++)
+            {
+                u64 area = (u64)MIN(side, w - x * side) * MIN(side, h - y * side);
+
+                assert(lvl[y * lw + x] == (cnt[y * lw + x] * 255ULL + area / 2) / area);
+            }
+        }
+
+        free(cnt);
+    }
+
+    printf("levels: %u, size: %llu, top: %u\n", lvls, (unsigned long long)size, pyr[size - 1]);
+
+    free(pyr);
+}
+
+void test_qtcd_img(const u8 *in, u32 w, u32 h)
+{
+    u32 row_size = (w + 7) / 8;
+    u8 *frame = malloc(row_size * h);
+    qtcd_enc *enc = qtcd_enc_create(w, h, 4);
+    qtcd_dec *dec = qtcd_dec_create(w, h);
+    u64 key_size = 0, delta_size = 0;
+
+    assert(frame && enc && dec);
+
+    // a small inverted rectangle moves over the image, still on frame 5
+    for (u32 f = 0; f < 10; f++)
+    {
+        u32 rx = (20 + 37 * (f == 5 ? 4 : f)) % (w - 40), ry = (10 + 23 * (f == 5 ? 4 : f)) % (h - 24);
+        u64 size, in_size;
+
+        memcpy(frame, in, row_size * h);
+        for (u32 y = ry; y < ry + 24; y++)
+        {
+            for (u32 x = rx; x < rx + 40; x++)
+            {
+                frame[y * row_size + x / 8] ^= 1 << (x % 8);
+            }
+        }
+
+        u8 *qtc = qtcd_encode(enc, frame, &size);
+        assert(qtc && (qtc[0] == QTCD_FRAME_KEY) == (f % 4 == 0));
+
+        const u8 *out = qtcd_decode(dec, qtc, &in_size);
+        assert(out && in_size == size);
+
+        for (u32 y = 0; y < h; y++)
+        {
+            for (u32 x = 0; x < w; x++)
+            {
+                assert(((frame[y * row_size + x / 8] ^ out[y * row_size + x / 8]) >> (x % 8) & 1) == 0);
+            }
+        }
+
+        *(qtc[0] == QTCD_FRAME_KEY ? &key_size : &delta_size) += size;
+
+        free(qtc);
+    }
+
+    printf("key size: %llu, delta size: %llu\n", (unsigned long long)key_size, (unsigned long long)delta_size);
+
+    qtcd_enc_free(enc);
+    qtcd_dec_free(dec);
+    free(frame);
+}
+
+void test_qtcv_vol(const u8 *in, u32 w, u32 h, u32 d, u8 slab_lvls)
+{
+    u32 row_size = (w + 7) / 8;
+    size_t slice_size = (size_t)row_size * h;
+    u64 size, in_size, slices_size = 0;
+
+    u8 *qtc = qtcv_encode(in, w, h, d, slab_lvls, &size);
+    assert(qtc);
+
+    u8 *out = qtcv_decode(qtc, w, h, d, &in_size);
+    assert(out && in_size == size);
+
+    for (u32 z = 0; z < d; z++)
+    {
+        for (u32 y = 0; y < h; y++)
+        {
+            for (u32 x = 0; x < w; x++)
+            {
+                size_t j = z * slice_size + y * row_size + x / 8;
+
+                assert(((in[j] ^ out[j]) >> (x % 8) & 1) == 0);
+            }
+        }
+    }
+
+    // slabs decode on their own, last first
+    u32 slab_d;
+    qtcv_dec *dec = qtcv_dec_create(qtc, w, h, d, &slab_d);
+    u8 *slab = malloc(slice_size * slab_d);
+    assert(dec && slab);
+
+    for (u32 k = (d + slab_d - 1) / slab_d; k-- > 0;)
+    {
+        u32 n = MIN(slab_d, d - k * slab_d);
+
+        bool ok = qtcv_decode_slab(dec, k, slab);
+        assert(ok);
+        assert(arr_equal(slab, out + k * slab_d * slice_size, n * slice_size));
+    }
+
+    for (u32 z = 0; z < d; z++)
+    {
+        u64 s;
+        u8 *qtcf = qtcf_encode64(in + z * slice_size, w, h, &s);
+
+        slices_size += s;
+        free(qtcf);
+    }
+
+    printf("size: %llu, qtcf slices size: %llu\n", (unsigned long long)size, (unsigned long long)slices_size);
+
+    qtcv_dec_free(dec);
+    free(slab);
+    free(qtc);
+    free(out);
+}
+
+void test_into_img(const u8 *in, u16 w, u16 h)
+{
+    u32 in_size = (w + 7) / 8 * h;
+    u32 qtc_cap = MAX(qtcf_max_compressed_size(w, h), qtca_max_compressed_size(w, h));
+    u32 qtcf_size, qtca_size, qtcr_size, size;
+
+    u8 *qtc = malloc(qtc_cap);
+    u8 *qtcr = malloc(qtcr_max_compressed_size(w, h));
+
+    // decode into the middle of a larger buffer to catch writes past the image
+    u8 *fb = malloc(in_size + 2);
+    fb[0] = 0xA5;
+    fb[in_size + 1] = 0x5A;
+
+    bool ok = qtcf_encode_into(in, w, h, qtc, qtc_cap, &qtcf_size);
+    assert(ok);
+    ok = qtcf_encode_into(in, w, h, qtc, qtcf_size - 1, &size);
+    assert(!ok);
+    ok = qtcr_encode_into(qtc, w, h, qtcr, qtcr_max_compressed_size(w, h), &qtcr_size);
+    assert(ok);
+
+    ok = qtcf_decode_into(qtc, w, h, fb + 1, &size);
+    assert(ok);
+    assert(size == qtcf_size);
+    assert(arr_equal(in, fb + 1, in_size));
+
+    ok = qtcr_decode_into(qtcr, qtc, qtc_cap, &size, &qtcr_size);
+    assert(ok);
+    assert(size == qtcf_size);
+
+    ok = qtca_encode_into(in, w, h, qtc, qtc_cap, &qtca_size);
+    assert(ok);
+    ok = qtca_encode_into(in, w, h, qtc, qtca_size - 1, &size);
+    assert(!ok);
+    ok = qtca_encode_into(in, w, h, qtc, qtc_cap, &qtca_size);
+    assert(ok);
+
+    ok = qtca_decode_into(qtc, w, h, fb + 1, &size);
+    assert(ok);
+    assert(size == qtca_size);
+    assert(arr_equal(in, fb + 1, in_size));
+
+    assert(fb[0] == 0xA5 && fb[in_size + 1] == 0x5A);
+
+    printf("qtcf: %u, qtca: %u, qtcr: %u\n", qtcf_size, qtca_size, qtcr_size);
+
+    free(qtc);
+    free(qtcr);
+    free(fb);
+}
+
+void test_synth_img(u16 w, u16 h, const synth_params *params)
+{
+    u32 in_size = (w + 7) / 8 * h;
+
+    synth_params other = *params;
+    other.seed++;
+
+    u8 *bits = synth_bilevel(w, h, params);
+    u8 *bits_again = synth_bilevel(w, h, params);
+    u8 *bits_other = synth_bilevel(w, h, &other);
+    u8 *gray = synth_gray(w, h, params);
+    u8 *gray_again = synth_gray(w, h, params);
+    u8 *gray_other = synth_gray(w, h, &other);
+
+    assert(bits && bits_again && bits_other && gray && gray_again && gray_other);
+
+    // the same seed gives the same image, another seed a different one
+    assert(arr_equal(bits, bits_again, in_size));
+    assert(!arr_equal(bits, bits_other, in_size));
+    assert(arr_equal(gray, gray_again, (u32)w * h));
+    assert(!arr_equal(gray, gray_other, (u32)w * h));
+
+    u32 set = 0;
+    for (u32 i = 0; i < in_size; i++)
+    {
+        set += __builtin_popcount(bits[i]);
+    }
+
+    printf("density: %f, ", 1.0 * set / ((u32)w * h));
+
+    test_qtc_img(bits, w, h, false);
+
+    free(bits);
+    free(bits_again);
+    free(bits_other);
+    free(gray);
+    free(gray_again);
+    free(gray_other);
+}
+
+void test_stats_img(const u8 *in, u16 w, u16 h)
+{
+    qtc_stats enc_stats, dec_stats;
+    memset(&enc_stats, 0, sizeof(enc_stats));
+    memset(&dec_stats, 0, sizeof(dec_stats));
+
+    u32 qtc_size, in_size;
+
+    qtc_stats_attach(&enc_stats);
+    u8 *qtc = qtcf_encode(in, w, h, &qtc_size);
+    qtc_stats_attach(&dec_stats);
+    u8 *out = qtcf_decode(qtc, w, h, &in_size);
+    qtc_stats_attach(NULL);
+
+    assert(qtc && out);
+
+#ifdef QTC_STATS
+    u64 nibs = 0;
+
+    for (u8 l = 0; l < QTC_STATS_MAX_LVLS; l++)
+    {
+        assert(enc_stats.lvl_nibbles[l] == dec_stats.lvl_nibbles[l]);
+        nibs += enc_stats.lvl_nibbles[l];
+    }
+
+    // the header nibble and the padding of an odd count are in no level
+    assert((nibs + 2) / 2 == qtc_size);
+    assert(enc_stats.normal_won + enc_stats.inverted_won == 1);
+    assert(MIN(enc_stats.normal_bytes, enc_stats.inverted_bytes) == qtc_size);
+
+    printf("build %.2f ms, fills %.2f ms, sizes %.2f ms, serialize %.2f ms, parse %.2f ms, raster %.2f ms, %s won\n",
+           enc_stats.phase_ns[QTC_PHASE_BUILD] / 1e6, enc_stats.phase_ns[QTC_PHASE_FILLS] / 1e6,
+           enc_stats.phase_ns[QTC_PHASE_SIZES] / 1e6, enc_stats.phase_ns[QTC_PHASE_SERIALIZE] / 1e6,
+           dec_stats.phase_ns[QTC_PHASE_PARSE] / 1e6, dec_stats.phase_ns[QTC_PHASE_RASTER] / 1e6,
+           enc_stats.inverted_won ? "inverted" : "normal");
+#else
+    // attaching is a no-op without QTC_STATS
+    assert(enc_stats.nodes_visited == 0 && dec_stats.nodes_visited == 0);
+    printf("disabled\n");
+#endif
+
+    free(qtc);
+    free(out);
+}
+
+typedef u8 *(*encode_fn)(const u8 *, u16, u16, u32 *);
+typedef u8 *(*decode_fn)(const u8 *, u16, u16, u32 *);
+
+/**
+ * qtcf_encode with the 16-bit height of the other bilevel codecs
+ */
+u8 *qtcf_encode_16(const u8 *data, u16 w, u16 h, u32 *out_size)
+{
+    return qtcf_encode(data, w, h, out_size);
+}
+
+void bench_bilevel_codec(const char *name, encode_fn enc, decode_fn dec, const u8 *in, u16 w, u16 h, u16 reps)
+{
+    u32 in_size = (w + 7) / 8 * h;
+    u32 size, dec_size;
+
+    clock_t start = clock();
+    for (u16 i = 0; i < reps; i++)
+    {
+        free(enc(in, w, h, &size));
+    }
+    double enc_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    u8 *data = enc(in, w, h, &size);
+
+    start = clock();
+    for (u16 i = 0; i < reps; i++)
+    {
+        free(dec(data, w, h, &dec_size));
+    }
+    double dec_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%s size: %u, cr: %f, enc: %.1f MB/s, dec: %.1f MB/s\n", name, size, 1.0 * in_size / size,
+           reps * in_size / enc_s / 1e6, reps * in_size / dec_s / 1e6);
+
+    free(data);
+}
+
 uint8_t *gs8_qtc_encode(const uint8_t *data, uint16_t w, uint16_t h, uint32_t *out_size)
 {
     uint32_t bp_size;
@@ -174,7 +1044,7 @@ uint8_t *gs8_qtc_encode(const uint8_t *data, uint16_t w, uint16_t h, uint32_t *o
         uint32_t bpc_size;
         uint8_t *bpc = qtcf_encode(bit_planes + bp_size * bp, w, h, &bpc_size);
 
-        printf("bit %u plane compressed size: %u\n", bp, bpc_size);
+        QTC_TRACE(gs8_plane, bp, bpc_size);
 
         // gsprint_arr_hex(stdout, bpc, bpc_size, 150);
 
@@ -198,9 +1068,7 @@ uint8_t *gs8_qtc_encode(const uint8_t *data, uint16_t w, uint16_t h, uint32_t *o
 
     *out_size = gs8c_size;
 
-    printf("gs8 uncompressed size = %u\n", w * h);
-    printf("gs8 compressed size = %u\n", *out_size);
-    printf("gs8 cr = %f\n", 1.0 * w * h / *out_size);
+    QTC_TRACE(gs8_encode, (u32)w * h, *out_size);
 
     return gs8c;
 }
@@ -217,9 +1085,7 @@ uint8_t *gs8_qtc_encode_2(const uint8_t *data, uint16_t w, uint16_t h, uint32_t
 
     *out_size = bpc_size;
 
-    printf("gs8 uncompressed size = %u\n", w * h);
-    printf("gs8 compressed size = %u\n", *out_size);
-    printf("gs8 cr = %f\n", 1.0 * w * h / *out_size);
+    QTC_TRACE(gs8_encode, (u32)w * h, *out_size);
 
     return bpc;
 }
@@ -262,6 +1128,9 @@ int main()
 {
     uint16_t w, h;
     uint32_t qtc_pix_size;
+
+    qtc_trace_set(print_trace, NULL);
+
     printf("Banana qtc ");
     uint8_t *pgm_pix = pgm_read("test_assets/banana.pgm", &w, &h);
     uint8_t *qtc_pix = gs8_qtc_encode(pgm_pix, w, h, &qtc_pix_size);
@@ -347,6 +1216,224 @@ int main()
     free(pgm_pix);
     free(qtc_pix);
 
+    printf("Canada L qtcr ");
+    test_qtcr_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    printf("Canada XS qtcr ");
+    test_qtcr_img(canada_xs_bits, CANADA_XS_WIDTH, CANADA_XS_HEIGHT);
+
+    printf("Canada L xbn blk ");
+    test_xbn_blk_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    printf("Canada L qtca ");
+    test_qtca_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    printf("Canada XS qtca ");
+    test_qtca_img(canada_xs_bits, CANADA_XS_WIDTH, CANADA_XS_HEIGHT);
+
+    bench_bilevel_codec("Canada L qtcf", qtcf_encode_16, qtcf_decode, canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT, 20);
+    bench_bilevel_codec("Canada L qtca", qtca_encode, qtca_decode, canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT, 20);
+
+    printf("Canada L qtcf ctx ");
+    test_qtcf_ctx_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT, 20);
+
+    printf("Canada L qtcf64 ");
+    test_qtcf64_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    printf("Canada L qtcf dag ");
+    test_qtcf_dag_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    // a texture of a 48x40 tile of the map, repeated off the 8x8 grid
+    u8 *texture = calloc(1000 / 8, 600);
+
+    for (u32 y = 0; y < 600; y++)
+    {
+        for (u32 x = 0; x < 1000; x++)
+        {
+            u32 tx = 800 + x % 48, ty = 600 + y % 40;
+
+            if ((canada_l_bits[ty * (CANADA_L_WIDTH / 8) + tx / 8] >> (tx % 8)) & 1)
+            {
+                texture[y * (1000 / 8) + x / 8] |= 1 << (x % 8);
+            }
+        }
+    }
+
+    printf("Texture 1000x600 qtcf dag ");
+    test_qtcf_dag_img(texture, 1000, 600);
+
+    free(texture);
+
+    printf("Canada L qtcg ");
+    test_qtcg_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    printf("Canada L qtcb ");
+    test_qtcb_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT, QTCB_LEAF_4X4);
+
+    printf("Canada L qtcb ");
+    test_qtcb_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT, QTCB_LEAF_8X8);
+
+    printf("Canada L qtcs ");
+    test_qtcs_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    printf("Canada L qtct ");
+    test_qtct_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    printf("Canada L qtcm ");
+    test_qtcm_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT, 8, 1, 1);
+
+    // tiles past the image edge
+    printf("Canada L edge qtcm ");
+    test_qtcm_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT, 9, 1, 1);
+
+    printf("Canada L qtcm update ");
+    test_qtcm_update_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT, 301, 77, 90, 45);
+
+    printf("Canada L qtcp ");
+    test_qtcp_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    printf("Canada L qtcd ");
+    test_qtcd_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    // mostly empty canvas, padded to a 8192x8192 tree
+    u32 canvas_w = 5000, canvas_h = 3000;
+    u8 *canvas = calloc((canvas_w + 7) / 8, canvas_h);
+    for (u32 y = 0; y < CANADA_L_HEIGHT; y++)
+    {
+        memcpy(canvas + (y + 1200) * ((canvas_w + 7) / 8) + 400, canada_l_bits + y * ((CANADA_L_WIDTH + 7) / 8),
+               (CANADA_L_WIDTH + 7) / 8);
+    }
+
+    printf("Canada L canvas qtcs ");
+    test_qtcs_img(canvas, canvas_w, canvas_h);
+
+    printf("Canada L canvas qtcq ");
+    test_qtcq_img(canvas, canvas_w, canvas_h);
+
+    free(canvas);
+
+    printf("Canada XS into ");
+    test_into_img(canada_xs_bits, CANADA_XS_WIDTH, CANADA_XS_HEIGHT);
+
+    synth_params params = {7, 64, 48, 0, 32};
+
+    printf("Synth 1000x700 qtc ");
+    test_synth_img(1000, 700, &params);
+
+    params.noise = 40;
+
+    printf("Synth noisy 333x257 qtc ");
+    test_synth_img(333, 257, &params);
+
+    u8 *synth = synth_bilevel(333, 257, &params);
+
+    printf("Synth noisy 333x257 qtcg ");
+    test_qtcg_img(synth, 333, 257);
+
+    printf("Synth noisy 333x257 qtcb ");
+    test_qtcb_img(synth, 333, 257, QTCB_LEAF_8X8);
+
+    printf("Synth noisy 333x257 qtcs ");
+    test_qtcs_img(synth, 333, 257);
+
+    // mostly white, so coded inverted
+    u8 *synth_inv = malloc((333 + 7) / 8 * 257);
+    memcpy(synth_inv, synth, (333 + 7) / 8 * 257);
+    arr_invert(synth_inv, (333 + 7) / 8 * 200);
+
+    printf("Synth noisy 333x257 qtco ");
+    test_qtco_img(synth, synth_inv, 333, 257);
+
+    printf("Synth noisy 333x257 inverted qtcq ");
+    test_qtcq_img(synth_inv, 333, 257);
+
+    printf("Synth noisy 333x257 inverted qtct ");
+    test_qtct_img(synth_inv, 333, 257);
+
+    // the raster padding of the odd width is set
+    printf("Synth noisy 333x257 inverted qtcp ");
+    test_qtcp_img(synth_inv, 333, 257);
+
+    printf("Synth noisy 333x257 inverted qtcd ");
+    test_qtcd_img(synth_inv, 333, 257);
+
+    // a rectangle to the last column of the odd width
+    printf("Synth noisy 333x257 inverted qtcm update ");
+    test_qtcm_update_img(synth_inv, 333, 257, 250, 100, 83, 60);
+
+    free(synth_inv);
+    free(synth);
+
+    u8 *synth_l = synth_bilevel(CANADA_L_WIDTH, CANADA_L_HEIGHT, &params);
+
+    printf("Canada L synth qtco ");
+    test_qtco_img(canada_l_bits, synth_l, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    free(synth_l);
+
+    // slices of the map drifting along x, as a volume of odd size
+    u32 vol_w = 333, vol_h = 257, vol_d = 100;
+    size_t vol_slice = (vol_w + 7) / 8 * vol_h;
+    u8 *vol = calloc(vol_slice, vol_d);
+
+    for (u32 z = 0; z < vol_d; z++)
+    {
+        for (u32 y = 0; y < vol_h; y++)
+        {
+            for (u32 x = 0; x < vol_w; x++)
+            {
+                u32 mx = 600 + x + z / 3, my = 500 + y;
+
+                if ((canada_l_bits[my * (CANADA_L_WIDTH / 8) + mx / 8] >> (mx % 8)) & 1)
+                {
+                    vol[z * vol_slice + y * ((vol_w + 7) / 8) + x / 8] |= 1 << (x % 8);
+                }
+            }
+        }
+    }
+
+    printf("Canada L drift 333x257x100 qtcv ");
+    test_qtcv_vol(vol, vol_w, vol_h, vol_d, 4);
+
+    free(vol);
+
+    // solid ball, mostly fills
+    vol_w = vol_h = vol_d = 65;
+    vol_slice = (vol_w + 7) / 8 * vol_h;
+    vol = calloc(vol_slice, vol_d);
+
+    for (u32 z = 0; z < vol_d; z++)
+    {
+        for (u32 y = 0; y < vol_h; y++)
+        {
+            for (u32 x = 0; x < vol_w; x++)
+            {
+                s32 dx = x - 32, dy = y - 32, dz = z - 32;
+
+                if (dx * dx + dy * dy + dz * dz <= 30 * 30)
+                {
+                    vol[z * vol_slice + y * ((vol_w + 7) / 8) + x / 8] |= 1 << (x % 8);
+                }
+            }
+        }
+    }
+
+    printf("Ball 65x65x65 qtcv ");
+    test_qtcv_vol(vol, vol_w, vol_h, vol_d, 3);
+
+    memset(vol, 0, vol_slice * vol_d);
+
+    printf("Empty 65x65x65 qtcv ");
+    test_qtcv_vol(vol, vol_w, vol_h, vol_d, 3);
+
+    free(vol);
+
+    printf("Canada L stats ");
+    test_stats_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
+    printf("Canada L trace ");
+    test_trace_img(canada_l_bits, CANADA_L_WIDTH, CANADA_L_HEIGHT);
+
     // printf("Globe qtc ");
     // test_qtc_img(globe_bits, GLOBE_WIDTH, GLOBE_HEIGHT, false);
 
@@ -5,6 +5,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -18,9 +19,9 @@
  * @param i nibble index
  * @param val 4-bit value (4 lsbs are masked out)
  */
-static inline void na_write(u8 *na, u32 i, u8 val)
+static inline void na_write(u8 *na, u64 i, u8 val)
 {
-    u32 byte_index = i / 2;
+    u64 byte_index = i / 2;
     u8 nibble_shift = (i & 1) * 4;
 
     na[byte_index] &= ~(0xF << nibble_shift);
@@ -34,14 +35,40 @@ static inline void na_write(u8 *na, u32 i, u8 val)
  * @param i nibble index
  * @return 4-bit value at index i
  */
-static inline u8 na_read(const u8 *na, u32 i)
+static inline u8 na_read(const u8 *na, u64 i)
 {
-    u32 byte_index = i / 2;
+    u64 byte_index = i / 2;
     u8 nibble_shift = (i & 1) * 4;
 
     return (na[byte_index] >> nibble_shift) & 0xF;
 }
 
+/**
+ * Write a value to a run of a nibble array, a byte at a time in between its
+ * ends
+ *
+ * @param p pointer to nibble array
+ * @param i index of the first nibble
+ * @param n number of nibbles
+ * @param val 4-bit value (4 lsbs are masked out)
+ */
+static inline void na_fill(u8 *na, u64 i, u64 n, u8 val)
+{
+    if (n && (i & 1))
+    {
+        na_write(na, i, val);
+        i++;
+        n--;
+    }
+
+    memset(na + i / 2, (val & 0xF) * 0x11, n / 2);
+
+    if (n & 1)
+    {
+        na_write(na, i + n - 1, val);
+    }
+}
+
 static inline void ba_write(u8 *ba, u32 i, bool val)
 {
     u32 byte_index = i / 8;
@@ -59,7 +86,7 @@ static inline bool ba_read(const u8 *ba, u32 i)
     return (ba[byte_index] >> bit_shift) & 0x1;
 }
 
-static inline void arr_invert(u8 *arr, const u32 size)
+static inline void arr_invert(u8 *arr, const size_t size)
 {
     u8 *arr_end = arr + size;
     while (arr < arr_end)
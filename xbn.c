@@ -1,8 +1,9 @@
 #include "xbn.h"
+#include "xbn_internal.h"
+#include "qtc_trace.h"
 
 #include <stdbool.h>
 #include <stdlib.h>
-#include <stdio.h>
 #include <string.h>
 
 static void arr_write_bit(uint8_t *arr, const uint32_t i, const bool set)
@@ -64,7 +65,83 @@ void bsw_write(bsw_t *bsw, bool set)
     bsw->bit_pos++;
 }
 
-static uint32_t arr_max_run_length(const uint8_t *arr, const uint32_t size)
+static void bsw_write_val(bsw_t *bsw, uint32_t val, uint8_t bits)
+{
+    for (uint8_t k = 0; k < bits; k++)
+    {
+        bsw_write(bsw, val & (1U << k));
+    }
+}
+
+/**
+ * Write a run length using the xbn code: runs up to x are written in unary,
+ * longer runs as x ones followed by the bd_n bit excess over x
+ */
+static void bsw_write_run(bsw_t *bsw, uint32_t n, const uint8_t x, const uint8_t bd_n)
+{
+    uint32_t k;
+
+    if (n > x)
+    {
+        for (k = 0; k < x; k++)
+        {
+            bsw_write(bsw, true);
+        }
+        bsw_write_val(bsw, n - x, bd_n);
+    }
+    else
+    {
+        for (k = 0; k < n - 1; k++)
+        {
+            bsw_write(bsw, true);
+        }
+        bsw_write(bsw, false);
+    }
+}
+
+static uint32_t arr_read_val(const uint8_t *arr, uint32_t *i, uint8_t bits)
+{
+    uint32_t val = 0;
+
+    for (uint8_t k = 0; k < bits; k++)
+    {
+        val |= (uint32_t)arr_read_bit(arr, (*i)++) << k;
+    }
+
+    return val;
+}
+
+/**
+ * Find the end of the run of equal bits starting at bit i
+ *
+ * @param arr bit array
+ * @param i bit index where the run starts
+ * @param end bit index where the array ends
+ * @param ones value of the bits in the run
+ *
+ * @return index of the first bit after the run
+ */
+static uint32_t arr_run_end(const uint8_t *arr, uint32_t i, const uint32_t end, const bool ones)
+{
+    const uint8_t flip = ones ? 0xFF : 0x00;
+
+    while (i < end)
+    {
+        uint8_t b = (arr[i / 8] ^ flip) >> (i % 8);
+
+        if (b != 0)
+        {
+            i += __builtin_ctz(b);
+            break;
+        }
+
+        i = (i | 7) + 1;
+    }
+
+    return i < end ? i : end;
+}
+
+uint32_t arr_max_run_length(const uint8_t *arr, const uint32_t size)
 {
     uint32_t max_run = 0;
 
@@ -103,7 +180,6 @@ uint8_t *xbn_encode(const uint8_t *data,
 {
     uint32_t max_run;
     uint32_t data_pos, n;
-    uint8_t k;
     bool cnt_1s;
     uint8_t *xbn;
     bsw_t *xbn_bsw;
@@ -134,26 +210,7 @@ uint8_t *xbn_encode(const uint8_t *data,
     {
         if (arr_read_bit(data, data_pos) != cnt_1s)
         {
-            if (n > x)
-            {
-                for (k = 0; k < x; k++)
-                {
-                    bsw_write(xbn_bsw, true);
-                }
-                n -= x;
-                for (k = 0; k < *bd_n; k++)
-                {
-                    bsw_write(xbn_bsw, n & (1 << k));
-                }
-            }
-            else
-            {
-                for (k = 0; k < n - 1; k++)
-                {
-                    bsw_write(xbn_bsw, true);
-                }
-                bsw_write(xbn_bsw, false);
-            }
+            bsw_write_run(xbn_bsw, n, x, *bd_n);
             n = 0;
             cnt_1s = !cnt_1s;
         }
@@ -162,28 +219,9 @@ uint8_t *xbn_encode(const uint8_t *data,
         data_pos++;
     }
 
-    if (n > x)
-    {
-        for (k = 0; k < x; k++)
-        {
-            bsw_write(xbn_bsw, true);
-        }
-        n -= x;
-        for (k = 0; k < *bd_n; k++)
-        {
-            bsw_write(xbn_bsw, n & (1 << k));
-        }
-    }
-    else
-    {
-        for (k = 0; k < n - 1; k++)
-        {
-            bsw_write(xbn_bsw, true);
-        }
-        bsw_write(xbn_bsw, false);
-    }
+    bsw_write_run(xbn_bsw, n, x, *bd_n);
 
-    printf("%u %u\n", xbn_bsw->bit_pos, *bd_n);
+    QTC_TRACE(xbn_encode, xbn_bsw->bit_pos, *bd_n);
 
     *out_size = (xbn_bsw->bit_pos + 7) / 8;
     xbn = xbn_bsw->arr;
@@ -227,7 +265,7 @@ uint8_t *xbn_decode(const uint8_t *xbn,
             }
         }
 
-        for (k = 0; k < n && data_pos < size * 8; k++)
+        for (uint32_t i = 0; i < n && data_pos < size * 8; i++)
         {
             arr_write_bit(data, data_pos++, write_1s);
         }
@@ -359,7 +397,7 @@ uint8_t *xbsn_encode(const uint8_t *data,
         bsw_write(xbsn_bsw, false);
     }
 
-    printf("%u %u\n", xbsn_bsw->bit_pos, *bd_s);
+    QTC_TRACE(xbsn_encode, xbsn_bsw->bit_pos, *bd_s);
 
     *out_size = (xbsn_bsw->bit_pos + 7) / 8;
     xbsn = xbsn_bsw->arr;
@@ -411,7 +449,7 @@ uint8_t *xbsn_decode(const uint8_t *xbn,
             }
         }
 
-        for (k = 0; k < n; k++)
+        for (uint32_t i = 0; i < n && data_pos < size * 8; i++)
         {
             arr_write_bit(data, data_pos++, write_1s);
         }
@@ -419,5 +457,177 @@ uint8_t *xbsn_decode(const uint8_t *xbn,
         write_1s = !write_1s;
     }
 
+    return data;
+}
+
+/**
+ * Pick the xbn parameters that minimise the coded size of a block
+ *
+ * @param hist run length histogram of the block, indexed by run length
+ * @param runs number of runs in the block
+ * @param max_run longest run in the block
+ * @param x pointer to variable that will hold the unary threshold
+ * @param bd_n pointer to variable that will hold the escape width
+ */
+static void xbn_blk_params(const uint32_t *hist,
+                           const uint32_t runs,
+                           const uint32_t max_run,
+                           uint8_t *x,
+                           uint8_t *bd_n)
+{
+    uint64_t best_cost = UINT64_MAX;
+    uint64_t unary_bits = 0;
+    uint32_t escapes = runs;
+    uint32_t max_x = max_run < XBN_BLK_MAX_X ? max_run : XBN_BLK_MAX_X;
+
+    // the first candidate always replaces these, they are set for a block
+    // without runs
+    *x = 1;
+    *bd_n = 0;
+
+    for (uint32_t cx = 1; cx <= max_x; cx++)
+    {
+        uint8_t cbd = 0;
+
+        unary_bits += (uint64_t)cx * hist[cx];
+        escapes -= hist[cx];
+
+        while (((1U << cbd) - 1) < (max_run - cx))
+        {
+            cbd++;
+        }
+
+        uint64_t cost = unary_bits + (uint64_t)escapes * (cx + cbd);
+
+        if (cost < best_cost)
+        {
+            best_cost = cost;
+            *x = cx;
+            *bd_n = cbd;
+        }
+    }
+}
+
+uint8_t *xbn_encode_blk(const uint8_t *data,
+                        const uint32_t size,
+                        uint32_t *out_size)
+{
+    uint32_t *hist;
+    uint32_t blk_start, blk_bits, pos, end, runs, max_run;
+    uint8_t x, bd_n;
+    bool cnt_1s;
+    uint8_t *xbn;
+    bsw_t *xbn_bsw;
+
+    hist = calloc(XBN_BLK_SIZE * 8 + 1, sizeof(uint32_t));
+    if (!hist)
+    {
+        return NULL;
+    }
+
+    xbn_bsw = bsw_create();
+
+    for (blk_start = 0; blk_start < size; blk_start += XBN_BLK_SIZE)
+    {
+        const uint8_t *blk = data + blk_start;
+
+        blk_bits = (size - blk_start < XBN_BLK_SIZE ? size - blk_start : XBN_BLK_SIZE) * 8;
+
+        runs = 0;
+        max_run = 0;
+        pos = 0;
+        cnt_1s = arr_read_bit(blk, 0);
+
+        while (pos < blk_bits)
+        {
+            end = arr_run_end(blk, pos, blk_bits, cnt_1s);
+            hist[end - pos]++;
+            if (end - pos > max_run)
+            {
+                max_run = end - pos;
+            }
+            runs++;
+            pos = end;
+            cnt_1s = !cnt_1s;
+        }
+
+        xbn_blk_params(hist, runs, max_run, &x, &bd_n);
+        memset(hist, 0, (max_run + 1) * sizeof(uint32_t));
+
+        bsw_write_val(xbn_bsw, x, XBN_BLK_X_BITS);
+        bsw_write_val(xbn_bsw, bd_n, XBN_BLK_BD_BITS);
+
+        pos = 0;
+        cnt_1s = arr_read_bit(blk, 0);
+        bsw_write(xbn_bsw, cnt_1s);
+
+        while (pos < blk_bits)
+        {
+            end = arr_run_end(blk, pos, blk_bits, cnt_1s);
+            bsw_write_run(xbn_bsw, end - pos, x, bd_n);
+            pos = end;
+            cnt_1s = !cnt_1s;
+        }
+    }
+
+    free(hist);
+
+    *out_size = (xbn_bsw->bit_pos + 7) / 8;
+    xbn = xbn_bsw->arr;
+    free(xbn_bsw);
+    return realloc(xbn, *out_size);
+}
+
+uint8_t *xbn_decode_blk(const uint8_t *xbn, const uint32_t size)
+{
+    uint32_t blk_start, blk_end, data_pos, xbn_pos, n;
+    uint8_t x, bd_n;
+    bool write_1s, bit;
+    uint8_t *data;
+
+    data = malloc(size);
+    if (!data)
+    {
+        return NULL;
+    }
+
+    xbn_pos = 0;
+
+    for (blk_start = 0; blk_start < size; blk_start += XBN_BLK_SIZE)
+    {
+        blk_end = (size - blk_start < XBN_BLK_SIZE ? size : blk_start + XBN_BLK_SIZE) * 8;
+
+        x = arr_read_val(xbn, &xbn_pos, XBN_BLK_X_BITS);
+        bd_n = arr_read_val(xbn, &xbn_pos, XBN_BLK_BD_BITS);
+        write_1s = arr_read_bit(xbn, xbn_pos++);
+
+        data_pos = blk_start * 8;
+
+        while (data_pos < blk_end)
+        {
+            n = 1;
+
+            bit = arr_read_bit(xbn, xbn_pos++);
+            while (bit && n < x)
+            {
+                bit = arr_read_bit(xbn, xbn_pos++);
+                n++;
+            }
+
+            if (bit)
+            {
+                n += arr_read_val(xbn, &xbn_pos, bd_n);
+            }
+
+            while (n > 0 && data_pos < blk_end)
+            {
+                arr_write_bit(data, data_pos++, write_1s);
+                n--;
+            }
+
+            write_1s = !write_1s;
+        }
+    }
+
     return data;
 }
\ No newline at end of file
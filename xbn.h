@@ -3,6 +3,15 @@
 
 #include <stdint.h>
 
+/**
+ * Number of input bytes coded with one set of parameters by xbn_encode_blk
+ */
+#define XBN_BLK_SIZE 4096
+
+#define XBN_BLK_MAX_X 255
+#define XBN_BLK_X_BITS 8
+#define XBN_BLK_BD_BITS 4
+
 uint8_t *xbn_encode(const uint8_t *data,
                     const uint32_t size,
                     const uint8_t x,
@@ -25,4 +34,30 @@ uint8_t *xbsn_decode(const uint8_t *xbn,
                      const uint8_t x,
                      const uint8_t bd_s);
 
+/**
+ * Run-length code a bit array in blocks of XBN_BLK_SIZE bytes, choosing the
+ * unary threshold and escape width of every block from its run histogram.
+ * Each block starts with a header holding x, bd_n and the value of its
+ * first bit, so no parameters need to be passed to the decoder.
+ *
+ * @param data bit array to compress
+ * @param size size, in bytes, of the bit array
+ * @param out_size size, in bytes, of compressed data
+ *
+ * @return pointer to compressed data. NULL if unsuccessful
+ */
+uint8_t *xbn_encode_blk(const uint8_t *data,
+                        const uint32_t size,
+                        uint32_t *out_size);
+
+/**
+ * Decompress a bit array compressed with xbn_encode_blk
+ *
+ * @param xbn pointer to compressed data
+ * @param size size, in bytes, of the decompressed bit array
+ *
+ * @return pointer to decompressed bit array. NULL if unsuccessful
+ */
+uint8_t *xbn_decode_blk(const uint8_t *xbn, const uint32_t size);
+
 #endif // __XBN_H__
\ No newline at end of file
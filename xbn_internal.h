@@ -0,0 +1,22 @@
+#ifndef __XBN_INTERNAL_H__
+#define __XBN_INTERNAL_H__
+
+#include <stdint.h>
+
+/*
+ * Kernels of xbn.c, declared for the kernel microbenchmarks. Not part of the
+ * xbn API.
+ */
+
+/**
+ * Find the longest run of equal bits in an array, read from the least
+ * significant bit of each byte
+ *
+ * @param arr pointer to array
+ * @param size size, in bytes, of the array
+ *
+ * @return length of the longest run
+ */
+uint32_t arr_max_run_length(const uint8_t *arr, const uint32_t size);
+
+#endif // __XBN_INTERNAL_H__